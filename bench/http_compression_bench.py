@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+''' Compare HTTP listener Content-Encoding decompression cost.
+
+Launch n2kafka with an HTTP listener and the zz_http2k decoder for every
+encoding, POST the same JSON messages body compressed with it from several
+sender processes during a fixed time, and report the n2kafka CPU time spent
+per MB of decompressed data. The identity (not compressed) run is the
+baseline, so the difference with it is the decompression cost.
+
+Bodies are compressed once, with python zlib for gzip and deflate, and with
+zstd, lz4 and brotli command line tools for the others. Encodings whose tool
+is not installed are skipped, and the ones that n2kafka has not been built with
+show up as errors.
+
+Brokers do not need to be reachable: messages will fail when the librdkafka
+queue is full, but decompression and decoding cost is still measured.
+'''
+
+from multiprocessing import Process, Value
+from subprocess import Popen, STDOUT, run as run_cmd
+from tempfile import NamedTemporaryFile
+import argparse
+import http.client
+import json
+import os
+import shutil
+import signal
+import time
+import zlib
+
+# Command line compressor of every encoding, reading stdin
+COMPRESS_TOOLS = {'zstd': ['zstd', '-c', '-q'],
+                  'lz4': ['lz4', '-c', '-q'],
+                  'br': ['brotli', '-c']}
+
+
+def compress(encoding, body, level):
+    ''' Compress body with encoding, or return None if there is no tool '''
+    if encoding == 'identity':
+        return body
+    if encoding == 'gzip':
+        c = zlib.compressobj(level, zlib.DEFLATED, 16 + zlib.MAX_WBITS)
+        return c.compress(body) + c.flush()
+    if encoding == 'deflate':
+        return zlib.compress(body, level)
+
+    cmd = COMPRESS_TOOLS[encoding]
+    if shutil.which(cmd[0]) is None:
+        return None
+    return run_cmd(cmd + ['-{}'.format(level)], input=body, check=True,
+                   capture_output=True).stdout
+
+
+def sender(port, encoding, body, seconds, posts, errors):
+    ''' POST body to localhost:port with keep-alive connection as fast as
+    possible '''
+    headers = {'Content-Type': 'application/json'}
+    if encoding != 'identity':
+        headers['Content-Encoding'] = encoding
+    count = err = 0
+    conn = http.client.HTTPConnection('127.0.0.1', port)
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        conn.request('POST', '/v1/data/n2kafka_bench', body, headers)
+        response = conn.getresponse()
+        response.read()
+        count += 1
+        # Queue full errors are expected without brokers
+        err += response.status in (400, 500)
+    conn.close()
+
+    with posts.get_lock():
+        posts.value += count
+    with errors.get_lock():
+        errors.value += err
+
+
+def process_cpu_seconds(pid):
+    ''' User + system CPU time of a running process '''
+    with open('/proc/{}/stat'.format(pid)) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    # utime and stime are 14th and 15th fields, and we have removed 2
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def wait_listener(child, log):
+    while 'Creating new' not in open(log.name).read():
+        if child.poll() is not None:
+            raise RuntimeError('n2kafka exited before creating listener')
+        time.sleep(0.1)
+
+
+def run(args, encoding, body):
+    config = {
+        'listeners': [{
+            'proto': 'http',
+            'port': args.port,
+            'decode_as': 'zz_http2k',
+            'num_threads': args.threads,
+            'mode': 'epoll',
+        }],
+        'brokers': args.brokers,
+    }
+
+    # n2kafka can log a lot of errors if brokers are not reachable, so we
+    # can't let it block in a pipe
+    with NamedTemporaryFile(mode='w', suffix='.json') as config_file, \
+            NamedTemporaryFile(mode='w', suffix='.log') as log:
+        json.dump(config, config_file)
+        config_file.flush()
+
+        child = Popen([args.n2kafka, config_file.name],
+                      stdout=log,
+                      stderr=STDOUT)
+        wait_listener(child, log)
+        time.sleep(0.5)  # Let listener threads start
+
+        posts, errors = Value('Q', 0), Value('Q', 0)
+        senders = [Process(target=sender,
+                           args=(args.port, encoding, body, args.seconds,
+                                 posts, errors))
+                   for _ in range(args.senders)]
+        cpu_start = process_cpu_seconds(child.pid)
+        for p in senders:
+            p.start()
+        for p in senders:
+            p.join()
+        cpu = process_cpu_seconds(child.pid) - cpu_start
+
+        child.send_signal(signal.SIGINT)
+        child.wait(timeout=60)
+
+    return {'posts': posts.value, 'errors': errors.value, 'cpu': cpu}
+
+
+def json_body(messages):
+    ''' zz_http2k body with messages JSON objects, like a flow exporter '''
+    return ''.join(json.dumps({'timestamp': 1546300800 + i,
+                               'sensor_uuid': 'sensor-{}'.format(i % 16),
+                               'src': '10.0.{}.{}'.format(i % 7, i % 251),
+                               'dst': '192.168.1.{}'.format(i % 254),
+                               'bytes': i * 37 % 65536,
+                               'pkts': i % 97})
+                   for i in range(messages)).encode()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--n2kafka', default='./n2kafka')
+    parser.add_argument('--brokers', default='localhost:9092')
+    parser.add_argument('--port', type=int, default=7981)
+    parser.add_argument('--encoding', action='append',
+                        choices=['identity', 'gzip', 'deflate'] +
+                        list(COMPRESS_TOOLS),
+                        help='Encodings to compare (default all)')
+    parser.add_argument('--level', type=int, default=3,
+                        help='Compression level')
+    parser.add_argument('--messages', type=int, default=1000,
+                        help='JSON messages per POST')
+    parser.add_argument('--threads', type=int, default=2)
+    parser.add_argument('--senders', type=int, default=4)
+    parser.add_argument('--seconds', type=float, default=10)
+    args = parser.parse_args()
+
+    body = json_body(args.messages)
+    print('{:<9} {:>8} {:>10} {:>10} {:>8} {:>10} {:>12}'.format(
+        'encoding', 'ratio', 'posts', 'errors', 'MB', 'cpu(s)',
+        'cpu ms/MB'))
+    for encoding in args.encoding or ['identity', 'gzip', 'deflate'] + \
+            list(COMPRESS_TOOLS):
+        compressed = compress(encoding, body, args.level)
+        if compressed is None:
+            print('{:<9} skipped, no compressor tool'.format(encoding))
+            continue
+
+        r = run(args, encoding, compressed)
+        mb = r['posts'] * len(body) / 1e6
+        print('{:<9} {:>8.2f} {:>10} {:>10} {:>8.1f} {:>10.3f} {:>12.3f}'
+              .format(encoding,
+                      len(body) / len(compressed),
+                      r['posts'],
+                      r['errors'],
+                      mb,
+                      r['cpu'],
+                      1e3 * r['cpu'] / mb if mb else 0))
+
+
+if __name__ == '__main__':
+    main()
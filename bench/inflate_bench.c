@@ -0,0 +1,313 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * HTTP request bodies decompression microbenchmark.
+ *
+ * Decompress a corpus of captured request bodies with the same decompressors,
+ * pools and output buffer size that HTTP listener uses, feeding them in
+ * upload-sized chunks as libmicrohttpd would do, and report throughput. Body
+ * Content-Encoding is taken from the file extension.
+ */
+
+#include "config.h"
+
+#include "listener/http/decompressor.h"
+#include "listener/http/inflate_pool.h"
+#include "util/buffer_pool.h"
+
+#include <librd/rd.h>
+#include <librd/rdfile.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Default size of the chunks given to the decompressor
+#define DEFAULT_CHUNK_SIZE (32 * 1024)
+/// Default time spent decompressing each file
+#define DEFAULT_SECONDS 2.
+
+/// Content-Encoding of a file extension
+static const struct {
+	const char *extension;
+	const char *encoding;
+} extension_encodings[] = {
+		{".gz", "gzip"},
+		{".zz", "deflate"},
+		{".deflate", "deflate"},
+		{".zst", "zstd"},
+		{".lz4", "lz4"},
+		{".br", "br"},
+};
+
+/// Bench results of a file
+struct bench_result {
+	size_t iterations; ///< Times the file has been decompressed
+	size_t in_bytes;   ///< Compressed bytes processed
+	size_t out_bytes;  ///< Decompressed bytes produced
+	double seconds;	   ///< Time spent decompressing
+};
+
+static void show_usage(const char *progname) {
+	fprintf(stderr,
+		"Usage: %s [-c chunk_size] [-t seconds] <file>...\n"
+		"\n"
+		"Decompress every file for the given time (default %.0fs), "
+		"in chunks of\n"
+		"chunk_size bytes (default %d), and report MB/s.\n"
+		"Content-Encoding is chosen by file extension:\n",
+		progname,
+		DEFAULT_SECONDS,
+		DEFAULT_CHUNK_SIZE);
+
+	size_t i;
+	for (i = 0; i < RD_ARRAYSIZE(extension_encodings); ++i) {
+		fprintf(stderr,
+			"\t%s: %s\n",
+			extension_encodings[i].extension,
+			extension_encodings[i].encoding);
+	}
+}
+
+static const char *file_encoding(const char *path) {
+	const size_t path_len = strlen(path);
+	size_t i;
+
+	for (i = 0; i < RD_ARRAYSIZE(extension_encodings); ++i) {
+		const char *extension = extension_encodings[i].extension;
+		const size_t extension_len = strlen(extension);
+		if (path_len > extension_len &&
+		    0 == strcasecmp(&path[path_len - extension_len],
+				    extension)) {
+			return extension_encodings[i].encoding;
+		}
+	}
+
+	return NULL;
+}
+
+static double monotonic_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief      Decompress a body once, the same way HTTP listener does
+ *
+ * @param[in]  codec       The decompressor
+ * @param[in]  body        The compressed body
+ * @param[in]  body_size   The compressed body size
+ * @param[in]  chunk_size  Size of the chunks to feed decompressor with
+ * @param      out_bytes   Decompressed bytes are added here
+ *
+ * @return     0 if success, -1 if error (printed)
+ */
+static int decompress_body(const struct http_decompressor *codec,
+			   const char *body,
+			   size_t body_size,
+			   size_t chunk_size,
+			   size_t *out_bytes) {
+	const char *response = NULL;
+	int rc = 0;
+
+	void *strm = codec->stream_new(NULL, &response);
+	if (NULL == strm) {
+		fprintf(stderr, "Can't create stream: %s\n", response);
+		return -1;
+	}
+
+	while (body_size > 0 && 0 == rc) {
+		const char *chunk = body;
+		size_t chunk_left =
+				chunk_size < body_size ? chunk_size : body_size;
+		body += chunk_left;
+		body_size -= chunk_left;
+
+		struct pool_buffer *pool_buffer = inflate_pool_buffer_get();
+		if (NULL == pool_buffer) {
+			fprintf(stderr, "Can't get output buffer (OOM?)\n");
+			rc = -1;
+			break;
+		}
+		char *buffer = pool_buffer_data(pool_buffer);
+
+		size_t processed;
+		do {
+			processed = INFLATE_POOL_BUFFER_SIZE;
+			const enum decoder_callback_err decompress_rc =
+					codec->decompress(strm,
+							  &chunk,
+							  &chunk_left,
+							  buffer,
+							  &processed,
+							  &response);
+			if (decompress_rc != DECODER_CALLBACK_OK) {
+				fprintf(stderr, "%s\n", response);
+				rc = -1;
+				break;
+			}
+
+			*out_bytes += processed;
+		} while (processed == INFLATE_POOL_BUFFER_SIZE);
+
+		pool_buffer_unref(pool_buffer);
+	}
+
+	codec->stream_done(strm);
+	return rc;
+}
+
+/**
+ * @brief      Decompress a file body repeatedly
+ *
+ * @param[in]  codec       The decompressor
+ * @param[in]  body        The compressed body
+ * @param[in]  body_size   The compressed body size
+ * @param[in]  chunk_size  Size of the chunks to feed decompressor with
+ * @param[in]  seconds     Minimum time to spend
+ * @param      result      The result
+ *
+ * @return     0 if success, -1 if error (printed)
+ */
+static int bench_body(const struct http_decompressor *codec,
+		      const char *body,
+		      size_t body_size,
+		      size_t chunk_size,
+		      double seconds,
+		      struct bench_result *result) {
+	const double start = monotonic_seconds();
+	memset(result, 0, sizeof(*result));
+
+	do {
+		const int rc = decompress_body(codec,
+					       body,
+					       body_size,
+					       chunk_size,
+					       &result->out_bytes);
+		if (rc != 0) {
+			return rc;
+		}
+
+		result->in_bytes += body_size;
+		result->iterations++;
+		result->seconds = monotonic_seconds() - start;
+	} while (result->seconds < seconds);
+
+	return 0;
+}
+
+static int bench_file(const char *path, size_t chunk_size, double seconds) {
+	const char *encoding = file_encoding(path);
+	if (NULL == encoding) {
+		fprintf(stderr, "%s: unknown extension, skipping\n", path);
+		return 0;
+	}
+
+	const struct http_decompressor *codec =
+			http_decompressor_find(encoding);
+	if (NULL == codec) {
+		fprintf(stderr,
+			"%s: n2kafka built without %s support, skipping\n",
+			path,
+			encoding);
+		return 0;
+	}
+
+	int body_size = 0;
+	char *body = rd_file_read(path, &body_size);
+	if (NULL == body) {
+		fprintf(stderr, "%s: can't read: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct bench_result result;
+	const int rc = bench_body(codec,
+				  body,
+				  (size_t)body_size,
+				  chunk_size,
+				  seconds,
+				  &result);
+	free(body);
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s decompression error\n", path, encoding);
+		return rc;
+	}
+
+	static const double MB = 1024 * 1024;
+	printf("%-40s %-8s %8zu %7.2f %10.1f %10.1f\n",
+	       path,
+	       encoding,
+	       result.iterations,
+	       result.in_bytes ? (double)result.out_bytes /
+						 (double)result.in_bytes
+			       : 0.,
+	       (double)result.in_bytes / MB / result.seconds,
+	       (double)result.out_bytes / MB / result.seconds);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	size_t chunk_size = DEFAULT_CHUNK_SIZE;
+	double seconds = DEFAULT_SECONDS;
+	int opt, rc = 0;
+
+	while ((opt = getopt(argc, argv, "c:t:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			chunk_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'h':
+		default:
+			show_usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind == argc || 0 == chunk_size) {
+		show_usage(argv[0]);
+		exit(1);
+	}
+
+	printf("%-40s %-8s %8s %7s %10s %10s\n",
+	       "file",
+	       "encoding",
+	       "iters",
+	       "ratio",
+	       "in MB/s",
+	       "out MB/s");
+
+	for (; optind < argc; ++optind) {
+		if (0 != bench_file(argv[optind], chunk_size, seconds)) {
+			rc = 1;
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+''' Compare socket listener multiplexing modes (libev vs io_uring).
+
+Launch n2kafka with a socket listener in every mode, flood it with messages
+from several sender processes during a fixed time, and report the n2kafka CPU
+time spent, and the messages and wakeups reported by the listener at exit.
+
+With --udp-gro, UDP runs are repeated with the listener UDP_GRO receive path,
+and senders send --udp-segment datagrams per system call using UDP_SEGMENT, so
+the kernel keeps them coalesced through loopback.
+
+With --busy-poll, runs are repeated with the listener busy_poll latency mode.
+Use --rate to limit the messages per second of every sender, since latency is
+more meaningful when the listener is not saturated.
+
+Unix domain socket listeners can be compared against loopback TCP and UDP with
+--proto unix (stream), unix_dgram and unix_seqpacket. They always run in epoll
+mode, listening in --unix-path.
+
+Brokers do not need to be reachable: dumb decoder messages will fail when the
+librdkafka queue is full, but socket reception cost is still measured. Use a
+real broker to measure the full pipeline.
+'''
+
+from multiprocessing import Process, Value
+from subprocess import Popen, STDOUT
+from tempfile import NamedTemporaryFile
+import argparse
+import json
+import os
+import re
+import signal
+import socket
+import time
+
+STATS_RE = re.compile(r'read (\d+) (?:datagrams|messages) in (\d+) wakeups')
+LATENCY_RE = re.compile(r'latency: p50 (\d+)us, p99 (\d+)us')
+
+# linux/udp.h
+UDP_SEGMENT = 103
+
+# Unix domain socket listeners socket type
+UNIX_TYPES = {'unix': 'stream',
+              'unix_dgram': 'dgram',
+              'unix_seqpacket': 'seqpacket'}
+
+SOCK_TYPES = {'udp': socket.SOCK_DGRAM,
+              'tcp': socket.SOCK_STREAM,
+              'unix': socket.SOCK_STREAM,
+              'unix_dgram': socket.SOCK_DGRAM,
+              'unix_seqpacket': socket.SOCK_SEQPACKET}
+
+
+def sender(proto, addr, msg, segments, seconds, rate, sent):
+    ''' Send messages to addr (localhost port or unix socket path) as fast as
+    possible, or at rate sends per second if rate > 0. UDP messages are sent
+    in groups of segments datagrams if segments > 1 '''
+    family = socket.AF_UNIX if proto in UNIX_TYPES else socket.AF_INET
+    count = 0
+    with socket.socket(family, SOCK_TYPES[proto]) as s:
+        s.connect(addr if family == socket.AF_UNIX else ('127.0.0.1', addr))
+        if segments > 1:
+            s.setsockopt(socket.IPPROTO_UDP, UDP_SEGMENT, len(msg))
+            msg = msg * segments
+        end = time.monotonic() + seconds
+        next_send = time.monotonic()
+        while time.monotonic() < end:
+            for _ in range(1 if rate else 1000):
+                try:
+                    s.send(msg)
+                    count += segments
+                except ConnectionRefusedError:
+                    pass  # UDP ICMP error from a previous run
+            if rate:
+                next_send += 1. / rate
+                time.sleep(max(0, next_send - time.monotonic()))
+
+    with sent.get_lock():
+        sent.value += count
+
+
+def process_cpu_seconds(pid):
+    ''' User + system CPU time of a running process '''
+    with open('/proc/{}/stat'.format(pid)) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    # utime and stime are 14th and 15th fields, and we have removed 2
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def wait_listener(child, log):
+    while 'Creating new' not in open(log.name).read():
+        if child.poll() is not None:
+            raise RuntimeError('n2kafka exited before creating listener')
+        time.sleep(0.1)
+
+
+def run(args, proto, mode, gro, latency_mode):
+    listener = {
+        'proto': proto,
+        'port': args.port,
+        'num_threads': args.threads,
+        'mode': mode,
+        'reuseport': args.reuseport,
+        'udp_gro': gro,
+        'latency_mode': latency_mode,
+    }
+    addr = args.port
+    if proto in UNIX_TYPES:
+        listener.update({'proto': 'unix',
+                         'path': args.unix_path,
+                         'type': UNIX_TYPES[proto],
+                         'reuseport': False})
+        del listener['port']
+        addr = args.unix_path
+
+    config = {
+        'listeners': [listener],
+        'brokers': args.brokers,
+        'topic': args.topic,
+    }
+
+    # n2kafka can log a lot of errors if brokers are not reachable, so we
+    # can't let it block in a pipe
+    with NamedTemporaryFile(mode='w', suffix='.json') as config_file, \
+            NamedTemporaryFile(mode='w', suffix='.log') as log:
+        json.dump(config, config_file)
+        config_file.flush()
+
+        child = Popen([args.n2kafka, config_file.name],
+                      stdout=log,
+                      stderr=STDOUT)
+        wait_listener(child, log)
+        time.sleep(0.5)  # Let listener threads start
+
+        sent = Value('Q', 0)
+        msg = b'x' * (args.msg_size - 1) + b'\n'
+        segments = args.udp_segment if gro else 1
+        senders = [Process(target=sender,
+                           args=(proto, addr, msg, segments,
+                                 args.seconds, args.rate, sent))
+                   for _ in range(args.senders)]
+        cpu_start = process_cpu_seconds(child.pid)
+        for p in senders:
+            p.start()
+        for p in senders:
+            p.join()
+        time.sleep(0.5)  # Let listener drain socket buffers
+        cpu = process_cpu_seconds(child.pid) - cpu_start
+
+        child.send_signal(signal.SIGINT)
+        child.wait(timeout=60)
+        err = open(log.name).read()
+
+    stats = STATS_RE.search(err)
+    received, wakeups = map(int, stats.groups()) if stats else (None, None)
+    latency = LATENCY_RE.search(err)
+    p50, p99 = latency.groups() if latency else ('-', '-')
+    return {'sent': sent.value,
+            'received': received,
+            'wakeups': wakeups,
+            'cpu': cpu,
+            'p50': p50,
+            'p99': p99}
+
+
+def print_result(proto, mode, seconds, r):
+    msgs = r['received'] if r['received'] is not None else r['sent']
+    per_wakeup = '{:.2f}'.format(msgs / r['wakeups']) if r['wakeups'] \
+        else '-'
+    print('{:<14} {:<13} {:>12} {:>12} {:>12.0f} {:>10.3f} {:>12.3f} {:>8} '
+          '{:>8} {:>8}'
+          .format(proto,
+                  mode,
+                  r['sent'],
+                  r['received'] if r['received'] is not None else '-',
+                  msgs / seconds,
+                  r['cpu'],
+                  1e6 * r['cpu'] / msgs if msgs else 0,
+                  per_wakeup,
+                  r['p50'],
+                  r['p99']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--n2kafka', default='./n2kafka')
+    parser.add_argument('--brokers', default='localhost:9092')
+    parser.add_argument('--topic', default='n2kafka_bench')
+    parser.add_argument('--port', type=int, default=2057)
+    parser.add_argument('--proto', choices=['udp', 'tcp'] + list(UNIX_TYPES),
+                        action='append')
+    parser.add_argument('--unix-path', default='/tmp/n2kafka_bench.sock')
+    parser.add_argument('--mode', action='append',
+                        help='Modes to compare (default epoll and io_uring)')
+    parser.add_argument('--threads', type=int, default=2)
+    parser.add_argument('--senders', type=int, default=4)
+    parser.add_argument('--seconds', type=float, default=10)
+    parser.add_argument('--msg-size', type=int, default=512)
+    parser.add_argument('--reuseport', action='store_true')
+    parser.add_argument('--udp-gro', action='store_true',
+                        help='Compare UDP runs with UDP_GRO enabled')
+    parser.add_argument('--udp-segment', type=int, default=16,
+                        help='Datagrams per send in UDP_GRO runs')
+    parser.add_argument('--busy-poll', action='store_true',
+                        help='Compare runs with busy_poll latency mode')
+    parser.add_argument('--rate', type=float, default=0,
+                        help='Sends per second of every sender (default '
+                        'unlimited)')
+    args = parser.parse_args()
+
+    print('{:<14} {:<13} {:>12} {:>12} {:>12} {:>10} {:>12} {:>8} {:>8} '
+          '{:>8}'.format('prot', 'mode', 'sent', 'received', 'msgs/s',
+                         'cpu(s)', 'cpu us/msg', 'msg/wake', 'p50 us',
+                         'p99 us'))
+    for proto in args.proto or ['udp', 'tcp']:
+        for mode in args.mode or ['epoll', 'io_uring']:
+            if proto in UNIX_TYPES and mode == 'io_uring':
+                continue  # Listener falls back to epoll
+
+            r = run(args, proto, mode, False, 'throughput')
+            print_result(proto, mode, args.seconds, r)
+            if proto == 'udp' and args.udp_gro and mode != 'io_uring':
+                r = run(args, proto, mode, True, 'throughput')
+                print_result(proto, mode + '+gro', args.seconds, r)
+            if args.busy_poll and mode != 'io_uring':
+                r = run(args, proto, mode, False, 'busy_poll')
+                print_result(proto, mode + '+busy', args.seconds, r)
+
+
+if __name__ == '__main__':
+    main()
@@ -47,6 +47,19 @@ enum decoder_callback_err {
 	DECODER_CALLBACK_GENERIC_ERROR,
 };
 
+struct pool_buffer;
+
+/// Message of a decoder batch
+struct n2k_decoder_batch_msg {
+	const char *buffer;	    ///< Message buffer
+	size_t buf_size;	    ///< Message buffer size
+	const keyval_list_t *props; ///< Message properties
+	/// Pool buffer that contains message buffer, or NULL. Decoder can use
+	/// message buffer after callback returns if it takes a buffer
+	/// reference with pool_buffer_ref.
+	struct pool_buffer *pool_buffer;
+};
+
 /** Decoder API
   All functions are thread-safe except init & done, and call callback() with
   the same opaque from two different threads
@@ -70,6 +83,19 @@ typedef struct n2k_decoder {
 					      size_t *response_size,
 					      void *sessionp);
 
+	/** Optional callback to process many sessionless messages at once.
+	    Listener will fall back to call callback for each message if not
+	    provided.
+	    @param msgs Messages to process
+	    @param msgs_count Number of messages
+	    @param listener_callback_opaque Decoder opaque
+	    @return First non-OK decoder error, or OK if all went fine
+	    */
+	enum decoder_callback_err (*callback_batch)(
+			const struct n2k_decoder_batch_msg *msgs,
+			size_t msgs_count,
+			void *listener_callback_opaque);
+
 	int (*init)();			     ///< Init decoder global config
 	int (*reload)(const json_t *config); ///< Reload decoder.
 	void (*done)();			     ///< Finish decoder global config
@@ -22,16 +22,50 @@
 
 #include "dumb.h"
 
+#include "util/buffer_pool.h"
 #include "util/kafka.h"
 #include "util/pair.h"
 #include "util/util.h"
 
+#include <librd/rd.h>
 #include <librd/rdlog.h>
 #include <librdkafka/rdkafka.h>
 
+#include <stdbool.h>
 #include <string.h>
 #include <syslog.h>
 
+/// Max number of messages to send to librdkafka in the same batch
+#define DUMB_PRODUCE_BATCH_SIZE 64
+/// Messages are copied if their listener buffer is more than this times
+/// bigger, so buffers held until delivery are bounded by kafka queue size
+#define DUMB_ZERO_COPY_MAX_RATIO 4
+
+/**
+ * @brief      Translate a librdkafka produce error to decoder error
+ *
+ * @param[in]  kafka_error_code  The kafka error code
+ *
+ * @return     Decoder error
+ */
+static enum decoder_callback_err
+dumb_kafka_err2decoder_err(rd_kafka_resp_err_t kafka_error_code) {
+	switch (kafka_error_code) {
+	case RD_KAFKA_RESP_ERR_NO_ERROR:
+		return DECODER_CALLBACK_OK;
+	case RD_KAFKA_RESP_ERR__QUEUE_FULL:
+		return DECODER_CALLBACK_BUFFER_FULL;
+	case RD_KAFKA_RESP_ERR_MSG_SIZE_TOO_LARGE:
+		return DECODER_CALLBACK_UNKNOWN_TOPIC;
+	case RD_KAFKA_RESP_ERR__UNKNOWN_PARTITION:
+		return DECODER_CALLBACK_UNKNOWN_PARTITION;
+	case RD_KAFKA_RESP_ERR__UNKNOWN_TOPIC:
+		return DECODER_CALLBACK_MSG_TOO_LARGE;
+	default:
+		return DECODER_CALLBACK_GENERIC_ERROR;
+	};
+}
+
 static enum decoder_callback_err dumb_decode(const char *buffer,
 					     size_t buf_size,
 					     const keyval_list_t *keyval,
@@ -72,20 +106,162 @@ static enum decoder_callback_err dumb_decode(const char *buffer,
 
 	rd_kafka_topic_destroy(rkt);
 
-	switch (kafka_error_code) {
-	case RD_KAFKA_RESP_ERR_NO_ERROR:
-		return DECODER_CALLBACK_OK;
-	case RD_KAFKA_RESP_ERR__QUEUE_FULL:
-		return DECODER_CALLBACK_BUFFER_FULL;
-	case RD_KAFKA_RESP_ERR_MSG_SIZE_TOO_LARGE:
+	return dumb_kafka_err2decoder_err(kafka_error_code);
+}
+
+/**
+ * @brief      Produce a batch of messages. Messages that librdkafka could not
+ *             enqueue release their private data, since they will not have
+ *             delivery report.
+ *
+ * @param      rkt       The topic
+ * @param[in]  msgflags  The produce flags
+ * @param      rkmsgs    The messages
+ * @param[in]  count     The messages count
+ *
+ * @return     First produce error, or RD_KAFKA_RESP_ERR_NO_ERROR
+ */
+static rd_kafka_resp_err_t dumb_produce_batch(rd_kafka_topic_t *rkt,
+					      int msgflags,
+					      rd_kafka_message_t *rkmsgs,
+					      size_t count) {
+	rd_kafka_resp_err_t ret = RD_KAFKA_RESP_ERR_NO_ERROR;
+	size_t i;
+
+	if (0 == count) {
+		return ret;
+	}
+
+	const int produced = rd_kafka_produce_batch(rkt,
+						    RD_KAFKA_PARTITION_UA,
+						    msgflags,
+						    rkmsgs,
+						    (int)count);
+	if (likely((size_t)produced == count)) {
+		return ret;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (rkmsgs[i].err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+			continue;
+		}
+
+		if (ret == RD_KAFKA_RESP_ERR_NO_ERROR) {
+			ret = rkmsgs[i].err;
+		}
+
+		if (rkmsgs[i]._private) {
+			struct kafka_msg_private *priv = rkmsgs[i]._private;
+			priv->release(priv);
+		}
+	}
+
+	rdlog(LOG_ERR,
+	      "Couldn't produce %zu messages: %s",
+	      count - (size_t)produced,
+	      rd_kafka_err2str(ret));
+	return ret;
+}
+
+/**
+ * @brief      Check if a message can be sent from its listener buffer. Small
+ *             messages are copied, so they don't keep a much bigger buffer
+ *             out of its pool until delivery: librdkafka queue limits only
+ *             account messages length.
+ *
+ * @param[in]  msg   The message
+ *
+ * @return     True if message can be sent without copy
+ */
+static bool dumb_zero_copy(const struct n2k_decoder_batch_msg *msg) {
+	return msg->pool_buffer &&
+	       msg->buf_size * DUMB_ZERO_COPY_MAX_RATIO >=
+			       pool_buffer_size(msg->pool_buffer);
+}
+
+/**
+ * @brief      Produce a group of messages sent the same way, keeping the
+ *             first error
+ *
+ * @param      rkt        The topic
+ * @param[in]  zero_copy  The messages are sent from listener buffers
+ * @param      rkmsgs     The messages
+ * @param[in]  count      The messages count
+ * @param      err        First produce error. Updated if it was not set.
+ */
+static void dumb_produce_group(rd_kafka_topic_t *rkt,
+			       bool zero_copy,
+			       rd_kafka_message_t *rkmsgs,
+			       size_t count,
+			       rd_kafka_resp_err_t *err) {
+	const int msgflags = zero_copy ? 0 : RD_KAFKA_MSG_F_COPY;
+	const rd_kafka_resp_err_t produce_err =
+			dumb_produce_batch(rkt, msgflags, rkmsgs, count);
+	if (*err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+		*err = produce_err;
+	}
+}
+
+static enum decoder_callback_err
+dumb_decode_batch(const struct n2k_decoder_batch_msg *msgs,
+		  size_t msgs_count,
+		  void *listener_callback_opaque) {
+	(void)listener_callback_opaque;
+	rd_kafka_message_t rkmsgs[DUMB_PRODUCE_BATCH_SIZE];
+	rd_kafka_resp_err_t kafka_error_code = RD_KAFKA_RESP_ERR_NO_ERROR;
+	size_t i, count = 0;
+	bool zero_copy = false;
+
+	rd_kafka_topic_t *rkt = new_rkt_global_config(default_topic_name());
+	if (unlikely(NULL == rkt)) {
+		rdlog(LOG_ERR,
+		      "Couldn't produce %zu messages: No topic specified in "
+		      "config file",
+		      msgs_count);
 		return DECODER_CALLBACK_UNKNOWN_TOPIC;
-	case RD_KAFKA_RESP_ERR__UNKNOWN_PARTITION:
-		return DECODER_CALLBACK_UNKNOWN_PARTITION;
-	case RD_KAFKA_RESP_ERR__UNKNOWN_TOPIC:
-		return DECODER_CALLBACK_MSG_TOO_LARGE;
-	default:
-		return DECODER_CALLBACK_GENERIC_ERROR;
-	};
+	}
+
+	// Only consecutive messages sent the same way go in the same
+	// librdkafka batch, so they keep their order
+	for (i = 0; i < msgs_count; ++i) {
+		const struct n2k_decoder_batch_msg *msg = &msgs[i];
+		const bool msg_zero_copy = dumb_zero_copy(msg);
+
+		if (count == DUMB_PRODUCE_BATCH_SIZE ||
+		    (count > 0 && msg_zero_copy != zero_copy)) {
+			dumb_produce_group(rkt,
+					   zero_copy,
+					   rkmsgs,
+					   count,
+					   &kafka_error_code);
+			count = 0;
+		}
+
+		rd_kafka_message_t *rkmsg = &rkmsgs[count++];
+		memset(rkmsg, 0, sizeof(*rkmsg));
+		zero_copy = msg_zero_copy;
+		if (zero_copy) {
+			// Buffer goes back to its pool in delivery report
+			pool_buffer_ref(msg->pool_buffer);
+			rkmsg->_private = pool_buffer_kafka_private(
+					msg->pool_buffer);
+		}
+
+		rkmsg->payload = const_cast(msg->buffer);
+		rkmsg->len = msg->buf_size;
+	}
+
+	if (count > 0) {
+		dumb_produce_group(rkt,
+				   zero_copy,
+				   rkmsgs,
+				   count,
+				   &kafka_error_code);
+	}
+
+	rd_kafka_topic_destroy(rkt);
+
+	return dumb_kafka_err2decoder_err(kafka_error_code);
 }
 
 static const char *dumb_decoder_name() {
@@ -95,4 +271,5 @@ static const char *dumb_decoder_name() {
 const struct n2k_decoder dumb_decoder = {
 		.name = dumb_decoder_name,
 		.callback = dumb_decode,
+		.callback_batch = dumb_decode_batch,
 };
@@ -33,6 +33,7 @@
 #endif
 #include "listener/listener_api.h"
 #include "listener/socket/socket.h"
+#include "listener/socket/socket_packet.h"
 
 #include "util/kafka.h"
 #include "util/util.h"
@@ -48,8 +49,11 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -70,10 +74,22 @@
 #define CONFIG_DEBUG_KEY "debug"
 #define CONFIG_RESPONSE_KEY "response"
 #define CONFIG_BLACKLIST_KEY "blacklist"
+#define CONFIG_ALLOWLIST_KEY "allowlist"
 #define CONFIG_RDKAFKA_KEY "rdkafka."
 
 struct n2kafka_config global_config;
 
+/// Serializes access list swaps with threads taking a reference to it
+static pthread_mutex_t addr_acl_mutex = PTHREAD_MUTEX_INITIALIZER;
+/// Access list reference held by each listener thread, so a list replaced
+/// in a reload is freed when the last thread that was using it moves on.
+static pthread_key_t addr_acl_thread_key;
+
+/// Release thread access list reference at thread exit
+static void addr_acl_thread_release(void *acl) {
+	addr_acl_decref(acl);
+}
+
 static const struct n2k_decoder *registered_decoders[] = {
 		&dumb_decoder, &meraki_decoder, &zz_decoder};
 
@@ -83,15 +99,22 @@ static const n2k_listener_factory *registered_listeners[] = {
 #endif
 		&tcp_listener_factory,
 		&udp_listener_factory,
+		&unix_listener_factory,
+		&packet_listener_factory,
 };
 
 void init_global_config() {
 	memset(&global_config, 0, sizeof(global_config));
 
-	global_config.blacklist = in_addr_list_new();
 	global_config.log_severity = LOG_INFO;
 	LIST_INIT(&global_config.listeners);
 
+	const int key_rc = pthread_key_create(&addr_acl_thread_key,
+					      addr_acl_thread_release);
+	if (key_rc != 0) {
+		fatal("Can't create access list thread key: %d", key_rc);
+	}
+
 	size_t i;
 	for (i = 0; i < RD_ARRAYSIZE(registered_decoders); ++i) {
 		const n2k_decoder *decoder = registered_decoders[i];
@@ -115,14 +138,6 @@ static const char *assert_json_string(const char *key, const json_t *value) {
 	return json_string_value(value);
 }
 
-static void *assert_pton(int af, const char *src, void *dst) {
-	const int pton_rc = inet_pton(af, src, dst);
-	if (pton_rc < 0) {
-		fatal("pton(%s) error: %s", src, strerror(errno));
-	}
-	return dst;
-}
-
 static void parse_response(const char *filename) {
 	global_config.response =
 			rd_file_read(filename, &global_config.response_len);
@@ -152,6 +167,11 @@ static void parse_rdkafka_keyval_config(n2kafka_rdkafka_conf *conf,
 		return;
 	}
 
+	if (!strcmp(name, "queue.buffering.max.ms") ||
+	    !strcmp(name, "linger.ms")) {
+		conf->linger_set = true;
+	}
+
 	rd_kafka_conf_res_t res = rd_kafka_conf_set(
 			conf->rk_conf, name, value, errstr, sizeof(errstr));
 
@@ -166,19 +186,137 @@ static void parse_rdkafka_config_json(n2kafka_rdkafka_conf *conf,
 	parse_rdkafka_keyval_config(conf, key, value);
 }
 
-static void parse_blacklist(const json_t *config_array) {
-	assert(json_is_array(config_array));
-
+/// Add blacklist or allowlist rules to access list
+static int parse_addr_acl_rules(struct addr_acl *acl,
+				const json_t *config,
+				const char *key,
+				enum addr_acl_action action) {
+	const json_t *config_array = json_object_get(config, key);
 	size_t index;
 	const json_t *value;
+
+	if (NULL == config_array) {
+		return 0;
+	}
+
+	if (!json_is_array(config_array)) {
+		rdlog(LOG_ERR, "%s must be an array", key);
+		return -1;
+	}
+
 	json_array_foreach(config_array, index, value) {
-		struct in_addr addr;
-		const char *addr_string =
-				assert_json_string("blacklist values", value);
-		rdlog(LOG_INFO, "adding %s address to blacklist", addr_string);
-		assert_pton(AF_INET, addr_string, &addr);
-		in_addr_list_add(global_config.blacklist, &addr);
+		if (!json_is_string(value)) {
+			rdlog(LOG_ERR, "%s values must be strings", key);
+			return -1;
+		}
+
+		const char *cidr = json_string_value(value);
+		rdlog(LOG_DEBUG, "adding %s to %s", cidr, key);
+		if (0 != addr_acl_add(acl, cidr, action)) {
+			return -1;
+		}
 	}
+
+	return 0;
+}
+
+/**
+ * @brief      Parse clients access list
+ *
+ * @param[in]  config  The configuration root
+ * @param[out] acl     The access list, or NULL if no rules
+ *
+ * @return     0 if success, -1 if invalid configuration
+ */
+static int parse_addr_acl(const json_t *config, struct addr_acl **acl) {
+	*acl = addr_acl_new();
+	if (unlikely(NULL == *acl)) {
+		rdlog(LOG_ERR, "Can't allocate access list (OOM?)");
+		return -1;
+	}
+
+	if (0 != parse_addr_acl_rules(*acl,
+				      config,
+				      CONFIG_BLACKLIST_KEY,
+				      ADDR_ACL_DENY) ||
+	    0 != parse_addr_acl_rules(*acl,
+				      config,
+				      CONFIG_ALLOWLIST_KEY,
+				      ADDR_ACL_ALLOW)) {
+		addr_acl_decref(*acl);
+		*acl = NULL;
+		return -1;
+	}
+
+	if (0 == addr_acl_size(*acl)) {
+		addr_acl_decref(*acl);
+		*acl = NULL;
+	} else {
+		rdlog(LOG_INFO,
+		      "Using clients access list with %zu rules",
+		      addr_acl_size(*acl));
+	}
+
+	return 0;
+}
+
+/// Publish a new access list to listener threads
+static void swap_addr_acl(struct addr_acl *acl) {
+	pthread_mutex_lock(&addr_acl_mutex);
+	struct addr_acl *old_acl = global_config.addr_acl;
+	__atomic_store_n(&global_config.addr_acl, acl, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&addr_acl_mutex);
+
+	// Threads still using it hold their own reference
+	if (old_acl) {
+		addr_acl_decref(old_acl);
+	}
+}
+
+/**
+ * @brief      Check a client against the current access list, taking a
+ *             reference to it, if it changed since calling thread last check
+ *
+ * @param[in]  addr        The client address
+ * @param      thread_acl  The access list calling thread holds, if any
+ *
+ * @return     True if allowed, false otherwise
+ */
+static bool client_addr_allowed_swapped(const struct sockaddr *addr,
+					struct addr_acl *thread_acl) {
+	pthread_mutex_lock(&addr_acl_mutex);
+	struct addr_acl *acl = global_config.addr_acl;
+	if (acl) {
+		addr_acl_incref(acl);
+	}
+	pthread_mutex_unlock(&addr_acl_mutex);
+
+	if (thread_acl) {
+		addr_acl_decref(thread_acl);
+	}
+
+	const bool ret = NULL == acl || addr_acl_allowed(acl, addr);
+	if (unlikely(0 != pthread_setspecific(addr_acl_thread_key, acl))) {
+		rdlog(LOG_ERR, "Can't hold access list in thread (OOM?)");
+		pthread_setspecific(addr_acl_thread_key, NULL);
+		if (acl) {
+			addr_acl_decref(acl);
+		}
+	}
+
+	return ret;
+}
+
+bool client_addr_allowed(const struct sockaddr *addr) {
+	// Thread reference keeps the list alive, no need of a locked operation
+	const struct addr_acl *acl = __atomic_load_n(&global_config.addr_acl,
+						     __ATOMIC_ACQUIRE);
+	struct addr_acl *thread_acl = pthread_getspecific(addr_acl_thread_key);
+	if (unlikely(acl != thread_acl)) {
+		return client_addr_allowed_swapped(addr, thread_acl);
+	}
+
+	return NULL == acl || addr_acl_allowed(acl, addr);
 }
 
 static const n2k_listener_factory *listener_for(const char *proto) {
@@ -255,6 +393,7 @@ static void parse_listener(json_t *config) {
 		exit(-1);
 	}
 
+	proto_listener->config = json_incref(config);
 	LIST_INSERT_HEAD(&global_config.listeners, proto_listener, entry);
 }
 
@@ -408,6 +547,91 @@ static void get_rdkafka_config(n2kafka_rdkafka_conf *conf, const json_t *root) {
 	}
 }
 
+/// Identify a listener config in logs, as listeners do
+static const char *
+listener_config_id(const json_t *listener_config, char *buf, size_t size) {
+	const char *path = json_string_value(
+			json_object_get(listener_config, "path"));
+	if (path) {
+		snprintf(buf, size, "path %s", path);
+	} else {
+		const json_t *port = json_object_get(listener_config, "port");
+		snprintf(buf,
+			 size,
+			 "port %lld",
+			 (long long)json_integer_value(port));
+	}
+
+	return buf;
+}
+
+/// First listener config that busy polls its sockets, or NULL if none
+static const json_t *busy_poll_listener_config(const json_t *listeners) {
+	const json_t *listener_config;
+	size_t index;
+
+	json_array_foreach(listeners, index, listener_config) {
+		const char *latency_mode = json_string_value(json_object_get(
+				listener_config, "latency_mode"));
+		if (NULL != latency_mode &&
+		    0 == strcmp(latency_mode, SOCKET_LATENCY_MODE_BUSY_POLL)) {
+			return listener_config;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief      Disable producer linger if some listener busy polls its
+ *             sockets, so messages are not held in the producer queue after
+ *             reading them as soon as possible. User configured linger is
+ *             respected.
+ *
+ * @param      conf       The rdkafka configuration
+ * @param[in]  listeners  The listeners configuration array
+ */
+static void busy_poll_linger_config(n2kafka_rdkafka_conf *conf,
+				    const json_t *listeners) {
+	static const char linger_key[] = "queue.buffering.max.ms";
+	char linger[32] = "", errstr[512], listener_id[PATH_MAX];
+	size_t linger_size = sizeof(linger);
+	const json_t *listener_config = busy_poll_listener_config(listeners);
+
+	rd_kafka_conf_get(conf->rk_conf, linger_key, linger, &linger_size);
+	global_config.producer_no_linger = (0 == strcmp(linger, "0"));
+	if (NULL == listener_config || global_config.producer_no_linger) {
+		return;
+	}
+
+	listener_config_id(listener_config, listener_id, sizeof(listener_id));
+	if (conf->linger_set) {
+		rdlog(LOG_WARNING,
+		      "Listener on %s busy polls its sockets, but rdkafka "
+		      "linger.ms is configured to %s: messages will wait for "
+		      "it anyway",
+		      listener_id,
+		      linger);
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Listener on %s busy polls its sockets, setting rdkafka "
+	      "linger.ms to 0 (was %s)",
+	      listener_id,
+	      linger);
+	if (RD_KAFKA_CONF_OK != rd_kafka_conf_set(conf->rk_conf,
+						  linger_key,
+						  "0",
+						  errstr,
+						  sizeof(errstr))) {
+		rdlog(LOG_ERR, "Can't disable linger: %s", errstr);
+		return;
+	}
+
+	global_config.producer_no_linger = true;
+}
+
 void parse_config(const char *config_file_path) {
 	json_error_t jerror;
 	global_config.config_path = config_file_path;
@@ -427,19 +651,17 @@ void parse_config(const char *config_file_path) {
 	get_rdkafka_config(&rdkafka_conf, root);
 
 	const char *response_file = NULL;
-	json_t *blacklist = NULL, *listeners = NULL;
+	json_t *listeners = NULL;
 
 	// Parse global stuff
 	const int json_unpack_rc = json_unpack_ex(root,
 						  &jerror,
 						  0,
-						  "{s?i,s?s,s?o,s:o}",
+						  "{s?i,s?s,s:o}",
 						  CONFIG_DEBUG_KEY,
 						  &global_config.log_severity,
 						  CONFIG_RESPONSE_KEY,
 						  &response_file,
-						  CONFIG_BLACKLIST_KEY,
-						  &blacklist,
 						  CONFIG_LISTENERS_ARRAY,
 						  &listeners);
 
@@ -453,10 +675,11 @@ void parse_config(const char *config_file_path) {
 		parse_response(response_file);
 	}
 
-	if (blacklist) {
-		parse_blacklist(blacklist);
+	if (0 != parse_addr_acl(root, &global_config.addr_acl)) {
+		fatal("Can't parse clients access list");
 	}
 
+	busy_poll_linger_config(&rdkafka_conf, listeners);
 	init_rdkafka(&rdkafka_conf);
 
 	size_t index;
@@ -467,8 +690,60 @@ void parse_config(const char *config_file_path) {
 	json_decref(root);
 }
 
+/// Unix socket path of a listener, or NULL if it listens in a port
+static const char *listener_path(const struct listener *l) {
+	if (l->port > 0) {
+		return NULL;
+	}
+
+	return json_string_value(json_object_get(l->config, "path"));
+}
+
+/**
+ * @brief      Check if a listener config is the one of a running listener.
+ *             Listeners with port are identified by it, and the ones with no
+ *             port by their path and socket kind, so they are not recreated
+ *             in every reload.
+ *
+ * @param[in]  l       The running listener
+ * @param      config  The listener config
+ *
+ * @return     True if config is the one of the listener
+ */
+static bool listener_config_is(const struct listener *l, json_t *config) {
+	static const char *path_id_keys[] = {"proto", "path", "type"};
+	size_t i;
+
+	if (l->port > 0) {
+		return json_integer_value(json_object_get(config, "port")) ==
+		       l->port;
+	}
+
+	if (NULL == listener_path(l)) {
+		return false;
+	}
+
+	for (i = 0; i < RD_ARRAYSIZE(path_id_keys); ++i) {
+		json_t *l_value = json_object_get(l->config, path_id_keys[i]);
+		json_t *value = json_object_get(config, path_id_keys[i]);
+		if (l_value != value && !json_equal(l_value, value)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static void shutdown_listener(struct listener *i) {
-	rblog(LOG_INFO, "Joining listener on port %d.", i->port);
+	const char *path = listener_path(i);
+	if (path) {
+		rblog(LOG_INFO, "Joining listener on path %s.", path);
+	} else {
+		rblog(LOG_INFO, "Joining listener on port %d.", i->port);
+	}
+
+	json_decref(i->config);
+	i->config = NULL;
 	if (NULL == i->join) {
 		return;
 	}
@@ -486,32 +761,35 @@ static void shutdown_listeners(struct n2kafka_config *config) {
 static void
 reload_listeners_check_already_present(json_t *new_listeners,
 				       struct n2kafka_config *config) {
-	json_error_t jerr;
 	size_t _index = 0;
 	struct listener *i = NULL, *aux = NULL;
 	LIST_FOREACH_SAFE(i, &config->listeners, entry, aux) {
-		const uint16_t i_port = i->port;
-
 		json_t *found_value = NULL;
 		json_t *value = NULL;
 
 		json_array_foreach(new_listeners, _index, value) {
-			int port = 0;
-
 			if (NULL != found_value)
 				break;
 
-			json_unpack_ex(value, &jerr, 0, "{s:i}", "port", &port);
-
-			if (port > 0 && port == i_port)
+			if (listener_config_is(i, value))
 				found_value = value;
 		}
 
 		if (found_value && i->reload) {
-			rdlog(LOG_INFO,
-			      "Reloading listener on port %d",
-			      i_port);
+			const char *path = listener_path(i);
+			if (path) {
+				rdlog(LOG_INFO,
+				      "Reloading listener on path %s",
+				      path);
+			} else {
+				rdlog(LOG_INFO,
+				      "Reloading listener on port %d",
+				      i->port);
+			}
 			i->reload(i, found_value);
+			json_incref(found_value);
+			json_decref(i->config);
+			i->config = found_value;
 		} else {
 			LIST_REMOVE(i, entry);
 			shutdown_listener(i);
@@ -522,30 +800,18 @@ reload_listeners_check_already_present(json_t *new_listeners,
 /// Creating new declared listeners
 static void reload_listeners_create_new_ones(json_t *new_listeners_array,
 					     struct n2kafka_config *config) {
-	json_error_t jerr;
 	size_t _index = 0;
 	json_t *new_config_listener = 0;
 	struct listener *i = NULL;
 	json_array_foreach(new_listeners_array, _index, new_config_listener) {
-		uint16_t searched_port = 0;
-
 		struct listener *found_value = NULL;
 		i = NULL;
 
-		json_unpack_ex(new_config_listener,
-			       &jerr,
-			       0,
-			       "{s:i}",
-			       "port",
-			       &searched_port);
-
 		LIST_FOREACH(i, &config->listeners, entry) {
-			uint16_t port = i->port;
-
 			if (NULL != found_value)
 				break;
 
-			if (port > 0 && port == searched_port)
+			if (listener_config_is(i, new_config_listener))
 				found_value = i;
 		}
 
@@ -573,6 +839,18 @@ reload_listeners(json_t *new_config, struct n2kafka_config *config) {
 		return;
 	}
 
+	const json_t *busy_poll_config =
+			busy_poll_listener_config(listeners_array);
+	if (busy_poll_config && !config->producer_no_linger) {
+		char listener_id[PATH_MAX];
+		rdlog(LOG_WARNING,
+		      "Listener on %s busy polls its sockets, but rdkafka "
+		      "linger.ms can't be changed until restart",
+		      listener_config_id(busy_poll_config,
+					 listener_id,
+					 sizeof(listener_id)));
+	}
+
 	reload_listeners_check_already_present(listeners_array, config);
 	reload_listeners_create_new_ones(listeners_array, config);
 }
@@ -595,6 +873,13 @@ void reload_config(struct n2kafka_config *config) {
 		      jerr.text,
 		      jerr.line,
 		      jerr.column);
+	} else {
+		struct addr_acl *acl = NULL;
+		if (0 == parse_addr_acl(new_config_file, &acl)) {
+			swap_addr_acl(acl);
+		} else {
+			rdlog(LOG_ERR, "Keeping previous clients access list");
+		}
 	}
 
 	reload_listeners(new_config_file, config);
@@ -614,7 +899,7 @@ void free_global_config() {
 	flush_kafka();
 	stop_rdkafka();
 
-	in_addr_list_done(global_config.blacklist);
+	swap_addr_acl(NULL);
 	free(global_config.topic);
 	free(global_config.response);
 }
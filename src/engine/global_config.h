@@ -22,12 +22,14 @@
 
 #pragma once
 
-#include "util/in_addr_list.h"
+#include "util/addr_acl.h"
 
 #include <librdkafka/rdkafka.h>
 #include <stdbool.h>
 #include <sys/queue.h>
 
+struct sockaddr;
+
 typedef LIST_HEAD(, listener) listener_list;
 
 struct n2kafka_config {
@@ -38,13 +40,18 @@ struct n2kafka_config {
 
 	rd_kafka_t *rk;
 
-	in_addr_list_t *blacklist;
+	/// Clients access list, NULL if no rules. Check it with
+	/// client_addr_allowed(), since it can be swapped at reload.
+	struct addr_acl *addr_acl;
 
 	char *response;
 	int response_len;
 
 	listener_list listeners;
 
+	/// Producer sends messages as soon as possible (linger.ms is 0)
+	bool producer_no_linger;
+
 	int log_severity;
 };
 
@@ -56,4 +63,14 @@ void parse_config(const char *config_file_path);
 
 void reload_config(struct n2kafka_config *config);
 
+/**
+ * @brief      Check if a client is allowed by configured blacklist and
+ *             allowlist. It can be called from any thread.
+ *
+ * @param[in]  addr  The client address
+ *
+ * @return     True if allowed, false otherwise
+ */
+bool client_addr_allowed(const struct sockaddr *addr);
+
 void free_global_config();
@@ -29,6 +29,8 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
 
@@ -44,6 +46,9 @@ sockaddr2str(char *buf, size_t buf_size, struct sockaddr *sockaddr) {
 	case AF_INET6:
 		addr_buf = &((struct sockaddr_in6 *)sockaddr)->sin6_addr;
 		break;
+	case AF_UNIX:
+		snprintf(buf, buf_size, "%s", SOCKADDR_STR_UNIX);
+		return buf;
 	default:
 		break;
 	}
@@ -62,3 +67,106 @@ sockaddr2str(char *buf, size_t buf_size, struct sockaddr *sockaddr) {
 
 	return ret;
 }
+
+/**
+ * @brief      Locate binary address of a socket address
+ *
+ * @param[in]  sockaddr  The socket address
+ * @param      addr_len  The address length
+ *
+ * @return     The address, or NULL if family is not supported
+ */
+static const uint8_t *sockaddr_addr(const struct sockaddr *sockaddr,
+				    size_t *addr_len) {
+	switch (sockaddr->sa_family) {
+	case AF_INET:
+		*addr_len = sizeof(struct in_addr);
+		return (const uint8_t *)&(
+				(const struct sockaddr_in *)sockaddr)
+				->sin_addr;
+	case AF_INET6:
+		*addr_len = sizeof(struct in6_addr);
+		return (const uint8_t *)&(
+				(const struct sockaddr_in6 *)sockaddr)
+				->sin6_addr;
+	default:
+		return NULL;
+	}
+}
+
+/// Cache entry index of an address
+static size_t sockaddr_str_cache_idx(const uint8_t *addr, size_t addr_len) {
+	uint32_t hash = 0;
+	size_t i;
+
+	for (i = 0; i < addr_len; i += sizeof(uint32_t)) {
+		uint32_t word;
+		memcpy(&word, &addr[i], sizeof(word));
+		hash ^= word;
+	}
+
+	// Fibonacci hashing
+	hash *= 2654435761u;
+	return (hash >> 24) & (SOCKADDR_STR_CACHE_SIZE - 1);
+}
+
+const char *sockaddr2str_cached(struct sockaddr_str_cache *cache,
+				const struct sockaddr *sockaddr) {
+	size_t addr_len = 0;
+	if (sockaddr->sa_family == AF_UNIX) {
+		return SOCKADDR_STR_UNIX;
+	}
+
+	const uint8_t *addr = sockaddr_addr(sockaddr, &addr_len);
+	if (NULL == addr) {
+		// Not an error: client may have no IP address, or no address
+		return SOCKADDR_STR_UNKNOWN;
+	}
+
+	const size_t idx = sockaddr_str_cache_idx(addr, addr_len);
+	struct sockaddr_str_cache_entry *entry = &cache->entries[idx];
+	if (entry->family == sockaddr->sa_family &&
+	    0 == memcmp(entry->addr, addr, addr_len)) {
+		return entry->str;
+	}
+
+	const char *ret = inet_ntop(sockaddr->sa_family,
+				    addr,
+				    entry->str,
+				    sizeof(entry->str));
+	if (NULL == ret) {
+		entry->family = 0;
+		rdlog(LOG_ERR,
+		      "Can't print client address: %s",
+		      gnu_strerror_r(errno));
+		return NULL;
+	}
+
+	entry->family = sockaddr->sa_family;
+	memcpy(entry->addr, addr, addr_len);
+	return ret;
+}
+
+/// Print pair socket address when somebody asks for pair value
+static const char *sockaddr_pair_value(struct pair *pair) {
+	struct sockaddr_pair *sockaddr_pair = (struct sockaddr_pair *)pair;
+	const char *ret = sockaddr2str_cached(sockaddr_pair->cache,
+					      sockaddr_pair->sockaddr);
+	if (NULL == ret) {
+		return NULL;
+	}
+
+	// Cache entry can be reused by next address of the same batch
+	strncpy(sockaddr_pair->str, ret, sizeof(sockaddr_pair->str));
+	sockaddr_pair->str[sizeof(sockaddr_pair->str) - 1] = '\0';
+	return sockaddr_pair->str;
+}
+
+void sockaddr_pair_init(struct sockaddr_pair *sockaddr_pair,
+			const char *key,
+			struct sockaddr_str_cache *cache) {
+	memset(sockaddr_pair, 0, sizeof(*sockaddr_pair));
+	sockaddr_pair->pair.key = key;
+	sockaddr_pair->pair.lazy_value = sockaddr_pair_value;
+	sockaddr_pair->cache = cache;
+}
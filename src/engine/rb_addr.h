@@ -22,7 +22,81 @@
 
 #pragma once
 
+#include "util/pair.h"
+
+#include <netinet/in.h>
 #include <stddef.h>
-struct sockaddr;
+#include <stdint.h>
+#include <sys/socket.h>
+
+/// Printed address of unix domain sockets clients. They have no address we
+/// can use to tell them apart.
+#define SOCKADDR_STR_UNIX "unix"
 
 const char *sockaddr2str(char *buf, size_t buf_size, struct sockaddr *sockaddr);
+
+/// Number of entries of sockaddr strings cache. Needs to be a power of 2
+#define SOCKADDR_STR_CACHE_SIZE 256
+
+/// Printed address of clients with no IP address, or with no address at all
+#define SOCKADDR_STR_UNKNOWN "unknown"
+
+struct sockaddr_str_cache_entry {
+	sa_family_t family;	    ///< Address family. 0 if empty
+	uint8_t addr[16];	    ///< Binary address
+	char str[INET6_ADDRSTRLEN]; ///< Printed address
+};
+
+/// Small direct mapped cache of printed addresses, indexed by binary address.
+/// It is not thread safe, so every thread needs its own.
+struct sockaddr_str_cache {
+	struct sockaddr_str_cache_entry entries[SOCKADDR_STR_CACHE_SIZE];
+};
+
+/**
+ * @brief      Print a socket address, using cache if it has been printed
+ *             before.
+ *
+ * @param      cache     The cache
+ * @param[in]  sockaddr  The socket address
+ *
+ * @return     Printed address, valid until next call with the same cache, or
+ *             NULL if error. Addresses with no IP are printed as a
+ *             placeholder.
+ */
+const char *sockaddr2str_cached(struct sockaddr_str_cache *cache,
+				const struct sockaddr *sockaddr);
+
+/// Key-value pair with a socket address as value, that is only printed if
+/// somebody asks for it
+struct sockaddr_pair {
+	struct pair pair;		   ///< Pair to add to key-value lists
+	struct sockaddr_str_cache *cache;  ///< Printed addresses cache
+	const struct sockaddr *sockaddr;   ///< Address to print
+	char str[INET6_ADDRSTRLEN];	   ///< Printed address
+};
+
+/**
+ * @brief      Init a lazy socket address pair
+ *
+ * @param      sockaddr_pair  The pair
+ * @param[in]  key            The key
+ * @param      cache          The printed addresses cache to use
+ */
+void sockaddr_pair_init(struct sockaddr_pair *sockaddr_pair,
+			const char *key,
+			struct sockaddr_str_cache *cache);
+
+/**
+ * @brief      Set pair address, that will be printed when pair value is
+ *             asked with valueof.
+ *
+ * @param      sockaddr_pair  The pair
+ * @param[in]  sockaddr       The address. It needs to be valid while pair
+ *                            value can be asked for.
+ */
+static inline void sockaddr_pair_set(struct sockaddr_pair *sockaddr_pair,
+				     const struct sockaddr *sockaddr) {
+	sockaddr_pair->sockaddr = sockaddr;
+	sockaddr_pair->pair.value = NULL;
+}
@@ -1,7 +1,10 @@
 THIS_SRCS := \
+	decompressor.c \
 	http.c \
 	http_config.c \
+	http_native.c \
 	http_auth.c \
+	inflate_pool.c \
 	responses.c \
 	tls.c
 
@@ -0,0 +1,647 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "decompressor.h"
+
+#include "config.h"
+
+#include "inflate_pool.h"
+
+#include "listener/listener_api.h"
+#include "util/buffer_pool.h"
+#include "util/pair.h"
+#include "util/util.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <time.h>
+
+/*
+ * zlib (deflate and gzip) decompressor, or zlib-ng if configured with it
+ */
+
+/**
+ * @brief      Translate a zlib error code to a static human readable string
+ *
+ * @param[in]  z_status  zlib error
+ *
+ * @return     Static allocated human readable description
+ */
+static const char *zlib_init_error2str(const int z_status) {
+	switch (z_status) {
+	case Z_MEM_ERROR:
+		return "{\"error\":\"Out of memory on zlib init\"}";
+	default:
+		// case Z_VERSION_ERROR:
+		// case Z_OK:
+		//
+		assert(0);
+		return "{\"error\":\"Unknown error\"}";
+	};
+}
+
+static const char *zlib_deflate_error2str(const int z_status) {
+	switch (z_status) {
+	// case Z_STREAM_ERROR:
+	//	return "Stream structure was inconsistent"
+	// case Z_OK:
+	// case Z_STREAM_END:
+	//	return "No error"
+	case Z_NEED_DICT:
+		return "{\"error\":\"libz deflate error: a dictionary is "
+		       "need\"}";
+	case Z_DATA_ERROR:
+		return "{\"error\":\"deflated input is not conforming to the "
+		       "zlib format\"}";
+	case Z_MEM_ERROR:
+		return "{\"error\":\"Out of memory\"}";
+
+	case Z_BUF_ERROR:
+		return "{\"error\":\"Is not possible to progress in input "
+		       "stream\"}";
+	default:
+		return "{\"error\":\"Unknown error\"}";
+	};
+}
+
+static void *zlib_stream_new(const void *dict, const char **error) {
+	(void)dict;
+	int rc = Z_OK;
+	inflate_stream *strm = inflate_pool_stream_get(&rc);
+	if (unlikely(NULL == strm)) {
+		*error = zlib_init_error2str(rc);
+		rdlog(LOG_ERR,
+		      "Couldn't init inflate. Error was %d: %s",
+		      rc,
+		      *error);
+	}
+
+	return strm;
+}
+
+static enum decoder_callback_err zlib_decompress(void *vstrm,
+						 const char **in,
+						 size_t *in_size,
+						 char *out,
+						 size_t *out_size,
+						 const char **response) {
+	inflate_stream *strm = vstrm;
+	strm->next_in = const_cast(*in);
+	strm->avail_in = (unsigned int)*in_size;
+	strm->next_out = (unsigned char *)out;
+	strm->avail_out = (unsigned int)*out_size;
+
+	const int zret = inflate_stream_inflate(
+			strm, Z_NO_FLUSH /* TODO compare different flush */);
+
+	*out_size -= strm->avail_out;
+	*in = (const char *)strm->next_in;
+	*in_size = strm->avail_in;
+	strm->next_in = NULL;
+	strm->next_out = NULL;
+
+	switch (zret) {
+	case Z_OK:
+	case Z_STREAM_END:
+	case Z_BUF_ERROR: // Not fatal: no progress possible until more input
+		return DECODER_CALLBACK_OK;
+	case Z_NEED_DICT:
+	case Z_DATA_ERROR:
+		*response = zlib_deflate_error2str(zret);
+		return DECODER_CALLBACK_INVALID_REQUEST;
+	case Z_MEM_ERROR:
+		*response = zlib_deflate_error2str(zret);
+		return DECODER_CALLBACK_MEMORY_ERROR;
+	default:
+		*response = zlib_deflate_error2str(zret);
+		return DECODER_CALLBACK_GENERIC_ERROR;
+	};
+}
+
+static enum decoder_callback_err zlib_stream_end(void *vstrm,
+						  const char **response) {
+	inflate_stream *strm = vstrm;
+	if (0 == strm->total_in) {
+		// Empty body
+		return DECODER_CALLBACK_OK;
+	}
+
+	// Finished streams keep returning Z_STREAM_END, and need no output
+	unsigned char out;
+	strm->next_out = &out;
+	strm->avail_out = 0;
+	const int zret = inflate_stream_inflate(strm, Z_NO_FLUSH);
+	strm->next_out = NULL;
+
+	if (unlikely(Z_STREAM_END != zret)) {
+		*response = "{\"error\":\"compressed body is truncated\"}";
+		return DECODER_CALLBACK_INVALID_REQUEST;
+	}
+
+	return DECODER_CALLBACK_OK;
+}
+
+static void zlib_stream_done(void *strm) {
+	inflate_pool_stream_put(strm);
+}
+
+#ifdef HAVE_ZSTD
+/*
+ * zstd decompressor
+ */
+
+static const char *zstd_error2str(size_t zstd_rc) {
+	switch (ZSTD_getErrorCode(zstd_rc)) {
+	case ZSTD_error_memory_allocation:
+		return "{\"error\":\"Out of memory\"}";
+	case ZSTD_error_dictionary_wrong:
+		return "{\"error\":\"zstd error: frame needs a dictionary "
+		       "that is not configured\"}";
+	case ZSTD_error_frameParameter_windowTooLarge:
+		return "{\"error\":\"zstd error: frame window is too "
+		       "large\"}";
+	default:
+		return "{\"error\":\"compressed input is not conforming to "
+		       "the zstd format\"}";
+	};
+}
+
+static void *zstd_dict_new(const char *data, size_t size) {
+	ZSTD_DDict *ddict = ZSTD_createDDict(data, size);
+	if (NULL == ddict) {
+		rdlog(LOG_ERR, "Can't create zstd dictionary (OOM?)");
+	}
+
+	return ddict;
+}
+
+static void zstd_dict_done(void *ddict) {
+	ZSTD_freeDDict(ddict);
+}
+
+/// zstd decompression stream
+struct zstd_stream {
+	ZSTD_DCtx *dctx;
+	/// Last ZSTD_decompressStream progress return. 0 means frame end.
+	size_t frame_left;
+};
+
+static void *zstd_stream_new(const void *ddict, const char **error) {
+	struct zstd_stream *strm = calloc(1, sizeof(*strm));
+	ZSTD_DCtx *dctx = strm ? ZSTD_createDCtx() : NULL;
+	if (unlikely(NULL == dctx)) {
+		*error = "{\"error\":\"Out of memory on zstd init\"}";
+		rdlog(LOG_ERR, "Couldn't create zstd context (OOM?)");
+		free(strm);
+		return NULL;
+	}
+
+	if (ddict) {
+		// Only referenced, so streams do not copy it
+		const size_t rc = ZSTD_DCtx_refDDict(dctx, ddict);
+		if (unlikely(ZSTD_isError(rc))) {
+			*error = zstd_error2str(rc);
+			rdlog(LOG_ERR,
+			      "Couldn't use zstd dictionary: %s",
+			      ZSTD_getErrorName(rc));
+			ZSTD_freeDCtx(dctx);
+			free(strm);
+			return NULL;
+		}
+	}
+
+	strm->dctx = dctx;
+	return strm;
+}
+
+static enum decoder_callback_err zstd_decompress(void *vstrm,
+						 const char **in,
+						 size_t *in_size,
+						 char *out,
+						 size_t *out_size,
+						 const char **response) {
+	struct zstd_stream *strm = vstrm;
+	ZSTD_inBuffer input = {.src = *in, .size = *in_size, .pos = 0};
+	ZSTD_outBuffer output = {.dst = out, .size = *out_size, .pos = 0};
+	enum decoder_callback_err rc = DECODER_CALLBACK_OK;
+
+	// Every call stops at frame end, continue with the next frame. Keep
+	// calling with no input too: context can hold output that did not fit
+	// in previous call buffer.
+	while (output.pos < output.size) {
+		const size_t in_pos = input.pos, out_pos = output.pos;
+		const size_t zstd_rc = ZSTD_decompressStream(
+				strm->dctx, &output, &input);
+		if (unlikely(ZSTD_isError(zstd_rc))) {
+			const ZSTD_ErrorCode err = ZSTD_getErrorCode(zstd_rc);
+			*response = zstd_error2str(zstd_rc);
+			rc = err == ZSTD_error_memory_allocation
+					     ? DECODER_CALLBACK_MEMORY_ERROR
+					     : DECODER_CALLBACK_INVALID_REQUEST;
+			break;
+		}
+
+		if (in_pos == input.pos && out_pos == output.pos) {
+			break;
+		}
+
+		strm->frame_left = zstd_rc;
+	}
+
+	*in += input.pos;
+	*in_size -= input.pos;
+	*out_size = output.pos;
+	return rc;
+}
+
+static enum decoder_callback_err zstd_stream_end(void *vstrm,
+						  const char **response) {
+	const struct zstd_stream *strm = vstrm;
+	if (unlikely(strm->frame_left)) {
+		*response = "{\"error\":\"zstd error: body ends in the "
+			    "middle of a frame\"}";
+		return DECODER_CALLBACK_INVALID_REQUEST;
+	}
+
+	return DECODER_CALLBACK_OK;
+}
+
+static void zstd_stream_done(void *vstrm) {
+	struct zstd_stream *strm = vstrm;
+	ZSTD_freeDCtx(strm->dctx);
+	free(strm);
+}
+#endif // HAVE_ZSTD
+
+#ifdef HAVE_LZ4
+/*
+ * lz4 frame format decompressor
+ */
+
+static const char *lz4_error2str(size_t lz4_rc) {
+	(void)lz4_rc;
+	// Error codes enum is only exported for static linking
+	return "{\"error\":\"compressed input is not conforming to the lz4 "
+	       "frame format\"}";
+}
+
+/// lz4 decompression stream
+struct lz4_stream {
+	LZ4F_dctx *dctx;
+	/// Last LZ4F_decompress progress return. 0 means frame end.
+	size_t frame_left;
+};
+
+static void *lz4_stream_new(const void *dict, const char **error) {
+	(void)dict;
+	struct lz4_stream *strm = calloc(1, sizeof(*strm));
+	if (unlikely(NULL == strm)) {
+		*error = "{\"error\":\"Out of memory on lz4 init\"}";
+		rdlog(LOG_ERR, "Couldn't create lz4 stream (OOM?)");
+		return NULL;
+	}
+
+	const LZ4F_errorCode_t rc = LZ4F_createDecompressionContext(
+			&strm->dctx, LZ4F_VERSION);
+	if (unlikely(LZ4F_isError(rc))) {
+		*error = "{\"error\":\"Out of memory on lz4 init\"}";
+		rdlog(LOG_ERR,
+		      "Couldn't create lz4 context: %s",
+		      LZ4F_getErrorName(rc));
+		free(strm);
+		return NULL;
+	}
+
+	return strm;
+}
+
+static enum decoder_callback_err lz4_decompress(void *vstrm,
+						const char **in,
+						size_t *in_size,
+						char *out,
+						size_t *out_size,
+						const char **response) {
+	struct lz4_stream *strm = vstrm;
+	size_t produced = 0;
+
+	// Every call stops at frame end, continue with the next frame. Keep
+	// calling with no input too: context can hold output that did not fit
+	// in previous call buffer.
+	while (produced < *out_size) {
+		size_t src_size = *in_size, dst_size = *out_size - produced;
+		const size_t lz4_rc = LZ4F_decompress(strm->dctx,
+						      &out[produced],
+						      &dst_size,
+						      *in,
+						      &src_size,
+						      NULL);
+		if (unlikely(LZ4F_isError(lz4_rc))) {
+			*response = lz4_error2str(lz4_rc);
+			*out_size = produced;
+			return DECODER_CALLBACK_INVALID_REQUEST;
+		}
+
+		*in += src_size;
+		*in_size -= src_size;
+		produced += dst_size;
+		if (0 == src_size && 0 == dst_size) {
+			break;
+		}
+
+		strm->frame_left = lz4_rc;
+	}
+
+	*out_size = produced;
+	return DECODER_CALLBACK_OK;
+}
+
+static enum decoder_callback_err lz4_stream_end(void *vstrm,
+						 const char **response) {
+	const struct lz4_stream *strm = vstrm;
+	if (unlikely(strm->frame_left)) {
+		*response = "{\"error\":\"lz4 error: body ends in the "
+			    "middle of a frame\"}";
+		return DECODER_CALLBACK_INVALID_REQUEST;
+	}
+
+	return DECODER_CALLBACK_OK;
+}
+
+static void lz4_stream_done(void *vstrm) {
+	struct lz4_stream *strm = vstrm;
+	LZ4F_freeDecompressionContext(strm->dctx);
+	free(strm);
+}
+#endif // HAVE_LZ4
+
+#ifdef HAVE_BROTLI
+/*
+ * brotli decompressor
+ */
+
+/// Brotli allocation errors
+static bool brotli_memory_error(BrotliDecoderErrorCode brotli_rc) {
+	switch (brotli_rc) {
+	case BROTLI_DECODER_ERROR_ALLOC_CONTEXT_MODES:
+	case BROTLI_DECODER_ERROR_ALLOC_TREE_GROUPS:
+	case BROTLI_DECODER_ERROR_ALLOC_CONTEXT_MAP:
+	case BROTLI_DECODER_ERROR_ALLOC_RING_BUFFER_1:
+	case BROTLI_DECODER_ERROR_ALLOC_RING_BUFFER_2:
+	case BROTLI_DECODER_ERROR_ALLOC_BLOCK_TYPE_TREES:
+		return true;
+	default:
+		return false;
+	};
+}
+
+static const char *brotli_error2str(BrotliDecoderErrorCode brotli_rc) {
+	if (brotli_memory_error(brotli_rc)) {
+		return "{\"error\":\"Out of memory\"}";
+	}
+
+	switch (brotli_rc) {
+	case BROTLI_DECODER_ERROR_DICTIONARY_NOT_SET:
+		return "{\"error\":\"brotli error: a dictionary is need\"}";
+	default:
+		return "{\"error\":\"compressed input is not conforming to "
+		       "the brotli format\"}";
+	};
+}
+
+static void *brotli_stream_new(const void *dict, const char **error) {
+	(void)dict;
+	BrotliDecoderState *state =
+			BrotliDecoderCreateInstance(NULL, NULL, NULL);
+	if (unlikely(NULL == state)) {
+		*error = "{\"error\":\"Out of memory on brotli init\"}";
+		rdlog(LOG_ERR, "Couldn't create brotli decoder (OOM?)");
+	}
+
+	return state;
+}
+
+static enum decoder_callback_err brotli_decompress(void *state,
+						   const char **in,
+						   size_t *in_size,
+						   char *out,
+						   size_t *out_size,
+						   const char **response) {
+	const uint8_t *next_in = (const uint8_t *)*in;
+	uint8_t *next_out = (uint8_t *)out;
+	size_t avail_out = *out_size;
+
+	const BrotliDecoderResult result = BrotliDecoderDecompressStream(
+			state, in_size, &next_in, &avail_out, &next_out, NULL);
+
+	*in = (const char *)next_in;
+	*out_size -= avail_out;
+
+	if (unlikely(result == BROTLI_DECODER_RESULT_ERROR)) {
+		const BrotliDecoderErrorCode brotli_rc =
+				BrotliDecoderGetErrorCode(state);
+		*response = brotli_error2str(brotli_rc);
+		return brotli_memory_error(brotli_rc)
+			       ? DECODER_CALLBACK_MEMORY_ERROR
+			       : DECODER_CALLBACK_INVALID_REQUEST;
+	}
+
+	if (unlikely(result == BROTLI_DECODER_RESULT_SUCCESS &&
+		     *in_size > 0)) {
+		*response = "{\"error\":\"brotli error: data after stream "
+			    "end\"}";
+		return DECODER_CALLBACK_INVALID_REQUEST;
+	}
+
+	return DECODER_CALLBACK_OK;
+}
+
+static enum decoder_callback_err brotli_stream_end(void *state,
+						    const char **response) {
+	if (unlikely(BrotliDecoderIsUsed(state) &&
+		     !BrotliDecoderIsFinished(state))) {
+		*response = "{\"error\":\"brotli error: body ends in the "
+			    "middle of the stream\"}";
+		return DECODER_CALLBACK_INVALID_REQUEST;
+	}
+
+	return DECODER_CALLBACK_OK;
+}
+
+static void brotli_stream_done(void *state) {
+	BrotliDecoderDestroyInstance(state);
+}
+#endif // HAVE_BROTLI
+
+static const struct http_decompressor http_decompressors[] = {
+		{
+				.encoding = "gzip",
+				.stream_new = zlib_stream_new,
+				.decompress = zlib_decompress,
+				.stream_end = zlib_stream_end,
+				.stream_done = zlib_stream_done,
+		},
+		{
+				.encoding = "deflate",
+				.stream_new = zlib_stream_new,
+				.decompress = zlib_decompress,
+				.stream_end = zlib_stream_end,
+				.stream_done = zlib_stream_done,
+		},
+#ifdef HAVE_ZSTD
+		{
+				.encoding = "zstd",
+				.dict_new = zstd_dict_new,
+				.dict_done = zstd_dict_done,
+				.stream_new = zstd_stream_new,
+				.decompress = zstd_decompress,
+				.stream_end = zstd_stream_end,
+				.stream_done = zstd_stream_done,
+		},
+#endif
+#ifdef HAVE_LZ4
+		{
+				.encoding = "lz4",
+				.stream_new = lz4_stream_new,
+				.decompress = lz4_decompress,
+				.stream_end = lz4_stream_end,
+				.stream_done = lz4_stream_done,
+		},
+#endif
+#ifdef HAVE_BROTLI
+		{
+				.encoding = "br",
+				.stream_new = brotli_stream_new,
+				.decompress = brotli_decompress,
+				.stream_end = brotli_stream_end,
+				.stream_done = brotli_stream_done,
+		},
+#endif
+};
+
+const struct http_decompressor *http_decompressor_find(const char *encoding) {
+	size_t i;
+	for (i = 0; i < RD_ARRAYSIZE(http_decompressors); ++i) {
+		if (0 == strcasecmp(http_decompressors[i].encoding, encoding)) {
+			return &http_decompressors[i];
+		}
+	}
+
+	return NULL;
+}
+
+enum decoder_callback_err
+http_decompress_decode(const struct listener *l,
+		       const struct http_decompressor *codec,
+		       void *strm,
+		       const char *data,
+		       size_t size,
+		       const keyval_list_t *params,
+		       void *session,
+		       const char **response,
+		       size_t *response_size) {
+	static pthread_mutex_t last_warning_timestamp_mutex =
+			PTHREAD_MUTEX_INITIALIZER;
+	static time_t last_warning_timestamp = 0;
+	enum decoder_callback_err rc = DECODER_CALLBACK_OK;
+
+	struct pool_buffer *pool_buffer = inflate_pool_buffer_get();
+	if (unlikely(NULL == pool_buffer)) {
+		*response = "{\"error\":\"Out of memory\"}";
+		return DECODER_CALLBACK_MEMORY_ERROR;
+	}
+	char *buffer = pool_buffer_data(pool_buffer);
+
+	/* run decompressor until output buffer not full */
+	size_t zprocessed;
+	do {
+		zprocessed = INFLATE_POOL_BUFFER_SIZE;
+		rc = codec->decompress(strm,
+				       &data,
+				       &size,
+				       buffer,
+				       &zprocessed,
+				       response);
+		if (unlikely(rc != DECODER_CALLBACK_OK)) {
+			static const time_t threshold_s = 5 * 60;
+
+			pthread_mutex_lock(&last_warning_timestamp_mutex);
+			const time_t now = time(NULL);
+			const int warn = difftime(now, last_warning_timestamp) >
+					 threshold_s;
+			if (warn) {
+				last_warning_timestamp = now;
+			}
+			pthread_mutex_unlock(&last_warning_timestamp_mutex);
+
+			if (warn) {
+				rdlog(LOG_ERR,
+				      "Compressed %s error from client %s: %s",
+				      codec->encoding,
+				      valueof(params, "D-Client-IP", strcmp),
+				      *response);
+			}
+
+			break;
+		}
+
+		/// @TODO this should only in case of session decoder!
+		if (zprocessed) {
+			rc = listener_decode(l,
+					     buffer,
+					     zprocessed,
+					     params,
+					     response,
+					     response_size,
+					     session);
+
+			if (unlikely(rc != DECODER_CALLBACK_OK)) {
+				break;
+			}
+		}
+
+	} while (zprocessed == INFLATE_POOL_BUFFER_SIZE);
+
+	// Back to this thread pool, ready for the next chunk
+	pool_buffer_unref(pool_buffer);
+
+	return rc;
+}
@@ -0,0 +1,136 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "decoder/decoder_api.h"
+
+#include <stddef.h>
+
+struct listener;
+
+/*
+ * Streaming decompressors of HTTP request bodies, selected by
+ * Content-Encoding header.
+ */
+
+/// Streaming decompressor of a Content-Encoding
+struct http_decompressor {
+	/// Content-Encoding token, case insensitive
+	const char *encoding;
+
+	/**
+	 * @brief      Create a shared dictionary, if the decompressor supports
+	 *             them. Can be NULL.
+	 *
+	 * @param[in]  data  The dictionary content
+	 * @param[in]  size  The dictionary size
+	 *
+	 * @return     The dictionary, or NULL if error (error is logged)
+	 */
+	void *(*dict_new)(const char *data, size_t size);
+
+	/// Release a dictionary. Can't be in use by any stream.
+	void (*dict_done)(void *dict);
+
+	/**
+	 * @brief      Create a decompression stream for a new request body
+	 *
+	 * @param[in]  dict   The dictionary to use, if any. Needs to outlive
+	 *                    the stream.
+	 * @param      error  Error response if return is NULL
+	 *
+	 * @return     The stream, or NULL if error
+	 */
+	void *(*stream_new)(const void *dict, const char **error);
+
+	/**
+	 * @brief      Decompress as much input as output buffer allows
+	 *
+	 * @param      strm      The stream
+	 * @param      in        The input. Updated to point to the
+	 *                       non-consumed input.
+	 * @param      in_size   The input size. Updated to the non-consumed
+	 *                       input size.
+	 * @param      out       The output buffer
+	 * @param      out_size  The output buffer size. Updated to the produced
+	 *                       output size.
+	 * @param      response  Error response if return is not OK
+	 *
+	 * @return     DECODER_CALLBACK_OK, or error
+	 */
+	enum decoder_callback_err (*decompress)(void *strm,
+						const char **in,
+						size_t *in_size,
+						char *out,
+						size_t *out_size,
+						const char **response);
+
+	/**
+	 * @brief      Check that the body did not end in the middle of
+	 *             compressed data. An empty body is valid.
+	 *
+	 * @param      strm      The stream, with all body decompressed
+	 * @param      response  Error response if return is not OK
+	 *
+	 * @return     DECODER_CALLBACK_OK, or error
+	 */
+	enum decoder_callback_err (*stream_end)(void *strm,
+						const char **response);
+
+	/// Release a stream
+	void (*stream_done)(void *strm);
+};
+
+/**
+ * @brief      Look for the decompressor of a Content-Encoding
+ *
+ * @param[in]  encoding  The Content-Encoding header value
+ *
+ * @return     The decompressor, or NULL if not supported
+ */
+const struct http_decompressor *http_decompressor_find(const char *encoding);
+
+/**
+ * @brief      Decompress a request body chunk, and send decompressed data to
+ *             listener decoder as it is produced
+ *
+ * @param[in]  l              The listener
+ * @param[in]  codec          The request Content-Encoding decompressor
+ * @param      strm           The request decompression stream
+ * @param[in]  data           The body chunk
+ * @param[in]  size           The body chunk size
+ * @param[in]  params         The decoder parameters
+ * @param      session        The decoder session
+ * @param      response       The HTTP response, if error
+ * @param      response_size  The HTTP response size
+ *
+ * @return     DECODER_CALLBACK_OK, or decompressor or decoder error
+ */
+enum decoder_callback_err
+http_decompress_decode(const struct listener *l,
+		       const struct http_decompressor *codec,
+		       void *strm,
+		       const char *data,
+		       size_t size,
+		       const keyval_list_t *params,
+		       void *session,
+		       const char **response,
+		       size_t *response_size);
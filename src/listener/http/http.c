@@ -24,6 +24,7 @@
 
 #ifdef HAVE_LIBMICROHTTPD
 
+#include "decompressor.h"
 #include "http.h"
 #include "http_auth.h"
 #include "responses.h"
@@ -48,17 +49,11 @@
 
 #include <alloca.h>
 #include <assert.h>
-#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
-#include <time.h>
-#include <zlib.h>
-
-/// Chunk to store decompression flow
-#define ZLIB_CHUNK (512 * 1024)
 
 #define HTTP_UNUSED __attribute__((unused))
 
@@ -70,13 +65,13 @@ struct conn_info {
 	/// @todo no need for a linked list, it's better with a pair array
 	keyval_list_t decoder_params;
 
-	/// libz related
+	/// Compressed request body
 	struct {
-		/// Request has asked for compressed data
-		int enable;
-		/// zlib handler
-		z_stream strm;
-	} zlib;
+		/// Content-Encoding decompressor, NULL if not compressed
+		const struct http_decompressor *codec;
+		/// Decompression stream
+		void *strm;
+	} decompress;
 
 	/// pre-allocated session pointer.
 	void *decoder_sess;
@@ -127,6 +122,10 @@ static bool conn_info_has_queue_response(const struct conn_info *conn_info) {
 }
 
 static void free_con_info(struct conn_info *con_info) {
+	if (con_info->decompress.strm) {
+		con_info->decompress.codec->stream_done(
+				con_info->decompress.strm);
+	}
 	free(con_info->str.buf);
 	con_info->str.buf = NULL;
 	free(con_info);
@@ -156,10 +155,6 @@ static void request_completed(void *cls,
 		decoder->delete_session(con_info->decoder_sess);
 	}
 
-	if (con_info->zlib.enable) {
-		inflateEnd(&con_info->zlib.strm);
-	}
-
 	free_con_info(con_info);
 	*con_cls = NULL;
 }
@@ -177,10 +172,8 @@ static int connection_args_iterator(void *cls,
 		return MHD_YES; // Not interested in
 	}
 
-	if (value && 0 == strcasecmp("Content-Encoding", key) &&
-	    (0 == strcasecmp("deflate", value) ||
-	     (0 == strcasecmp("gzip", value)))) {
-		con_info->zlib.enable = 1;
+	if (value && 0 == strcasecmp("Content-Encoding", key)) {
+		con_info->decompress.codec = http_decompressor_find(value);
 	}
 
 	con_info->decoder_opts[i].key = key;
@@ -189,50 +182,6 @@ static int connection_args_iterator(void *cls,
 	return MHD_YES; // keep iterating
 }
 
-/**
- * @brief      Translate a zlib error code to a static human readable string
- *
- * @param[in]  z_status  zlib error
- *
- * @return     Static allocated human readable description
- */
-static const char *zlib_init_error2str(const int z_status) {
-	switch (z_status) {
-	case Z_MEM_ERROR:
-		return "{\"error\":\"Out of memory on zlib init\"}";
-	default:
-		// case Z_VERSION_ERROR:
-		// case Z_OK:
-		//
-		assert(0);
-		return "{\"error\":\"Unknown error\"}";
-	};
-}
-
-static const char *zlib_deflate_error2str(const int z_status) {
-	switch (z_status) {
-	// case Z_STREAM_ERROR:
-	//	return "Stream structure was inconsistent"
-	// case Z_OK:
-	// case Z_STREAM_END:
-	//	return "No error"
-	case Z_NEED_DICT:
-		return "{\"error\":\"libz deflate error: a dictionary is "
-		       "need\"}";
-	case Z_DATA_ERROR:
-		return "{\"error\":\"deflated input is not conforming to the "
-		       "zlib format\"}";
-	case Z_MEM_ERROR:
-		return "{\"error\":\"Out of memory\"}";
-
-	case Z_BUF_ERROR:
-		return "{\"error\":\"Is not possible to progress in input "
-		       "stream\"}";
-	default:
-		return "{\"error\":\"Unknown error\"}";
-	};
-}
-
 /// Save all decoder options in conn_info, or ask for size if !conn_info
 static size_t decoder_opts(struct MHD_Connection *connection,
 			   const char *http_method,
@@ -271,6 +220,7 @@ static size_t decoder_opts(struct MHD_Connection *connection,
 /**
  * @brief      Creates a connection information.
  *
+ * @param[in]  http_listener         The http listener
  * @param[in]  http_method           The http method
  * @param[in]  uri                   The http uri
  * @param[in]  client                The http client
@@ -281,16 +231,14 @@ static size_t decoder_opts(struct MHD_Connection *connection,
  * @return     connection information
  */
 static struct conn_info *
-create_connection_info(const char *http_method,
+create_connection_info(const struct http_listener *http_listener,
+		       const char *http_method,
 		       const char *uri,
 		       const char *client,
 		       const size_t decoder_session_size,
 		       struct MHD_Connection *connection,
 		       const char **error) {
 
-	static const int WINDOW_BITS = 15;
-	static const int ENABLE_ZLIB_GZIP = 32;
-
 	/* First call, creating all needed structs */
 	const size_t num_decoder_opts = decoder_opts(
 			connection, http_method, uri, client, NULL);
@@ -322,21 +270,18 @@ create_connection_info(const char *http_method,
 
 	string_init(&con_info->str);
 
-	if (con_info->zlib.enable) {
-		con_info->zlib.strm.zalloc = Z_NULL;
-		con_info->zlib.strm.zfree = Z_NULL;
-		con_info->zlib.strm.opaque = Z_NULL;
-		con_info->zlib.strm.avail_in = 0;
-		con_info->zlib.strm.next_in = Z_NULL;
-
-		const int rc = inflateInit2(&con_info->zlib.strm,
-					    WINDOW_BITS | ENABLE_ZLIB_GZIP);
-		if (rc != Z_OK) {
-			*error = zlib_init_error2str(rc);
-			rdlog(LOG_ERR,
-			      "Couldn't init inflate. Error was %d: %s",
-			      rc,
-			      *error);
+	const struct http_decompressor *codec = con_info->decompress.codec;
+	if (codec) {
+		con_info->decompress.strm = codec->stream_new(
+				http_listener_decompress_dict(http_listener,
+							      codec),
+				error);
+		if (unlikely(NULL == con_info->decompress.strm)) {
+			// Don't process the body, return the error at the end
+			conn_info_queue_response(con_info,
+						 MHD_HTTP_INTERNAL_SERVER_ERROR,
+						 *error,
+						 0);
 		}
 	}
 
@@ -398,107 +343,6 @@ static bool http_valid_client_certificate(struct MHD_Connection *connection,
 	return rc;
 }
 
-/**
- * @brief      Process compressed POST message
- *
- * @param      h_listener        The http listener
- * @param      con_info          The connection information
- * @param[in]  upload_data       The upload data
- * @param[in]  upload_data_size  The upload data size
- * @param      response          The HTTP response
- * @param      response_size     The HTTP response size
- *
- * @return     MHD_YES if all information was processed.
- */
-static enum decoder_callback_err
-compressed_callback(struct http_listener *h_listener,
-		    struct conn_info *con_info,
-		    const char *upload_data,
-		    size_t upload_data_size,
-		    const char **response,
-		    size_t *response_size) {
-	static pthread_mutex_t last_zlib_warning_timestamp_mutex =
-			PTHREAD_MUTEX_INITIALIZER;
-	time_t last_zlib_warning_timestamp = 0;
-	enum decoder_callback_err rc = DECODER_CALLBACK_OK;
-
-	con_info->zlib.strm.next_in = const_cast(upload_data);
-	con_info->zlib.strm.avail_in = upload_data_size;
-
-	unsigned char *buffer = malloc(ZLIB_CHUNK);
-
-	/* run inflate until output buffer not full */
-	do {
-		/* Reset counters */
-		con_info->zlib.strm.next_out = buffer;
-		con_info->zlib.strm.avail_out = ZLIB_CHUNK;
-
-		const int zret = inflate(
-				&con_info->zlib.strm,
-				Z_NO_FLUSH /* TODO compare different flush */);
-		if (unlikely(zret != Z_OK && zret != Z_STREAM_END)) {
-			static const time_t threshold_s = 5 * 60;
-			// Simulate decoder error
-			switch (zret) {
-			case Z_NEED_DICT:
-			case Z_DATA_ERROR:
-				rc = DECODER_CALLBACK_INVALID_REQUEST;
-				break;
-			default:
-				rc = DECODER_CALLBACK_GENERIC_ERROR;
-				break;
-			}
-			*response = zlib_deflate_error2str(zret);
-
-			pthread_mutex_lock(&last_zlib_warning_timestamp_mutex);
-			const time_t now = time(NULL);
-			const int warn = difftime(now,
-						  last_zlib_warning_timestamp) >
-					 threshold_s;
-			pthread_mutex_unlock(
-					&last_zlib_warning_timestamp_mutex);
-
-			if (warn) {
-				const char *client_ip =
-						con_info->decoder_opts[0].value;
-				rdlog(LOG_ERR,
-				      "Compressed error %d from client %s: %s",
-				      zret,
-				      client_ip,
-				      *response);
-			}
-
-			break;
-		}
-
-		const size_t zprocessed =
-				ZLIB_CHUNK - con_info->zlib.strm.avail_out;
-
-		/// @TODO this should only in case of session decoder!
-		if (zprocessed) {
-			rc = listener_decode(
-					http_listener_cast_listener(h_listener),
-					(char *)buffer,
-					zprocessed,
-					&con_info->decoder_params,
-					response,
-					response_size,
-					con_info->decoder_sess);
-
-			if (unlikely(rc != DECODER_CALLBACK_OK)) {
-				break;
-			}
-		}
-
-	} while (con_info->zlib.strm.avail_out == 0);
-
-	/* Do not want to waste memory */
-	free(buffer);
-	con_info->zlib.strm.next_out = NULL;
-
-	return rc;
-}
-
 /** Initialize an HTTP connection and decoder session
   @param http_listener Used listener
   @param connection MHD connection
@@ -552,7 +396,8 @@ static int handle_http_post_init(struct http_listener *http_listener,
 			decoder->session_size ? decoder->session_size() : 0;
 
 	const char *create_error = NULL;
-	*ptr = create_connection_info(method,
+	*ptr = create_connection_info(http_listener,
+				      method,
 				      url,
 				      client,
 				      decoder_session_size,
@@ -583,42 +428,6 @@ static int handle_http_post_init(struct http_listener *http_listener,
 	return (NULL == *ptr) ? MHD_NO : MHD_YES;
 }
 
-/**
- * @brief      Transform decoder error code to http code.
- *
- * @param[in]  decode_rc  The decoder return code
- *
- * @return     HTTP response code
- */
-static unsigned int decoder_err2http(enum decoder_callback_err decode_rc) {
-	switch (decode_rc) {
-	case DECODER_CALLBACK_OK:
-		return MHD_HTTP_OK;
-	case DECODER_CALLBACK_BUFFER_FULL:
-		return MHD_HTTP_SERVICE_UNAVAILABLE;
-
-	// Client side errors
-	case DECODER_CALLBACK_INVALID_REQUEST:
-	case DECODER_CALLBACK_UNKNOWN_TOPIC:
-	case DECODER_CALLBACK_UNKNOWN_PARTITION:
-		return MHD_HTTP_BAD_REQUEST;
-
-	// Kafka errors - Client side
-	case DECODER_CALLBACK_MSG_TOO_LARGE:
-		return MHD_HTTP_PAYLOAD_TOO_LARGE;
-
-	// HTTP errors
-	case DECODER_CALLBACK_HTTP_METHOD_NOT_ALLOWED:
-		return MHD_HTTP_METHOD_NOT_ALLOWED;
-	case DECODER_CALLBACK_RESOURCE_NOT_FOUND:
-		return MHD_HTTP_NOT_FOUND;
-	case DECODER_CALLBACK_MEMORY_ERROR:
-	case DECODER_CALLBACK_GENERIC_ERROR:
-	default:
-		return MHD_HTTP_INTERNAL_SERVER_ERROR;
-	};
-}
-
 /** Handle a sent chunk
 
  @param      http_listener     n2k HTTP listener
@@ -645,19 +454,32 @@ static int handle_http_post_chunk(struct http_listener *http_listener,
 	if (!decoder->new_session) {
 		// Does not support stream, we need to allocate
 		// a big buffer and send all the data together
+		if (unlikely(con_info->str.size + *upload_data_size >
+			     http_listener_max_body_size(http_listener))) {
+			conn_info_queue_response(con_info,
+						 MHD_HTTP_PAYLOAD_TOO_LARGE,
+						 NULL,
+						 0);
+			goto err;
+		}
+
 		const int append_rc = string_append(
 				&con_info->str, upload_data, *upload_data_size);
 		decode_rc = (0 == append_rc) ? DECODER_CALLBACK_OK
 					     : DECODER_CALLBACK_MEMORY_ERROR;
-	} else if (con_info->zlib.enable) {
+	} else if (con_info->decompress.codec) {
 		// Does support streaming, we will decompress &  process until
 		// end of received chunk
-		decode_rc = compressed_callback(http_listener,
-						con_info,
-						upload_data,
-						*upload_data_size,
-						&response,
-						&response_size);
+		decode_rc = http_decompress_decode(
+				http_listener_cast_listener(http_listener),
+				con_info->decompress.codec,
+				con_info->decompress.strm,
+				upload_data,
+				*upload_data_size,
+				&con_info->decoder_params,
+				con_info->decoder_sess,
+				&response,
+				&response_size);
 	} else {
 		// Does support streaming processing, sending the chunk
 		decode_rc = listener_decode(
@@ -721,6 +543,20 @@ static int handle_post_end(const struct http_listener *http_listener,
 				NULL,
 				NULL,
 				NULL);
+	} else if (con_info->decompress.strm) {
+		const char *response = NULL;
+		const enum decoder_callback_err decode_rc =
+				con_info->decompress.codec->stream_end(
+						con_info->decompress.strm,
+						&response);
+		if (unlikely(decode_rc != DECODER_CALLBACK_OK)) {
+			return send_buffered_response(
+					connection,
+					strlen(response),
+					const_cast(response),
+					MHD_RESPMEM_PERSISTENT,
+					decoder_err2http(decode_rc));
+		}
 	}
 
 	send_http_ok(connection);
@@ -24,14 +24,19 @@
 
 #ifdef HAVE_LIBMICROHTTPD
 
+#include "decompressor.h"
 #include "http_auth.h"
 #include "http_config.h"
+#include "http_native.h"
 #include "responses.h"
 
+#include "engine/global_config.h"
 #include "listener/listener_api.h"
 
+#include "util/cpu_affinity.h"
 #include "util/file.h"
 #include "util/n2k_config_x.h"
+#include "util/unix_socket.h"
 #include "util/util.h"
 
 #include <jansson.h>
@@ -44,10 +49,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <syslog.h>
 #include <unistd.h>
@@ -57,6 +64,9 @@
 #define MODE_POLL "poll"
 #define MODE_EPOLL "epoll"
 
+#define ENGINE_LIBMICROHTTPD "libmicrohttpd"
+#define ENGINE_NATIVE "native"
+
 /// Per listener stuff
 struct http_listener {
 	// Note: This MUST be the first member!
@@ -67,8 +77,16 @@ struct http_listener {
 #endif
 	size_t tls_data_size;
 	struct MHD_Daemon *d; ///< Associated daemon
+	struct http_native *native; ///< Native engine, used instead of daemon
+	char *unix_path;      ///< Unix socket path, if listening in one
+	/// Shared decompression dictionary
+	struct {
+		const struct http_decompressor *codec; ///< Dictionary codec
+		void *dict;			       ///< Dictionary
+	} decompress;
 	char *htpasswd;
 	bool client_tls_cert;
+	size_t max_body_size; ///< Max body of decoders that don't stream
 	char tls_data[];
 };
 
@@ -93,6 +111,66 @@ const char *http_listener_htpasswd(const struct http_listener *l) {
 	return l->htpasswd;
 }
 
+size_t http_listener_max_body_size(const struct http_listener *l) {
+	return l->max_body_size;
+}
+
+const void *
+http_listener_decompress_dict(const struct http_listener *l,
+			      const struct http_decompressor *codec) {
+	return codec == l->decompress.codec ? l->decompress.dict : NULL;
+}
+
+/**
+ * @brief      Load a shared decompression dictionary in listener
+ *
+ * @param      l         The listener
+ * @param[in]  encoding  The dictionary Content-Encoding
+ * @param[in]  filename  The dictionary file
+ *
+ * @return     0 if success, !0 in other case (error is logged)
+ */
+static int http_listener_decompress_dict_load(struct http_listener *l,
+					      const char *encoding,
+					      const char *filename) {
+	const struct http_decompressor *codec =
+			http_decompressor_find(encoding);
+	if (NULL == codec || NULL == codec->dict_new) {
+		rdlog(LOG_ERR,
+		      "n2kafka built without %s dictionaries support",
+		      encoding);
+		return -1;
+	}
+
+	int dict_size = 0;
+	char *dict_data = rd_file_read(filename, &dict_size);
+	if (NULL == dict_data) {
+		rdlog(LOG_ERR,
+		      "Can't read %s dictionary %s: %s",
+		      encoding,
+		      filename,
+		      gnu_strerror_r(errno));
+		return -1;
+	}
+
+	// Dictionary keeps its own copy
+	l->decompress.dict = codec->dict_new(dict_data, (size_t)dict_size);
+	free(dict_data);
+	if (NULL == l->decompress.dict) {
+		return -1;
+	}
+
+	l->decompress.codec = codec;
+	return 0;
+}
+
+/// Release listener shared decompression dictionary, if any
+static void http_listener_decompress_dict_done(struct http_listener *l) {
+	if (l->decompress.dict) {
+		l->decompress.codec->dict_done(l->decompress.dict);
+	}
+}
+
 /**
  * @brief      Wrapper for htpassword database size
  *
@@ -154,7 +232,15 @@ static const char *string_identity_function(const char *a) {
 // str_to_value_function, default)
 #define X_HTTP_CONFIG(X)                                                       \
 	/* HTTP server port */                                                 \
-	X(int, ":i", port, port, NULL, atoi, 0)                                \
+	X(int, "?i", port, port, NULL, atoi, 0)                                \
+	/* HTTP server unix socket path, instead of port */                    \
+	X(const char *,                                                        \
+	  "?s",                                                                \
+	  path,                                                                \
+	  path,                                                                \
+	  NULL,                                                                \
+	  string_identity_function,                                            \
+	  NULL)                                                                \
 	/* HTTP server number of polling threads */                            \
 	X(int, "?i", num_threads, num_threads, NULL, atoi, 1)                  \
 	/* Per connection memory limit */                                      \
@@ -165,6 +251,14 @@ static const char *string_identity_function(const char *a) {
 	  NULL,                                                                \
 	  atoi,                                                                \
 	  (128 * 1024))                                                        \
+	/* Max request body size buffered for decoders that don't stream */    \
+	X(int,                                                                 \
+	  "?i",                                                                \
+	  max_body_size,                                                       \
+	  max_body_size,                                                       \
+	  NULL,                                                                \
+	  atoi,                                                                \
+	  (16 * 1024 * 1024))                                                  \
 	/* Connections limit */                                                \
 	X(int, "?i", connection_limit, connection_limit, NULL, atoi, 1024)     \
 	/* Timeout to drop a connection */                                     \
@@ -186,6 +280,14 @@ static const char *string_identity_function(const char *a) {
 	  NULL,                                                                \
 	  string_identity_function,                                            \
 	  "poll")                                                              \
+	/* HTTP engine: libmicrohttpd (default), native */                     \
+	X(const char *,                                                        \
+	  "?s",                                                                \
+	  engine,                                                              \
+	  engine,                                                              \
+	  NULL,                                                                \
+	  string_identity_function,                                            \
+	  ENGINE_LIBMICROHTTPD)                                                \
 	/* Server TLS key filename */                                          \
 	X(const char *,                                                        \
 	  "?s",                                                                \
@@ -225,6 +327,48 @@ static const char *string_identity_function(const char *a) {
 	  htpasswd_filename,                                                   \
 	  "HTTP_HTPASSWD_FILE",                                                \
 	  string_identity_function,                                            \
+	  NULL)                                                                \
+	/* HTTP threads CPU list */                                            \
+	X(const char *,                                                        \
+	  "?s",                                                                \
+	  cpu_affinity,                                                        \
+	  cpu_affinity,                                                        \
+	  NULL,                                                                \
+	  string_identity_function,                                            \
+	  NULL)                                                                \
+	/* HTTP threads memory NUMA node */                                    \
+	X(int, "?i", numa_node, numa_node, NULL, atoi, -1)                     \
+	/* Native engine HTTP/2 max concurrent streams per connection */       \
+	X(int,                                                                 \
+	  "?i",                                                                \
+	  http2_max_concurrent_streams,                                        \
+	  http2_max_concurrent_streams,                                        \
+	  NULL,                                                                \
+	  atoi,                                                                \
+	  100)                                                                 \
+	/* Kafka queue messages that stop HTTP/2 streams window updates */     \
+	X(int,                                                                 \
+	  "?i",                                                                \
+	  backpressure_high_watermark,                                         \
+	  backpressure_high_watermark,                                         \
+	  NULL,                                                                \
+	  atoi,                                                                \
+	  0)                                                                   \
+	/* Kafka queue messages that resume HTTP/2 streams window updates */   \
+	X(int,                                                                 \
+	  "?i",                                                                \
+	  backpressure_low_watermark,                                          \
+	  backpressure_low_watermark,                                          \
+	  NULL,                                                                \
+	  atoi,                                                                \
+	  -1)                                                                  \
+	/* zstd shared dictionary file */                                      \
+	X(const char *,                                                        \
+	  "?s",                                                                \
+	  zstd_dictionary,                                                     \
+	  zstd_dictionary,                                                     \
+	  NULL,                                                                \
+	  string_identity_function,                                            \
 	  NULL)
 
 /**
@@ -246,8 +390,17 @@ static void break_http_loop(struct listener *vhttp_listener) {
 #ifdef HTTP_PRIVATE_MAGIC
 	assert(HTTP_PRIVATE_MAGIC == http_listener->magic);
 #endif
-	MHD_stop_daemon(http_listener->d);
+	if (http_listener->native) {
+		http_native_stop(http_listener->native);
+	} else {
+		MHD_stop_daemon(http_listener->d);
+	}
 	listener_join(&http_listener->listener);
+	http_listener_decompress_dict_done(http_listener);
+	if (http_listener->unix_path) {
+		unix_socket_unlink(http_listener->unix_path);
+		free(http_listener->unix_path);
+	}
 	if (http_listener->tls_data_size > 0) {
 		http_listener_scrub_tls_data(http_listener);
 		munlock(http_listener->tls_data, http_listener->tls_data_size);
@@ -257,10 +410,139 @@ static void break_http_loop(struct listener *vhttp_listener) {
 	responses_listener_counter_decref();
 }
 
+/**
+ * @brief      Reject connections of clients not allowed by global blacklist
+ *             and allowlist
+ *
+ * @param      cls      Unused
+ * @param[in]  addr     The client address
+ * @param[in]  addrlen  The client address length
+ *
+ * @return     MHD_YES if client is allowed, MHD_NO otherwise
+ */
+static int
+http_accept_policy(void *cls, const struct sockaddr *addr, socklen_t addrlen) {
+	(void)cls;
+	(void)addrlen;
+	return client_addr_allowed(addr) ? MHD_YES : MHD_NO;
+}
+
+/**
+ * @brief      Start the libmicrohttpd daemon of a HTTP listener
+ *
+ * @param[in]  args            The listener arguments
+ * @param[in]  flags           The daemon flags
+ * @param[in]  listen_fd       The listen socket, or MHD_INVALID_SOCKET
+ * @param[in]  affinity        The HTTP threads placement
+ * @param[in]  http_callbacks  The http callbacks
+ * @param      http_listener   The http listener
+ * @param      tls_key         The TLS key, if MHD_USE_TLS
+ * @param      tls_cert        The TLS certificate, if MHD_USE_TLS
+ * @param      tls_client_ca   The TLS clients CA, or NULL
+ *
+ * @return     The daemon, or NULL if error
+ */
+static struct MHD_Daemon *
+start_http_daemon(const struct http_loop_args *args,
+		  unsigned int flags,
+		  MHD_socket listen_fd,
+		  const struct cpu_affinity *affinity,
+		  const struct http_callbacks *http_callbacks,
+		  struct http_listener *http_listener,
+		  char *tls_key,
+		  char *tls_cert,
+		  char *tls_client_ca) {
+	const struct MHD_OptionItem opts[] = {
+			{MHD_OPTION_NOTIFY_COMPLETED,
+			 (intptr_t)http_callbacks->request_completed,
+			 http_listener},
+
+			/* Digest-Authentication related. Setting to 0
+			   saves some memory */
+			{MHD_OPTION_NONCE_NC_SIZE, 0, NULL},
+
+			/* Max number of concurrent onnections */
+			{MHD_OPTION_CONNECTION_LIMIT,
+			 args->connection_limit,
+			 NULL},
+
+			/* Max number of connections per IP */
+			{MHD_OPTION_PER_IP_CONNECTION_LIMIT,
+			 args->per_ip_connection_limit,
+			 NULL},
+
+			/* Connection timeout */
+			{MHD_OPTION_CONNECTION_TIMEOUT,
+			 args->connection_timeout,
+			 NULL},
+
+			/* Memory limit per connection */
+			{MHD_OPTION_CONNECTION_MEMORY_LIMIT,
+			 args->connection_memory_limit,
+			 NULL},
+
+			/* Thread pool size */
+			{MHD_OPTION_THREAD_POOL_SIZE, args->num_threads, NULL},
+
+			/* Unix socket, if any. Daemon closes it at stop */
+			{MHD_OPTION_LISTEN_SOCKET, listen_fd, NULL},
+
+			/* Finish options OR https tls options */
+			{flags & MHD_USE_TLS ? MHD_OPTION_HTTPS_MEM_KEY
+					     : MHD_OPTION_END,
+			 0,
+			 tls_key},
+			{MHD_OPTION_HTTPS_MEM_CERT, 0, tls_cert},
+			{MHD_OPTION_HTTPS_KEY_PASSWORD,
+			 0,
+			 const_cast(args->https_key_password)},
+
+			/* Finish options OR HTTPS client CA */
+			{tls_client_ca ? MHD_OPTION_HTTPS_MEM_TRUST
+				       : MHD_OPTION_END,
+			 0,
+			 tls_client_ca},
+
+			{MHD_OPTION_END, 0, NULL}};
+
+	// libmicrohttpd threads inherit the placement of the thread that
+	// creates them, so pin this one while starting the daemon
+	struct cpu_affinity_saved saved_affinity;
+	const bool pin = cpu_affinity_enabled(affinity) &&
+			 0 == cpu_affinity_save(&saved_affinity);
+	if (pin) {
+		cpu_affinity_apply(affinity,
+				   http_listener->listener.port,
+				   "HTTP",
+				   CPU_AFFINITY_ALL);
+	}
+
+	struct MHD_Daemon *d = MHD_start_daemon(
+			flags,
+			args->port,
+			http_accept_policy, /* Accept policy callback */
+			NULL, /* Accept policy callback parameter */
+			http_callbacks->handle_request, /* Request
+							   handler
+							 */
+			http_listener,			/* Request handler
+							   parameter */
+			MHD_OPTION_ARRAY,
+			opts,
+			MHD_OPTION_END);
+
+	if (pin) {
+		cpu_affinity_restore(&saved_affinity);
+	}
+
+	return d;
+}
+
 /**
  * @brief      Start a http server
  *
  * @param[in]  args            The arguments
+ * @param[in]  affinity        The HTTP threads placement
  * @param[in]  http_callbacks  The http callbacks
  * @param[in]  decoder         The decoder
  * @param[in]  decoder_conf    The decoder config
@@ -269,6 +551,7 @@ static void break_http_loop(struct listener *vhttp_listener) {
  */
 static struct http_listener *
 start_http_loop(const struct http_loop_args *args,
+		const struct cpu_affinity *affinity,
 		const struct http_callbacks *http_callbacks,
 		const struct n2k_decoder *decoder,
 		const json_t *decoder_conf) {
@@ -343,6 +626,27 @@ start_http_loop(const struct http_loop_args *args,
 
 	flags |= MHD_USE_DEBUG;
 
+	const bool native = args->engine &&
+			    0 == strcmp(ENGINE_NATIVE, args->engine);
+	if (!native && args->engine &&
+	    0 != strcmp(ENGINE_LIBMICROHTTPD, args->engine)) {
+		rdlog(LOG_ERR,
+		      "Not a valid HTTP engine. Select one "
+		      "between(" ENGINE_LIBMICROHTTPD "," ENGINE_NATIVE ")");
+		return NULL;
+	}
+
+	if (native && (args->num_threads <= 0 ||
+		       args->connection_memory_limit <= 0 ||
+		       args->connection_limit < 0 ||
+		       args->per_ip_connection_limit < 0)) {
+		rdlog(LOG_ERR,
+		      "HTTP " ENGINE_NATIVE " engine needs positive "
+		      "num_threads and connection_memory_limit, and "
+		      "non-negative connection limits");
+		return NULL;
+	}
+
 	if (unlikely(!(args->https_key_filename) !=
 		     !(args->https_cert_filename))) {
 		// User set only one of the two
@@ -368,6 +672,17 @@ start_http_loop(const struct http_loop_args *args,
 		return NULL;
 	}
 
+	if (args->max_body_size <= 0) {
+		rdlog(LOG_ERR, "HTTP max body size has to be > 0");
+		return NULL;
+	}
+
+	if (native && args->http2_max_concurrent_streams <= 0) {
+		rdlog(LOG_ERR,
+		      "HTTP/2 max concurrent streams has to be > 0");
+		return NULL;
+	}
+
 	if (args->https_key_filename) {
 		flags |= MHD_USE_TLS;
 	}
@@ -516,6 +831,13 @@ start_http_loop(const struct http_loop_args *args,
 	if (args->htpasswd_filename) {
 		http_listener->htpasswd = secret_files[HTPASSWD].mem;
 	}
+	http_listener->max_body_size = (size_t)args->max_body_size;
+
+	if (args->zstd_dictionary &&
+	    0 != http_listener_decompress_dict_load(
+			    http_listener, "zstd", args->zstd_dictionary)) {
+		goto listener_init_err;
+	}
 
 	const int listener_init_rc = listener_init(&http_listener->listener,
 						   args->port,
@@ -530,79 +852,72 @@ start_http_loop(const struct http_loop_args *args,
 	http_listener->magic = HTTP_PRIVATE_MAGIC;
 #endif
 
-	responses_listener_counter_incref();
-	const struct MHD_OptionItem opts[] = {
-			{MHD_OPTION_NOTIFY_COMPLETED,
-			 (intptr_t)http_callbacks->request_completed,
-			 http_listener},
-
-			/* Digest-Authentication related. Setting to 0
-			   saves some memory */
-			{MHD_OPTION_NONCE_NC_SIZE, 0, NULL},
-
-			/* Max number of concurrent onnections */
-			{MHD_OPTION_CONNECTION_LIMIT,
-			 args->connection_limit,
-			 NULL},
-
-			/* Max number of connections per IP */
-			{MHD_OPTION_PER_IP_CONNECTION_LIMIT,
-			 args->per_ip_connection_limit,
-			 NULL},
-
-			/* Connection timeout */
-			{MHD_OPTION_CONNECTION_TIMEOUT,
-			 args->connection_timeout,
-			 NULL},
-
-			/* Memory limit per connection */
-			{MHD_OPTION_CONNECTION_MEMORY_LIMIT,
-			 args->connection_memory_limit,
-			 NULL},
-
-			/* Thread pool size */
-			{MHD_OPTION_THREAD_POOL_SIZE, args->num_threads, NULL},
-
-			/* Finish options OR https tls options */
-			{flags & MHD_USE_TLS ? MHD_OPTION_HTTPS_MEM_KEY
-					     : MHD_OPTION_END,
-			 0,
-			 secret_files[KEY_FILE].mem},
-			{MHD_OPTION_HTTPS_MEM_CERT,
-			 0,
-			 secret_files[CERT_FILE].mem},
-			{MHD_OPTION_HTTPS_KEY_PASSWORD,
-			 0,
-			 const_cast(args->https_key_password)},
-
-			/* Finish options OR HTTPS client CA */
-			{secret_files[CLIENT_CA_TRUST].filename
-					 ? MHD_OPTION_HTTPS_MEM_TRUST
-					 : MHD_OPTION_END,
-			 0,
-			 secret_files[CLIENT_CA_TRUST].mem},
-
-			{MHD_OPTION_END, 0, NULL}};
+	// libmicrohttpd creates its own socket if we do not provide it one
+	MHD_socket listen_fd = MHD_INVALID_SOCKET;
+	if (args->path) {
+		http_listener->unix_path = strdup(args->path);
+		if (NULL == http_listener->unix_path) {
+			rdlog(LOG_ERR, "Can't strdup HTTP unix path (OOM?)");
+			goto unix_socket_err;
+		}
 
-	http_listener->d = MHD_start_daemon(
-			flags,
-			args->port,
-			NULL, /* Auth callback */
-			NULL, /* Auth callback parameter */
-			http_callbacks->handle_request, /* Request
-							   handler
-							 */
-			http_listener,			/* Request handler
-							   parameter */
-			MHD_OPTION_ARRAY,
-			opts,
-			MHD_OPTION_END);
+		listen_fd = unix_socket_listen(args->path, SOCK_STREAM);
+		if (listen_fd < 0) {
+			goto unix_socket_err;
+		}
+	}
 
-	if (NULL == http_listener->d) {
-		rdlog(LOG_ERR,
-		      "Can't allocate LIBMICROHTTPD handler"
-		      " (out of memory?)");
-		goto start_daemon_err;
+	responses_listener_counter_incref();
+	if (native) {
+		// Validated before
+		const int buffer_size = args->connection_memory_limit;
+		const int per_ip_limit = args->per_ip_connection_limit;
+		const int max_streams = args->http2_max_concurrent_streams;
+		const int high_watermark = args->backpressure_high_watermark;
+		const int low_watermark = args->backpressure_low_watermark;
+		const struct http_native_config native_config = {
+				.port = (uint16_t)args->port,
+				.listenfd = listen_fd,
+				.num_threads = (size_t)args->num_threads,
+				.buffer_size = (size_t)buffer_size,
+				.connection_limit =
+						(size_t)args->connection_limit,
+				.per_ip_connection_limit = (size_t)per_ip_limit,
+				.connection_timeout = args->connection_timeout,
+				.tls.key = secret_files[KEY_FILE].mem,
+				.tls.key_password = args->https_key_password,
+				.tls.cert = secret_files[CERT_FILE].mem,
+				.tls.client_ca = secret_files[CLIENT_CA_TRUST]
+								 .mem,
+				.http2.max_streams = (size_t)max_streams,
+				.http2.high_watermark = (size_t)high_watermark,
+				.http2.low_watermark = (size_t)low_watermark,
+		};
+		http_listener->native = http_native_start(
+				http_listener, &native_config, affinity);
+		if (NULL == http_listener->native) {
+			goto start_daemon_err;
+		}
+	} else {
+		char *client_ca = secret_files[CLIENT_CA_TRUST].filename
+					  ? secret_files[CLIENT_CA_TRUST].mem
+					  : NULL;
+		http_listener->d = start_http_daemon(
+				args,
+				flags,
+				listen_fd,
+				affinity,
+				http_callbacks,
+				http_listener,
+				secret_files[KEY_FILE].mem,
+				secret_files[CERT_FILE].mem,
+				client_ca);
+		if (NULL == http_listener->d) {
+			rdlog(LOG_ERR,
+			      "Can't allocate LIBMICROHTTPD handler"
+			      " (out of memory?)");
+			goto start_daemon_err;
+		}
 	}
 
 	http_listener->listener.join = break_http_loop;
@@ -618,9 +933,16 @@ tls_err:
 
 start_daemon_err:
 	responses_listener_counter_decref();
+	if (http_listener->unix_path) {
+		unix_socket_unlink(http_listener->unix_path);
+	}
+
+unix_socket_err:
+	free(http_listener->unix_path);
 	http_listener->listener.join(&http_listener->listener);
 
 listener_init_err:
+	http_listener_decompress_dict_done(http_listener);
 	// Volatile avoid write-before-free optimization!
 	if (http_listener->tls_data_size > 0) {
 		http_listener_scrub_tls_data(http_listener);
@@ -672,16 +994,55 @@ struct listener *create_http_listener0(const struct http_callbacks *callbacks,
 		handler_args.https_key_password = key_password;
 	}
 
+	if (NULL == handler_args.path &&
+	    (handler_args.port <= 0 || handler_args.port > UINT16_MAX)) {
+		rdlog(LOG_ERR, "HTTP listener needs a valid port or path");
+		goto err;
+	}
+
+	int *high_watermark = &handler_args.backpressure_high_watermark;
+	int *low_watermark = &handler_args.backpressure_low_watermark;
+	if (*high_watermark < 0) {
+		rdlog(LOG_ERR,
+		      "Backpressure high watermark has to be >= 0. "
+		      "Disabling backpressure");
+		*high_watermark = 0;
+	}
+
+	if (*low_watermark < 0 || *low_watermark > *high_watermark) {
+		if (*low_watermark > *high_watermark) {
+			rdlog(LOG_ERR,
+			      "Backpressure low watermark has to be <= high "
+			      "watermark. Setting to %d",
+			      *high_watermark / 2);
+		}
+		*low_watermark = *high_watermark / 2;
+	}
+
+	struct cpu_affinity affinity;
+	if (0 != cpu_affinity_init(&affinity,
+				   handler_args.cpu_affinity,
+				   handler_args.numa_node)) {
+		rdlog(LOG_ERR, "Invalid HTTP listener CPU affinity");
+		goto err;
+	}
+
 	http_listener = start_http_loop(
-			&handler_args, callbacks, decoder, config);
+			&handler_args, &affinity, callbacks, decoder, config);
 	if (NULL == http_listener) {
 		rdlog(LOG_ERR, "Can't create http listener (out of memory?)");
 		goto err;
 	}
 
-	rdlog(LOG_INFO,
-	      "Creating new HTTP listener on port %d",
-	      handler_args.port);
+	if (handler_args.path) {
+		rdlog(LOG_INFO,
+		      "Creating new HTTP listener on path %s",
+		      handler_args.path);
+	} else {
+		rdlog(LOG_INFO,
+		      "Creating new HTTP listener on port %d",
+		      handler_args.port);
+	}
 
 err:
 	json_decref(config);
@@ -33,6 +33,7 @@
 
 struct n2k_decoder;
 struct json_t;
+struct http_decompressor;
 
 /// Per listener stuff
 struct http_listener;
@@ -66,6 +67,28 @@ struct http_listener *http_listener_cast(void *vhttp_listener);
  */
 const char *http_listener_htpasswd(const struct http_listener *listener);
 
+/**
+ * @brief      Return the max request body size the listener buffers for
+ *             decoders that don't stream
+ *
+ * @param[in]  listener  The listener
+ *
+ * @return     Max body size, in bytes
+ */
+size_t http_listener_max_body_size(const struct http_listener *listener);
+
+/**
+ * @brief      Return the listener shared dictionary of a decompressor
+ *
+ * @param[in]  listener  The listener
+ * @param[in]  codec     The decompressor
+ *
+ * @return     The dictionary, or NULL if listener has not one for codec
+ */
+const void *
+http_listener_decompress_dict(const struct http_listener *listener,
+			      const struct http_decompressor *codec);
+
 /**
  * @brief      Returns the http decoder name
  *
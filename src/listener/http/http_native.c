@@ -0,0 +1,3170 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "http_native.h"
+
+#ifdef HAVE_LIBMICROHTTPD
+
+#include "decompressor.h"
+#include "http_auth.h"
+#include "http_config.h"
+#include "responses.h"
+#include "tls.h"
+
+#include "engine/global_config.h"
+#include "engine/rb_addr.h"
+#include "listener/listener_api.h"
+#include "util/addr_count.h"
+#include "util/buffer_pool.h"
+#include "util/cpu_affinity.h"
+#include "util/kafka.h"
+#include "util/pair.h"
+#include "util/slab.h"
+#include "util/timer_wheel.h"
+#include "util/util.h"
+
+#include <ev.h>
+#include <gnutls/gnutls.h>
+#include <librd/rdlog.h>
+#include <microhttpd.h>
+#ifdef HAVE_NGHTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+/// Max number of headers of a request
+#define HTTP_NATIVE_MAX_HEADERS 64
+/// Properties added by listener to request headers
+#define HTTP_NATIVE_LISTENER_PROPS 3
+/// Connection output buffer size
+#define HTTP_NATIVE_OUTPUT_SIZE 4096
+/// Max response body size, so a response always fits in output buffer
+#define HTTP_NATIVE_MAX_RESPONSE_BODY 2048
+/// Max length of a chunk size line, including extensions
+#define HTTP_NATIVE_MAX_CHUNK_LINE 1024
+/// Max size of decoded Basic authorization credentials
+#define HTTP_NATIVE_MAX_CREDENTIALS 1024
+/// Max accepted connections per accept event
+#define HTTP_NATIVE_MAX_ACCEPTS_PER_EVENT 64
+/// Max reads per connection read event, so no connection starves the rest
+#define HTTP_NATIVE_MAX_READS_PER_EVENT 16
+/// Free receive buffers kept by every worker pool
+#define HTTP_NATIVE_BUFFER_POOL_MAX_FREE 64
+/// Connections allocated at once
+#define HTTP_NATIVE_CONNECTIONS_PER_CHUNK 64
+/// Decoder session alignment inside connection memory
+#define HTTP_NATIVE_SESSION_ALIGNMENT 16
+/// HTTP/2 stream memory for headers names and values
+#define HTTP_NATIVE_H2_HEAD_SIZE 8192
+/// HTTP/2 streams allocated at once
+#define HTTP_NATIVE_STREAMS_PER_CHUNK 64
+/// Kafka producer queue check interval while windows are held, in seconds
+#define HTTP_NATIVE_BACKPRESSURE_CHECK_INTERVAL 0.01
+
+static const char HTTP_NATIVE_CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+/// Connection state
+enum http_native_state {
+	HTTP_NATIVE_HANDSHAKE, ///< Negotiating TLS
+	HTTP_NATIVE_HEAD,      ///< Waiting for request line and headers
+	HTTP_NATIVE_BODY,      ///< Receiving request body
+	HTTP_NATIVE_RESPONSE,  ///< Waiting for output space to queue response
+	HTTP_NATIVE_CLOSING,   ///< Flushing output before close
+	HTTP_NATIVE_H2,	       ///< Serving HTTP/2 streams
+};
+
+/// Chunked body parser state
+enum http_native_chunk_state {
+	HTTP_NATIVE_CHUNK_SIZE,	    ///< Waiting for chunk size line
+	HTTP_NATIVE_CHUNK_DATA,	    ///< Receiving chunk data
+	HTTP_NATIVE_CHUNK_DATA_END, ///< Waiting for chunk data CRLF
+	HTTP_NATIVE_CHUNK_TRAILER,  ///< Skipping trailer, waiting for CRLF
+};
+
+/// Request in process. Strings point to connection receive buffer.
+struct http_native_request {
+	const char *method;	   ///< Request method
+	const char *uri;	   ///< Request URI, without query
+	const char *authorization; ///< Authorization header value
+	size_t head_end;	   ///< Body offset in receive buffer
+	bool http10;		   ///< HTTP/1.0 request
+	bool http2;		   ///< HTTP/2 stream request
+	bool keep_alive;	   ///< Keep connection open after response
+	bool expect_continue;	   ///< Client waits for 100 Continue
+	bool chunked;		   ///< Chunked transfer encoding
+	bool has_content_length;   ///< Content-Length header present
+	uint64_t content_length;   ///< Content-Length value
+	uint64_t body_left; ///< Content or current chunk bytes not received
+	enum http_native_chunk_state chunk_state; ///< Chunked body state
+
+	/// Sessionless decoder body buffer. If buf is NULL, body is in
+	/// receive buffer, just after head.
+	struct {
+		struct pool_buffer *buf; ///< Reference counted buffer
+		char *data;		 ///< Buffer data
+		size_t size;		 ///< Buffer capacity
+		size_t len;		 ///< Received body bytes
+	} body;
+
+	/// Compressed request body
+	struct {
+		/// Content-Encoding decompressor, NULL if not compressed
+		const struct http_decompressor *codec;
+		void *strm; ///< Decompression stream
+	} decompress;
+
+	void *decoder_sess; ///< Decoder session, if created
+
+	/// HTTP response
+	struct {
+		/// Response code. If !0, further body data is not processed.
+		unsigned int code;
+		const char *str;     ///< Response body
+		size_t str_size;     ///< Response body size
+		const char *headers; ///< Extra response headers
+	} response;
+
+	// Not cleared between requests
+
+	keyval_list_t decoder_params; ///< Decoder properties list
+	/// Properties memory
+	struct pair props[HTTP_NATIVE_MAX_HEADERS + HTTP_NATIVE_LISTENER_PROPS];
+};
+
+struct http_native_worker;
+
+#ifdef HAVE_NGHTTP2
+/// HTTP/2 stream: a request of a HTTP/2 connection
+struct http_native_stream {
+	TAILQ_ENTRY(http_native_stream) entry; ///< Connection streams entry
+	int32_t id;			       ///< Stream id
+	/// Received data not given back to stream flow control window yet
+	size_t held;
+	size_t headers;	     ///< Number of received headers
+	size_t head_len;     ///< Used head memory
+	size_t response_len; ///< Response body length
+	size_t response_off; ///< Response body sent bytes
+	struct http_native_request request;  ///< Stream request
+	char head[HTTP_NATIVE_H2_HEAD_SIZE]; ///< Headers names and values
+};
+
+TAILQ_HEAD(http_native_stream_list, http_native_stream);
+#endif
+
+/// HTTP connection
+struct http_native_connection {
+	/// Socket watcher. Needs to be the first member.
+	struct ev_io watcher;
+	struct http_native_worker *worker; ///< Connection owner
+	TAILQ_ENTRY(http_native_connection) entry; ///< Worker list entry
+	struct timer_wheel_entry idle_entry; ///< Idle wheel entry
+	ev_tstamp last_activity;	     ///< Last read or write time
+	struct sockaddr_storage addr;	     ///< Client address
+	char client[BUFSIZ / 16];	     ///< Client address string
+	enum http_native_state state;	     ///< Connection state
+	bool broken; ///< Connection needs to be closed right now
+	/// HTTP/2 prior knowledge preface has been looked for
+	bool preface_checked;
+
+	/// TLS layer
+	struct {
+		gnutls_session_t session; ///< TLS session, NULL if cleartext
+		/// Client certificate verification error, if any
+		const char *client_error;
+	} tls;
+
+#ifdef HAVE_NGHTTP2
+	/// HTTP/2 layer
+	struct {
+		nghttp2_session *session; ///< Session, NULL if HTTP/1.x
+		struct http_native_stream_list streams; ///< Open streams
+		/// Closed streams data not given back to connection window yet
+		size_t held;
+		/// Worker backpressure list entry
+		TAILQ_ENTRY(http_native_connection) held_entry;
+		bool held_back; ///< Connection is holding back window
+	} h2;
+#endif
+
+	/// Receive buffer. Buffers are shared with librdkafka when a request
+	/// body is produced from them, so data before off is never modified.
+	struct {
+		struct pool_buffer *buf; ///< Buffer, NULL if idle
+		char *data;		 ///< Buffer data
+		size_t off;		 ///< Not processed data offset
+		size_t len;		 ///< Received data length
+		size_t scan; ///< Next head terminator search offset
+	} in;
+
+	/// Output buffer
+	struct {
+		size_t off;			   ///< Not sent data offset
+		size_t len;			   ///< Queued data length
+		char data[HTTP_NATIVE_OUTPUT_SIZE]; ///< Output data
+	} out;
+
+	struct http_native_request request; ///< Request in process
+};
+
+TAILQ_HEAD(http_native_connection_list, http_native_connection);
+
+/// Worker thread
+struct http_native_worker {
+	struct http_native *native; ///< Worker engine
+	size_t idx;		    ///< Worker index
+	pthread_t thread;	    ///< Worker thread
+	struct ev_loop *loop;	    ///< Worker event loop
+	int listenfd;		    ///< Listen socket
+	struct ev_io accept_watcher; ///< Listen socket watcher
+	struct ev_async stop_async;  ///< Stop notification
+	struct buffer_pool *buffers; ///< Receive buffers
+	struct http_native_connection_list connections; ///< Open connections
+
+	/// Idle connections reaping
+	struct {
+		struct timer_wheel wheel; ///< Connections by idle deadline
+		struct ev_timer timer;	  ///< Wheel tick
+	} idle;
+
+#ifdef HAVE_NGHTTP2
+	/// Kafka producer queue backpressure on HTTP/2 streams
+	struct {
+		bool paused; ///< Streams window is being held back
+		struct ev_timer resume_timer; ///< Check queue length
+		/// Connections holding back window
+		struct http_native_connection_list connections;
+	} backpressure;
+#endif
+};
+
+struct http_native {
+	struct http_listener *listener;	   ///< Owner listener
+	struct http_native_config config;  ///< Engine configuration
+	struct cpu_affinity affinity;	   ///< Worker threads placement
+	struct slab *connections_slab;	   ///< Connections memory
+	size_t session_offset; ///< Decoder session offset in connection
+	size_t connections;    ///< Open connections
+	struct addr_count *ip_connections; ///< Open connections per client
+	/// TLS server credentials, NULL if cleartext
+	gnutls_certificate_credentials_t tls_credentials;
+#ifdef HAVE_NGHTTP2
+	/// HTTP/2 sessions resources
+	struct {
+		struct slab *streams_slab; ///< Streams memory
+		size_t session_offset; ///< Decoder session offset in stream
+		nghttp2_session_callbacks *callbacks; ///< Sessions callbacks
+		nghttp2_option *option;		      ///< Sessions options
+	} h2;
+#endif
+	size_t workers_running; ///< Started worker threads
+	struct http_native_worker workers[]; ///< Worker threads
+};
+
+static size_t size_align_to(size_t size, size_t alignment) {
+	return size % alignment == 0 ? size
+				     : (size / alignment + 1) * alignment;
+}
+
+static const struct listener *
+http_native_listener(const struct http_native *native) {
+	return http_listener_cast_listener(native->listener);
+}
+
+/*
+ * HEAD PARSING
+ */
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+/// Percent-decode an URI path in place
+static void http_native_unescape(char *str) {
+	const char *src = str;
+	char *dst = str;
+
+	while (*src) {
+		const int hi = '%' == src[0] ? hex_value(src[1]) : -1;
+		const int lo = hi >= 0 ? hex_value(src[2]) : -1;
+		if (lo >= 0) {
+			*dst++ = (char)(hi << 4 | lo);
+			src += 3;
+		} else {
+			*dst++ = *src++;
+		}
+	}
+
+	*dst = '\0';
+}
+
+/// Check if a comma separated header value contains a token, ignoring case
+static bool http_native_has_token(const char *value, const char *token) {
+	const size_t token_len = strlen(token);
+
+	while (*value) {
+		value += strspn(value, " \t,");
+		const size_t len = strcspn(value, ",");
+		size_t trimmed_len = len;
+		while (trimmed_len > 0 && (' ' == value[trimmed_len - 1] ||
+					   '\t' == value[trimmed_len - 1])) {
+			trimmed_len--;
+		}
+
+		if (trimmed_len == token_len &&
+		    0 == strncasecmp(value, token, token_len)) {
+			return true;
+		}
+
+		value += len;
+	}
+
+	return false;
+}
+
+/// Parse a Content-Length value. Return 0 if success, -1 if invalid.
+static int http_native_content_length(const char *value, uint64_t *ret) {
+	uint64_t content_length = 0;
+
+	if ('\0' == *value) {
+		return -1;
+	}
+
+	for (; *value; ++value) {
+		if (*value < '0' || *value > '9' ||
+		    content_length > (UINT64_MAX - 9) / 10) {
+			return -1;
+		}
+		content_length = content_length * 10 +
+				 (uint64_t)(*value - '0');
+	}
+
+	*ret = content_length;
+	return 0;
+}
+
+static int base64_value(char c) {
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	} else if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 26;
+	} else if (c >= '0' && c <= '9') {
+		return c - '0' + 52;
+	} else if ('+' == c) {
+		return 62;
+	} else if ('/' == c) {
+		return 63;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief      Decode a base64 string
+ *
+ * @param      dst       The destination buffer
+ * @param[in]  dst_size  The destination buffer size
+ * @param[in]  src       The base64 string
+ *
+ * @return     Decoded size, or -1 if invalid or it does not fit
+ */
+static ssize_t base64_decode(char *dst, size_t dst_size, const char *src) {
+	uint32_t acc = 0;
+	size_t bits = 0, len = 0;
+
+	for (; *src && '=' != *src; ++src) {
+		const int value = base64_value(*src);
+		if (value < 0) {
+			return -1;
+		}
+
+		acc = acc << 6 | (uint32_t)value;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (len == dst_size) {
+				return -1;
+			}
+			dst[len++] = (char)(acc >> bits & 0xff);
+		}
+	}
+
+	return (ssize_t)len;
+}
+
+/**
+ * @brief      Check Basic authorization credentials against htpasswd
+ *
+ * @param[in]  authorization  The Authorization header value, if any
+ * @param[in]  htpasswd       The htpasswd database
+ *
+ * @return     True if credentials are valid
+ */
+static bool http_native_basic_auth(const char *authorization,
+				   const char *htpasswd) {
+	static const char basic[] = "Basic ";
+	char credentials[HTTP_NATIVE_MAX_CREDENTIALS];
+
+	if (NULL == authorization ||
+	    0 != strncasecmp(authorization, basic, strlen(basic))) {
+		return false;
+	}
+
+	authorization += strlen(basic);
+	authorization += strspn(authorization, " ");
+	const ssize_t credentials_len = base64_decode(
+			credentials, sizeof(credentials) - 1, authorization);
+	if (credentials_len < 0) {
+		return false;
+	}
+
+	credentials[credentials_len] = '\0';
+	char *password = strchr(credentials, ':');
+	if (NULL == password) {
+		return false;
+	}
+
+	*password++ = '\0';
+	const bool ret = http_authenticate(credentials, password, htpasswd);
+
+	// Don't leave password in stack
+	volatile char *p = credentials;
+	size_t i;
+	for (i = 0; i < (size_t)credentials_len; ++i) {
+		p[i] = '\0';
+	}
+
+	return ret;
+}
+
+/// Set request response, if it has not one yet
+static void http_native_response(struct http_native_request *request,
+				 unsigned int code,
+				 const char *str,
+				 size_t str_size) {
+	if (0 == request->response.code) {
+		request->response.code = code;
+		request->response.str = str;
+		request->response.str_size = str_size;
+	}
+}
+
+/// Set an error response that closes connection after it
+static void http_native_response_close(struct http_native_request *request,
+				       unsigned int code) {
+	http_native_response(request, code, NULL, 0);
+	request->keep_alive = false;
+}
+
+/**
+ * @brief      Cut next head line, terminated by CRLF
+ *
+ * @param      cursor  The line start. Updated to next line start.
+ * @param[in]  end     The head end
+ *
+ * @return     The line, NUL terminated, or NULL if malformed. Empty line
+ *             means end of head.
+ */
+static char *http_native_line(char **cursor, const char *end) {
+	char *line = *cursor;
+	char *lf = memchr(line, '\n', (size_t)(end - line));
+
+	if (NULL == lf || lf == line || '\r' != lf[-1]) {
+		return NULL;
+	}
+
+	lf[-1] = '\0';
+	*cursor = lf + 1;
+	return line;
+}
+
+/// Parse request line. Return 0 if success, HTTP error code if not.
+static unsigned int http_native_parse_request_line(
+		struct http_native_request *request, char *line) {
+	char *uri = strchr(line, ' ');
+	if (NULL == uri || uri == line) {
+		return MHD_HTTP_BAD_REQUEST;
+	}
+	*uri++ = '\0';
+
+	char *version = strchr(uri, ' ');
+	if (NULL == version || version == uri) {
+		return MHD_HTTP_BAD_REQUEST;
+	}
+	*version++ = '\0';
+
+	if (0 == strcmp(version, "HTTP/1.1")) {
+		request->keep_alive = true;
+	} else if (0 == strcmp(version, "HTTP/1.0")) {
+		request->http10 = true;
+	} else if (0 == strncmp(version, "HTTP/", strlen("HTTP/"))) {
+		return MHD_HTTP_HTTP_VERSION_NOT_SUPPORTED;
+	} else {
+		return MHD_HTTP_BAD_REQUEST;
+	}
+
+	// Decoders expect the path, as libmicrohttpd gives them
+	char *query = strchr(uri, '?');
+	if (query) {
+		*query = '\0';
+	}
+	http_native_unescape(uri);
+
+	request->method = line;
+	request->uri = uri;
+	return 0;
+}
+
+/// Process a request header. Return 0 if success, HTTP error code if not.
+static unsigned int http_native_header(struct http_native_request *request,
+				       const char *key,
+				       const char *value) {
+	if (0 == strcasecmp(key, "Content-Length")) {
+		uint64_t content_length;
+		if (0 != http_native_content_length(value, &content_length) ||
+		    (request->has_content_length &&
+		     content_length != request->content_length)) {
+			return MHD_HTTP_BAD_REQUEST;
+		}
+		request->has_content_length = true;
+		request->content_length = content_length;
+	} else if (0 == strcasecmp(key, "Transfer-Encoding")) {
+		if (0 != strcasecmp(value, "chunked")) {
+			return MHD_HTTP_NOT_IMPLEMENTED;
+		}
+		request->chunked = true;
+	} else if (0 == strcasecmp(key, "Connection")) {
+		if (http_native_has_token(value, "close")) {
+			request->keep_alive = false;
+		} else if (http_native_has_token(value, "keep-alive")) {
+			request->keep_alive = true;
+		}
+	} else if (0 == strcasecmp(key, "Expect")) {
+		if (0 != strcasecmp(value, "100-continue")) {
+			return MHD_HTTP_EXPECTATION_FAILED;
+		}
+		request->expect_continue = !request->http10;
+	} else if (0 == strcasecmp(key, "Content-Encoding")) {
+		request->decompress.codec = http_decompressor_find(value);
+	} else if (0 == strcasecmp(key, "Authorization")) {
+		request->authorization = value;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Parse request head in place, filling request properties
+ *
+ * @param      request  The request
+ * @param      head     The head, including the last empty line
+ * @param[in]  end      The head end
+ *
+ * @return     Number of request headers. If error, response is set.
+ */
+static size_t http_native_parse_head(struct http_native_request *request,
+				     char *head,
+				     const char *end) {
+	size_t headers = 0;
+	char *cursor = head;
+	unsigned int rc = MHD_HTTP_BAD_REQUEST;
+
+	char *request_line = http_native_line(&cursor, end);
+	if (NULL == request_line) {
+		goto err;
+	}
+
+	rc = http_native_parse_request_line(request, request_line);
+	if (0 != rc) {
+		goto err;
+	}
+
+	while (true) {
+		char *key = http_native_line(&cursor, end);
+		rc = MHD_HTTP_BAD_REQUEST;
+		if (NULL == key) {
+			goto err;
+		} else if ('\0' == key[0]) {
+			// Empty line: End of head
+			break;
+		}
+
+		// Obsolete line folding is not supported
+		char *colon = strchr(key, ':');
+		if (' ' == key[0] || '\t' == key[0] || NULL == colon ||
+		    colon == key || ' ' == colon[-1] || '\t' == colon[-1]) {
+			goto err;
+		}
+
+		*colon = '\0';
+		char *value = colon + 1 + strspn(colon + 1, " \t");
+		char *value_end = value + strlen(value);
+		while (value_end > value &&
+		       (' ' == value_end[-1] || '\t' == value_end[-1])) {
+			*--value_end = '\0';
+		}
+
+		if (headers == HTTP_NATIVE_MAX_HEADERS) {
+			rc = MHD_HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE;
+			goto err;
+		}
+
+		request->props[headers++] =
+				(struct pair){.key = key, .value = value};
+		rc = http_native_header(request, key, value);
+		if (0 != rc) {
+			goto err;
+		}
+	}
+
+	if (request->chunked && request->has_content_length) {
+		rc = MHD_HTTP_BAD_REQUEST;
+		goto err;
+	}
+
+	return headers;
+
+err:
+	http_native_response_close(request, rc);
+	return headers;
+}
+
+/*
+ * TRANSPORT
+ */
+
+/**
+ * @brief      Translate a gnutls I/O return code to send/recv convention
+ *
+ * @param[in]  connection  The connection
+ * @param[in]  rc          The gnutls return code
+ *
+ * @return     Transferred bytes, or -1 with errno set
+ */
+static ssize_t
+http_native_tls_rc(const struct http_native_connection *connection,
+		   ssize_t rc) {
+	if (rc >= 0) {
+		return rc;
+	}
+
+	switch (rc) {
+	case GNUTLS_E_AGAIN:
+		errno = EAGAIN;
+		break;
+	case GNUTLS_E_INTERRUPTED:
+		errno = EINTR;
+		break;
+	default:
+		rdbg("TLS error with %s: %s",
+		     connection->client,
+		     gnutls_strerror((int)rc));
+		errno = EPROTO;
+		break;
+	};
+
+	return -1;
+}
+
+/// Receive from connection, through TLS if needed. Same return as recv.
+static ssize_t http_native_recv(struct http_native_connection *connection,
+				char *buf,
+				size_t size) {
+	if (NULL == connection->tls.session) {
+		return recv(connection->watcher.fd, buf, size, 0);
+	}
+
+	const ssize_t rc = gnutls_record_recv(connection->tls.session,
+					      buf,
+					      size);
+	if (GNUTLS_E_PREMATURE_TERMINATION == rc) {
+		// Client closed without TLS close notify
+		return 0;
+	}
+
+	return http_native_tls_rc(connection, rc);
+}
+
+/// Send to connection, through TLS if needed. Same return as send.
+static ssize_t http_native_send(struct http_native_connection *connection,
+				const char *buf,
+				size_t size) {
+	if (NULL == connection->tls.session) {
+		return send(connection->watcher.fd, buf, size, MSG_NOSIGNAL);
+	}
+
+	// If last call returned GNUTLS_E_AGAIN, gnutls sends its pending
+	// record, that holds the first bytes of the same buffer
+	return http_native_tls_rc(connection,
+				  gnutls_record_send(connection->tls.session,
+						     buf,
+						     size));
+}
+
+/*
+ * OUTPUT
+ */
+
+/// Send as much output as socket allows
+static void http_native_flush(struct http_native_connection *connection) {
+	while (connection->out.off < connection->out.len) {
+		const ssize_t rc = http_native_send(
+				connection,
+				&connection->out.data[connection->out.off],
+				connection->out.len - connection->out.off);
+		if (rc >= 0) {
+			connection->out.off += (size_t)rc;
+			connection->last_activity =
+					ev_now(connection->worker->loop);
+			continue;
+		}
+
+		if (EINTR == errno) {
+			continue;
+		} else if (EAGAIN == errno) {
+			break;
+		}
+
+		rdbg("Can't send to %s: %s",
+		     connection->client,
+		     gnu_strerror_r(errno));
+		connection->broken = true;
+		return;
+	}
+
+	// Make room for next responses
+	memmove(connection->out.data,
+		&connection->out.data[connection->out.off],
+		connection->out.len - connection->out.off);
+	connection->out.len -= connection->out.off;
+	connection->out.off = 0;
+}
+
+/// Append data to output. Return 0 if success, -1 if it does not fit.
+static int http_native_output(struct http_native_connection *connection,
+			      const char *data,
+			      size_t size) {
+	if (size > sizeof(connection->out.data) - connection->out.len) {
+		http_native_flush(connection);
+		if (size > sizeof(connection->out.data) - connection->out.len) {
+			return -1;
+		}
+	}
+
+	memcpy(&connection->out.data[connection->out.len], data, size);
+	connection->out.len += size;
+	return 0;
+}
+
+/**
+ * @brief      Append request response to output
+ *
+ * @param      connection  The connection
+ *
+ * @return     0 if success, -1 if there is no room for it yet
+ */
+static int
+http_native_queue_response(struct http_native_connection *connection) {
+	const struct http_native_request *request = &connection->request;
+	const unsigned int code =
+			request->response.code ? request->response.code
+					       : MHD_HTTP_OK;
+	size_t body_size = request->response.str_size;
+	if (request->response.str && 0 == body_size) {
+		body_size = strlen(request->response.str);
+	}
+	if (body_size > HTTP_NATIVE_MAX_RESPONSE_BODY) {
+		body_size = HTTP_NATIVE_MAX_RESPONSE_BODY;
+	}
+
+	const char *connection_header =
+			!request->keep_alive
+					? "Connection: close\r\n"
+					: request->http10 ? "Connection: "
+							    "keep-alive\r\n"
+							  : "";
+	const char *reason = MHD_get_reason_phrase_for(code);
+	const char *headers = request->response.headers
+				      ? request->response.headers
+				      : "";
+	char head[HTTP_NATIVE_OUTPUT_SIZE - HTTP_NATIVE_MAX_RESPONSE_BODY];
+	const int head_size = snprintf(head,
+				       sizeof(head),
+				       "HTTP/1.%d %u %s\r\n"
+				       "Content-Length: %zu\r\n"
+				       "%s%s\r\n",
+				       request->http10 ? 0 : 1,
+				       code,
+				       reason,
+				       body_size,
+				       headers,
+				       connection_header);
+	if (unlikely(head_size < 0 || (size_t)head_size >= sizeof(head))) {
+		rdlog(LOG_ERR, "Can't print HTTP response head");
+		connection->broken = true;
+		return 0;
+	}
+
+	if ((size_t)head_size + body_size >
+	    sizeof(connection->out.data) - connection->out.len) {
+		http_native_flush(connection);
+	}
+
+	if ((size_t)head_size + body_size >
+	    sizeof(connection->out.data) - connection->out.len) {
+		return -1;
+	}
+
+	http_native_output(connection, head, (size_t)head_size);
+	if (body_size > 0) {
+		http_native_output(
+				connection, request->response.str, body_size);
+	}
+	return 0;
+}
+
+/*
+ * REQUEST PROCESSING
+ */
+
+/**
+ * @brief      Get a buffer able to hold size bytes: a worker pool one, or a
+ *             dedicated one if it is bigger than pool buffers.
+ *
+ * @param      worker  The worker
+ * @param[in]  size    The needed size
+ *
+ * @return     The buffer, or NULL if no memory
+ */
+static struct pool_buffer *
+http_native_buffer_get(struct http_native_worker *worker, size_t size) {
+	if (size <= worker->native->config.buffer_size) {
+		return buffer_pool_get(worker->buffers);
+	}
+
+	struct buffer_pool *pool = buffer_pool_new(size, 0);
+	if (unlikely(NULL == pool)) {
+		return NULL;
+	}
+
+	// Pool memory is released with its only buffer
+	struct pool_buffer *ret = buffer_pool_get(pool);
+	buffer_pool_done(pool);
+	return ret;
+}
+
+/// Set sessionless request body buffer
+static int http_native_body_buffer(struct http_native_connection *connection,
+				   struct http_native_request *request,
+				   size_t size) {
+	struct pool_buffer *buf =
+			http_native_buffer_get(connection->worker, size);
+	if (unlikely(NULL == buf)) {
+		rdlog(LOG_ERR,
+		      "Can't allocate %s request body buffer (OOM?)",
+		      connection->client);
+		return -1;
+	}
+
+	if (request->body.buf) {
+		memcpy(pool_buffer_data(buf),
+		       request->body.data,
+		       request->body.len);
+		pool_buffer_unref(request->body.buf);
+	}
+
+	request->body.buf = buf;
+	request->body.data = pool_buffer_data(buf);
+	request->body.size = size;
+	return 0;
+}
+
+/// Process a request body segment
+static void http_native_body_data(struct http_native_connection *connection,
+				  struct http_native_request *request,
+				  const char *data,
+				  size_t size) {
+	const struct listener *l =
+			http_native_listener(connection->worker->native);
+	const char *response = NULL;
+	size_t response_size = 0;
+	enum decoder_callback_err rc;
+
+	if (0 == size || request->response.code) {
+		return;
+	}
+
+	if (request->body.buf) {
+		// Sessionless chunked body. Its first buffer can be bigger
+		// than max body size.
+		const size_t max_size = http_listener_max_body_size(
+				connection->worker->native->listener);
+		const size_t needed = request->body.len + size;
+		if (needed > max_size) {
+			http_native_response_close(request,
+						   MHD_HTTP_PAYLOAD_TOO_LARGE);
+			return;
+		}
+
+		if (needed > request->body.size) {
+			size_t new_size = 2 * request->body.size;
+			while (new_size < needed) {
+				new_size *= 2;
+			}
+			if (new_size > max_size) {
+				new_size = max_size;
+			}
+			if (0 != http_native_body_buffer(
+					    connection, request, new_size)) {
+				http_native_response(
+						request,
+						MHD_HTTP_INTERNAL_SERVER_ERROR,
+						NULL,
+						0);
+				return;
+			}
+		}
+
+		memcpy(&request->body.data[request->body.len], data, size);
+		request->body.len += size;
+		return;
+	} else if (NULL == request->decoder_sess) {
+		// Not a POST
+		return;
+	} else if (request->decompress.codec) {
+		rc = http_decompress_decode(l,
+					    request->decompress.codec,
+					    request->decompress.strm,
+					    data,
+					    size,
+					    &request->decoder_params,
+					    request->decoder_sess,
+					    &response,
+					    &response_size);
+	} else {
+		rc = listener_decode(l,
+				     data,
+				     size,
+				     &request->decoder_params,
+				     &response,
+				     &response_size,
+				     request->decoder_sess);
+	}
+
+	if (unlikely(DECODER_CALLBACK_OK != rc)) {
+		http_native_response(request,
+				     decoder_err2http(rc),
+				     response,
+				     response_size);
+	}
+}
+
+/**
+ * @brief      Start processing a POST request
+ *
+ * @param      connection  The connection
+ * @param      request     The request
+ * @param      session     The request decoder session memory
+ *
+ * @return     0 if success, -1 if decoder session could not be created
+ */
+static int http_native_post_start(struct http_native_connection *connection,
+				  struct http_native_request *request,
+				  void *session) {
+	struct http_native *native = connection->worker->native;
+	const struct listener *l = http_native_listener(native);
+	const struct n2k_decoder *decoder = l->decoder;
+
+	if (connection->tls.client_error) {
+		// Same response as libmicrohttpd engine
+		http_native_response(request,
+				     MHD_HTTP_FORBIDDEN,
+				     connection->tls.client_error,
+				     0);
+		request->keep_alive = false;
+		return 0;
+	}
+
+	const char *htpasswd = http_listener_htpasswd(native->listener);
+	if (htpasswd &&
+	    !http_native_basic_auth(request->authorization, htpasswd)) {
+		request->response.headers = "WWW-Authenticate: Basic\r\n";
+		http_native_response_close(request, MHD_HTTP_UNAUTHORIZED);
+		return 0;
+	}
+
+	if (NULL == decoder->new_session) {
+		if (request->content_length >
+		    http_listener_max_body_size(native->listener)) {
+			http_native_response_close(request,
+						   MHD_HTTP_PAYLOAD_TOO_LARGE);
+			return 0;
+		}
+
+		// Body will be decoded at once, without copies if possible.
+		// Chunked and HTTP/2 bodies size is not known in advance.
+		const size_t buffer_size = native->config.buffer_size;
+		const bool sized = !request->chunked && !request->http2;
+		if (!sized ||
+		    request->head_end + request->content_length > buffer_size) {
+			const bool big = request->content_length > buffer_size;
+			const size_t size = sized || big
+						    ? request->content_length
+						    : buffer_size;
+			if (0 != http_native_body_buffer(
+					    connection, request, size)) {
+				http_native_response(
+						request,
+						MHD_HTTP_INTERNAL_SERVER_ERROR,
+						NULL,
+						0);
+			}
+		}
+		return 0;
+	}
+
+	request->decoder_sess = session;
+	const int session_rc = decoder->new_session(request->decoder_sess,
+						    l->decoder_opaque,
+						    &request->decoder_params);
+	if (0 != session_rc) {
+		request->decoder_sess = NULL;
+		return -1;
+	}
+
+	const struct http_decompressor *codec = request->decompress.codec;
+	if (codec) {
+		const char *error = NULL;
+		request->decompress.strm = codec->stream_new(
+				http_listener_decompress_dict(native->listener,
+							      codec),
+				&error);
+		if (unlikely(NULL == request->decompress.strm)) {
+			// Don't process the body, return the error at the end
+			http_native_response(request,
+					     MHD_HTTP_INTERNAL_SERVER_ERROR,
+					     error,
+					     0);
+		}
+	}
+
+	return 0;
+}
+
+/// Process a GET request
+static void http_native_get(struct http_native_connection *connection,
+			    struct http_native_request *request) {
+	const char *response = NULL;
+	size_t response_size = 0;
+
+	const enum decoder_callback_err rc = listener_decode(
+			http_native_listener(connection->worker->native),
+			NULL,
+			0,
+			&request->decoder_params,
+			&response,
+			&response_size,
+			NULL);
+	if (DECODER_CALLBACK_HTTP_METHOD_NOT_ALLOWED == rc) {
+		request->response.headers = "Allow: POST\r\n";
+	}
+
+	http_native_response(request,
+			     decoder_err2http(rc),
+			     response,
+			     response_size);
+}
+
+/// Clear request, except properties memory
+static void http_native_request_reset(struct http_native_request *request) {
+	memset(request,
+	       0,
+	       offsetof(struct http_native_request, decoder_params));
+}
+
+/**
+ * @brief      Add listener properties to request headers, and start
+ *             processing the request by its method
+ *
+ * @param      connection  The connection
+ * @param      request     The request, with its head parsed
+ * @param[in]  headers     Number of request headers
+ * @param      session     The request decoder session memory
+ *
+ * @return     0 if success, -1 if decoder session could not be created
+ */
+static int http_native_request_route(struct http_native_connection *connection,
+				     struct http_native_request *request,
+				     size_t headers,
+				     void *session) {
+	size_t i;
+
+	const struct pair listener_props[] = {
+			{.key = "D-HTTP-method", .value = request->method},
+			{.key = "D-HTTP-URI", .value = request->uri},
+			{.key = "D-Client-IP", .value = connection->client},
+	};
+	memcpy(&request->props[headers],
+	       listener_props,
+	       sizeof(listener_props));
+	keyval_list_init(&request->decoder_params);
+	for (i = 0; i < headers + RD_ARRAYSIZE(listener_props); ++i) {
+		add_key_value_pair(&request->decoder_params,
+				   &request->props[i]);
+	}
+
+	if (request->response.code) {
+		// Head error
+	} else if (0 == strcmp(request->method, MHD_HTTP_METHOD_POST)) {
+		return http_native_post_start(connection, request, session);
+	} else if (0 == strcmp(request->method, MHD_HTTP_METHOD_GET)) {
+		http_native_get(connection, request);
+	} else {
+		rdlog(LOG_WARNING,
+		      "Received invalid method %s",
+		      request->method);
+		request->response.headers = "Allow: GET, POST\r\n";
+		http_native_response(
+				request, MHD_HTTP_METHOD_NOT_ALLOWED, NULL, 0);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Process a complete request head, and prepare connection to
+ *             receive the body
+ *
+ * @param      connection  The connection
+ * @param[in]  head_end    The head end offset in receive buffer
+ */
+static void http_native_request_start(struct http_native_connection *connection,
+				      size_t head_end) {
+	struct http_native_request *request = &connection->request;
+
+	http_native_request_reset(request);
+	request->head_end = head_end;
+
+	const size_t headers = http_native_parse_head(
+			request,
+			&connection->in.data[connection->in.off],
+			&connection->in.data[head_end]);
+	connection->in.off = head_end;
+
+	void *session = (char *)connection +
+			connection->worker->native->session_offset;
+	if (0 != http_native_request_route(
+			 connection, request, headers, session)) {
+		// Not valid decoder session! libmicrohttpd engine closes
+		// connection too
+		connection->broken = true;
+		return;
+	}
+
+	if (request->chunked) {
+		request->chunk_state = HTTP_NATIVE_CHUNK_SIZE;
+	} else {
+		request->body_left = request->content_length;
+	}
+
+	const bool has_body = request->chunked || request->body_left > 0;
+	if (has_body && request->response.code && !request->keep_alive) {
+		// Don't wait for a body we are not going to read
+		connection->state = HTTP_NATIVE_RESPONSE;
+		return;
+	}
+
+	if (has_body && request->expect_continue &&
+	    0 == request->response.code) {
+		http_native_output(connection,
+				   HTTP_NATIVE_CONTINUE,
+				   strlen(HTTP_NATIVE_CONTINUE));
+	}
+
+	connection->state = HTTP_NATIVE_BODY;
+}
+
+/// Release request resources
+static void http_native_request_done(struct http_native_request *request,
+				     const struct n2k_decoder *decoder) {
+	if (request->decoder_sess) {
+		decoder->delete_session(request->decoder_sess);
+		request->decoder_sess = NULL;
+	}
+
+	if (request->decompress.strm) {
+		const struct http_decompressor *codec =
+				request->decompress.codec;
+		codec->stream_done(request->decompress.strm);
+		request->decompress.strm = NULL;
+	}
+
+	if (request->body.buf) {
+		pool_buffer_unref(request->body.buf);
+		request->body.buf = NULL;
+	}
+}
+
+/// Decode a complete sessionless request body, or check that a compressed
+/// streaming body is complete
+static void http_native_request_end(struct http_native_connection *connection,
+				    struct http_native_request *request) {
+	const struct listener *l =
+			http_native_listener(connection->worker->native);
+
+	if (request->response.code ||
+	    0 != strcmp(request->method, MHD_HTTP_METHOD_POST)) {
+		return;
+	}
+
+	if (request->decoder_sess) {
+		void *strm = request->decompress.strm;
+		const char *response = NULL;
+		const enum decoder_callback_err rc =
+				strm ? request->decompress.codec->stream_end(
+					       strm, &response)
+				     : DECODER_CALLBACK_OK;
+		if (unlikely(DECODER_CALLBACK_OK != rc)) {
+			http_native_response(request,
+					     decoder_err2http(rc),
+					     response,
+					     0);
+		}
+		return;
+	}
+
+	// Body is in its own buffer, or in place after head
+	struct n2k_decoder_batch_msg msg = {
+			.buffer = &connection->in.data[request->head_end],
+			.buf_size = (size_t)request->content_length,
+			.props = &request->decoder_params,
+			.pool_buffer = connection->in.buf,
+	};
+	if (request->body.buf) {
+		msg.buffer = request->body.data;
+		msg.buf_size = request->body.len;
+		msg.pool_buffer = request->body.buf;
+	}
+
+	const enum decoder_callback_err rc =
+			listener_decode_batch(l, &msg, 1);
+	if (DECODER_CALLBACK_OK != rc) {
+		http_native_response(request, decoder_err2http(rc), NULL, 0);
+	}
+}
+
+/**
+ * @brief      Keep only request head and not processed data in receive
+ *             buffer, so there is room for the rest of the body.
+ *
+ * @param      connection  The connection
+ */
+static void
+http_native_body_compact(struct http_native_connection *connection) {
+	const size_t head_end = connection->request.head_end;
+	if (connection->in.off == head_end) {
+		return;
+	}
+
+	memmove(&connection->in.data[head_end],
+		&connection->in.data[connection->in.off],
+		connection->in.len - connection->in.off);
+	connection->in.len -= connection->in.off - head_end;
+	connection->in.off = head_end;
+}
+
+/// Process received chunked body data. Return true if body is complete.
+static bool http_native_chunked_process(
+		struct http_native_connection *connection) {
+	struct http_native_request *request = &connection->request;
+
+	while (true) {
+		char *cursor = &connection->in.data[connection->in.off];
+		const size_t available =
+				connection->in.len - connection->in.off;
+		const char *lf;
+		size_t size;
+		int digit;
+
+		switch (request->chunk_state) {
+		case HTTP_NATIVE_CHUNK_SIZE:
+		case HTTP_NATIVE_CHUNK_TRAILER:
+			lf = memchr(cursor, '\n', available);
+			if (NULL == lf) {
+				if (available > HTTP_NATIVE_MAX_CHUNK_LINE) {
+					goto err;
+				}
+				http_native_body_compact(connection);
+				return false;
+			}
+
+			if (lf == cursor || '\r' != lf[-1]) {
+				goto err;
+			}
+
+			connection->in.off += (size_t)(lf + 1 - cursor);
+			if (HTTP_NATIVE_CHUNK_TRAILER == request->chunk_state) {
+				if (lf == cursor + 1) {
+					// Empty line: End of body
+					return true;
+				}
+				break;
+			}
+
+			// Chunk size, ignoring chunk extensions
+			request->body_left = 0;
+			for (size = 0; (digit = hex_value(cursor[size])) >= 0;
+			     ++size) {
+				if (request->body_left > UINT64_MAX >> 4) {
+					goto err;
+				}
+				request->body_left = request->body_left << 4 |
+						     (uint64_t)digit;
+			}
+
+			const char *size_end = &cursor[size];
+			if (0 == size || (size_end != lf - 1 &&
+					  NULL == strchr(" \t;", *size_end))) {
+				goto err;
+			}
+
+			if (0 == request->body_left) {
+				// Last chunk
+				request->chunk_state =
+						HTTP_NATIVE_CHUNK_TRAILER;
+			} else {
+				request->chunk_state = HTTP_NATIVE_CHUNK_DATA;
+			}
+			break;
+
+		case HTTP_NATIVE_CHUNK_DATA:
+			size = available < request->body_left
+				       ? available
+				       : (size_t)request->body_left;
+			if (0 == size) {
+				http_native_body_compact(connection);
+				return false;
+			}
+
+			http_native_body_data(
+					connection, request, cursor, size);
+			connection->in.off += size;
+			request->body_left -= size;
+			if (0 == request->body_left) {
+				request->chunk_state =
+						HTTP_NATIVE_CHUNK_DATA_END;
+			}
+			break;
+
+		case HTTP_NATIVE_CHUNK_DATA_END:
+			if (available < 2) {
+				http_native_body_compact(connection);
+				return false;
+			}
+
+			if ('\r' != cursor[0] || '\n' != cursor[1]) {
+				goto err;
+			}
+
+			connection->in.off += 2;
+			request->chunk_state = HTTP_NATIVE_CHUNK_SIZE;
+			break;
+
+		default:
+			goto err;
+		};
+	}
+
+err:
+	// Can't know where next request starts
+	request->response.code = 0;
+	http_native_response_close(request, MHD_HTTP_BAD_REQUEST);
+	return true;
+}
+
+/// Process received body data. Return true if body is complete.
+static bool
+http_native_body_process(struct http_native_connection *connection) {
+	struct http_native_request *request = &connection->request;
+
+	if (request->chunked) {
+		return http_native_chunked_process(connection);
+	}
+
+	if (request->body.buf) {
+		// Rest of the body is read directly to body buffer
+		const size_t available =
+				connection->in.len - connection->in.off;
+		const size_t left = (size_t)request->content_length -
+				    request->body.len;
+		const size_t size = available < left ? available : left;
+		memcpy(&request->body.data[request->body.len],
+		       &connection->in.data[connection->in.off],
+		       size);
+		request->body.len += size;
+		connection->in.off += size;
+		return request->body.len == request->content_length;
+	}
+
+	const size_t available = connection->in.len - connection->in.off;
+	const size_t size = available < request->body_left
+				    ? available
+				    : (size_t)request->body_left;
+	const bool in_place = NULL == request->decoder_sess &&
+			      0 == request->response.code &&
+			      0 == strcmp(request->method,
+					  MHD_HTTP_METHOD_POST);
+	if (!in_place) {
+		http_native_body_data(
+				connection,
+				request,
+				&connection->in.data[connection->in.off],
+				size);
+	}
+
+	connection->in.off += size;
+	request->body_left -= size;
+	if (0 == request->body_left) {
+		return true;
+	}
+
+	if (!in_place) {
+		http_native_body_compact(connection);
+	}
+
+	return false;
+}
+
+#ifdef HAVE_NGHTTP2
+
+/*
+ * HTTP/2
+ */
+
+static const char HTTP_NATIVE_H2_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/**
+ * @brief      Check if HTTP/2 streams window has to be held back, pausing
+ *             worker if kafka producer queue has reached high watermark
+ *
+ * @param      worker  The worker
+ *
+ * @return     True if window has to be held back
+ */
+static bool http_native_backpressure(struct http_native_worker *worker) {
+	const size_t high_watermark =
+			worker->native->config.http2.high_watermark;
+
+	if (worker->backpressure.paused) {
+		return true;
+	} else if (0 == high_watermark || kafka_outq_len() < high_watermark) {
+		return false;
+	}
+
+	rdlog(LOG_INFO,
+	      "Kafka queue over high watermark, holding HTTP worker %zu "
+	      "streams window",
+	      worker->idx);
+	worker->backpressure.paused = true;
+	ev_timer_again(worker->loop, &worker->backpressure.resume_timer);
+	return true;
+}
+
+/**
+ * @brief      Give processed stream data window back to client, or hold it
+ *             back until kafka producer queue goes down
+ *
+ * @param      connection  The connection
+ * @param      stream      The stream, or NULL if it is closed
+ * @param[in]  stream_id   The stream identifier
+ * @param[in]  size        The processed data size
+ */
+static void http_native_h2_consume(struct http_native_connection *connection,
+				   struct http_native_stream *stream,
+				   int32_t stream_id,
+				   size_t size) {
+	struct http_native_worker *worker = connection->worker;
+
+	if (!http_native_backpressure(worker)) {
+		nghttp2_session_consume(
+				connection->h2.session, stream_id, size);
+		return;
+	}
+
+	if (stream) {
+		stream->held += size;
+	} else {
+		connection->h2.held += size;
+	}
+
+	if (!connection->h2.held_back) {
+		connection->h2.held_back = true;
+		TAILQ_INSERT_TAIL(&worker->backpressure.connections,
+				  connection,
+				  h2.held_entry);
+	}
+}
+
+/// Give all held back window to client
+static void http_native_h2_release(struct http_native_connection *connection) {
+	struct http_native_stream *stream;
+
+	TAILQ_FOREACH(stream, &connection->h2.streams, entry) {
+		if (stream->held > 0) {
+			nghttp2_session_consume(connection->h2.session,
+						stream->id,
+						stream->held);
+			stream->held = 0;
+		}
+	}
+
+	if (connection->h2.held > 0) {
+		nghttp2_session_consume_connection(connection->h2.session,
+						   connection->h2.held);
+		connection->h2.held = 0;
+	}
+}
+
+/// Release stream resources
+static void
+http_native_h2_stream_done(struct http_native_connection *connection,
+			   struct http_native_stream *stream) {
+	struct http_native *native = connection->worker->native;
+
+	// Connection window is still held
+	connection->h2.held += stream->held;
+	TAILQ_REMOVE(&connection->h2.streams, stream, entry);
+	http_native_request_done(&stream->request,
+				 http_native_listener(native)->decoder);
+	slab_free(native->h2.streams_slab, stream);
+}
+
+/// Copy a header string to stream memory. Return NULL if there is no room.
+static char *http_native_h2_strdup(struct http_native_stream *stream,
+				   const uint8_t *str,
+				   size_t len) {
+	if (len >= sizeof(stream->head) - stream->head_len) {
+		return NULL;
+	}
+
+	char *ret = &stream->head[stream->head_len];
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+	stream->head_len += len + 1;
+	return ret;
+}
+
+static int http_native_h2_begin_headers_cb(nghttp2_session *session,
+					   const nghttp2_frame *frame,
+					   void *user_data) {
+	struct http_native_connection *connection = user_data;
+	struct http_native *native = connection->worker->native;
+
+	if (NGHTTP2_HEADERS != frame->hd.type ||
+	    NGHTTP2_HCAT_REQUEST != frame->headers.cat) {
+		return 0;
+	}
+
+	struct http_native_stream *stream = slab_alloc(native->h2.streams_slab);
+	if (unlikely(NULL == stream)) {
+		rdlog(LOG_ERR,
+		      "Can't allocate %s HTTP/2 stream (OOM?)",
+		      connection->client);
+		// Stream is reset
+		return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+	}
+
+	stream->id = frame->hd.stream_id;
+	stream->request.http2 = true;
+	stream->request.keep_alive = true;
+	TAILQ_INSERT_TAIL(&connection->h2.streams, stream, entry);
+	nghttp2_session_set_stream_user_data(session, stream->id, stream);
+	return 0;
+}
+
+static int http_native_h2_header_cb(nghttp2_session *session,
+				    const nghttp2_frame *frame,
+				    const uint8_t *name,
+				    size_t name_len,
+				    const uint8_t *value,
+				    size_t value_len,
+				    uint8_t flags,
+				    void *user_data) {
+	struct http_native_stream *stream =
+			nghttp2_session_get_stream_user_data(
+					session, frame->hd.stream_id);
+	(void)flags;
+	(void)user_data;
+
+	if (NGHTTP2_HEADERS != frame->hd.type ||
+	    NGHTTP2_HCAT_REQUEST != frame->headers.cat || NULL == stream ||
+	    stream->request.response.code) {
+		// Trailers are ignored
+		return 0;
+	}
+
+	struct http_native_request *request = &stream->request;
+	char *key = http_native_h2_strdup(stream, name, name_len);
+	char *val = key ? http_native_h2_strdup(stream, value, value_len)
+			: NULL;
+	if (NULL == val) {
+		http_native_response(request,
+				     MHD_HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE,
+				     NULL,
+				     0);
+		return 0;
+	}
+
+	if (':' == key[0]) {
+		// Pseudo-headers are validated by nghttp2
+		if (0 == strcmp(key, ":method")) {
+			request->method = val;
+		} else if (0 == strcmp(key, ":path")) {
+			// Decoders expect the path, as libmicrohttpd gives them
+			char *query = strchr(val, '?');
+			if (query) {
+				*query = '\0';
+			}
+			http_native_unescape(val);
+			request->uri = val;
+		}
+		return 0;
+	}
+
+	if (stream->headers == HTTP_NATIVE_MAX_HEADERS) {
+		http_native_response(request,
+				     MHD_HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE,
+				     NULL,
+				     0);
+		return 0;
+	}
+
+	request->props[stream->headers++] =
+			(struct pair){.key = key, .value = val};
+	const unsigned int rc = http_native_header(request, key, val);
+	if (0 != rc) {
+		http_native_response(request, rc, NULL, 0);
+	}
+
+	return 0;
+}
+
+static int http_native_h2_data_chunk_recv_cb(nghttp2_session *session,
+					     uint8_t flags,
+					     int32_t stream_id,
+					     const uint8_t *data,
+					     size_t len,
+					     void *user_data) {
+	struct http_native_connection *connection = user_data;
+	struct http_native_stream *stream =
+			nghttp2_session_get_stream_user_data(session,
+							     stream_id);
+	(void)flags;
+
+	if (stream) {
+		http_native_body_data(connection,
+				      &stream->request,
+				      (const char *)data,
+				      len);
+	}
+
+	http_native_h2_consume(connection, stream, stream_id, len);
+	return 0;
+}
+
+/// Response body provider
+static ssize_t http_native_h2_response_read_cb(nghttp2_session *session,
+					       int32_t stream_id,
+					       uint8_t *buf,
+					       size_t length,
+					       uint32_t *data_flags,
+					       nghttp2_data_source *source,
+					       void *user_data) {
+	struct http_native_stream *stream = source->ptr;
+	size_t size = stream->response_len - stream->response_off;
+	(void)session;
+	(void)stream_id;
+	(void)user_data;
+
+	if (size > length) {
+		size = length;
+	}
+
+	memcpy(buf,
+	       &stream->request.response.str[stream->response_off],
+	       size);
+	stream->response_off += size;
+	if (stream->response_off == stream->response_len) {
+		*data_flags |= NGHTTP2_DATA_FLAG_EOF;
+	}
+
+	return (ssize_t)size;
+}
+
+/// Create a name/value pair
+static nghttp2_nv http_native_h2_nv(const char *name, const char *value) {
+	return (nghttp2_nv){
+			.name = const_cast(name),
+			.value = const_cast(value),
+			.namelen = strlen(name),
+			.valuelen = strlen(value),
+			.flags = NGHTTP2_NV_FLAG_NONE,
+	};
+}
+
+/**
+ * @brief      Submit stream request response
+ *
+ * @param      connection  The connection
+ * @param      stream      The stream
+ *
+ * @return     0 if success, nghttp2 error code if not
+ */
+static int http_native_h2_respond(struct http_native_connection *connection,
+				  struct http_native_stream *stream) {
+	const struct http_native_request *request = &stream->request;
+	const unsigned int code =
+			request->response.code ? request->response.code
+					       : MHD_HTTP_OK;
+	char status[sizeof("999")];
+	char content_length[sizeof("18446744073709551615")];
+	char header_name[64], header_value[64];
+	nghttp2_nv headers[3];
+	size_t headers_count = 0, i;
+
+	stream->response_len = request->response.str_size;
+	if (request->response.str && 0 == stream->response_len) {
+		stream->response_len = strlen(request->response.str);
+	}
+	if (stream->response_len > HTTP_NATIVE_MAX_RESPONSE_BODY) {
+		stream->response_len = HTTP_NATIVE_MAX_RESPONSE_BODY;
+	}
+
+	snprintf(status, sizeof(status), "%u", code);
+	snprintf(content_length,
+		 sizeof(content_length),
+		 "%zu",
+		 stream->response_len);
+	headers[headers_count++] = http_native_h2_nv(":status", status);
+	headers[headers_count++] =
+			http_native_h2_nv("content-length", content_length);
+
+	// Extra response header, like "Allow: POST\r\n". HTTP/2 header
+	// names are lowercase.
+	if (request->response.headers &&
+	    2 == sscanf(request->response.headers,
+			"%63[^:]: %63[^\r]",
+			header_name,
+			header_value)) {
+		for (i = 0; header_name[i]; ++i) {
+			header_name[i] = (char)tolower(header_name[i]);
+		}
+		headers[headers_count++] =
+				http_native_h2_nv(header_name, header_value);
+	}
+
+	const nghttp2_data_provider provider = {
+			.source.ptr = stream,
+			.read_callback = http_native_h2_response_read_cb,
+	};
+	return nghttp2_submit_response(connection->h2.session,
+				       stream->id,
+				       headers,
+				       headers_count,
+				       stream->response_len > 0 ? &provider
+								: NULL);
+}
+
+static int http_native_h2_frame_recv_cb(nghttp2_session *session,
+					const nghttp2_frame *frame,
+					void *user_data) {
+	struct http_native_connection *connection = user_data;
+
+	if (NGHTTP2_HEADERS != frame->hd.type &&
+	    NGHTTP2_DATA != frame->hd.type) {
+		return 0;
+	}
+
+	struct http_native_stream *stream =
+			nghttp2_session_get_stream_user_data(
+					session, frame->hd.stream_id);
+	if (NULL == stream) {
+		return 0;
+	}
+
+	struct http_native_request *request = &stream->request;
+	if (NGHTTP2_HEADERS == frame->hd.type &&
+	    NGHTTP2_HCAT_REQUEST == frame->headers.cat) {
+		if (NULL == request->method || NULL == request->uri) {
+			// Headers did not fit
+			request->method = request->uri = "";
+		}
+
+		void *decoder_session = (char *)stream +
+					connection->worker->native->h2
+							.session_offset;
+		if (0 != http_native_request_route(connection,
+						   request,
+						   stream->headers,
+						   decoder_session)) {
+			// Not valid decoder session! Only this request fails.
+			return nghttp2_submit_rst_stream(
+					session,
+					NGHTTP2_FLAG_NONE,
+					stream->id,
+					NGHTTP2_INTERNAL_ERROR);
+		}
+	}
+
+	if (frame->hd.flags & NGHTTP2_FLAG_END_STREAM) {
+		http_native_request_end(connection, request);
+		return http_native_h2_respond(connection, stream);
+	}
+
+	return 0;
+}
+
+static int http_native_h2_stream_close_cb(nghttp2_session *session,
+					  int32_t stream_id,
+					  uint32_t error_code,
+					  void *user_data) {
+	struct http_native_connection *connection = user_data;
+	struct http_native_stream *stream =
+			nghttp2_session_get_stream_user_data(session,
+							     stream_id);
+	(void)error_code;
+
+	if (stream) {
+		http_native_h2_stream_done(connection, stream);
+	}
+
+	return 0;
+}
+
+/// Copy HTTP/2 session output to connection output buffer
+static ssize_t http_native_h2_send_cb(nghttp2_session *session,
+				      const uint8_t *data,
+				      size_t length,
+				      int flags,
+				      void *user_data) {
+	struct http_native_connection *connection = user_data;
+	size_t room = sizeof(connection->out.data) - connection->out.len;
+	(void)session;
+	(void)flags;
+
+	if (0 == room) {
+		http_native_flush(connection);
+		if (connection->broken) {
+			return NGHTTP2_ERR_CALLBACK_FAILURE;
+		}
+		room = sizeof(connection->out.data) - connection->out.len;
+	}
+
+	if (0 == room) {
+		return NGHTTP2_ERR_WOULDBLOCK;
+	}
+
+	const size_t size = length < room ? length : room;
+	memcpy(&connection->out.data[connection->out.len], data, size);
+	connection->out.len += size;
+	return (ssize_t)size;
+}
+
+/// Switch connection to HTTP/2, sending server settings
+static void http_native_h2_start(struct http_native_connection *connection) {
+	struct http_native *native = connection->worker->native;
+	const size_t max_window = NGHTTP2_MAX_WINDOW_SIZE;
+	const size_t max_streams = native->config.http2.max_streams;
+	size_t window = native->config.buffer_size;
+
+	if (window > max_window) {
+		window = max_window;
+	}
+	const size_t connection_window = window > max_window / max_streams
+						 ? max_window
+						 : window * max_streams;
+
+	TAILQ_INIT(&connection->h2.streams);
+	const int new_rc = nghttp2_session_server_new2(&connection->h2.session,
+						       native->h2.callbacks,
+						       connection,
+						       native->h2.option);
+	if (unlikely(0 != new_rc)) {
+		rdlog(LOG_ERR,
+		      "Can't create %s HTTP/2 session: %s",
+		      connection->client,
+		      nghttp2_strerror(new_rc));
+		connection->h2.session = NULL;
+		connection->broken = true;
+		return;
+	}
+
+	// Stream window bounds data received before it is processed, as
+	// connection receive buffer does in HTTP/1.1
+	const nghttp2_settings_entry settings[] = {
+			{NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS,
+			 (uint32_t)max_streams},
+			{NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE,
+			 (uint32_t)window},
+			{NGHTTP2_SETTINGS_MAX_HEADER_LIST_SIZE,
+			 HTTP_NATIVE_H2_HEAD_SIZE},
+	};
+	int rc = nghttp2_submit_settings(connection->h2.session,
+					 NGHTTP2_FLAG_NONE,
+					 settings,
+					 RD_ARRAYSIZE(settings));
+	if (0 == rc) {
+		rc = nghttp2_session_set_local_window_size(
+				connection->h2.session,
+				NGHTTP2_FLAG_NONE,
+				0,
+				(int32_t)connection_window);
+	}
+
+	if (unlikely(0 != rc)) {
+		rdlog(LOG_ERR,
+		      "Can't set %s HTTP/2 settings: %s",
+		      connection->client,
+		      nghttp2_strerror(rc));
+		connection->broken = true;
+		return;
+	}
+
+	connection->state = HTTP_NATIVE_H2;
+}
+
+/**
+ * @brief      Look for HTTP/2 prior knowledge preface at connection start,
+ *             and switch connection to HTTP/2 if it is there
+ *
+ * @param      connection  The connection
+ *
+ * @return     False if more data is needed to know
+ */
+static bool http_native_h2_preface(struct http_native_connection *connection) {
+	const size_t preface_len = strlen(HTTP_NATIVE_H2_PREFACE);
+	const size_t available = connection->in.len - connection->in.off;
+	const size_t cmp_len =
+			available < preface_len ? available : preface_len;
+
+	if (0 != memcmp(&connection->in.data[connection->in.off],
+			HTTP_NATIVE_H2_PREFACE,
+			cmp_len)) {
+		connection->preface_checked = true;
+		return true;
+	} else if (cmp_len < preface_len) {
+		return false;
+	}
+
+	connection->preface_checked = true;
+	http_native_h2_start(connection);
+	return true;
+}
+
+/// Process received HTTP/2 data
+static void http_native_h2_recv(struct http_native_connection *connection) {
+	const char *data = &connection->in.data[connection->in.off];
+	const ssize_t rc = nghttp2_session_mem_recv(
+			connection->h2.session,
+			(const uint8_t *)data,
+			connection->in.len - connection->in.off);
+	if (rc < 0) {
+		rdbg("Can't process %s HTTP/2 data: %s",
+		     connection->client,
+		     nghttp2_strerror((int)rc));
+		connection->broken = true;
+		return;
+	}
+
+	// Streams copied what they need, so buffer can be reused
+	connection->in.off = connection->in.len = 0;
+}
+
+/// Send queued HTTP/2 frames, and start closing if session is over
+static void http_native_h2_send(struct http_native_connection *connection) {
+	nghttp2_session *session = connection->h2.session;
+
+	const int rc = nghttp2_session_send(session);
+	if (rc != 0) {
+		rdbg("Can't send %s HTTP/2 data: %s",
+		     connection->client,
+		     nghttp2_strerror(rc));
+		connection->broken = true;
+		return;
+	}
+
+	if (!nghttp2_session_want_read(session) &&
+	    !nghttp2_session_want_write(session)) {
+		connection->state = HTTP_NATIVE_CLOSING;
+	}
+}
+
+/// Release connection HTTP/2 session and streams
+static void http_native_h2_done(struct http_native_connection *connection) {
+	struct http_native_stream *stream;
+
+	nghttp2_session_del(connection->h2.session);
+	connection->h2.session = NULL;
+	while ((stream = TAILQ_FIRST(&connection->h2.streams))) {
+		http_native_h2_stream_done(connection, stream);
+	}
+
+	if (connection->h2.held_back) {
+		TAILQ_REMOVE(&connection->worker->backpressure.connections,
+			     connection,
+			     h2.held_entry);
+		connection->h2.held_back = false;
+	}
+}
+
+/// Create HTTP/2 sessions callbacks and options. Return 0 if success.
+static int http_native_h2_init(struct http_native *native,
+			       size_t session_size) {
+	native->h2.session_offset =
+			size_align_to(sizeof(struct http_native_stream),
+				      HTTP_NATIVE_SESSION_ALIGNMENT);
+	native->h2.streams_slab =
+			slab_new(native->h2.session_offset + session_size,
+				 HTTP_NATIVE_STREAMS_PER_CHUNK);
+	if (unlikely(NULL == native->h2.streams_slab)) {
+		return -1;
+	}
+
+	if (0 != nghttp2_session_callbacks_new(&native->h2.callbacks) ||
+	    0 != nghttp2_option_new(&native->h2.option)) {
+		return -1;
+	}
+
+	nghttp2_session_callbacks *callbacks = native->h2.callbacks;
+	nghttp2_session_callbacks_set_send_callback(callbacks,
+						    http_native_h2_send_cb);
+	nghttp2_session_callbacks_set_on_begin_headers_callback(
+			callbacks, http_native_h2_begin_headers_cb);
+	nghttp2_session_callbacks_set_on_header_callback(
+			callbacks, http_native_h2_header_cb);
+	nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+			callbacks, http_native_h2_data_chunk_recv_cb);
+	nghttp2_session_callbacks_set_on_frame_recv_callback(
+			callbacks, http_native_h2_frame_recv_cb);
+	nghttp2_session_callbacks_set_on_stream_close_callback(
+			callbacks, http_native_h2_stream_close_cb);
+
+	// Window is given back by hand, when data has been processed and
+	// kafka queue is not over watermark
+	nghttp2_option_set_no_auto_window_update(native->h2.option, 1);
+	return 0;
+}
+
+#endif // HAVE_NGHTTP2
+
+/**
+ * @brief      Look for a complete request head in receive buffer
+ *
+ * @param      connection  The connection
+ *
+ * @return     Head end offset, or 0 if it is not complete yet
+ */
+static size_t http_native_head_end(struct http_native_connection *connection) {
+	static const char terminator[] = "\r\n\r\n";
+	const size_t terminator_len = strlen(terminator);
+
+	// Skip empty lines before request line
+	while (connection->in.off < connection->in.len &&
+	       ('\r' == connection->in.data[connection->in.off] ||
+		'\n' == connection->in.data[connection->in.off])) {
+		connection->in.off++;
+	}
+
+	size_t scan = connection->in.scan;
+	if (scan < connection->in.off) {
+		scan = connection->in.off;
+	}
+
+	const char *head_end = memmem(&connection->in.data[scan],
+				      connection->in.len - scan,
+				      terminator,
+				      terminator_len);
+	if (NULL == head_end) {
+		// Terminator could be split between reads
+		connection->in.scan = connection->in.len > terminator_len
+					      ? connection->in.len -
+							terminator_len + 1
+					      : 0;
+		return 0;
+	}
+
+	connection->in.scan = 0;
+	return (size_t)(head_end - connection->in.data) + terminator_len;
+}
+
+/// Process all complete requests in receive buffer
+static void http_native_process(struct http_native_connection *connection) {
+	const struct n2k_decoder *decoder =
+			http_native_listener(connection->worker->native)
+					->decoder;
+	struct http_native_request *request = &connection->request;
+
+	while (!connection->broken) {
+		size_t head_end;
+
+		switch (connection->state) {
+		case HTTP_NATIVE_HEAD:
+#ifdef HAVE_NGHTTP2
+			if (!connection->preface_checked) {
+				if (!http_native_h2_preface(connection)) {
+					return;
+				}
+				break;
+			}
+#endif
+			head_end = http_native_head_end(connection);
+			if (0 == head_end) {
+				return;
+			}
+
+			http_native_request_start(connection, head_end);
+			break;
+
+		case HTTP_NATIVE_BODY:
+			if (!http_native_body_process(connection)) {
+				return;
+			}
+
+			http_native_request_end(connection, request);
+			connection->state = HTTP_NATIVE_RESPONSE;
+			break;
+
+		case HTTP_NATIVE_RESPONSE:
+			if (0 != http_native_queue_response(connection)) {
+				// Wait for output room
+				return;
+			}
+
+			http_native_request_done(request, decoder);
+			connection->state = request->keep_alive
+						    ? HTTP_NATIVE_HEAD
+						    : HTTP_NATIVE_CLOSING;
+			break;
+
+#ifdef HAVE_NGHTTP2
+		case HTTP_NATIVE_H2:
+			http_native_h2_recv(connection);
+			return;
+#endif
+
+		case HTTP_NATIVE_HANDSHAKE:
+		case HTTP_NATIVE_CLOSING:
+		default:
+			return;
+		};
+	}
+}
+
+/*
+ * CONNECTIONS
+ */
+
+/**
+ * @brief      Get the receive buffer room to read more data to
+ *
+ * @param      connection  The connection
+ * @param      room_size   The room size
+ *
+ * @return     The room, or NULL if error (response is queued or connection
+ *             is broken)
+ */
+static char *http_native_read_room(struct http_native_connection *connection,
+				   size_t *room_size) {
+	struct http_native_request *request = &connection->request;
+	struct http_native_worker *worker = connection->worker;
+	const size_t buffer_size = worker->native->config.buffer_size;
+
+	if (HTTP_NATIVE_BODY == connection->state && request->body.buf &&
+	    !request->chunked) {
+		*room_size = (size_t)request->content_length -
+			     request->body.len;
+		return &request->body.data[request->body.len];
+	}
+
+	if (NULL == connection->in.buf) {
+		connection->in.buf = buffer_pool_get(worker->buffers);
+		if (unlikely(NULL == connection->in.buf)) {
+			rdlog(LOG_ERR,
+			      "Can't allocate %s receive buffer (OOM?)",
+			      connection->client);
+			connection->broken = true;
+			return NULL;
+		}
+
+		connection->in.data = pool_buffer_data(connection->in.buf);
+		connection->in.off = connection->in.len = connection->in.scan =
+				0;
+	}
+
+	if (connection->in.len == buffer_size &&
+	    HTTP_NATIVE_HEAD == connection->state && connection->in.off > 0) {
+		// Move the partial head to a new buffer: previous requests
+		// bodies can still be in use by librdkafka
+		struct pool_buffer *buf = buffer_pool_get(worker->buffers);
+		if (unlikely(NULL == buf)) {
+			rdlog(LOG_ERR,
+			      "Can't allocate %s receive buffer (OOM?)",
+			      connection->client);
+			connection->broken = true;
+			return NULL;
+		}
+
+		memcpy(pool_buffer_data(buf),
+		       &connection->in.data[connection->in.off],
+		       connection->in.len - connection->in.off);
+		pool_buffer_unref(connection->in.buf);
+		connection->in.buf = buf;
+		connection->in.data = pool_buffer_data(buf);
+		connection->in.len -= connection->in.off;
+		connection->in.scan = 0;
+		connection->in.off = 0;
+	}
+
+	if (connection->in.len == buffer_size) {
+		// Head, or head and chunk line, does not fit
+		if (HTTP_NATIVE_HEAD == connection->state) {
+			http_native_request_reset(request);
+			request->method = "";
+		}
+		request->response.code = 0;
+		http_native_response_close(
+				request,
+				MHD_HTTP_REQUEST_HEADER_FIELDS_TOO_LARGE);
+		connection->state = HTTP_NATIVE_RESPONSE;
+		return NULL;
+	}
+
+	*room_size = buffer_size - connection->in.len;
+	return &connection->in.data[connection->in.len];
+}
+
+/// Read and process available connection data
+static void http_native_read(struct http_native_connection *connection) {
+	size_t i;
+
+	for (i = 0; i < HTTP_NATIVE_MAX_READS_PER_EVENT; ++i) {
+		size_t room_size = 0;
+
+		if (connection->broken ||
+		    (HTTP_NATIVE_HEAD != connection->state &&
+		     HTTP_NATIVE_BODY != connection->state &&
+		     HTTP_NATIVE_H2 != connection->state)) {
+			break;
+		}
+
+		char *room = http_native_read_room(connection, &room_size);
+		if (NULL == room) {
+			http_native_process(connection);
+			break;
+		}
+
+		const ssize_t rc =
+				http_native_recv(connection, room, room_size);
+		if (rc > 0) {
+			connection->last_activity =
+					ev_now(connection->worker->loop);
+			if (HTTP_NATIVE_BODY == connection->state &&
+			    connection->request.body.buf &&
+			    !connection->request.chunked) {
+				connection->request.body.len += (size_t)rc;
+			} else {
+				connection->in.len += (size_t)rc;
+			}
+
+			http_native_process(connection);
+			if (NULL == connection->tls.session &&
+			    (size_t)rc < room_size) {
+				// Socket drained. TLS reads one record at a
+				// time, so it reads until EAGAIN.
+				break;
+			}
+			continue;
+		} else if (0 == rc) {
+			// Client closed. Answer already received requests.
+			if (HTTP_NATIVE_HEAD == connection->state &&
+			    connection->in.off == connection->in.len) {
+				connection->state = HTTP_NATIVE_CLOSING;
+			} else {
+				connection->broken = true;
+			}
+			break;
+		} else if (EINTR == errno) {
+			continue;
+		} else if (EAGAIN == errno) {
+			break;
+		}
+
+		rdbg("Can't receive from %s: %s",
+		     connection->client,
+		     gnu_strerror_r(errno));
+		connection->broken = true;
+		break;
+	}
+
+	if ((HTTP_NATIVE_HEAD == connection->state ||
+	     HTTP_NATIVE_H2 == connection->state) &&
+	    connection->in.buf && connection->in.off == connection->in.len) {
+		// Idle connection does not need a buffer
+		pool_buffer_unref(connection->in.buf);
+		connection->in.buf = NULL;
+	}
+}
+
+/// Release connection limits accounting
+static void http_native_limits_release(struct http_native *native,
+				       const struct sockaddr *addr) {
+	ATOMIC_OP(sub, fetch, &native->connections, 1);
+	if (native->config.per_ip_connection_limit > 0) {
+		addr_count_dec(native->ip_connections, addr);
+	}
+}
+
+/// Close a connection and release all its resources
+static void http_native_close(struct http_native_connection *connection) {
+	struct http_native_worker *worker = connection->worker;
+	struct http_native *native = worker->native;
+
+	ev_io_stop(worker->loop, &connection->watcher);
+	TAILQ_REMOVE(&worker->connections, connection, entry);
+	timer_wheel_remove(&worker->idle.wheel, &connection->idle_entry);
+
+	http_native_request_done(&connection->request,
+				 http_native_listener(native)->decoder);
+#ifdef HAVE_NGHTTP2
+	if (connection->h2.session) {
+		http_native_h2_done(connection);
+	}
+#endif
+	if (connection->in.buf) {
+		pool_buffer_unref(connection->in.buf);
+	}
+	if (connection->tls.session) {
+		gnutls_deinit(connection->tls.session);
+	}
+
+	close(connection->watcher.fd);
+	http_native_limits_release(native,
+				   (const struct sockaddr *)&connection->addr);
+	slab_free(native->connections_slab, connection);
+}
+
+/// Update connection watched events after processing, or close it
+static void http_native_update(struct http_native_connection *connection) {
+	gnutls_session_t tls = connection->tls.session;
+
+#ifdef HAVE_NGHTTP2
+	if (HTTP_NATIVE_H2 == connection->state && !connection->broken) {
+		http_native_h2_send(connection);
+	}
+#endif
+
+	if (connection->out.len > 0 && !connection->broken) {
+		http_native_flush(connection);
+	}
+
+	if (connection->broken || (HTTP_NATIVE_CLOSING == connection->state &&
+				   0 == connection->out.len)) {
+		if (HTTP_NATIVE_CLOSING == connection->state) {
+			if (tls) {
+				// Best effort, socket is not going to wait
+				gnutls_bye(tls, GNUTLS_SHUT_WR);
+			}
+			shutdown(connection->watcher.fd, SHUT_WR);
+		}
+		http_native_close(connection);
+		return;
+	}
+
+	int events = 0;
+	if (HTTP_NATIVE_HANDSHAKE == connection->state) {
+		events |= gnutls_record_get_direction(tls) ? EV_WRITE : EV_READ;
+	} else if (HTTP_NATIVE_HEAD == connection->state ||
+		   HTTP_NATIVE_BODY == connection->state ||
+		   HTTP_NATIVE_H2 == connection->state) {
+		events |= EV_READ;
+	}
+	if (connection->out.len > 0) {
+		events |= EV_WRITE;
+	}
+
+	if (events != (connection->watcher.events & (EV_READ | EV_WRITE))) {
+		ev_io_stop(connection->worker->loop, &connection->watcher);
+		ev_io_set(&connection->watcher, connection->watcher.fd, events);
+		ev_io_start(connection->worker->loop, &connection->watcher);
+	}
+
+	if (tls && HTTP_NATIVE_HANDSHAKE != connection->state &&
+	    (events & EV_READ) && gnutls_record_check_pending(tls) > 0) {
+		// Already decrypted data does not wake up socket watcher
+		ev_feed_event(connection->worker->loop,
+			      &connection->watcher,
+			      EV_READ);
+	}
+}
+
+/// Go on with connection TLS handshake
+static void http_native_handshake(struct http_native_connection *connection) {
+	struct http_native *native = connection->worker->native;
+	gnutls_session_t tls = connection->tls.session;
+	int rc;
+
+	do {
+		rc = gnutls_handshake(tls);
+	} while (rc < 0 && GNUTLS_E_AGAIN != rc && !gnutls_error_is_fatal(rc));
+
+	if (GNUTLS_E_AGAIN == rc) {
+		// Wait for socket in the direction gnutls needs
+		return;
+	} else if (rc < 0) {
+		rdbg("TLS handshake with %s failed: %s",
+		     connection->client,
+		     gnutls_strerror(rc));
+		connection->broken = true;
+		return;
+	}
+
+	connection->last_activity = ev_now(connection->worker->loop);
+	if (native->config.tls.client_ca) {
+		// Requests will be answered with the error
+		tls_valid_client_certificate(tls,
+					     &connection->tls.client_error,
+					     connection->client);
+	}
+
+	connection->state = HTTP_NATIVE_HEAD;
+#ifdef HAVE_NGHTTP2
+	gnutls_datum_t protocol;
+	if (0 == gnutls_alpn_get_selected_protocol(tls, &protocol) &&
+	    2 == protocol.size && 0 == memcmp(protocol.data, "h2", 2)) {
+		connection->preface_checked = true;
+		http_native_h2_start(connection);
+	}
+#endif
+}
+
+static void http_native_connection_cb(struct ev_loop *loop,
+				      struct ev_io *watcher,
+				      int revents) {
+	struct http_native_connection *connection = (void *)watcher;
+	(void)loop;
+
+	if (HTTP_NATIVE_HANDSHAKE == connection->state) {
+		http_native_handshake(connection);
+		http_native_update(connection);
+		return;
+	}
+
+	if (revents & EV_WRITE) {
+		http_native_flush(connection);
+		if (HTTP_NATIVE_RESPONSE == connection->state) {
+			http_native_process(connection);
+		}
+	}
+
+	if (revents & EV_READ) {
+		http_native_read(connection);
+	}
+
+	http_native_update(connection);
+}
+
+/// Account a new connection. Return true if it is under limits.
+static bool http_native_limits_acquire(struct http_native *native,
+				       const struct sockaddr *addr,
+				       const char *client) {
+	const size_t limit = native->config.connection_limit;
+	const size_t per_ip_limit = native->config.per_ip_connection_limit;
+	const size_t connections =
+			ATOMIC_OP(add, fetch, &native->connections, 1);
+
+	if (limit > 0 && connections > limit) {
+		rdlog(LOG_INFO,
+		      "Connection rejected: %s over listener connection "
+		      "limit (%zu)",
+		      client,
+		      limit);
+		goto reject;
+	}
+
+	if (per_ip_limit > 0 &&
+	    !addr_count_inc(native->ip_connections, addr, per_ip_limit)) {
+		rdlog(LOG_INFO,
+		      "Connection rejected: %s over per IP connection limit "
+		      "(%zu)",
+		      client,
+		      per_ip_limit);
+		goto reject;
+	}
+
+	return true;
+
+reject:
+	ATOMIC_OP(sub, fetch, &native->connections, 1);
+	return false;
+}
+
+static ev_tstamp http_native_idle_tick(const struct http_native *native) {
+	return (ev_tstamp)native->config.connection_timeout /
+	       (TIMER_WHEEL_SLOTS - 1);
+}
+
+/**
+ * @brief      Create connection TLS session
+ *
+ * @param      connection  The connection
+ * @param[in]  fd          The connection socket
+ *
+ * @return     0 if success, -1 if error (error is logged)
+ */
+static int http_native_tls_session(struct http_native_connection *connection,
+				   int fd) {
+	const struct http_native *native = connection->worker->native;
+	gnutls_session_t tls;
+#ifdef HAVE_NGHTTP2
+	static unsigned char h2[] = "h2";
+	static unsigned char http11[] = "http/1.1";
+	static const gnutls_datum_t protocols[] = {
+			{.data = h2, .size = sizeof(h2) - 1},
+			{.data = http11, .size = sizeof(http11) - 1},
+	};
+#endif
+
+	int rc = gnutls_init(&tls, GNUTLS_SERVER | GNUTLS_NONBLOCK);
+	if (unlikely(GNUTLS_E_SUCCESS != rc)) {
+		goto err;
+	}
+
+	rc = gnutls_set_default_priority(tls);
+	if (GNUTLS_E_SUCCESS == rc) {
+		rc = gnutls_credentials_set(tls,
+					    GNUTLS_CRD_CERTIFICATE,
+					    native->tls_credentials);
+	}
+#ifdef HAVE_NGHTTP2
+	if (GNUTLS_E_SUCCESS == rc) {
+		rc = gnutls_alpn_set_protocols(tls,
+					       protocols,
+					       RD_ARRAYSIZE(protocols),
+					       GNUTLS_ALPN_SERVER_PRECEDENCE);
+	}
+#endif
+	if (unlikely(GNUTLS_E_SUCCESS != rc)) {
+		gnutls_deinit(tls);
+		goto err;
+	}
+
+	if (native->config.tls.client_ca) {
+		// Same as libmicrohttpd: certificate is checked by requests
+		gnutls_certificate_server_set_request(tls, GNUTLS_CERT_REQUEST);
+	}
+
+	gnutls_transport_set_int(tls, fd);
+	connection->tls.session = tls;
+	connection->state = HTTP_NATIVE_HANDSHAKE;
+	return 0;
+
+err:
+	rdlog(LOG_ERR,
+	      "Can't create %s TLS session: %s",
+	      connection->client,
+	      gnutls_strerror(rc));
+	return -1;
+}
+
+/// Set up an accepted connection
+static void http_native_accepted(struct http_native_worker *worker,
+				 int fd,
+				 struct sockaddr_storage *addr) {
+	struct http_native *native = worker->native;
+	char client_buf[BUFSIZ / 16];
+	const char *client = sockaddr2str(client_buf,
+					  sizeof(client_buf),
+					  (struct sockaddr *)addr);
+	if (NULL == client) {
+		client = "unknown";
+	}
+
+	if (!client_addr_allowed((const struct sockaddr *)addr)) {
+		rdlog(LOG_INFO, "Connection rejected: %s not allowed", client);
+		close(fd);
+		return;
+	}
+
+	if (!http_native_limits_acquire(
+			    native, (const struct sockaddr *)addr, client)) {
+		close(fd);
+		return;
+	}
+
+	struct http_native_connection *connection =
+			slab_alloc(native->connections_slab);
+	if (unlikely(NULL == connection)) {
+		rdlog(LOG_ERR, "Can't allocate HTTP connection (OOM?)");
+		http_native_limits_release(native,
+					   (const struct sockaddr *)addr);
+		close(fd);
+		return;
+	}
+
+	if (AF_INET == addr->ss_family || AF_INET6 == addr->ss_family) {
+		// Responses are small and complete, don't delay them
+		static const int one = 1;
+		if (0 != setsockopt(fd,
+				    IPPROTO_TCP,
+				    TCP_NODELAY,
+				    &one,
+				    sizeof(one))) {
+			rdbg("Can't set TCP_NODELAY option");
+		}
+	}
+
+	connection->worker = worker;
+	connection->addr = *addr;
+	snprintf(connection->client, sizeof(connection->client), "%s", client);
+	connection->state = HTTP_NATIVE_HEAD;
+	if (native->tls_credentials &&
+	    0 != http_native_tls_session(connection, fd)) {
+		slab_free(native->connections_slab, connection);
+		http_native_limits_release(native,
+					   (const struct sockaddr *)addr);
+		close(fd);
+		return;
+	}
+
+	connection->last_activity = ev_now(worker->loop);
+	ev_io_init(&connection->watcher,
+		   http_native_connection_cb,
+		   fd,
+		   EV_READ);
+	ev_io_start(worker->loop, &connection->watcher);
+	TAILQ_INSERT_TAIL(&worker->connections, connection, entry);
+	if (native->config.connection_timeout > 0) {
+		timer_wheel_add(&worker->idle.wheel,
+				&connection->idle_entry,
+				TIMER_WHEEL_SLOTS - 1);
+	}
+}
+
+static void http_native_accept_cb(struct ev_loop *loop,
+				  struct ev_io *watcher,
+				  int revents) {
+	struct http_native_worker *worker = ev_userdata(loop);
+	size_t i;
+	(void)revents;
+
+	for (i = 0; i < HTTP_NATIVE_MAX_ACCEPTS_PER_EVENT; ++i) {
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		memset(&addr, 0, sizeof(addr));
+		const int fd = accept4(watcher->fd,
+				       (struct sockaddr *)&addr,
+				       &addr_len,
+				       SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd >= 0) {
+			http_native_accepted(worker, fd, &addr);
+			continue;
+		}
+
+		switch (errno) {
+		case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+		case EWOULDBLOCK:
+#endif
+			// Accept queue drained, or other worker got it
+			return;
+		case EINTR:
+		case ECONNABORTED:
+			continue;
+		default:
+			// Out of descriptors or memory: let next event retry
+			rdlog(LOG_ERR,
+			      "HTTP accept error: %s",
+			      gnu_strerror_r(errno));
+			return;
+		}
+	}
+}
+
+/**
+ * @brief      Idle wheel expire callback: close connection if it has been
+ *             idle for connection timeout, or put it back in the wheel at its
+ *             new deadline.
+ *
+ * @param      entry   The connection wheel entry
+ * @param      opaque  The worker
+ */
+static void http_native_idle_expire(struct timer_wheel_entry *entry,
+				    void *opaque) {
+	struct http_native_worker *worker = opaque;
+	struct http_native_connection *connection =
+			(void *)((char *)entry -
+				 offsetof(struct http_native_connection,
+					  idle_entry));
+	const ev_tstamp timeout =
+			(ev_tstamp)worker->native->config.connection_timeout;
+	const ev_tstamp idle = ev_now(worker->loop) - connection->last_activity;
+
+	if (idle < timeout) {
+		uint64_t ticks = (uint64_t)((timeout - idle) /
+					    http_native_idle_tick(
+							    worker->native)) +
+				 1;
+		if (ticks > TIMER_WHEEL_SLOTS - 1) {
+			ticks = TIMER_WHEEL_SLOTS - 1;
+		}
+		timer_wheel_add(&worker->idle.wheel, entry, ticks);
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Closing %s HTTP connection: idle for %.1f seconds",
+	      connection->client,
+	      idle);
+	http_native_close(connection);
+}
+
+static void http_native_idle_cb(struct ev_loop *loop,
+				struct ev_timer *timer,
+				int revents) {
+	struct http_native_worker *worker = ev_userdata(loop);
+	(void)timer;
+	(void)revents;
+
+	timer_wheel_tick(&worker->idle.wheel, http_native_idle_expire, worker);
+}
+
+#ifdef HAVE_NGHTTP2
+/// Resume timer callback: give held window back if kafka queue is low
+static void http_native_resume_cb(struct ev_loop *loop,
+				  struct ev_timer *timer,
+				  int revents) {
+	struct http_native_worker *worker = ev_userdata(loop);
+	struct http_native_connection *connection;
+	(void)revents;
+
+	if (kafka_outq_len() > worker->native->config.http2.low_watermark) {
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Kafka queue under low watermark, giving back HTTP worker %zu "
+	      "streams window",
+	      worker->idx);
+	worker->backpressure.paused = false;
+	ev_timer_stop(loop, timer);
+	while ((connection = TAILQ_FIRST(&worker->backpressure.connections))) {
+		TAILQ_REMOVE(&worker->backpressure.connections,
+			     connection,
+			     h2.held_entry);
+		connection->h2.held_back = false;
+		http_native_h2_release(connection);
+		http_native_update(connection);
+	}
+}
+#endif
+
+static void http_native_stop_cb(struct ev_loop *loop,
+				struct ev_async *watcher,
+				int revents) {
+	(void)watcher;
+	(void)revents;
+	ev_break(loop, EVBREAK_ALL);
+}
+
+/*
+ * WORKERS
+ */
+
+static void *http_native_worker_main(void *vworker) {
+	struct http_native_worker *worker = vworker;
+	struct http_native *native = worker->native;
+	struct http_native_connection *connection;
+
+	cpu_affinity_apply(&native->affinity,
+			   native->config.port,
+			   "HTTP worker",
+			   worker->idx);
+
+	// Pool needs to be owned by this thread
+	worker->buffers = buffer_pool_new(native->config.buffer_size,
+					  HTTP_NATIVE_BUFFER_POOL_MAX_FREE);
+	if (unlikely(NULL == worker->buffers)) {
+		rdlog(LOG_ERR,
+		      "Can't create HTTP worker %zu buffer pool (OOM?)",
+		      worker->idx);
+		exit(-1);
+	}
+
+	ev_run(worker->loop, 0);
+
+	while ((connection = TAILQ_FIRST(&worker->connections))) {
+		http_native_close(connection);
+	}
+	buffer_pool_done(worker->buffers);
+
+	return NULL;
+}
+
+/// Create a SO_REUSEPORT TCP listen socket
+static int http_native_listen_socket(uint16_t port) {
+	static const int one = 1;
+	const struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+
+	const int fd = socket(AF_INET,
+			      SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			      0);
+	if (fd < 0) {
+		rdlog(LOG_ERR,
+		      "Can't create HTTP socket: %s",
+		      gnu_strerror_r(errno));
+		return -1;
+	}
+
+	if (0 != setsockopt(fd,
+			    SOL_SOCKET,
+			    SO_REUSEADDR,
+			    &one,
+			    sizeof(one)) ||
+	    0 != setsockopt(fd,
+			    SOL_SOCKET,
+			    SO_REUSEPORT,
+			    &one,
+			    sizeof(one))) {
+		rdlog(LOG_ERR,
+		      "Can't set HTTP socket options: %s",
+		      gnu_strerror_r(errno));
+		goto err;
+	}
+
+	if (0 != bind(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+		rdlog(LOG_ERR,
+		      "Can't bind HTTP port %" PRIu16 ": %s",
+		      port,
+		      gnu_strerror_r(errno));
+		goto err;
+	}
+
+	if (0 != listen(fd, SOMAXCONN)) {
+		rdlog(LOG_ERR,
+		      "Can't listen in HTTP port %" PRIu16 ": %s",
+		      port,
+		      gnu_strerror_r(errno));
+		goto err;
+	}
+
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+/**
+ * @brief      Stop running workers and release all engine resources
+ *
+ * @param      native  The engine
+ */
+static void http_native_done(struct http_native *native) {
+	size_t i;
+
+	for (i = 0; i < native->workers_running; ++i) {
+		struct http_native_worker *worker = &native->workers[i];
+		ev_async_send(worker->loop, &worker->stop_async);
+		pthread_join(worker->thread, NULL);
+	}
+
+	for (i = 0; i < native->config.num_threads; ++i) {
+		struct http_native_worker *worker = &native->workers[i];
+		if (worker->loop) {
+			ev_io_stop(worker->loop, &worker->accept_watcher);
+			ev_async_stop(worker->loop, &worker->stop_async);
+			ev_timer_stop(worker->loop, &worker->idle.timer);
+#ifdef HAVE_NGHTTP2
+			ev_timer_stop(worker->loop,
+				      &worker->backpressure.resume_timer);
+#endif
+			ev_loop_destroy(worker->loop);
+		}
+
+		if (worker->listenfd >= 0 &&
+		    (0 == i || worker->listenfd != native->config.listenfd)) {
+			close(worker->listenfd);
+		}
+	}
+
+	if (native->ip_connections) {
+		addr_count_done(native->ip_connections);
+	}
+	if (native->connections_slab) {
+		slab_destroy(native->connections_slab);
+	}
+#ifdef HAVE_NGHTTP2
+	if (native->h2.streams_slab) {
+		slab_destroy(native->h2.streams_slab);
+	}
+	nghttp2_session_callbacks_del(native->h2.callbacks);
+	nghttp2_option_del(native->h2.option);
+#endif
+	if (native->tls_credentials) {
+		gnutls_certificate_free_credentials(native->tls_credentials);
+	}
+	free(native);
+}
+
+/// Load TLS credentials. Return 0 if success, -1 if error.
+static int http_native_tls_init(struct http_native *native) {
+	const char *what = "credentials";
+	const gnutls_datum_t key = {
+			.data = const_cast(native->config.tls.key),
+			.size = (unsigned int)strlen(native->config.tls.key),
+	};
+	const gnutls_datum_t cert = {
+			.data = const_cast(native->config.tls.cert),
+			.size = (unsigned int)strlen(native->config.tls.cert),
+	};
+
+	int rc = gnutls_certificate_allocate_credentials(
+			&native->tls_credentials);
+	if (unlikely(GNUTLS_E_SUCCESS != rc)) {
+		native->tls_credentials = NULL;
+		goto err;
+	}
+
+	what = "key or certificate";
+	rc = gnutls_certificate_set_x509_key_mem2(
+			native->tls_credentials,
+			&cert,
+			&key,
+			GNUTLS_X509_FMT_PEM,
+			native->config.tls.key_password,
+			0);
+	if (GNUTLS_E_SUCCESS != rc) {
+		goto err;
+	}
+
+	if (native->config.tls.client_ca) {
+		const char *client_ca = native->config.tls.client_ca;
+		const gnutls_datum_t ca = {
+				.data = const_cast(client_ca),
+				.size = (unsigned int)strlen(client_ca),
+		};
+
+		what = "clients CA";
+		rc = gnutls_certificate_set_x509_trust_mem(
+				native->tls_credentials,
+				&ca,
+				GNUTLS_X509_FMT_PEM);
+		if (rc < 0) {
+			goto err;
+		}
+	}
+
+	// Secrets are not needed anymore
+	native->config.tls.key = NULL;
+	native->config.tls.key_password = NULL;
+	native->config.tls.cert = NULL;
+	return 0;
+
+err:
+	rdlog(LOG_ERR,
+	      "Can't load HTTP TLS %s: %s",
+	      what,
+	      gnutls_strerror(rc));
+	return -1;
+}
+
+/// Prepare a worker event loop. Return 0 if success, -1 if error.
+static int http_native_worker_init(struct http_native *native, size_t idx) {
+	struct http_native_worker *worker = &native->workers[idx];
+
+	worker->native = native;
+	worker->idx = idx;
+	TAILQ_INIT(&worker->connections);
+	timer_wheel_init(&worker->idle.wheel);
+#ifdef HAVE_NGHTTP2
+	TAILQ_INIT(&worker->backpressure.connections);
+	ev_timer_init(&worker->backpressure.resume_timer,
+		      http_native_resume_cb,
+		      0.,
+		      HTTP_NATIVE_BACKPRESSURE_CHECK_INTERVAL);
+#endif
+
+	worker->listenfd = native->config.listenfd >= 0
+				   ? native->config.listenfd
+				   : http_native_listen_socket(
+						     native->config.port);
+	if (worker->listenfd < 0) {
+		return -1;
+	}
+
+	worker->loop = ev_loop_new(EVBACKEND_EPOLL);
+	if (NULL == worker->loop) {
+		rdlog(LOG_ERR, "Can't create HTTP worker %zu event loop", idx);
+		return -1;
+	}
+
+	ev_set_userdata(worker->loop, worker);
+	ev_async_init(&worker->stop_async, http_native_stop_cb);
+	ev_async_start(worker->loop, &worker->stop_async);
+	ev_io_init(&worker->accept_watcher,
+		   http_native_accept_cb,
+		   worker->listenfd,
+		   EV_READ);
+	ev_io_start(worker->loop, &worker->accept_watcher);
+	if (native->config.connection_timeout > 0) {
+		const ev_tstamp tick = http_native_idle_tick(native);
+		ev_timer_init(&worker->idle.timer,
+			      http_native_idle_cb,
+			      tick,
+			      tick);
+		ev_timer_start(worker->loop, &worker->idle.timer);
+	}
+
+	return 0;
+}
+
+struct http_native *
+http_native_start(struct http_listener *http_listener,
+		  const struct http_native_config *config,
+		  const struct cpu_affinity *affinity) {
+	const struct n2k_decoder *decoder =
+			http_listener_cast_listener(http_listener)->decoder;
+	const size_t session_size =
+			decoder->session_size ? decoder->session_size() : 0;
+	size_t i;
+
+	const size_t workers_size =
+			config->num_threads * sizeof(struct http_native_worker);
+	struct http_native *native = calloc(1, sizeof(*native) + workers_size);
+	if (unlikely(NULL == native)) {
+		rdlog(LOG_ERR, "Can't allocate HTTP native engine (OOM?)");
+		if (config->listenfd >= 0) {
+			close(config->listenfd);
+		}
+		return NULL;
+	}
+
+	native->listener = http_listener;
+	native->config = *config;
+	native->affinity = *affinity;
+	for (i = 0; i < config->num_threads; ++i) {
+		native->workers[i].listenfd = -1;
+	}
+
+	native->session_offset =
+			size_align_to(sizeof(struct http_native_connection),
+				      HTTP_NATIVE_SESSION_ALIGNMENT);
+	native->connections_slab =
+			slab_new(native->session_offset + session_size,
+				 HTTP_NATIVE_CONNECTIONS_PER_CHUNK);
+	if (unlikely(NULL == native->connections_slab)) {
+		rdlog(LOG_ERR, "Can't allocate HTTP connections (OOM?)");
+		goto err;
+	}
+
+	if (config->per_ip_connection_limit > 0) {
+		native->ip_connections = addr_count_new();
+		if (unlikely(NULL == native->ip_connections)) {
+			rdlog(LOG_ERR,
+			      "Can't allocate HTTP per IP connections (OOM?)");
+			goto err;
+		}
+	}
+
+	if (config->tls.key && 0 != http_native_tls_init(native)) {
+		goto err;
+	}
+
+#ifdef HAVE_NGHTTP2
+	if (0 != http_native_h2_init(native, session_size)) {
+		rdlog(LOG_ERR, "Can't allocate HTTP/2 resources (OOM?)");
+		goto err;
+	}
+#endif
+
+	for (i = 0; i < config->num_threads; ++i) {
+		if (0 != http_native_worker_init(native, i)) {
+			goto err;
+		}
+	}
+
+	for (i = 0; i < config->num_threads; ++i) {
+		struct http_native_worker *worker = &native->workers[i];
+		const int create_rc = pthread_create(&worker->thread,
+						     NULL,
+						     http_native_worker_main,
+						     worker);
+		if (0 != create_rc) {
+			rdlog(LOG_ERR,
+			      "Can't create HTTP worker thread: %s",
+			      gnu_strerror_r(create_rc));
+			goto err;
+		}
+		native->workers_running++;
+	}
+
+	return native;
+
+err:
+	if (config->listenfd >= 0 && native->workers[0].listenfd < 0) {
+		close(config->listenfd);
+	}
+	http_native_done(native);
+	return NULL;
+}
+
+void http_native_stop(struct http_native *native) {
+	http_native_done(native);
+}
+
+#endif // HAVE_LIBMICROHTTPD
@@ -0,0 +1,113 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "config.h"
+
+#ifdef HAVE_LIBMICROHTTPD
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In-tree HTTP/1.1 engine, alternative to libmicrohttpd, built for POST
+ * ingestion.
+ *
+ * Every worker thread runs its own epoll event loop, accepting from its own
+ * SO_REUSEPORT socket (or from the shared unix socket). Requests are parsed
+ * in place in the connection receive buffer, with no allocation per request,
+ * and connections support keep-alive and pipelining. Receive buffers come
+ * from per-worker buffer pools, so the body of a request to a sessionless
+ * decoder is handed to it in the same reference counted buffer it has been
+ * read to, and it can go straight to librdkafka.
+ *
+ * If built with libnghttp2, connections can also speak HTTP/2, negotiated
+ * with ALPN over TLS or with prior knowledge in cleartext. Every stream is a
+ * request with its own decoder session, and streams flow control windows are
+ * only given back to clients while the kafka producer queue is not over the
+ * backpressure watermark.
+ */
+
+struct cpu_affinity;
+struct http_listener;
+
+/// Native engine
+struct http_native;
+
+/// Native engine configuration
+struct http_native_config {
+	uint16_t port; ///< TCP port, if not listening in unix socket
+	/// Listen unix socket, or -1 to listen in TCP port. Engine closes it
+	/// at stop, or if it can't start.
+	int listenfd;
+	size_t num_threads; ///< Number of worker threads
+	/// Connections receive buffer size. Request heads can't be bigger.
+	size_t buffer_size;
+	size_t connection_limit; ///< Max connections. 0 means unlimited
+	/// Max connections of a client address. 0 means unlimited
+	size_t per_ip_connection_limit;
+	/// Close connections without activity for this time, in seconds. 0
+	/// means disabled
+	int connection_timeout;
+
+	/// TLS credentials, in PEM format. Engine loads them at start.
+	struct {
+		const char *key; ///< Server key, or NULL to disable TLS
+		const char *key_password; ///< Server key password, or NULL
+		const char *cert;	  ///< Server certificate
+		/// Clients CA, or NULL to not ask clients for certificates
+		const char *client_ca;
+	} tls;
+
+	/// HTTP/2 streams configuration
+	struct {
+		size_t max_streams; ///< Max concurrent streams per connection
+		/// Stop giving streams window back when kafka producer queue
+		/// has this number of messages. 0 means disabled
+		size_t high_watermark;
+		/// Give streams window back again when kafka producer queue
+		/// goes down to this number of messages
+		size_t low_watermark;
+	} http2;
+};
+
+/**
+ * @brief      Start a native engine for a HTTP listener
+ *
+ * @param      http_listener  The HTTP listener
+ * @param[in]  config         The engine configuration
+ * @param[in]  affinity       The worker threads placement
+ *
+ * @return     The running engine, or NULL if error (error is logged)
+ */
+struct http_native *
+http_native_start(struct http_listener *http_listener,
+		  const struct http_native_config *config,
+		  const struct cpu_affinity *affinity);
+
+/**
+ * @brief      Stop a native engine, closing all its connections
+ *
+ * @param      native  The engine
+ */
+void http_native_stop(struct http_native *native);
+
+#endif // HAVE_LIBMICROHTTPD
@@ -0,0 +1,157 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "inflate_pool.h"
+
+#include "util/buffer_pool.h"
+#include "util/util.h"
+
+#include <librd/rdlog.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+/// Max free streams kept per thread. Every one keeps ~40KB of zlib state.
+#define INFLATE_POOL_MAX_STREAMS 16
+
+/// Max free output buffers kept per thread. Only one is used at a time.
+#define INFLATE_POOL_MAX_BUFFERS 1
+
+/// Max window size, and zlib/gzip header autodetection
+#define INFLATE_WINDOW_BITS (15 | 32)
+
+/// Per thread pools
+struct inflate_pool {
+	struct buffer_pool *buffers; ///< Output buffers
+	size_t streams_count;	     ///< Number of free streams
+	inflate_stream *streams[INFLATE_POOL_MAX_STREAMS]; ///< Free streams
+};
+
+static pthread_key_t inflate_pool_key;
+static pthread_once_t inflate_pool_key_once = PTHREAD_ONCE_INIT;
+
+/// Release thread pools at thread exit
+static void inflate_pool_destroy(void *vpool) {
+	struct inflate_pool *pool = vpool;
+	size_t i;
+
+	for (i = 0; i < pool->streams_count; ++i) {
+		inflate_stream_end(pool->streams[i]);
+		free(pool->streams[i]);
+	}
+
+	if (pool->buffers) {
+		buffer_pool_done(pool->buffers);
+	}
+	free(pool);
+}
+
+static void inflate_pool_key_create() {
+	const int rc = pthread_key_create(&inflate_pool_key,
+					  inflate_pool_destroy);
+	if (rc != 0) {
+		rdlog(LOG_ERR, "Can't create inflate pool key: %d", rc);
+		abort();
+	}
+}
+
+/// Calling thread pools, created on first use. NULL if no memory.
+static struct inflate_pool *inflate_pool_thread() {
+	pthread_once(&inflate_pool_key_once, inflate_pool_key_create);
+
+	struct inflate_pool *pool = pthread_getspecific(inflate_pool_key);
+	if (likely(pool)) {
+		return pool;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (unlikely(NULL == pool)) {
+		rdlog(LOG_ERR, "Can't allocate inflate pool (OOM?)");
+		return NULL;
+	}
+
+	pool->buffers = buffer_pool_new(INFLATE_POOL_BUFFER_SIZE,
+					INFLATE_POOL_MAX_BUFFERS);
+	if (unlikely(NULL == pool->buffers) ||
+	    unlikely(0 != pthread_setspecific(inflate_pool_key, pool))) {
+		rdlog(LOG_ERR, "Can't create inflate pool (OOM?)");
+		inflate_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+inflate_stream *inflate_pool_stream_get(int *z_rc) {
+	struct inflate_pool *pool = inflate_pool_thread();
+	if (unlikely(NULL == pool)) {
+		*z_rc = Z_MEM_ERROR;
+		return NULL;
+	}
+
+	if (likely(pool->streams_count > 0)) {
+		// Already reset when it was returned
+		return pool->streams[--pool->streams_count];
+	}
+
+	inflate_stream *strm = calloc(1, sizeof(*strm));
+	if (unlikely(NULL == strm)) {
+		*z_rc = Z_MEM_ERROR;
+		return NULL;
+	}
+
+	strm->zalloc = Z_NULL;
+	strm->zfree = Z_NULL;
+	strm->opaque = Z_NULL;
+	strm->avail_in = 0;
+	strm->next_in = Z_NULL;
+
+	*z_rc = inflate_stream_init2(strm, INFLATE_WINDOW_BITS);
+	if (unlikely(*z_rc != Z_OK)) {
+		free(strm);
+		return NULL;
+	}
+
+	return strm;
+}
+
+void inflate_pool_stream_put(inflate_stream *strm) {
+	struct inflate_pool *pool = inflate_pool_thread();
+
+	// Reset keeps the allocated window, so next request does not need it
+	if (likely(pool && pool->streams_count < INFLATE_POOL_MAX_STREAMS) &&
+	    likely(Z_OK == inflate_stream_reset2(strm, INFLATE_WINDOW_BITS))) {
+		strm->next_in = Z_NULL;
+		strm->avail_in = 0;
+		strm->next_out = Z_NULL;
+		strm->avail_out = 0;
+		pool->streams[pool->streams_count++] = strm;
+		return;
+	}
+
+	inflate_stream_end(strm);
+	free(strm);
+}
+
+struct pool_buffer *inflate_pool_buffer_get() {
+	struct inflate_pool *pool = inflate_pool_thread();
+	return likely(pool) ? buffer_pool_get(pool->buffers) : NULL;
+}
@@ -0,0 +1,83 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "config.h"
+
+#ifdef HAVE_ZLIB_NG
+#include <zlib-ng.h>
+
+/// Inflate stream, using zlib-ng vectorized implementation
+typedef zng_stream inflate_stream;
+#define inflate_stream_init2(strm, window_bits)                                \
+	zng_inflateInit2(strm, window_bits)
+#define inflate_stream_reset2(strm, window_bits)                               \
+	zng_inflateReset2(strm, window_bits)
+#define inflate_stream_inflate(strm, flush) zng_inflate(strm, flush)
+#define inflate_stream_end(strm) zng_inflateEnd(strm)
+#else
+#include <zlib.h>
+
+/// Inflate stream
+typedef z_stream inflate_stream;
+#define inflate_stream_init2(strm, window_bits) inflateInit2(strm, window_bits)
+#define inflate_stream_reset2(strm, window_bits)                               \
+	inflateReset2(strm, window_bits)
+#define inflate_stream_inflate(strm, flush) inflate(strm, flush)
+#define inflate_stream_end(strm) inflateEnd(strm)
+#endif
+
+/*
+ * Per thread pools of inflate streams and output buffers for HTTP compressed
+ * requests, so a request does not need to allocate nor initialize zlib state.
+ * Objects are returned to the pool of the thread that releases them, so they
+ * can be released from any thread.
+ */
+
+struct pool_buffer;
+
+/// Size of inflate output buffers
+#define INFLATE_POOL_BUFFER_SIZE (512 * 1024)
+
+/**
+ * @brief      Get an inflate stream ready to decompress a new deflate or gzip
+ *             body (autodetected)
+ *
+ * @param      z_rc  zlib error if return is NULL
+ *
+ * @return     The stream, or NULL if error
+ */
+inflate_stream *inflate_pool_stream_get(int *z_rc);
+
+/**
+ * @brief      Give an inflate stream back to the calling thread pool
+ *
+ * @param      strm  The stream, got with inflate_pool_stream_get
+ */
+void inflate_pool_stream_put(inflate_stream *strm);
+
+/**
+ * @brief      Get an inflate output buffer of INFLATE_POOL_BUFFER_SIZE bytes.
+ *             Release it with pool_buffer_unref.
+ *
+ * @return     The buffer, or NULL if no memory
+ */
+struct pool_buffer *inflate_pool_buffer_get(void);
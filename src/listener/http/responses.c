@@ -53,6 +53,42 @@ int send_buffered_response(struct MHD_Connection *con,
 	return ret;
 }
 
+/**
+ * @brief      Transform decoder error code to http code.
+ *
+ * @param[in]  decode_rc  The decoder return code
+ *
+ * @return     HTTP response code
+ */
+unsigned int decoder_err2http(enum decoder_callback_err decode_rc) {
+	switch (decode_rc) {
+	case DECODER_CALLBACK_OK:
+		return MHD_HTTP_OK;
+	case DECODER_CALLBACK_BUFFER_FULL:
+		return MHD_HTTP_SERVICE_UNAVAILABLE;
+
+	// Client side errors
+	case DECODER_CALLBACK_INVALID_REQUEST:
+	case DECODER_CALLBACK_UNKNOWN_TOPIC:
+	case DECODER_CALLBACK_UNKNOWN_PARTITION:
+		return MHD_HTTP_BAD_REQUEST;
+
+	// Kafka errors - Client side
+	case DECODER_CALLBACK_MSG_TOO_LARGE:
+		return MHD_HTTP_PAYLOAD_TOO_LARGE;
+
+	// HTTP errors
+	case DECODER_CALLBACK_HTTP_METHOD_NOT_ALLOWED:
+		return MHD_HTTP_METHOD_NOT_ALLOWED;
+	case DECODER_CALLBACK_RESOURCE_NOT_FOUND:
+		return MHD_HTTP_NOT_FOUND;
+	case DECODER_CALLBACK_MEMORY_ERROR:
+	case DECODER_CALLBACK_GENERIC_ERROR:
+	default:
+		return MHD_HTTP_INTERNAL_SERVER_ERROR;
+	}
+}
+
 int send_http_ok(struct MHD_Connection *connection) {
 	return MHD_queue_response(
 			connection, MHD_HTTP_OK, http_responses.empty_response);
@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include "decoder/decoder_api.h"
+
 #include <microhttpd.h>
 
 #include <string.h>
@@ -43,6 +45,15 @@ int send_buffered_response(struct MHD_Connection *con,
 			   enum MHD_ResponseMemoryMode buf_kind,
 			   unsigned int response_code);
 
+/**
+ * @brief      Transform decoder error code to http code.
+ *
+ * @param[in]  decode_rc  The decoder return code
+ *
+ * @return     HTTP response code
+ */
+unsigned int decoder_err2http(enum decoder_callback_err decode_rc);
+
 /**
  * @brief      Sends a http 200 ok
  *
@@ -44,6 +44,9 @@ typedef struct listener {
 	const struct n2k_decoder *decoder; ///< Decoder to use
 	void *decoder_opaque;		   ///< Decode per-listener opaque
 	uint16_t port;			   ///< as listener ID
+	/// Config of listener, as listener ID if it has no port. Owned by
+	/// global config.
+	json_t *config;
 	LIST_ENTRY(listener) entry;	///< Listener list entry
 } listener;
 
@@ -72,6 +75,47 @@ static enum decoder_callback_err listener_decode(const struct listener *this,
 				       session);
 }
 
+/** Decode a batch of sessionless messages, using decoder batch callback if
+    available
+    @param this Listener
+    @param msgs Messages to decode
+    @param msgs_count Number of messages
+    @return First non-OK decoder error, or OK if all went fine
+    */
+static enum decoder_callback_err
+listener_decode_batch(const struct listener *this,
+		      const struct n2k_decoder_batch_msg *msgs,
+		      size_t msgs_count) __attribute__((unused));
+static enum decoder_callback_err
+listener_decode_batch(const struct listener *this,
+		      const struct n2k_decoder_batch_msg *msgs,
+		      size_t msgs_count) {
+	if (this->decoder->callback_batch) {
+		return this->decoder->callback_batch(
+				msgs, msgs_count, this->decoder_opaque);
+	}
+
+	enum decoder_callback_err ret = DECODER_CALLBACK_OK;
+	size_t i;
+	for (i = 0; i < msgs_count; ++i) {
+		const char *response = NULL;
+		size_t response_size = 0;
+		const enum decoder_callback_err rc =
+				listener_decode(this,
+						msgs[i].buffer,
+						msgs[i].buf_size,
+						msgs[i].props,
+						&response,
+						&response_size,
+						NULL);
+		if (ret == DECODER_CALLBACK_OK) {
+			ret = rc;
+		}
+	}
+
+	return ret;
+}
+
 int listener_reload(struct listener *listener, struct json_t *new_config);
 
 /// @note This join DOES NOT free listener used space
@@ -1,5 +1,8 @@
 THIS_SRCS := \
-	socket.c
+	socket.c \
+	socket_framing.c \
+	socket_packet.c \
+	socket_uring.c
 
 SRCS += $(addprefix $(CURRENT_N2KAFKA_DIR), $(THIS_SRCS))
 THIS_SRCS :=
@@ -21,11 +21,23 @@
 */
 
 #include "socket.h"
+#include "socket_framing.h"
+#include "socket_uring.h"
+
+#include "config.h"
 
 #include "engine/global_config.h"
 #include "engine/rb_addr.h"
-#include "util/in_addr_list.h"
+#include "util/addr_count.h"
+#include "util/buffer_pool.h"
+#include "util/cpu_affinity.h"
+#include "util/kafka.h"
+#include "util/latency_histogram.h"
 #include "util/pair.h"
+#include "util/slab.h"
+#include "util/string.h"
+#include "util/timer_wheel.h"
+#include "util/unix_socket.h"
 #include "util/util.h"
 
 #include <ev.h>
@@ -37,15 +49,25 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/sock_diag.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
@@ -58,6 +80,7 @@ struct n2k_decoder;
 
 #define N2KAFKA_TCP "tcp"
 #define N2KAFKA_UDP "udp"
+#define N2KAFKA_UNIX "unix"
 
 #define CONFIG_NUM_THREADS "threads"
 
@@ -70,15 +93,101 @@ enum thread_mode {
 	MODE_POLL,
 #define STR_MODE_EPOLL "epoll"
 	MODE_EPOLL,
+#define STR_MODE_IO_URING "io_uring"
+	MODE_IO_URING,
 	MODE_INVALID
 };
 
+struct socket_listener;
+
+/// Kafka producer queue backpressure
+struct kafka_backpressure {
+	/// Stop reading when producer queue reaches it. 0 means disabled
+	size_t high_watermark;
+	/// Resume reading when producer queue goes down to it
+	size_t low_watermark;
+
+	/// Statistics
+	struct {
+		uint64_t pauses; ///< Number of times reading has been paused
+		/// Messages/records read after resuming, that were held back in
+		/// socket buffers
+		uint64_t held_back_messages;
+		uint64_t held_back_bytes; ///< Bytes of held back messages
+	} stats;
+};
+
+/// TCP worker thread load. Updated by the worker and read by the acceptor
+struct worker_load {
+	size_t connections; ///< Number of assigned connections
+	uint64_t bytes;	    ///< Total read bytes
+	/// Pending connection migration request: Target worker index + 1, or 0
+	/// if none
+	size_t migrate_to;
+
+	/// Acceptor thread private
+	uint64_t last_bytes;	 ///< bytes at the beginning of last interval
+	uint64_t interval_bytes; ///< bytes read in last interval
+} __attribute__((aligned(64)));
+
+/// UDP socket kernel drops and receive buffer tracking
+struct udp_socket_state {
+	int fd;
+	uint32_t rxq_ovfl;    ///< Last SO_RXQ_OVFL counter read
+	int rcvbuf;	      ///< Last requested receive buffer size
+	time_t last_autotune; ///< Last time receive buffer was grown
+};
+
 struct udp_thread_info {
-	pthread_mutex_t listenfd_mutex;
+	/// Serialize reads of a shared listenfd. NULL if thread owns listenfd
+	pthread_mutex_t *listenfd_mutex;
 	int listenfd;
-	const struct listener *listener;
+	/// listenfd state. Protected by listenfd_mutex if socket is shared
+	struct udp_socket_state *socket_state;
+	struct socket_listener *socket_listener;
+	size_t idx; ///< Thread index
+};
+
+/// TCP connections assignment to worker threads
+enum connection_balance {
+#define STR_BALANCE_ROUND_ROBIN "round_robin"
+	BALANCE_ROUND_ROBIN,
+#define STR_BALANCE_LEAST_CONNECTIONS "least_connections"
+	BALANCE_LEAST_CONNECTIONS,
+#define STR_BALANCE_LEAST_BYTES "least_bytes"
+	BALANCE_LEAST_BYTES,
+	BALANCE_INVALID
+};
+
+static enum connection_balance connection_balance_str(const char *str) {
+	if (NULL == str || 0 == strcmp(STR_BALANCE_ROUND_ROBIN, str))
+		return BALANCE_ROUND_ROBIN;
+	if (0 == strcmp(STR_BALANCE_LEAST_CONNECTIONS, str))
+		return BALANCE_LEAST_CONNECTIONS;
+	if (0 == strcmp(STR_BALANCE_LEAST_BYTES, str))
+		return BALANCE_LEAST_BYTES;
+	return BALANCE_INVALID;
+}
+
+/// How sockets are read
+enum latency_mode {
+#define STR_LATENCY_MODE_THROUGHPUT "throughput"
+	/// Wait for sockets readiness, and read big batches
+	LATENCY_MODE_THROUGHPUT,
+#define STR_LATENCY_MODE_BUSY_POLL SOCKET_LATENCY_MODE_BUSY_POLL
+	/// Keep polling sockets without waiting while they have data
+	LATENCY_MODE_BUSY_POLL,
+	LATENCY_MODE_INVALID
 };
 
+static enum latency_mode latency_mode_str(const char *str) {
+	if (NULL == str || 0 == strcmp(STR_LATENCY_MODE_THROUGHPUT, str))
+		return LATENCY_MODE_THROUGHPUT;
+	if (0 == strcmp(STR_LATENCY_MODE_BUSY_POLL, str))
+		return LATENCY_MODE_BUSY_POLL;
+	return LATENCY_MODE_INVALID;
+}
+
 static enum thread_mode thread_mode_str(const char *mode_str) {
 	if (NULL == mode_str ||
 	    0 == strcmp(STR_MODE_THREAD_PER_CONNECTION, mode_str))
@@ -89,17 +198,72 @@ static enum thread_mode thread_mode_str(const char *mode_str) {
 		return MODE_POLL;
 	if (0 == strcmp(STR_MODE_EPOLL, mode_str))
 		return MODE_EPOLL;
+	if (0 == strcmp(STR_MODE_IO_URING, mode_str))
+		return MODE_IO_URING;
 	return MODE_INVALID;
 }
 
 #define READ_BUFFER_SIZE 4096
+/// Number of TCP read sizes, from READ_BUFFER_SIZE doubling up to 256KB
+#define TCP_READ_SIZE_CLASSES 7
+/// Reset TCP connection read size if it has been idle for this time, in
+/// seconds
+#define TCP_READ_SIZE_IDLE_RESET 1.
+/// UDP read buffer size if GRO is enabled, enough for a coalesced super
+/// datagram
+#define UDP_GRO_BUFFER_SIZE 65536
+/// Max number of datagrams that kernel coalesces in the same UDP GRO read
+#define UDP_GRO_MAX_SEGMENTS 64
+/// Max number of free read buffers that every thread keeps. Decoders can
+/// keep buffers until kafka delivery report, so it needs to cover a few
+/// batches in flight.
+#define BUFFER_POOL_MAX_FREE 1024
+/// Max number of TCP connections accepted in the same readiness event, so
+/// accepting does not starve the rest of the loop
+#define TCP_MAX_ACCEPTS_PER_EVENT 64
+/// Max number of TCP reads in the same readiness event
+#define TCP_MAX_READS_PER_EVENT 8
+/// Max number of TCP records sent to decoder in the same batch
+#define TCP_RECORDS_BATCH_SIZE 256
+/// Default max TCP record size, if framing is used
+#define DEFAULT_MAX_RECORD_SIZE (1024 * 1024)
+/// Decoder session URI prefix, as if it was an HTTP POST
+#define SESSION_URI_PREFIX "/v1/data/"
+/// Decoder session memory alignment
+#define SESSION_ALIGNMENT 16
+/// Number of decoder session properties set by the listener
+#define SESSION_LISTENER_PROPS 4
+/// Kafka producer queue check interval while reading is paused, in seconds
+#define BACKPRESSURE_CHECK_INTERVAL 0.01
+/// TCP workers load measurement interval, in seconds
+#define WORKER_LOAD_INTERVAL 1.
+/// Rebalance connections if busiest worker reads this times the idlest one
+#define REBALANCE_RATIO 2
+/// Don't rebalance connections if busiest worker reads less bytes than this
+/// in load interval
+#define REBALANCE_MIN_BYTES (1024 * 1024)
+/// Only migrate connections that have been idle for this time, in seconds
+#define REBALANCE_MIN_IDLE 0.1
+/// Default number of datagrams to read in the same recvmmsg call
+#define DEFAULT_UDP_BATCH_SIZE 64
+/// Max number of datagrams to read in the same recvmmsg call
+#define MAX_UDP_BATCH_SIZE UIO_MAXIOV
+/// Min interval between UDP receive buffer grows, in seconds
+#define RCVBUF_AUTOTUNE_INTERVAL 1
+/// Default busy poll time without data before waiting for sockets, in
+/// microseconds
+#define DEFAULT_BUSY_POLL_BUDGET_US 50
+/// TCP connections allocated at once in connections slab
+#define CONNECTIONS_SLAB_CHUNK 64
 static const struct timeval READ_SELECT_TIMEVAL = {.tv_sec = 20, .tv_usec = 0};
 static const struct timeval WRITE_SELECT_TIMEVAL = {.tv_sec = 5, .tv_usec = 0};
 
 /// @TODO this can't be global, it produces a race condition!
 static int do_shutdown = 0;
 
-static int createListenSocket(const char *proto, uint16_t listen_port) {
+static int createListenSocket(const char *proto,
+			      uint16_t listen_port,
+			      bool reuseport) {
 	int listenfd = 0;
 	if (NULL == proto) {
 		rdlog(LOG_ERR, "Can't create listen socket: No protocol given");
@@ -134,6 +298,22 @@ static int createListenSocket(const char *proto, uint16_t listen_port) {
 		      gnu_strerror_r(errno));
 	}
 
+	if (reuseport) {
+		const int so_reuseport_value = 1;
+		const int reuseport_rc = setsockopt(listenfd,
+						    SOL_SOCKET,
+						    SO_REUSEPORT,
+						    &so_reuseport_value,
+						    sizeof(so_reuseport_value));
+		if (reuseport_rc < 0) {
+			rdlog(LOG_ERR,
+			      "Error setting SO_REUSEPORT socket option: %s",
+			      gnu_strerror_r(errno));
+			close(listenfd);
+			return -1;
+		}
+	}
+
 	struct sockaddr_in server_addr;
 	memset(&server_addr, 0, sizeof(server_addr));
 
@@ -168,6 +348,114 @@ static int createListenSocket(const char *proto, uint16_t listen_port) {
 	return listenfd;
 }
 
+/**
+ * @brief      Make the kernel deliver each flow to the SO_REUSEPORT group
+ *             socket with index (current CPU % num_sockets), so the flow keeps
+ *             being processed in the CPU that received it.
+ *
+ * @param[in]  fd           Any socket of the SO_REUSEPORT group
+ * @param[in]  num_sockets  The number of sockets in the group
+ *
+ * @return     0 if success, -1 in other case (errno set)
+ */
+static int attach_reuseport_cpu_cbpf(int fd, size_t num_sockets) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	struct sock_filter code[] = {
+			/* A = raw_smp_processor_id() */
+			{BPF_LD | BPF_W | BPF_ABS,
+			 0,
+			 0,
+			 (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)},
+			/* A = A % num_sockets */
+			{BPF_ALU | BPF_MOD | BPF_K,
+			 0,
+			 0,
+			 (uint32_t)num_sockets},
+			/* return A */
+			{BPF_RET | BPF_A, 0, 0, 0},
+	};
+	const struct sock_fprog prog = {
+			.len = RD_ARRAYSIZE(code), .filter = code,
+	};
+
+	return setsockopt(fd,
+			  SOL_SOCKET,
+			  SO_ATTACH_REUSEPORT_CBPF,
+			  &prog,
+			  sizeof(prog));
+#else
+	(void)fd;
+	(void)num_sockets;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+/**
+ * @brief      Place listener threads where the reuseport CPU program delivers
+ *             their flows. Program selects thread (CPU % threads), so thread
+ *             i should run in CPU i: threads are pinned that way if user did
+ *             not place them, and user placement is checked if they did.
+ *
+ * @param      affinity  The listener threads placement
+ * @param[in]  threads   The number of listener threads
+ */
+static void reuseport_cpu_affinity_config(struct cpu_affinity *affinity,
+					  size_t threads) {
+	const long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t cpu, i = 0;
+
+	if (online_cpus > 0 && (size_t)online_cpus != threads) {
+		rdlog(LOG_WARNING,
+		      "reuseport_cpu_affinity with %zu threads but %ld online "
+		      "CPUs: flows of some CPUs will be read in other CPUs",
+		      threads,
+		      online_cpus);
+	}
+
+	if (!cpu_affinity_enabled(affinity)) {
+		CPU_ZERO(&affinity->cpus);
+		for (cpu = 0; cpu < threads && cpu < (size_t)online_cpus;
+		     ++cpu) {
+			CPU_SET(cpu, &affinity->cpus);
+		}
+		affinity->cpus_count = (size_t)CPU_COUNT(&affinity->cpus);
+		rdlog(LOG_INFO,
+		      "reuseport_cpu_affinity without cpu_affinity: pinning "
+		      "every thread to the CPU of its flows");
+		return;
+	}
+
+	// Thread i runs in the (i % cpus_count)-th CPU of the set
+	for (cpu = 0; cpu < CPU_SETSIZE && i < threads; ++cpu) {
+		if (!CPU_ISSET(cpu, &affinity->cpus)) {
+			continue;
+		}
+
+		if (cpu % threads != i) {
+			rdlog(LOG_WARNING,
+			      "reuseport_cpu_affinity: thread %zu runs in CPU "
+			      "%zu, but it reads the flows of CPU %zu. List "
+			      "the CPUs that receive the flows in order in "
+			      "cpu_affinity",
+			      i,
+			      cpu,
+			      i);
+			return;
+		}
+		i++;
+	}
+
+	if (i < threads) {
+		rdlog(LOG_WARNING,
+		      "reuseport_cpu_affinity: %zu threads but only %zu CPUs "
+		      "in cpu_affinity, some threads will read flows of other "
+		      "CPUs",
+		      threads,
+		      i);
+	}
+}
+
 static int createListenSocketMutex(pthread_mutex_t *mutex) {
 	const int init_returned = pthread_mutex_init(mutex, NULL);
 	if (init_returned != 0)
@@ -188,15 +476,96 @@ static void set_keepalive_opt(int fd) {
 		rdbg("Can't set SO_KEEPALIVE option");
 }
 
+/// Socket receive buffer size as reported by kernel (twice the requested
+/// one, because of bookkeeping overhead), or -1 if error
+static int get_rcvbuf_opt(int fd) {
+	int rcvbuf = -1;
+	socklen_t len = sizeof(rcvbuf);
+	const int gso_rc = getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+	return gso_rc == 0 ? rcvbuf : -1;
+}
+
+/**
+ * @brief      Set socket receive buffer size. SO_RCVBUFFORCE is tried first,
+ *             so net.core.rmem_max can be exceeded if we have CAP_NET_ADMIN.
+ *
+ * @param[in]  fd      The socket
+ * @param[in]  rcvbuf  The requested receive buffer size
+ *
+ * @return     Effective receive buffer size, as get_rcvbuf_opt
+ */
+static int set_rcvbuf_opt(int fd, int rcvbuf) {
+	const socklen_t len = sizeof(rcvbuf);
+	if (0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, len) &&
+	    0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, len)) {
+		rdlog(LOG_WARNING,
+		      "Can't set socket receive buffer to %d bytes: %s",
+		      rcvbuf,
+		      gnu_strerror_r(errno));
+	}
+
+	return get_rcvbuf_opt(fd);
+}
+
+/// Bytes waiting in socket receive queue, or -1 if unknown
+static int64_t get_rmem_alloc(int fd) {
+#ifdef SO_MEMINFO
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+	const int gso_rc =
+			getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len);
+	if (gso_rc == 0 &&
+	    len > SK_MEMINFO_RMEM_ALLOC * sizeof(meminfo[0])) {
+		return meminfo[SK_MEMINFO_RMEM_ALLOC];
+	}
+#else
+	(void)fd;
+#endif
+	return -1;
+}
+
+/// Datagrams dropped by kernel because receive buffer of socket was full, or
+/// connections dropped because accept queue of listen socket was full (or
+/// they could not be queued). -1 if error
+static int64_t get_sk_drops(int fd) {
+#ifdef SO_MEMINFO
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+	const int gso_rc =
+			getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len);
+	if (gso_rc == 0 && len > SK_MEMINFO_DROPS * sizeof(meminfo[0])) {
+		return meminfo[SK_MEMINFO_DROPS];
+	}
+#else
+	(void)fd;
+#endif
+	return -1;
+}
+
+/// Connections waiting in listen socket accept queue, or -1 if error
+static int64_t get_accept_queue(int fd) {
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	const int gso_rc = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+	// Kernel reports listen sockets accept queue length as unacked
+	return gso_rc == 0 ? (int64_t)info.tcpi_unacked : -1;
+}
+
 static uint16_t get_port(const struct sockaddr_in *sa) {
 	return ntohs(sa->sin_port);
 }
 
-static void print_accepted_connection_log(const struct sockaddr_in *sa) {
-	char str[sizeof(INET_ADDRSTRLEN)];
-	inet_ntop(AF_INET, &(sa->sin_addr), str, INET_ADDRSTRLEN);
+static void print_accepted_connection_log(const char *client_addr,
+					  const struct sockaddr_in *sa) {
+	if (sa->sin_family == AF_UNIX) {
+		rdlog(LOG_INFO, "Accepted connection from %s", client_addr);
+		return;
+	}
 
-	rdlog(LOG_INFO, "Accepted connection from %s:%d", str, get_port(sa));
+	rdlog(LOG_INFO,
+	      "Accepted connection from %s:%d",
+	      client_addr,
+	      get_port(sa));
 }
 
 static int select_socket(int listenfd, struct timeval *tv) {
@@ -214,38 +583,351 @@ static int write_select_socket(int writefd, struct timeval *tv) {
 	return select(writefd + 1, NULL, &writefd_set, NULL, tv);
 }
 
-static int receive_from_socket(int fd,
-			       struct sockaddr_in6 *addr,
-			       char *buffer,
-			       const size_t buffer_size) {
-	socklen_t socklen = (socklen_t)sizeof(*addr);
-	return recvfrom(fd,
-			buffer,
-			buffer_size,
+/// Datagram control messages buffer, with room for SO_RXQ_OVFL counter,
+/// UDP GRO segment size and reception timestamp
+union udp_control {
+	char buf[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int)) +
+		 CMSG_SPACE(sizeof(struct timespec))];
+	struct cmsghdr align;
+};
+
+/// TCP read control messages buffer, with room for reception timestamp
+union tcp_control {
+	char buf[CMSG_SPACE(sizeof(struct timespec))];
+	struct cmsghdr align;
+};
+
+/// Nanoseconds of a timespec
+static uint64_t timespec_ns(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * 1000000000 + (uint64_t)ts->tv_nsec;
+}
+
+/// Current time of a clock, in nanoseconds
+static uint64_t clock_ns(clockid_t clock) {
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return timespec_ns(&now);
+}
+
+/**
+ * @brief      Search kernel reception timestamp (SO_TIMESTAMPNS) in read
+ *             message control messages
+ *
+ * @param      hdr   The message header
+ *
+ * @return     Reception time, in nanoseconds since epoch, or 0 if not found
+ */
+static uint64_t msg_rx_timestamp(struct msghdr *hdr) {
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return timespec_ns(&ts);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Account ingest to produce latency of a message
+ *
+ * @param      latency  The thread latency histogram
+ * @param[in]  rx_ns    The message kernel reception time, or 0 if unknown
+ * @param[in]  now_ns   The time message was produced
+ */
+static void
+listener_latency_add(struct latency_histogram *latency,
+		     uint64_t rx_ns,
+		     uint64_t now_ns) {
+	if (rx_ns > 0 && now_ns > rx_ns) {
+		latency_histogram_add(latency, now_ns - rx_ns);
+	}
+}
+
+/// Per UDP thread preallocated recvmmsg vector, and its decoder batch
+struct udp_recv_batch {
+	size_t size;			     ///< Vector size
+	size_t buffer_size;		     ///< Datagrams buffers size
+	/// Max number of decoder messages per datagram: GRO segments
+	size_t max_segments;
+	struct mmsghdr *msgs;		     ///< recvmmsg headers
+	struct iovec *iovecs;		     ///< Datagrams buffers pointers
+	struct sockaddr_in6 *addrs;	     ///< Datagrams source addresses
+	union udp_control *controls;	     ///< Datagrams control messages
+	/// Sources printed in string format
+	struct sockaddr_str_cache *addr_cache;
+	/// Decoder attributes memory. Source is only printed if decoder asks
+	/// for it.
+	struct sockaddr_pair *attrs_mem;
+	keyval_list_t *attrs; ///< Decoder attributes
+	/// Decoder batch, max_segments per datagram
+	struct n2k_decoder_batch_msg *batch;
+	struct buffer_pool *pool;     ///< Datagrams buffers pool
+	struct pool_buffer **buffers; ///< Datagrams actual buffers
+};
+
+static void udp_recv_batch_done(struct udp_recv_batch *batch) {
+	size_t i;
+	for (i = 0; batch->buffers && i < batch->size; ++i) {
+		if (batch->buffers[i]) {
+			pool_buffer_unref(batch->buffers[i]);
+		}
+	}
+	if (batch->pool) {
+		buffer_pool_done(batch->pool);
+	}
+
+	free(batch->msgs);
+	free(batch->iovecs);
+	free(batch->addrs);
+	free(batch->controls);
+	free(batch->addr_cache);
+	free(batch->attrs_mem);
+	free(batch->attrs);
+	free(batch->batch);
+	free(batch->buffers);
+}
+
+/// Point recvmmsg vector to batch pool buffers
+static void udp_recv_batch_bind_buffers(struct udp_recv_batch *batch) {
+	size_t i;
+	for (i = 0; i < batch->size; ++i) {
+		batch->iovecs[i].iov_base = pool_buffer_data(batch->buffers[i]);
+		batch->iovecs[i].iov_len = batch->buffer_size;
+	}
+}
+
+/**
+ * @brief      Allocate all needed resources to read a batch of datagrams.
+ *             Buffers pool will be owned by the calling thread.
+ *
+ * @param      batch  The batch
+ * @param[in]  size   The max number of datagrams per batch
+ * @param[in]  gro    Datagrams can be UDP GRO coalesced ones
+ *
+ * @return     0 if success, -1 if error (no memory).
+ */
+static int
+udp_recv_batch_init(struct udp_recv_batch *batch, size_t size, bool gro) {
+	size_t i;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->size = size;
+	batch->buffer_size = gro ? UDP_GRO_BUFFER_SIZE : READ_BUFFER_SIZE;
+	batch->max_segments = gro ? UDP_GRO_MAX_SEGMENTS : 1;
+	batch->msgs = calloc(size, sizeof(batch->msgs[0]));
+	batch->iovecs = calloc(size, sizeof(batch->iovecs[0]));
+	batch->addrs = calloc(size, sizeof(batch->addrs[0]));
+	batch->controls = calloc(size, sizeof(batch->controls[0]));
+	batch->addr_cache = calloc(1, sizeof(*batch->addr_cache));
+	batch->attrs_mem = calloc(size, sizeof(batch->attrs_mem[0]));
+	batch->attrs = calloc(size, sizeof(batch->attrs[0]));
+	batch->batch = calloc(size * batch->max_segments,
+			      sizeof(batch->batch[0]));
+	batch->pool = buffer_pool_new(batch->buffer_size,
+				      size > BUFFER_POOL_MAX_FREE
+					      ? size
+					      : BUFFER_POOL_MAX_FREE);
+	batch->buffers = calloc(size, sizeof(batch->buffers[0]));
+
+	if (unlikely(!batch->msgs || !batch->iovecs || !batch->addrs ||
+		     !batch->controls || !batch->addr_cache ||
+		     !batch->attrs_mem || !batch->attrs || !batch->batch ||
+		     !batch->pool || !batch->buffers)) {
+		udp_recv_batch_done(batch);
+		return -1;
+	}
+
+	for (i = 0; i < size; ++i) {
+		batch->buffers[i] = buffer_pool_get(batch->pool);
+		if (unlikely(NULL == batch->buffers[i])) {
+			udp_recv_batch_done(batch);
+			return -1;
+		}
+
+		sockaddr_pair_init(&batch->attrs_mem[i],
+				   "client_ip",
+				   batch->addr_cache);
+	}
+
+	udp_recv_batch_bind_buffers(batch);
+	return 0;
+}
+
+/**
+ * @brief      Prepare batch buffers for the next read. Buffers that decoder
+ *             has kept are replaced with new ones.
+ *
+ * @param      batch       The batch
+ * @param[in]  recv_count  The number of used buffers
+ *
+ * @return     0 if success, -1 if the batch has run out of buffers
+ */
+static int udp_recv_batch_refill(struct udp_recv_batch *batch,
+				 size_t recv_count) {
+	size_t i, new_size = 0;
+	for (i = 0; i < batch->size; ++i) {
+		struct pool_buffer *buffer =
+				i < recv_count ? buffer_pool_recycle(
+							 batch->pool,
+							 batch->buffers[i])
+					       : batch->buffers[i];
+		if (likely(NULL != buffer)) {
+			batch->buffers[new_size++] = buffer;
+		}
+	}
+
+	if (unlikely(new_size < batch->size)) {
+		rdlog(LOG_ERR,
+		      "Can't allocate UDP buffers (OOM?). Reducing batch size "
+		      "to %zu",
+		      new_size);
+		batch->size = new_size;
+	}
+
+	udp_recv_batch_bind_buffers(batch);
+	return new_size > 0 ? 0 : -1;
+}
+
+/**
+ * @brief      Read as many datagrams as available in socket, up to batch size
+ *
+ * @param[in]  fd     The socket
+ * @param      batch  The batch
+ *
+ * @return     Number of read datagrams, or -1 in case of error (errno set).
+ */
+static int receive_batch_from_socket(int fd, struct udp_recv_batch *batch) {
+	size_t i;
+	for (i = 0; i < batch->size; ++i) {
+		struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+		hdr->msg_name = &batch->addrs[i];
+		hdr->msg_namelen = sizeof(batch->addrs[i]);
+		hdr->msg_iov = &batch->iovecs[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_control = &batch->controls[i];
+		hdr->msg_controllen = sizeof(batch->controls[i]);
+	}
+
+	return recvmmsg(fd,
+			batch->msgs,
+			(unsigned int)batch->size,
 			MSG_DONTWAIT,
-			(struct sockaddr *)addr,
-			&socklen);
+			NULL);
+}
+
+/// UDP GRO segment size of a read datagram, or 0 if it is not coalesced
+static size_t udp_msg_gro_size(struct msghdr *hdr) {
+#ifdef UDP_GRO
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int gro_size;
+			memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
+			return gro_size > 0 ? (size_t)gro_size : 0;
+		}
+	}
+#else
+	(void)hdr;
+#endif
+	return 0;
 }
 
-static void process_data_received_from_socket(char *buffer,
-					      const size_t recv_result,
-					      const char *client,
-					      const struct listener *l) {
-	rdlog(LOG_DEBUG,
-	      "received %zu data from %s: %.*s",
-	      recv_result,
-	      client,
-	      (int)recv_result,
-	      buffer);
+/**
+ * @brief      Prepare the decoder batch of read datagrams. UDP GRO coalesced
+ *             datagrams are split in their original datagrams, that keep
+ *             pointing to the read buffer.
+ *
+ * @param      batch       The batch
+ * @param[in]  recv_count  The number of read datagrams in batch
+ *
+ * @return     Number of messages in decoder batch
+ */
+static size_t udp_recv_batch_messages(struct udp_recv_batch *batch,
+				      size_t recv_count) {
+	size_t i, msgs_count = 0;
+	for (i = 0; i < recv_count; ++i) {
+		const size_t recv_len = batch->msgs[i].msg_len;
+		const char *data = batch->iovecs[i].iov_base;
+		const size_t gro_size =
+				udp_msg_gro_size(&batch->msgs[i].msg_hdr);
+		const size_t segment_size = gro_size ? gro_size : recv_len;
+		const struct sockaddr *client =
+				(const struct sockaddr *)&batch->addrs[i];
+		size_t segment;
+
+		if (0 == batch->msgs[i].msg_hdr.msg_namelen) {
+			// Unnamed unix socket sender. Address still holds the
+			// previous sender of this slot.
+			batch->addrs[i].sin6_family = AF_UNSPEC;
+		}
 
-	struct pair attrs_mem[1];
-	attrs_mem->key = "client_ip";
-	attrs_mem->value = client;
+		if (!client_addr_allowed(client)) {
+			if (unlikely(global_config.log_severity >= LOG_DEBUG)) {
+				rdlog(LOG_DEBUG,
+				      "Discarding datagram from %s: not "
+				      "allowed",
+				      sockaddr2str_cached(batch->addr_cache,
+							  client));
+			}
+			continue;
+		}
 
-	keyval_list_t attrs = keyval_list_initializer(attrs);
-	add_key_value_pair(&attrs, attrs_mem);
+		sockaddr_pair_set(&batch->attrs_mem[i], client);
+		keyval_list_init(&batch->attrs[i]);
+		add_key_value_pair(&batch->attrs[i], &batch->attrs_mem[i].pair);
+
+		if (unlikely(global_config.log_severity >= LOG_DEBUG)) {
+			rdlog(LOG_DEBUG,
+			      "received %zu data from %s: %.*s",
+			      recv_len,
+			      valueof(&batch->attrs[i], "client_ip", strcmp),
+			      (int)recv_len,
+			      data);
+		}
+
+		for (segment = 0; segment < batch->max_segments; ++segment) {
+			const size_t offset = segment * segment_size;
+			const bool last = offset + segment_size >= recv_len ||
+					  segment + 1 == batch->max_segments;
+			struct n2k_decoder_batch_msg *msg =
+					&batch->batch[msgs_count++];
+
+			msg->buffer = &data[offset];
+			msg->buf_size = last ? recv_len - offset : segment_size;
+			msg->props = &batch->attrs[i];
+			msg->pool_buffer = batch->buffers[i];
+			if (last) {
+				break;
+			}
+		}
+	}
+
+	return msgs_count;
+}
+
+/**
+ * @brief      Account ingest to produce latency of the datagrams of a batch
+ *             that has been sent to decoder
+ *
+ * @param      batch       The batch
+ * @param[in]  recv_count  The number of read datagrams in batch
+ * @param      latency     The thread latency histogram
+ */
+static void udp_recv_batch_latency(struct udp_recv_batch *batch,
+				   size_t recv_count,
+				   struct latency_histogram *latency) {
+	const uint64_t now = clock_ns(CLOCK_REALTIME);
+	size_t i;
 
-	listener_decode(l, buffer, recv_result, &attrs, NULL, NULL, NULL);
+	for (i = 0; i < recv_count; ++i) {
+		listener_latency_add(latency,
+				     msg_rx_timestamp(&batch->msgs[i].msg_hdr),
+				     now);
+	}
 }
 
 static int send_to_socket(int fd, const char *data, size_t len) {
@@ -273,421 +955,2812 @@ struct connection_private {
 #endif
 	int first_response_sent;
 	const struct listener *listener;
-	const char *client;
+	struct sockaddr_in addr;       ///< Client address
+	char client[INET6_ADDRSTRLEN]; ///< Printed client address
+	struct socket_framer framer;   ///< Stream records framing state
+
+	/// Decoder session, NULL if decoder does not support them
+	void *decoder_session;
+	keyval_list_t decoder_props; ///< Decoder session properties
+
+	/// Connection has been paused by backpressure, and its socket buffer
+	/// has not been drained yet
+	bool held_back;
+	TAILQ_ENTRY(connection_private) paused_entry; ///< Paused list entry
+
+	uint64_t rebalance_bytes; ///< Bytes read since last rebalance
+	ev_tstamp last_read;	  ///< Last time connection had data
+	/// Worker idle connections wheel entry
+	struct timer_wheel_entry idle_entry;
+	/// Adaptive read size, READ_BUFFER_SIZE << read_size_class
+	unsigned read_size_class;
+	TAILQ_ENTRY(connection_private) worker_entry; ///< Worker list entry
 };
 
-static void
-close_socket_and_stop_watcher(struct ev_loop *loop, struct ev_io *watcher) {
-	ev_io_stop(loop, watcher);
-
-	close(watcher->fd);
-	free(watcher);
+/// Connection watcher. Connection private data is just after it.
+static struct ev_io *
+connection_watcher(struct connection_private *connection) {
+	return &((struct ev_io *)connection)[-1];
 }
 
-static void read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
+struct worker_args {
+	struct socket_listener *socket_listener;
+	size_t idx;
+	/// Read buffers pools, by TCP read size class
+	struct buffer_pool *buffer_pools[TCP_READ_SIZE_CLASSES];
 
-	if (EV_ERROR & revents) {
-		rdlog(LOG_ERR,
-		      "Read callback error: %s",
-		      gnu_strerror_r(errno));
+	/// Records found in current readiness event, not sent to decoder yet
+	struct {
+		struct n2k_decoder_batch_msg msgs[TCP_RECORDS_BATCH_SIZE];
+		size_t count;
+	} tcp_records;
+
+	/// Kafka producer queue backpressure
+	struct {
+		struct kafka_backpressure *config; ///< Listener backpressure
+		bool paused;			   ///< Reading is paused
+		struct ev_timer resume_timer;	   ///< Check queue length
+		/// Connections with pending data, stopped while paused
+		TAILQ_HEAD(, connection_private) connections;
+	} backpressure;
+
+	struct worker_load *load; ///< Worker load
+	/// Worker ingest to produce latency
+	struct latency_histogram *latency;
+	/// Worker connections
+	TAILQ_HEAD(, connection_private) connections;
+
+	/// Connections are message oriented (SOCK_SEQPACKET): every read is
+	/// a record, and framing is not used
+	struct tcp_worker_messages {
+		bool enabled;
+		/// Read overflow buffer, for messages bigger than read chain
+		char *overflow;
+		size_t overflow_size;
+	} messages;
+
+	/// Idle connections reaping
+	struct {
+		ev_tstamp timeout;	  ///< Idle timeout. 0 means disabled
+		struct timer_wheel wheel; ///< Connections by idle deadline
+		struct ev_timer timer;	  ///< Wheel tick
+	} idle;
+};
+
+static void tcp_connection_release(struct socket_listener *socket_listener,
+				   struct connection_private *connection);
+
+/// Start watching a connection assigned to this worker
+static void tcp_worker_add_connection(struct ev_loop *loop,
+				      struct worker_args *worker,
+				      struct ev_io *watcher) {
+	struct connection_private *connection = watcher->data;
+
+	TAILQ_INSERT_TAIL(&worker->connections, connection, worker_entry);
+	if (worker->idle.timeout > 0) {
+		timer_wheel_add(&worker->idle.wheel,
+				&connection->idle_entry,
+				TIMER_WHEEL_SLOTS - 1);
 	}
+	ev_io_start(loop, watcher);
+}
 
-	struct connection_private *connection =
-			(struct connection_private *)watcher->data;
-	struct sockaddr_in6 saddr;
+/// Stop watching a connection, because it is closed or migrated
+static void tcp_worker_remove_connection(struct ev_loop *loop,
+					 struct worker_args *worker,
+					 struct ev_io *watcher) {
+	struct connection_private *connection = watcher->data;
 
-#ifdef CONNECTION_PRIVATE_MAGIC
-	assert(connection->magic == CONNECTION_PRIVATE_MAGIC);
-#endif
+	ev_io_stop(loop, watcher);
+	TAILQ_REMOVE(&worker->connections, connection, worker_entry);
+	timer_wheel_remove(&worker->idle.wheel, &connection->idle_entry);
+	ATOMIC_OP(sub, fetch, &worker->load->connections, 1);
+}
 
-	char *buffer = calloc(READ_BUFFER_SIZE, sizeof(char));
-	const int recv_result = receive_from_socket(
-			watcher->fd, &saddr, buffer, READ_BUFFER_SIZE);
-	if (recv_result > 0) {
-		process_data_received_from_socket(buffer,
-						  (size_t)recv_result,
-						  connection->client,
-						  connection->listener);
-	} else if (recv_result < 0) {
-		if (errno == EAGAIN) {
-			rdbg("Socket not ready. re-trying");
-			free(buffer);
-			return;
-		} else {
-			rdlog(LOG_ERR, "Recv error: %s", gnu_strerror_r(errno));
-			free(buffer);
-			close_socket_and_stop_watcher(loop, watcher);
-			return;
-		}
-	} else { /* recv_result == 0 */
-		free(buffer);
-		close_socket_and_stop_watcher(loop, watcher);
-		return;
+static void
+close_socket_and_stop_watcher(struct ev_loop *loop, struct ev_io *watcher) {
+	struct connection_private *connection = watcher->data;
+	const struct n2k_decoder *decoder = connection->listener->decoder;
+	struct worker_args *worker = ev_userdata(loop);
+
+	tcp_worker_remove_connection(loop, worker, watcher);
+
+	close(watcher->fd);
+	socket_framer_done(&connection->framer);
+	if (connection->decoder_session && decoder->delete_session) {
+		decoder->delete_session(connection->decoder_session);
 	}
+	tcp_connection_release(worker->socket_listener, connection);
+}
 
-	if (NULL != global_config.response &&
-	    !connection->first_response_sent) {
-		int send_ret = 1;
-		rdlog(LOG_DEBUG, "Sending first response...");
+/// TCP readiness event context, passed to framer record callback
+struct tcp_read_event {
+	struct worker_args *worker;
+	struct connection_private *connection;
+	const keyval_list_t *props; ///< Records properties
+	size_t records;		    ///< Number of found records
+	bool close;		    ///< Decoder session can't continue
+	bool buffer_full;	    ///< Decoder could not enqueue messages
+	bool drained;		    ///< Last read did not fill read buffers
+	uint64_t rx_ns; ///< Kernel reception time of first read, if known
+};
 
-		if (global_config.response_len == 0) {
-			rdlog(LOG_ERR,
-			      "Can't send first response to %s: size of "
-			      "response == 0",
-			      connection->client);
-			connection->first_response_sent = 1;
-		} else {
-			send_ret = send_to_socket(
-					watcher->fd,
-					global_config.response,
-					(size_t)global_config.response_len - 1);
+/// Send pending TCP records to decoder
+static void tcp_read_event_flush(struct tcp_read_event *event) {
+	struct worker_args *worker = event->worker;
+
+	if (worker->tcp_records.count > 0) {
+		const enum decoder_callback_err rc = listener_decode_batch(
+				event->connection->listener,
+				worker->tcp_records.msgs,
+				worker->tcp_records.count);
+		if (rc == DECODER_CALLBACK_BUFFER_FULL) {
+			event->buffer_full = true;
 		}
+		worker->tcp_records.count = 0;
+	}
+}
 
-		if (send_ret <= 0) {
-			rdlog(LOG_ERR,
-			      "Cannot send first response to %s socket: %s",
-			      connection->client,
-			      gnu_strerror_r(errno));
-			close_socket_and_stop_watcher(loop, watcher);
-		}
+/// Send a record to connection decoder session
+static void tcp_session_record(struct tcp_read_event *event,
+			       const char *record,
+			       size_t size) {
+	const struct connection_private *connection = event->connection;
+	const char *response = NULL;
+	size_t response_size = 0;
+
+	const enum decoder_callback_err rc =
+			listener_decode(connection->listener,
+					record,
+					size,
+					&connection->decoder_props,
+					&response,
+					&response_size,
+					connection->decoder_session);
+	if (rc == DECODER_CALLBACK_BUFFER_FULL) {
+		event->buffer_full = true;
+	}
 
-		rdlog(LOG_DEBUG, "first response ok");
-		connection->first_response_sent = 1;
+	if (unlikely(rc != DECODER_CALLBACK_OK)) {
+		rdlog(LOG_ERR,
+		      "Error decoding %s data: %.*s",
+		      connection->client,
+		      response ? (int)response_size : 0,
+		      response ? response : "");
+		if (rc == DECODER_CALLBACK_INVALID_REQUEST) {
+			// Stream can't be parsed anymore
+			event->close = true;
+		}
 	}
 }
 
-#define SOCKET_LISTENER_PRIVATE_MAGIC 0xB0C31331AEA1CL
-
-struct socket_listener {
-	struct listener listener;
-#ifdef SOCKET_LISTENER_PRIVATE_MAGIC
-	uint64_t magic;
-#endif
-	pthread_t main_loop;
-	struct ev_loop *event_loop;
-	struct ev_async w_async;
+/// Framer record callback: Append record to worker batch
+static void tcp_record_cb(void *opaque,
+			  const char *record,
+			  size_t size,
+			  struct pool_buffer *buffer) {
+	struct tcp_read_event *event = opaque;
+	struct worker_args *worker = event->worker;
+	const struct connection_private *connection = event->connection;
+
+	event->records++;
+	if (connection->decoder_session) {
+		// Session records need to be decoded in order, one by one
+		tcp_session_record(event, record, size);
+		return;
+	}
 
-	struct {
-		char *proto;
-		size_t threads;
-		bool tcp_keepalive;
-		enum thread_mode thread_mode;
-	} config;
+	if (worker->tcp_records.count == TCP_RECORDS_BATCH_SIZE) {
+		tcp_read_event_flush(event);
+	}
 
-	pthread_t threads[MAX_NUM_THREADS];
-	struct ev_loop *event_loops[MAX_NUM_THREADS];
-	struct ev_async event_asyncs[MAX_NUM_THREADS];
-	rd_fifoq_t watchers_queue[MAX_NUM_THREADS];
+	worker->tcp_records.msgs[worker->tcp_records.count++] =
+			(struct n2k_decoder_batch_msg){
+					.buffer = record,
+					.buf_size = size,
+					.props = event->props,
+					.pool_buffer = buffer,
+			};
+
+	if (NULL == buffer) {
+		// Record assembled in framer memory, only valid right now
+		tcp_read_event_flush(event);
+	}
+}
 
-	size_t accept_current_worker_idx;
-};
+/// TCP connection read size
+static size_t tcp_read_size(const struct connection_private *connection) {
+	return (size_t)READ_BUFFER_SIZE << connection->read_size_class;
+}
 
-static void accept_cb(struct ev_loop *loop __attribute__((unused)),
-		      struct ev_io *watcher,
-		      int revents) {
-	struct sockaddr_in client_saddr;
-	socklen_t client_len = sizeof(client_saddr);
-	struct socket_listener *socket_listener =
-			(struct socket_listener *)watcher->data;
-	int client_sd;
-	char client_buf[BUFSIZ];
+/**
+ * @brief      Adapt connection read size to the last read: Grow it if read
+ *             overflowed the first buffer of the chain, and shrink it if read
+ *             did not fill a quarter of it.
+ *
+ * @param      connection  The connection
+ * @param[in]  read_bytes  The last read bytes
+ */
+static void tcp_read_size_adapt(struct connection_private *connection,
+				size_t read_bytes) {
+	const size_t read_size = tcp_read_size(connection);
+
+	if (read_bytes > read_size &&
+	    connection->read_size_class + 1 < TCP_READ_SIZE_CLASSES) {
+		connection->read_size_class++;
+	} else if (read_bytes < read_size / 4 &&
+		   connection->read_size_class > 0) {
+		connection->read_size_class--;
+	}
+}
 
-	if (EV_ERROR & revents) {
-		rdlog(LOG_ERR, "Invalid event: %s", gnu_strerror_r(errno));
+/**
+ * @brief      Send a message of a message oriented connection as one record.
+ *             Message is in the first buffer of the read chain unless it
+ *             overflowed it; in that case it is assembled in a temporary
+ *             buffer.
+ *
+ * @param      event      The read event
+ * @param      iov        The read vector: chain buffers and overflow buffer
+ * @param      buffer     The first buffer of the read chain
+ * @param[in]  size       The message size
+ * @param[in]  truncated  Message did not fit in read vector
+ */
+static void tcp_message_record(struct tcp_read_event *event,
+			       const struct iovec *iov,
+			       struct pool_buffer *buffer,
+			       size_t size,
+			       bool truncated) {
+	const struct connection_private *connection = event->connection;
+	size_t i, offset = 0;
+
+	if (truncated || size > connection->framer.max_record_size) {
+		rdlog(LOG_ERR,
+		      "Discarding %s message: bigger than max record size "
+		      "(%zu)",
+		      connection->client,
+		      connection->framer.max_record_size);
 		return;
 	}
 
-	client_sd = accept(watcher->fd,
-			   (struct sockaddr *)&client_saddr,
-			   &client_len);
-
-	if (client_sd < 0) {
-		rdlog(LOG_ERR, "accept error: %s", gnu_strerror_r(errno));
+	if (size <= iov[0].iov_len) {
+		tcp_record_cb(event, iov[0].iov_base, size, buffer);
 		return;
 	}
 
-	const char *client_addr =
-			sockaddr2str(client_buf,
-				     sizeof(client_buf),
-				     (struct sockaddr *)&client_saddr);
-	if (NULL == client_addr) {
-		rdlog(LOG_ERR, "couldn't get client address");
+	char *message = malloc(size);
+	if (unlikely(NULL == message)) {
+		rdlog(LOG_ERR,
+		      "Can't allocate %s message (OOM?)",
+		      connection->client);
 		return;
 	}
-	const size_t client_addr_len = strlen(client_addr);
 
-	if (in_addr_list_contains(global_config.blacklist,
-				  &client_saddr.sin_addr)) {
-		rdlog(LOG_INFO,
-		      "Connection rejected: %s in blacklist",
-		      client_addr);
-		close(client_sd);
-		return;
+	for (i = 0; offset < size; ++i) {
+		const size_t chunk = size - offset < iov[i].iov_len
+					     ? size - offset
+					     : iov[i].iov_len;
+		memcpy(&message[offset], iov[i].iov_base, chunk);
+		offset += chunk;
 	}
 
-	print_accepted_connection_log((struct sockaddr_in *)&client_saddr);
+	// Record callback sends records without buffer right away
+	tcp_record_cb(event, message, size, NULL);
+	free(message);
+}
 
-	if (socket_listener->config.tcp_keepalive)
-		set_keepalive_opt(client_sd);
-	set_nonblock_flag(client_sd);
+/**
+ * @brief      Read all connection available data (up to
+ *             TCP_MAX_READS_PER_EVENT reads), and send all found records to
+ *             decoder in the same batch. Every read is a readv into a chain
+ *             of two pool buffers of the connection read size, so the
+ *             second one tells if the connection could use bigger reads.
+ *             Message oriented connections read one message per read, that
+ *             is a record by itself.
+ *
+ * @param      event  The read event
+ * @param[in]  fd     The connection socket
+ * @param      framer The connection framer
+ *
+ * @return     Read bytes, or -1 if connection needs to be closed.
+ */
+static ssize_t tcp_read_event_process(struct tcp_read_event *event,
+				      int fd,
+				      struct socket_framer *framer) {
+	struct pool_buffer *buffers[2 * TCP_MAX_READS_PER_EVENT];
+	struct connection_private *connection = event->connection;
+	const struct tcp_worker_messages *messages = &event->worker->messages;
+	const char *client = connection->client;
+	size_t i, j, buffers_count = 0;
+	ssize_t ret = 0;
+
+	for (i = 0; i < TCP_MAX_READS_PER_EVENT; ++i) {
+		struct buffer_pool *pool =
+				event->worker->buffer_pools
+						[connection->read_size_class];
+		const size_t read_size = tcp_read_size(connection);
+		struct pool_buffer *chain[2] = {buffer_pool_get(pool),
+						buffer_pool_get(pool)};
+		// Messages can also use worker overflow buffer
+		struct iovec iov[RD_ARRAYSIZE(chain) + 1] = {
+				[RD_ARRAYSIZE(chain)] = {
+					.iov_base = messages->overflow,
+					.iov_len = messages->overflow_size,
+				}};
+
+		for (j = 0; j < RD_ARRAYSIZE(chain); ++j) {
+			iov[j].iov_base =
+					chain[j] ? pool_buffer_data(chain[j])
+						 : NULL;
+			iov[j].iov_len = read_size;
+		}
 
-	if (socket_listener->config.thread_mode == MODE_THREAD_PER_CONNECTION) {
-		rdlog(LOG_ERR,
-		      "Mode " STR_MODE_THREAD_PER_CONNECTION
-		      "still not implemented");
-		exit(-1);
-	} else {
-		/* Set watcher. Private data just after watcher */
-		struct ev_io *w_client = calloc(
-				1,
-				sizeof(struct ev_io) +
-						sizeof(struct connection_private) +
-						client_addr_len + 1);
-		if (unlikely(NULL == w_client)) {
+		if (unlikely(NULL == chain[0] || NULL == chain[1])) {
 			rdlog(LOG_ERR,
-			      "Can't allocate client %s private data",
-			      client_addr);
-		} else {
-			struct connection_private *conn_priv = NULL;
-			w_client->data = conn_priv =
-					(struct connection_private
-							 *)&w_client[1];
-#if CONNECTION_PRIVATE_MAGIC
-			conn_priv->magic = CONNECTION_PRIVATE_MAGIC;
-#endif
-			conn_priv->listener = &socket_listener->listener;
+			      "Can't allocate read buffer for %s (OOM?)",
+			      client);
+			for (j = 0; j < RD_ARRAYSIZE(chain); ++j) {
+				if (chain[j]) {
+					pool_buffer_unref(chain[j]);
+				}
+			}
+			break;
+		}
+
+		union tcp_control control;
+		struct msghdr hdr = {
+				.msg_iov = iov,
+				.msg_iovlen = messages->enabled
+						      ? RD_ARRAYSIZE(iov)
+						      : RD_ARRAYSIZE(chain),
+				.msg_control = &control,
+				.msg_controllen = sizeof(control),
+		};
+		const ssize_t recv_result = recvmsg(fd, &hdr, 0);
+		if (recv_result <= 0) {
+			pool_buffer_unref(chain[0]);
+			pool_buffer_unref(chain[1]);
+			if (recv_result == 0) {
+				ret = -1;
+			} else if (errno == EAGAIN) {
+				rdbg("Socket not ready. re-trying");
+				event->drained = true;
+			} else {
+				rdlog(LOG_ERR,
+				      "Recv error: %s",
+				      gnu_strerror_r(errno));
+				ret = -1;
+			}
+			break;
+		}
 
-			const size_t cur_idx =
-					socket_listener->accept_current_worker_idx++;
-			if (socket_listener->accept_current_worker_idx >=
-			    socket_listener->config.threads)
-				socket_listener->accept_current_worker_idx = 0;
+		size_t pending = (size_t)recv_result;
+		if (unlikely(global_config.log_severity >= LOG_DEBUG)) {
+			rdlog(LOG_DEBUG,
+			      "received %zu data from %s: %.*s",
+			      pending,
+			      client,
+			      (int)(pending < read_size ? pending : read_size),
+			      (const char *)iov[0].iov_base);
+		}
 
-			conn_priv->client = strncat((char *)&conn_priv[1],
-						    client_addr,
-						    client_addr_len + 1);
+		ret += recv_result;
+		tcp_read_size_adapt(connection, pending);
+		if (0 == event->rx_ns) {
+			event->rx_ns = msg_rx_timestamp(&hdr);
+		}
 
-			rdbg("Sent connection of %s to worker thread %zu",
-			     client_addr,
-			     cur_idx);
+		int feed_rc = 0;
+		if (messages->enabled) {
+			tcp_message_record(event,
+					   iov,
+					   chain[0],
+					   pending,
+					   hdr.msg_flags & MSG_TRUNC);
+			buffers[buffers_count++] = chain[0];
+			buffers[buffers_count++] = chain[1];
+		}
 
-			ev_io_init(w_client, read_cb, client_sd, EV_READ);
-			rd_fifoq_add(&socket_listener->watchers_queue[cur_idx],
-				     w_client);
-			ev_async_send(socket_listener->event_loops[cur_idx],
-				      &socket_listener->event_asyncs[cur_idx]);
+		for (j = 0; !messages->enabled && j < RD_ARRAYSIZE(chain);
+		     ++j) {
+			const size_t chunk = pending < read_size ? pending
+								 : read_size;
+			if (0 == chunk || 0 != feed_rc) {
+				pool_buffer_unref(chain[j]);
+				continue;
+			}
+
+			buffers[buffers_count++] = chain[j];
+			pending -= chunk;
+			feed_rc = socket_framer_feed(framer,
+						     chain[j],
+						     iov[j].iov_base,
+						     chunk,
+						     tcp_record_cb,
+						     event);
 		}
+
+		if (feed_rc != 0) {
+			rdlog(LOG_ERR,
+			      "Invalid framing in %s connection, closing",
+			      client);
+			ret = -1;
+			break;
+		}
+
+		if (event->close) {
+			ret = -1;
+			break;
+		}
+
+		if (!messages->enabled &&
+		    (size_t)recv_result < RD_ARRAYSIZE(chain) * read_size) {
+			// Socket drained
+			event->drained = true;
+			break;
+		}
+	}
+
+	tcp_read_event_flush(event);
+	listener_latency_add(event->worker->latency,
+			     event->rx_ns,
+			     clock_ns(CLOCK_REALTIME));
+
+	// Decoder takes its own reference if it needs the buffers
+	for (i = 0; i < buffers_count; ++i) {
+		pool_buffer_unref(buffers[i]);
 	}
+
+	return ret;
 }
 
-struct worker_args {
-	struct socket_listener *socket_listener;
-	size_t idx;
-};
+/// Check if kafka producer queue has reached backpressure high watermark
+static bool
+kafka_backpressure_high(const struct kafka_backpressure *backpressure) {
+	return backpressure->high_watermark > 0 &&
+	       kafka_outq_len() >= backpressure->high_watermark;
+}
 
-static void async_cb(struct ev_loop *loop,
-		     ev_async *w __attribute__((unused)),
-		     int revents) {
-	struct worker_args *args = ev_userdata(loop);
+/// Check if kafka producer queue has gone down to backpressure low watermark
+static bool
+kafka_backpressure_low(const struct kafka_backpressure *backpressure) {
+	return kafka_outq_len() <= backpressure->low_watermark;
+}
+
+/// Count data held back by backpressure
+static void
+kafka_backpressure_held_back(struct kafka_backpressure *backpressure,
+			     size_t messages,
+			     size_t bytes) {
+	ATOMIC_OP(add,
+		  fetch,
+		  &backpressure->stats.held_back_messages,
+		  messages);
+	ATOMIC_OP(add, fetch, &backpressure->stats.held_back_bytes, bytes);
+}
+
+/// Stop reading from worker connections until kafka queue goes down
+static void tcp_worker_pause(struct ev_loop *loop, struct worker_args *worker) {
+	if (worker->backpressure.paused) {
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Kafka queue over high watermark, pausing worker %zu reads",
+	      worker->idx);
+	ATOMIC_OP(add, fetch, &worker->backpressure.config->stats.pauses, 1);
+	worker->backpressure.paused = true;
+	ev_timer_again(loop, &worker->backpressure.resume_timer);
+}
+
+/// Stop watching a connection until worker resumes reading
+static void tcp_connection_pause(struct ev_loop *loop,
+				 struct worker_args *worker,
+				 struct connection_private *connection) {
+	ev_io_stop(loop, connection_watcher(connection));
+	connection->held_back = true;
+	TAILQ_INSERT_TAIL(&worker->backpressure.connections,
+			  connection,
+			  paused_entry);
+}
+
+/// Resume timer callback: restart paused connections if kafka queue is low
+static void tcp_worker_resume_cb(struct ev_loop *loop,
+				 struct ev_timer *timer,
+				 int revents) {
+	struct worker_args *worker = ev_userdata(loop);
+	struct connection_private *connection;
+	(void)revents;
+
+	if (!kafka_backpressure_low(worker->backpressure.config)) {
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Kafka queue under low watermark, resuming worker %zu reads",
+	      worker->idx);
+	worker->backpressure.paused = false;
+	ev_timer_stop(loop, timer);
+	while ((connection = TAILQ_FIRST(&worker->backpressure.connections))) {
+		TAILQ_REMOVE(&worker->backpressure.connections,
+			     connection,
+			     paused_entry);
+		ev_io_start(loop, connection_watcher(connection));
+	}
+}
+
+static void read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
 
 	if (EV_ERROR & revents) {
-		rdlog(LOG_ERR, "Invalid event: %s", gnu_strerror_r(errno));
+		rdlog(LOG_ERR,
+		      "Read callback error: %s",
+		      gnu_strerror_r(errno));
+	}
+
+	struct connection_private *connection =
+			(struct connection_private *)watcher->data;
+
+#ifdef CONNECTION_PRIVATE_MAGIC
+	assert(connection->magic == CONNECTION_PRIVATE_MAGIC);
+#endif
+
+	struct worker_args *worker = ev_userdata(loop);
+	struct kafka_backpressure *backpressure = worker->backpressure.config;
+	if (worker->backpressure.paused ||
+	    kafka_backpressure_high(backpressure)) {
+		// Let the kernel close the sender window
+		tcp_worker_pause(loop, worker);
+		tcp_connection_pause(loop, worker, connection);
 		return;
 	}
 
-	if (1 == do_shutdown) {
-		/* The signal was for end the loop */
-		ev_break(loop, EVBREAK_ALL);
+	struct pair attrs_mem[1] = {
+			{.key = "client_ip", .value = connection->client},
+	};
+
+	keyval_list_t attrs = keyval_list_initializer(attrs);
+	add_key_value_pair(&attrs, attrs_mem);
+
+	struct tcp_read_event event = {
+			.worker = worker,
+			.connection = connection,
+			.props = &attrs,
+	};
+
+	if (ev_now(loop) - connection->last_read > TCP_READ_SIZE_IDLE_RESET) {
+		// Burst is over, start again with small reads
+		connection->read_size_class = 0;
 	}
 
-	if (args) {
-		/* The signal was alerting a new socket to watch */
-		size_t i = args->idx;
-		rd_fifoq_elm_t *qelm = NULL;
-		while ((qelm = rd_fifoq_pop(
-					&args->socket_listener->watchers_queue
-							 [i]))) {
-			struct ev_io *w_client = qelm->rfqe_ptr;
-			if (NULL != w_client) {
-				ev_io_start(loop, w_client);
-			}
+	const ssize_t read_bytes = tcp_read_event_process(
+			&event, watcher->fd, &connection->framer);
+	if (read_bytes < 0) {
+		close_socket_and_stop_watcher(loop, watcher);
+		return;
+	} else if (read_bytes == 0) {
+		return;
+	}
 
-			rd_fifoq_elm_release(
-					&args->socket_listener
-							 ->watchers_queue[i],
-					qelm);
+	ATOMIC_OP(add, fetch, &worker->load->bytes, (uint64_t)read_bytes);
+	connection->rebalance_bytes += (uint64_t)read_bytes;
+	connection->last_read = ev_now(loop);
+
+	if (connection->held_back) {
+		kafka_backpressure_held_back(backpressure,
+					     event.records,
+					     (size_t)read_bytes);
+		connection->held_back = !event.drained;
+	}
+
+	if (event.buffer_full && backpressure->high_watermark > 0) {
+		// Kafka queue is full, no matter the watermark
+		tcp_worker_pause(loop, worker);
+	}
+
+	if (NULL != global_config.response &&
+	    !connection->first_response_sent) {
+		int send_ret = 1;
+		rdlog(LOG_DEBUG, "Sending first response...");
+
+		if (global_config.response_len == 0) {
+			rdlog(LOG_ERR,
+			      "Can't send first response to %s: size of "
+			      "response == 0",
+			      connection->client);
+			connection->first_response_sent = 1;
+		} else {
+			send_ret = send_to_socket(
+					watcher->fd,
+					global_config.response,
+					(size_t)global_config.response_len - 1);
+		}
+
+		if (send_ret <= 0) {
+			rdlog(LOG_ERR,
+			      "Cannot send first response to %s socket: %s",
+			      connection->client,
+			      gnu_strerror_r(errno));
+			close_socket_and_stop_watcher(loop, watcher);
+			return;
 		}
+
+		rdlog(LOG_DEBUG, "first response ok");
+		connection->first_response_sent = 1;
 	}
 }
 
-static void *worker(void *_worker_arg) {
-	struct worker_args *worker_args = _worker_arg;
+#define SOCKET_LISTENER_PRIVATE_MAGIC 0xB0C31331AEA1CL
 
-	ev_run(worker_args->socket_listener->event_loops[worker_args->idx], 0);
+struct socket_listener {
+	struct listener listener;
+#ifdef SOCKET_LISTENER_PRIVATE_MAGIC
+	uint64_t magic;
+#endif
+	pthread_t main_loop;
+	struct ev_loop *event_loop;
+	struct ev_async w_async;
 
-	free(worker_args);
+	struct {
+		char *proto;
+		char *path;    ///< Unix socket path. NULL for IP sockets
+		int unix_type; ///< Unix socket type
+		/// Listener address for logs: "port <port>" or "path <path>"
+		char addr_str[sizeof("path ") +
+			      sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+		size_t threads;
+		bool tcp_keepalive;
+		enum thread_mode thread_mode;
+		size_t udp_batch_size;
+		bool reuseport;
+		bool reuseport_cpu_affinity;
+		/// TCP workers accept from the shared listen socket
+		bool accept_exclusive;
+		enum socket_framing framing; ///< TCP records framing
+		size_t max_record_size;	     ///< TCP max record size
+		/// TCP connections assignment to workers
+		enum connection_balance balance;
+		bool rebalance; ///< Migrate connections between workers
+		int rcvbuf;	///< Sockets receive buffer. 0 means system one
+		bool udp_gro;	///< Read UDP GRO coalesced datagrams
+		/// Grow UDP receive buffer up to this size while kernel drops
+		/// datagrams. 0 means disabled
+		int rcvbuf_autotune_max;
+		/// Listener threads CPUs and memory NUMA node
+		struct cpu_affinity affinity;
+		enum latency_mode latency_mode; ///< How sockets are read
+		/// Busy poll time without data before waiting, in microseconds
+		int busy_poll_budget_us;
+		/// Max TCP connections. 0 means unlimited
+		size_t connection_limit;
+		/// Max TCP connections of a client address. 0 means unlimited
+		size_t per_ip_connection_limit;
+		/// Close TCP connections without data for this time, in
+		/// seconds. 0 means disabled
+		int idle_timeout;
+
+		/// TCP decoder sessions properties
+		struct {
+			char *uri;	 ///< Session URI, with topic
+			json_t *options; ///< Extra decoder options
+		} session;
+	} config;
 
-	return NULL;
+	/// Kafka producer queue backpressure
+	struct kafka_backpressure backpressure;
+
+	/// UDP reception statistics
+	struct {
+		uint64_t wakeups;      ///< Number of reads that returned data
+		uint64_t datagrams;    ///< Number of datagrams read
+		uint64_t full_batches; ///< Number of reads that filled batch
+		uint64_t drops; ///< Datagrams dropped by kernel (SO_RXQ_OVFL)
+		/// io_uring threads don't read SO_RXQ_OVFL, so drops are read
+		/// from sockets
+		bool socket_drops;
+	} udp_stats;
+
+	/// TCP accept statistics
+	struct {
+		uint64_t accepted;    ///< Accepted connections
+		uint64_t rejected;    ///< Connections of not allowed clients
+		uint64_t errors;      ///< Failed accept calls
+		uint64_t over_limit;  ///< Connections over connection limits
+		uint64_t idle_closed; ///< Connections closed by idle timeout
+	} tcp_stats;
+
+	/// Open TCP connections
+	size_t connections;
+	/// TCP connections memory
+	struct slab *connections_slab;
+	/// Open TCP connections per client address, if per IP limit enabled
+	struct addr_count *ip_connections;
+
+	/// UDP sockets state. Only one unless reuseport is enabled
+	struct udp_socket_state udp_sockets[MAX_NUM_THREADS];
+	size_t udp_sockets_count;
+	/// Export UDP statistics in kafka stats messages
+	struct kafka_stats_provider stats_provider;
+	/// Per thread ingest (kernel reception) to produce latency
+	struct latency_histogram *latency;
+
+	pthread_t threads[MAX_NUM_THREADS];
+	struct ev_loop *event_loops[MAX_NUM_THREADS];
+	struct ev_async event_asyncs[MAX_NUM_THREADS];
+	rd_fifoq_t watchers_queue[MAX_NUM_THREADS];
+
+	/// Per worker SO_REUSEPORT sockets, if reuseport enabled
+	int listenfds[MAX_NUM_THREADS];
+	/// Per worker accept watchers, if reuseport or accept_exclusive enabled
+	struct ev_io accept_watchers[MAX_NUM_THREADS];
+	/// Per worker epoll instances that wait for listen socket with
+	/// EPOLLEXCLUSIVE, if accept_exclusive enabled
+	int accept_epfds[MAX_NUM_THREADS];
+
+	size_t accept_current_worker_idx;
+
+	/// TCP workers load
+	struct worker_load worker_loads[MAX_NUM_THREADS];
+	/// Measure workers load every WORKER_LOAD_INTERVAL
+	struct ev_timer worker_load_timer;
+};
+
+/// Round robin connection balance
+static size_t
+next_worker_round_robin(struct socket_listener *socket_listener) {
+	const size_t cur_idx = socket_listener->accept_current_worker_idx++;
+	if (socket_listener->accept_current_worker_idx >=
+	    socket_listener->config.threads)
+		socket_listener->accept_current_worker_idx = 0;
+
+	return cur_idx;
 }
 
-static void
-main_tcp_loop(int listenfd, struct socket_listener *socket_listener) {
-	socket_listener->event_loop = ev_loop_new(0);
-	struct ev_io w_accept = {
-			.data = socket_listener,
+/// Number of connections of a worker
+static size_t worker_connections(struct socket_listener *socket_listener,
+				 size_t idx) {
+	return ATOMIC_OP(add,
+			 fetch,
+			 &socket_listener->worker_loads[idx].connections,
+			 0);
+}
+
+/// Least connections balance
+static size_t
+next_worker_least_connections(struct socket_listener *socket_listener) {
+	size_t i, ret = 0;
+
+	for (i = 1; i < socket_listener->config.threads; ++i) {
+		if (worker_connections(socket_listener, i) <
+		    worker_connections(socket_listener, ret)) {
+			ret = i;
+		}
+	}
+
+	return ret;
+}
+
+/// Least bytes in last load interval balance. Least connections breaks ties
+static size_t
+next_worker_least_bytes(struct socket_listener *socket_listener) {
+	const struct worker_load *loads = socket_listener->worker_loads;
+	size_t i, ret = 0;
+
+	for (i = 1; i < socket_listener->config.threads; ++i) {
+		if (loads[i].interval_bytes < loads[ret].interval_bytes ||
+		    (loads[i].interval_bytes == loads[ret].interval_bytes &&
+		     worker_connections(socket_listener, i) <
+				     worker_connections(socket_listener,
+							ret))) {
+			ret = i;
+		}
+	}
+
+	return ret;
+}
+
+/// Connection balance policies, indexed by enum connection_balance
+static size_t (*const next_worker_cbs[])(struct socket_listener *) = {
+		[BALANCE_ROUND_ROBIN] = next_worker_round_robin,
+		[BALANCE_LEAST_CONNECTIONS] = next_worker_least_connections,
+		[BALANCE_LEAST_BYTES] = next_worker_least_bytes,
+};
+
+static size_t size_align_to(size_t size, size_t alignment) {
+	return size % alignment == 0 ? size
+				     : (size / alignment + 1) * alignment;
+}
+
+/**
+ * @brief      Create a new connection decoder session, using properties
+ *             memory pairs
+ *
+ * @param      socket_listener  The socket listener
+ * @param      conn_priv        The connection private data
+ * @param      pairs            Properties memory
+ *
+ * @return     0 if success, !0 in other case
+ */
+static int new_connection_session(struct socket_listener *socket_listener,
+				  struct connection_private *conn_priv,
+				  struct pair *pairs) {
+	const struct listener *l = &socket_listener->listener;
+	const char *key;
+	json_t *value;
+	size_t i = 0;
+
+	const struct pair listener_options[SESSION_LISTENER_PROPS] = {
+			{.key = "D-HTTP-method", .value = "POST"},
+			{.key = "D-HTTP-URI",
+			 .value = socket_listener->config.session.uri},
+			{.key = "D-Client-IP", .value = conn_priv->client},
+			{.key = "client_ip", .value = conn_priv->client},
 	};
 
-	if (NULL == socket_listener->event_loop) {
-		rdlog(LOG_ERR, "Can't initialize event loop (out of memory?)");
-		return;
+	keyval_list_init(&conn_priv->decoder_props);
+	for (i = 0; i < RD_ARRAYSIZE(listener_options); ++i) {
+		pairs[i] = listener_options[i];
+		add_key_value_pair(&conn_priv->decoder_props, &pairs[i]);
 	}
 
-	ev_io_init((&w_accept), accept_cb, listenfd, EV_READ);
-	ev_async_init((&socket_listener->w_async), async_cb);
-	ev_io_start(socket_listener->event_loop, &w_accept);
-	ev_async_start(socket_listener->event_loop, &socket_listener->w_async);
+	json_object_foreach(socket_listener->config.session.options,
+			    key,
+			    value) {
+		pairs[i].key = key;
+		pairs[i].value = json_string_value(value);
+		add_key_value_pair(&conn_priv->decoder_props, &pairs[i++]);
+	}
 
-	size_t i;
-	for (i = 0; i < socket_listener->config.threads; ++i) {
-		struct worker_args *args = calloc(1, sizeof(args[0]));
-		if (!args) {
+	return l->decoder->new_session(conn_priv->decoder_session,
+				       l->decoder_opaque,
+				       &conn_priv->decoder_props);
+}
+
+/// TCP connection memory layout. Private data goes just after watcher, then
+/// decoder session properties and session. It is the same for all the
+/// connections of a listener, so they can be allocated from a slab.
+struct tcp_connection_layout {
+	size_t pairs_offset;   ///< Decoder session properties offset
+	size_t session_offset; ///< Decoder session offset
+	size_t size;	       ///< Total size
+};
+
+/// Connection memory layout of a listener
+static struct tcp_connection_layout
+tcp_connection_layout(const struct socket_listener *socket_listener) {
+	const struct n2k_decoder *decoder = socket_listener->listener.decoder;
+	const json_t *session_options = socket_listener->config.session.options;
+	size_t session_size = 0, num_pairs = 0;
+
+	if (decoder->new_session) {
+		session_size = decoder->session_size ? decoder->session_size()
+						     : 0;
+		num_pairs = SESSION_LISTENER_PROPS +
+			    json_object_size(session_options);
+	}
+
+	struct tcp_connection_layout layout = {
+			.pairs_offset = sizeof(struct ev_io) +
+					sizeof(struct connection_private),
+	};
+	layout.session_offset = size_align_to(
+			layout.pairs_offset + num_pairs * sizeof(struct pair),
+			SESSION_ALIGNMENT);
+	layout.size = layout.session_offset + session_size;
+	return layout;
+}
+
+/**
+ * @brief      Allocate a new connection watcher from listener slab, with its
+ *             private data, framer and decoder session (if decoder supports
+ *             them).
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  client_saddr     The client address
+ * @param[in]  client_addr      The printed client address
+ *
+ * @return     New watcher, or NULL if error.
+ */
+static struct ev_io *
+new_connection_watcher(struct socket_listener *socket_listener,
+		       const struct sockaddr_in *client_saddr,
+		       const char *client_addr) {
+	const struct n2k_decoder *decoder = socket_listener->listener.decoder;
+	const struct tcp_connection_layout layout =
+			tcp_connection_layout(socket_listener);
+
+	char *mem = slab_alloc(socket_listener->connections_slab);
+	if (unlikely(NULL == mem)) {
+		rdlog(LOG_ERR,
+		      "Can't allocate client %s private data",
+		      client_addr);
+		return NULL;
+	}
+
+	struct ev_io *w_client = (struct ev_io *)mem;
+	struct connection_private *conn_priv = NULL;
+	w_client->data = conn_priv = (struct connection_private *)&w_client[1];
+#if CONNECTION_PRIVATE_MAGIC
+	conn_priv->magic = CONNECTION_PRIVATE_MAGIC;
+#endif
+	conn_priv->listener = &socket_listener->listener;
+	conn_priv->addr = *client_saddr;
+	snprintf(conn_priv->client,
+		 sizeof(conn_priv->client),
+		 "%s",
+		 client_addr);
+
+	if (decoder->new_session) {
+		conn_priv->decoder_session = &mem[layout.session_offset];
+		const int session_rc = new_connection_session(
+				socket_listener,
+				conn_priv,
+				(struct pair *)&mem[layout.pairs_offset]);
+		if (0 != session_rc) {
 			rdlog(LOG_ERR,
-			      "Can't allocate worker arg (out of memory?");
-			continue;
+			      "Can't create client %s decoder session",
+			      client_addr);
+			slab_free(socket_listener->connections_slab, mem);
+			return NULL;
 		}
+	}
 
-		args->idx = i;
-		args->socket_listener = socket_listener;
+	socket_framer_init(&conn_priv->framer,
+			   socket_listener->config.framing,
+			   socket_listener->config.max_record_size);
+
+	return w_client;
+}
+
+/**
+ * @brief      Account a new connection in listener connection limits
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  client_saddr     The client address
+ * @param[in]  client_addr      The printed client address
+ *
+ * @return     True if connection is under limits, false if it has to be
+ *             rejected
+ */
+static bool
+tcp_connection_limits_acquire(struct socket_listener *socket_listener,
+			      const struct sockaddr_in *client_saddr,
+			      const char *client_addr) {
+	const size_t limit = socket_listener->config.connection_limit;
+	const size_t per_ip_limit =
+			socket_listener->config.per_ip_connection_limit;
+	const size_t connections =
+			ATOMIC_OP(add, fetch, &socket_listener->connections, 1);
+
+	if (limit > 0 && connections > limit) {
+		rdlog(LOG_INFO,
+		      "Connection rejected: %s over listener connection "
+		      "limit (%zu)",
+		      client_addr,
+		      limit);
+		goto reject;
+	}
+
+	if (per_ip_limit > 0 &&
+	    !addr_count_inc(socket_listener->ip_connections,
+			    (const struct sockaddr *)client_saddr,
+			    per_ip_limit)) {
+		rdlog(LOG_INFO,
+		      "Connection rejected: %s over per IP connection limit "
+		      "(%zu)",
+		      client_addr,
+		      per_ip_limit);
+		goto reject;
+	}
+
+	return true;
+
+reject:
+	ATOMIC_OP(sub, fetch, &socket_listener->connections, 1);
+	ATOMIC_OP(add, fetch, &socket_listener->tcp_stats.over_limit, 1);
+	return false;
+}
+
+/// Release a connection accounted with tcp_connection_limits_acquire
+static void
+tcp_connection_limits_release(struct socket_listener *socket_listener,
+			      const struct sockaddr_in *client_saddr) {
+	ATOMIC_OP(sub, fetch, &socket_listener->connections, 1);
+	if (socket_listener->config.per_ip_connection_limit > 0) {
+		addr_count_dec(socket_listener->ip_connections,
+			       (const struct sockaddr *)client_saddr);
+	}
+}
+
+/// Release a closed connection limits accounting and memory
+static void tcp_connection_release(struct socket_listener *socket_listener,
+				   struct connection_private *connection) {
+	tcp_connection_limits_release(socket_listener, &connection->addr);
+	slab_free(socket_listener->connections_slab,
+		  connection_watcher(connection));
+}
+
+/**
+ * @brief      Set up an accepted connection and hand it to a worker
+ *
+ * @param      loop             The loop that accepted the connection
+ * @param      socket_listener  The socket listener
+ * @param[in]  client_sd        The connection socket
+ * @param[in]  client_saddr     The client address
+ */
+static void tcp_accepted_connection(struct ev_loop *loop,
+				    struct socket_listener *socket_listener,
+				    int client_sd,
+				    struct sockaddr_in *client_saddr) {
+	char client_buf[INET6_ADDRSTRLEN];
+	const char *client_addr =
+			sockaddr2str(client_buf,
+				     sizeof(client_buf),
+				     (struct sockaddr *)client_saddr);
+	if (NULL == client_addr) {
+		rdlog(LOG_ERR, "couldn't get client address");
+		close(client_sd);
+		return;
+	}
+
+	if (!client_addr_allowed((const struct sockaddr *)client_saddr)) {
+		ATOMIC_OP(add, fetch, &socket_listener->tcp_stats.rejected, 1);
+		rdlog(LOG_INFO,
+		      "Connection rejected: %s not allowed",
+		      client_addr);
+		close(client_sd);
+		return;
+	}
+
+	if (!tcp_connection_limits_acquire(
+			    socket_listener, client_saddr, client_addr)) {
+		close(client_sd);
+		return;
+	}
+
+	ATOMIC_OP(add, fetch, &socket_listener->tcp_stats.accepted, 1);
+	print_accepted_connection_log(client_addr, client_saddr);
+
+	if (socket_listener->config.tcp_keepalive)
+		set_keepalive_opt(client_sd);
+
+	if (socket_listener->config.thread_mode == MODE_THREAD_PER_CONNECTION) {
+		rdlog(LOG_ERR,
+		      "Mode " STR_MODE_THREAD_PER_CONNECTION
+		      "still not implemented");
+		exit(-1);
+	} else {
+		struct ev_io *w_client = new_connection_watcher(
+				socket_listener, client_saddr, client_addr);
+		if (unlikely(NULL == w_client)) {
+			tcp_connection_limits_release(socket_listener,
+						      client_saddr);
+			close(client_sd);
+		} else {
+			ev_io_init(w_client, read_cb, client_sd, EV_READ);
+			// Idle time counts from accept
+			((struct connection_private *)w_client->data)
+					->last_read = ev_now(loop);
+
+			struct worker_args *worker = ev_userdata(loop);
+			if (worker) {
+				// Accepted by worker itself
+				rdbg("Connection of %s accepted by worker "
+				     "thread %zu",
+				     client_addr,
+				     worker->idx);
+				ATOMIC_OP(add,
+					  fetch,
+					  &worker->load->connections,
+					  1);
+				tcp_worker_add_connection(
+						loop, worker, w_client);
+				return;
+			}
+
+			const size_t cur_idx = next_worker_cbs
+					[socket_listener->config.balance](
+							socket_listener);
+			ATOMIC_OP(add,
+				  fetch,
+				  &socket_listener->worker_loads[cur_idx]
+						   .connections,
+				  1);
+
+			rdbg("Sent connection of %s to worker thread %zu",
+			     client_addr,
+			     cur_idx);
+
+			rd_fifoq_add(&socket_listener->watchers_queue[cur_idx],
+				     w_client);
+			ev_async_send(socket_listener->event_loops[cur_idx],
+				      &socket_listener->event_asyncs[cur_idx]);
+		}
+	}
+}
+
+/**
+ * @brief      Accept pending connections of a non blocking listen socket,
+ *             until its accept queue is empty or TCP_MAX_ACCEPTS_PER_EVENT
+ *             connections have been accepted.
+ *
+ * @param      loop             The loop
+ * @param      socket_listener  The socket listener
+ * @param[in]  listenfd         The listen socket
+ */
+static void tcp_accept_drain(struct ev_loop *loop,
+			     struct socket_listener *socket_listener,
+			     int listenfd) {
+	size_t i;
+
+	for (i = 0; i < TCP_MAX_ACCEPTS_PER_EVENT; ++i) {
+		struct sockaddr_in client_saddr;
+		socklen_t client_len = sizeof(client_saddr);
+		const int client_sd = accept4(listenfd,
+					      (struct sockaddr *)&client_saddr,
+					      &client_len,
+					      SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (client_sd >= 0) {
+			tcp_accepted_connection(loop,
+						socket_listener,
+						client_sd,
+						&client_saddr);
+			continue;
+		}
+
+		switch (errno) {
+		case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+		case EWOULDBLOCK:
+#endif
+			// Accept queue drained, or other worker got it
+			return;
+		case EINTR:
+		case ECONNABORTED:
+			continue;
+		default:
+			// Out of descriptors or memory: let next event retry
+			ATOMIC_OP(add,
+				  fetch,
+				  &socket_listener->tcp_stats.errors,
+				  1);
+			rdlog(LOG_ERR,
+			      "accept error: %s",
+			      gnu_strerror_r(errno));
+			return;
+		}
+	}
+}
+
+static void
+accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
+	struct socket_listener *socket_listener =
+			(struct socket_listener *)watcher->data;
+
+	if (EV_ERROR & revents) {
+		rdlog(LOG_ERR, "Invalid event: %s", gnu_strerror_r(errno));
+		return;
+	}
+
+	tcp_accept_drain(loop, socket_listener, watcher->fd);
+}
+
+/// Worker accept callback, when woken by its EPOLLEXCLUSIVE epoll instance
+static void exclusive_accept_cb(struct ev_loop *loop,
+				struct ev_io *watcher,
+				int revents) {
+	struct socket_listener *socket_listener =
+			(struct socket_listener *)watcher->data;
+	const struct worker_args *worker = ev_userdata(loop);
+	struct epoll_event event;
+
+	if (EV_ERROR & revents) {
+		rdlog(LOG_ERR, "Invalid event: %s", gnu_strerror_r(errno));
+		return;
+	}
+
+	// Just consume the readiness notification
+	(void)epoll_wait(watcher->fd, &event, 1, 0);
+	tcp_accept_drain(loop,
+			 socket_listener,
+			 socket_listener->listenfds[worker->idx]);
+}
+
+/**
+ * @brief      Attend acceptor connection migration request, moving the idle
+ *             connection that has read more bytes since last rebalance to
+ *             the requested worker.
+ *
+ * @param      loop    The worker loop
+ * @param      worker  The worker
+ */
+static void tcp_worker_migrate_connection(struct ev_loop *loop,
+					  struct worker_args *worker) {
+	struct socket_listener *socket_listener = worker->socket_listener;
+	struct connection_private *connection, *candidate = NULL;
+	uint64_t candidate_bytes = 0;
+
+	const size_t migrate_to =
+			ATOMIC_OP(add, fetch, &worker->load->migrate_to, 0);
+	if (0 == migrate_to) {
+		return;
+	}
+	ATOMIC_OP(sub, fetch, &worker->load->migrate_to, migrate_to);
+
+	const size_t target = migrate_to - 1;
+	const ev_tstamp now = ev_now(loop);
+	TAILQ_FOREACH(connection, &worker->connections, worker_entry) {
+		// Paused connections are kept in backpressure list
+		const bool active =
+				ev_is_active(connection_watcher(connection));
+		const bool idle = active && now - connection->last_read >=
+						    REBALANCE_MIN_IDLE;
+		if (idle && connection->rebalance_bytes > candidate_bytes) {
+			candidate = connection;
+			candidate_bytes = connection->rebalance_bytes;
+		}
+		connection->rebalance_bytes = 0;
+	}
+
+	if (NULL == candidate) {
+		rdbg("No idle connection to migrate from worker %zu",
+		     worker->idx);
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Migrating %s connection from worker %zu to worker %zu",
+	      candidate->client,
+	      worker->idx,
+	      target);
+
+	struct ev_io *watcher = connection_watcher(candidate);
+	tcp_worker_remove_connection(loop, worker, watcher);
+	ATOMIC_OP(add,
+		  fetch,
+		  &socket_listener->worker_loads[target].connections,
+		  1);
+
+	rd_fifoq_add(&socket_listener->watchers_queue[target], watcher);
+	ev_async_send(socket_listener->event_loops[target],
+		      &socket_listener->event_asyncs[target]);
+}
+
+/**
+ * @brief      Ask busiest worker to migrate one connection to the idlest
+ *             one, if load difference is big enough.
+ *
+ * @param      socket_listener  The socket listener
+ */
+static void tcp_rebalance(struct socket_listener *socket_listener) {
+	const struct worker_load *loads = socket_listener->worker_loads;
+	size_t i, busiest = 0, idlest = 0;
+
+	for (i = 1; i < socket_listener->config.threads; ++i) {
+		if (loads[i].interval_bytes > loads[busiest].interval_bytes) {
+			busiest = i;
+		}
+		if (loads[i].interval_bytes < loads[idlest].interval_bytes) {
+			idlest = i;
+		}
+	}
+
+	const uint64_t max_bytes = loads[busiest].interval_bytes;
+	if (busiest == idlest || max_bytes < REBALANCE_MIN_BYTES ||
+	    max_bytes < REBALANCE_RATIO * loads[idlest].interval_bytes ||
+	    worker_connections(socket_listener, busiest) < 2) {
+		// Moving the only connection just moves the problem
+		return;
+	}
+
+	struct worker_load *busiest_load =
+			&socket_listener->worker_loads[busiest];
+	if (0 != ATOMIC_OP(add, fetch, &busiest_load->migrate_to, 0)) {
+		// Previous request not attended yet
+		return;
+	}
+
+	ATOMIC_OP(add, fetch, &busiest_load->migrate_to, idlest + 1);
+	ev_async_send(socket_listener->event_loops[busiest],
+		      &socket_listener->event_asyncs[busiest]);
+}
+
+/// Idle connections wheel tick interval
+static ev_tstamp tcp_idle_tick(const struct worker_args *worker) {
+	return worker->idle.timeout / (TIMER_WHEEL_SLOTS - 1);
+}
+
+/**
+ * @brief      Idle wheel expire callback: close connection if it has been
+ *             idle for idle timeout, or put it back in the wheel at its new
+ *             deadline. Connections are not moved in the wheel when they
+ *             read data, so this is the only place where deadline is
+ *             checked.
+ *
+ * @param      entry   The connection wheel entry
+ * @param      opaque  The worker loop
+ */
+static void tcp_idle_expire(struct timer_wheel_entry *entry, void *opaque) {
+	struct ev_loop *loop = opaque;
+	struct worker_args *worker = ev_userdata(loop);
+	struct connection_private *connection =
+			(void *)((char *)entry -
+				 offsetof(struct connection_private,
+					  idle_entry));
+	struct ev_io *watcher = connection_watcher(connection);
+	const ev_tstamp idle = ev_now(loop) - connection->last_read;
+
+	if (!ev_is_active(watcher)) {
+		// Paused by backpressure, so it is not its fault
+		timer_wheel_add(&worker->idle.wheel,
+				entry,
+				TIMER_WHEEL_SLOTS - 1);
+		return;
+	}
+
+	if (idle < worker->idle.timeout) {
+		uint64_t ticks = (uint64_t)((worker->idle.timeout - idle) /
+					    tcp_idle_tick(worker)) +
+				 1;
+		if (ticks > TIMER_WHEEL_SLOTS - 1) {
+			ticks = TIMER_WHEEL_SLOTS - 1;
+		}
+		timer_wheel_add(&worker->idle.wheel, entry, ticks);
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Closing %s connection: idle for %.1f seconds",
+	      connection->client,
+	      idle);
+	ATOMIC_OP(add,
+		  fetch,
+		  &worker->socket_listener->tcp_stats.idle_closed,
+		  1);
+	close_socket_and_stop_watcher(loop, watcher);
+}
+
+/// Worker idle timer callback: Advance idle connections wheel
+static void
+tcp_worker_idle_cb(struct ev_loop *loop, struct ev_timer *timer, int revents) {
+	struct worker_args *worker = ev_userdata(loop);
+	(void)timer;
+	(void)revents;
+
+	timer_wheel_tick(&worker->idle.wheel, tcp_idle_expire, loop);
+}
+
+/// Acceptor timer callback: Measure workers load, and rebalance if needed
+static void worker_load_timer_cb(struct ev_loop *loop,
+				 struct ev_timer *timer,
+				 int revents) {
+	struct socket_listener *socket_listener = timer->data;
+	size_t i;
+	(void)loop;
+	(void)revents;
+
+	for (i = 0; i < socket_listener->config.threads; ++i) {
+		struct worker_load *load = &socket_listener->worker_loads[i];
+		const uint64_t bytes = ATOMIC_OP(add, fetch, &load->bytes, 0);
+		load->interval_bytes = bytes - load->last_bytes;
+		load->last_bytes = bytes;
+	}
+
+	if (socket_listener->config.rebalance) {
+		tcp_rebalance(socket_listener);
+	}
+}
+
+static void async_cb(struct ev_loop *loop,
+		     ev_async *w __attribute__((unused)),
+		     int revents) {
+	struct worker_args *args = ev_userdata(loop);
+
+	if (EV_ERROR & revents) {
+		rdlog(LOG_ERR, "Invalid event: %s", gnu_strerror_r(errno));
+		return;
+	}
+
+	if (1 == do_shutdown) {
+		/* The signal was for end the loop */
+		ev_break(loop, EVBREAK_ALL);
+	}
+
+	if (args) {
+		/* The signal was alerting a new socket to watch */
+		size_t i = args->idx;
+		rd_fifoq_elm_t *qelm = NULL;
+		while ((qelm = rd_fifoq_pop(
+					&args->socket_listener->watchers_queue
+							 [i]))) {
+			struct ev_io *w_client = qelm->rfqe_ptr;
+			if (NULL != w_client) {
+				tcp_worker_add_connection(
+						loop, args, w_client);
+			}
+
+			rd_fifoq_elm_release(
+					&args->socket_listener
+							 ->watchers_queue[i],
+					qelm);
+		}
+
+		tcp_worker_migrate_connection(loop, args);
+	}
+}
+
+/**
+ * @brief      Run worker event loop in busy poll latency mode: while its
+ *             connections keep sending data, look for events without
+ *             waiting, and only wait in epoll after busy poll budget time
+ *             without data.
+ *
+ * @param      worker_args  The worker arguments
+ */
+static void tcp_worker_busy_poll_run(struct worker_args *worker_args) {
+	struct socket_listener *socket_listener = worker_args->socket_listener;
+	struct ev_loop *loop = socket_listener->event_loops[worker_args->idx];
+	const uint64_t budget_ns =
+			(uint64_t)socket_listener->config.busy_poll_budget_us *
+			1000;
+	struct worker_load *load = worker_args->load;
+
+	while (!do_shutdown) {
+		uint64_t bytes = ATOMIC_OP(add, fetch, &load->bytes, 0);
+		uint64_t spin_deadline = clock_ns(CLOCK_MONOTONIC) + budget_ns;
+
+		do {
+			ev_run(loop, EVRUN_NOWAIT);
+			const uint64_t new_bytes =
+					ATOMIC_OP(add, fetch, &load->bytes, 0);
+			if (new_bytes != bytes) {
+				bytes = new_bytes;
+				spin_deadline = clock_ns(CLOCK_MONOTONIC) +
+						budget_ns;
+			}
+		} while (!do_shutdown &&
+			 clock_ns(CLOCK_MONOTONIC) < spin_deadline);
+
+		if (!do_shutdown) {
+			ev_run(loop, EVRUN_ONCE);
+		}
+	}
+}
+
+static void *worker(void *_worker_arg) {
+	struct worker_args *worker_args = _worker_arg;
+
+	size_t i;
+
+	cpu_affinity_apply(&worker_args->socket_listener->config.affinity,
+			   worker_args->socket_listener->listener.port,
+			   "worker",
+			   worker_args->idx);
+
+	// Pools need to be owned by this thread. Keep roughly the same free
+	// memory in every size class.
+	for (i = 0; i < TCP_READ_SIZE_CLASSES; ++i) {
+		worker_args->buffer_pools[i] =
+				buffer_pool_new((size_t)READ_BUFFER_SIZE << i,
+						BUFFER_POOL_MAX_FREE >> i);
+		if (unlikely(NULL == worker_args->buffer_pools[i])) {
+			rdlog(LOG_ERR,
+			      "Can't create worker %zu buffer pool (OOM?)",
+			      worker_args->idx);
+			exit(-1);
+		}
+	}
+
+	if (worker_args->messages.enabled) {
+		// Tail of the messages that does not fit in a pool buffer
+		worker_args->messages.overflow_size =
+				worker_args->socket_listener->config
+						.max_record_size;
+		worker_args->messages.overflow =
+				malloc(worker_args->messages.overflow_size);
+		if (unlikely(NULL == worker_args->messages.overflow)) {
+			rdlog(LOG_ERR,
+			      "Can't create worker %zu message buffer (OOM?)",
+			      worker_args->idx);
+			exit(-1);
+		}
+	}
+
+	struct socket_listener *socket_listener = worker_args->socket_listener;
+	struct ev_loop *loop = socket_listener->event_loops[worker_args->idx];
+	if (socket_listener->config.latency_mode == LATENCY_MODE_BUSY_POLL) {
+		tcp_worker_busy_poll_run(worker_args);
+	} else {
+		ev_run(loop, 0);
+	}
+
+	// Release connections limits and decoder sessions
+	struct connection_private *connection;
+	while ((connection = TAILQ_FIRST(&worker_args->connections))) {
+		close_socket_and_stop_watcher(loop,
+					      connection_watcher(connection));
+	}
+	ev_timer_stop(loop, &worker_args->idle.timer);
+
+	for (i = 0; i < TCP_READ_SIZE_CLASSES; ++i) {
+		buffer_pool_done(worker_args->buffer_pools[i]);
+	}
+	free(worker_args->messages.overflow);
+	free(worker_args);
+
+	return NULL;
+}
+
+/// Number of listen sockets of the listener
+static size_t listen_sockets_count(const struct socket_listener *sl) {
+	return sl->config.reuseport ? sl->config.threads : 1;
+}
+
+/**
+ * @brief      Append listener member name of kafka stats message:
+ *             "<proto>_listener_<port>", or "unix_listener_<path>" for unix
+ *             sockets listeners.
+ *
+ * @param[in]  socket_listener  The socket listener
+ * @param[in]  proto            The IP protocol name
+ * @param      str              The stats members
+ */
+static void
+socket_listener_stats_key(const struct socket_listener *socket_listener,
+			  const char *proto,
+			  struct string *str) {
+	char key[sizeof(((struct sockaddr_un *)NULL)->sun_path) +
+		 sizeof(N2KAFKA_UNIX "_listener_")];
+
+	if (NULL == socket_listener->config.path) {
+		string_printf(str,
+			      "\"%s_listener_%" PRIu16 "\"",
+			      proto,
+			      socket_listener->listener.port);
+		return;
+	}
+
+	// Path can contain characters that need to be escaped
+	const int key_len = snprintf(key,
+				     sizeof(key),
+				     N2KAFKA_UNIX "_listener_%s",
+				     socket_listener->config.path);
+	string_append_json_string(str, key, (size_t)key_len);
+}
+
+/**
+ * @brief      Get listener ingest to produce latency percentile
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  percentile       The percentile
+ *
+ * @return     Latency, in microseconds
+ */
+static uint64_t listener_latency_us(struct socket_listener *socket_listener,
+				    double percentile) {
+	return latency_histogram_percentile(socket_listener->latency,
+					    socket_listener->config.threads,
+					    percentile) /
+	       1000;
+}
+
+/**
+ * @brief      Append TCP listener statistics to kafka stats message
+ *
+ * @param      provider  The socket listener stats provider
+ * @param      str       The stats members
+ */
+static void tcp_stats_provider_append(struct kafka_stats_provider *provider,
+				      struct string *str) {
+	struct socket_listener *socket_listener =
+			(void *)((char *)provider -
+				 offsetof(struct socket_listener,
+					  stats_provider));
+	int64_t listen_drops = 0, accept_queue = 0;
+	size_t i;
+
+	for (i = 0; i < listen_sockets_count(socket_listener); ++i) {
+		const int fd = socket_listener->listenfds[i];
+		const int64_t drops = get_sk_drops(fd);
+		const int64_t queue = get_accept_queue(fd);
+
+		if (drops > 0) {
+			listen_drops += drops;
+		}
+		if (queue > 0) {
+			accept_queue += queue;
+		}
+	}
+
+	socket_listener_stats_key(socket_listener, N2KAFKA_TCP, str);
+	string_printf(str,
+		      ":{\"accepted\":%" PRIu64
+		      ",\"rejected\":%" PRIu64 ",\"accept_errors\":%" PRIu64
+		      ",\"listen_drops\":%" PRId64 ",\"accept_queue\":%" PRId64
+		      ",\"connections\":%zu,\"over_limit\":%" PRIu64
+		      ",\"idle_closed\":%" PRIu64
+		      ",\"latency_p50_us\":%" PRIu64
+		      ",\"latency_p99_us\":%" PRIu64 "}",
+		      ATOMIC_OP(add,
+				fetch,
+				&socket_listener->tcp_stats.accepted,
+				0),
+		      ATOMIC_OP(add,
+				fetch,
+				&socket_listener->tcp_stats.rejected,
+				0),
+		      ATOMIC_OP(add,
+				fetch,
+				&socket_listener->tcp_stats.errors,
+				0),
+		      listen_drops,
+		      accept_queue,
+		      ATOMIC_OP(add, fetch, &socket_listener->connections, 0),
+		      ATOMIC_OP(add,
+				fetch,
+				&socket_listener->tcp_stats.over_limit,
+				0),
+		      ATOMIC_OP(add,
+				fetch,
+				&socket_listener->tcp_stats.idle_closed,
+				0),
+		      listener_latency_us(socket_listener, 50),
+		      listener_latency_us(socket_listener, 99));
+}
+
+/**
+ * @brief      Log TCP accept statistics
+ *
+ * @param[in]  socket_listener  The socket listener
+ */
+static void
+print_tcp_stats(const struct socket_listener *socket_listener) {
+	int64_t listen_drops = 0;
+	size_t i;
+
+	for (i = 0; i < listen_sockets_count(socket_listener); ++i) {
+		const int64_t drops =
+				get_sk_drops(socket_listener->listenfds[i]);
+		if (drops > 0) {
+			listen_drops += drops;
+		}
+	}
+
+	rdlog(LOG_INFO,
+	      "%s listener on %s accepted %" PRIu64
+	      " connections, rejected %" PRIu64 ", %" PRIu64
+	      " accept errors, %" PRId64 " connections dropped by kernel "
+	      "because of full accept queue, %" PRIu64 " over connection "
+	      "limits, %" PRIu64 " closed by idle timeout",
+	      socket_listener->config.proto,
+	      socket_listener->config.addr_str,
+	      socket_listener->tcp_stats.accepted,
+	      socket_listener->tcp_stats.rejected,
+	      socket_listener->tcp_stats.errors,
+	      listen_drops,
+	      socket_listener->tcp_stats.over_limit,
+	      socket_listener->tcp_stats.idle_closed);
+}
+
+/// Close worker accept epoll instances
+static void close_accept_epolls(struct socket_listener *socket_listener,
+				size_t count) {
+	size_t i;
+	for (i = 0; i < count; ++i) {
+		close(socket_listener->accept_epfds[i]);
+	}
+}
+
+/**
+ * @brief      Make every worker wait for the shared listen socket in its own
+ *             epoll instance, registered with EPOLLEXCLUSIVE so the kernel
+ *             only wakes one of them for each incoming connection.
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  listenfd         The listen socket
+ *
+ * @return     0 if success, -1 in other case (errno set)
+ */
+static int open_accept_epolls(struct socket_listener *socket_listener,
+			      int listenfd) {
+#ifdef EPOLLEXCLUSIVE
+	struct epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE};
+	size_t i;
+
+	for (i = 0; i < socket_listener->config.threads; ++i) {
+		const int epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0) {
+			close_accept_epolls(socket_listener, i);
+			return -1;
+		}
+
+		if (0 != epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &event)) {
+			const int epoll_ctl_errno = errno;
+			close(epfd);
+			close_accept_epolls(socket_listener, i);
+			errno = epoll_ctl_errno;
+			return -1;
+		}
+
+		socket_listener->accept_epfds[i] = epfd;
+		socket_listener->listenfds[i] = listenfd;
+	}
+
+	return 0;
+#else
+	(void)socket_listener;
+	(void)listenfd;
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+static void
+main_tcp_loop(int listenfd, struct socket_listener *socket_listener) {
+	socket_listener->event_loop = ev_loop_new(0);
+	struct ev_io w_accept = {
+			.data = socket_listener,
+	};
+	size_t i;
+
+	if (NULL == socket_listener->event_loop) {
+		rdlog(LOG_ERR, "Can't initialize event loop (out of memory?)");
+		return;
+	}
+
+	socket_listener->connections_slab =
+			slab_new(tcp_connection_layout(socket_listener).size,
+				 CONNECTIONS_SLAB_CHUNK);
+	if (socket_listener->config.per_ip_connection_limit > 0) {
+		socket_listener->ip_connections = addr_count_new();
+	}
+
+	if (NULL == socket_listener->connections_slab ||
+	    (socket_listener->config.per_ip_connection_limit > 0 &&
+	     NULL == socket_listener->ip_connections)) {
+		rdlog(LOG_ERR, "Can't allocate connections table (OOM?)");
+		goto connections_err;
+	}
+
+	if (!socket_listener->config.reuseport) {
+		socket_listener->listenfds[0] = listenfd;
+	}
+
+	// Accept callbacks drain accept queue until EAGAIN
+	for (i = 0; i < listen_sockets_count(socket_listener); ++i) {
+		set_nonblock_flag(socket_listener->listenfds[i]);
+	}
+
+	if (socket_listener->config.accept_exclusive &&
+	    0 != open_accept_epolls(socket_listener, listenfd)) {
+		rdlog(LOG_WARNING,
+		      "Can't make workers accept with EPOLLEXCLUSIVE: %s. "
+		      "Accepting in listener thread.",
+		      gnu_strerror_r(errno));
+		socket_listener->config.accept_exclusive = false;
+	}
+
+	const bool workers_accept = socket_listener->config.reuseport ||
+				    socket_listener->config.accept_exclusive;
+
+	ev_io_init((&w_accept), accept_cb, listenfd, EV_READ);
+	ev_async_init((&socket_listener->w_async), async_cb);
+	if (!workers_accept) {
+		ev_io_start(socket_listener->event_loop, &w_accept);
+	}
+	ev_async_start(socket_listener->event_loop, &socket_listener->w_async);
+
+	if (socket_listener->config.balance == BALANCE_LEAST_BYTES ||
+	    socket_listener->config.rebalance) {
+		ev_timer_init(&socket_listener->worker_load_timer,
+			      worker_load_timer_cb,
+			      WORKER_LOAD_INTERVAL,
+			      WORKER_LOAD_INTERVAL);
+		socket_listener->worker_load_timer.data = socket_listener;
+		ev_timer_start(socket_listener->event_loop,
+			       &socket_listener->worker_load_timer);
+	}
+
+	socket_listener->stats_provider.append = tcp_stats_provider_append;
+	kafka_stats_provider_add(&socket_listener->stats_provider);
+
+	for (i = 0; i < socket_listener->config.threads; ++i) {
+		struct worker_args *args = calloc(1, sizeof(args[0]));
+		if (!args) {
+			rdlog(LOG_ERR,
+			      "Can't allocate worker arg (out of memory?");
+			continue;
+		}
+
+		args->idx = i;
+		args->socket_listener = socket_listener;
+		args->backpressure.config = &socket_listener->backpressure;
+		TAILQ_INIT(&args->backpressure.connections);
+		args->load = &socket_listener->worker_loads[i];
+		args->latency = &socket_listener->latency[i];
+		TAILQ_INIT(&args->connections);
+		ev_timer_init(&args->backpressure.resume_timer,
+			      tcp_worker_resume_cb,
+			      0.,
+			      BACKPRESSURE_CHECK_INTERVAL);
+		args->idle.timeout = socket_listener->config.idle_timeout;
+		args->messages.enabled =
+				socket_listener->config.path &&
+				socket_listener->config.unix_type ==
+						SOCK_SEQPACKET;
+		timer_wheel_init(&args->idle.wheel);
+		ev_timer_init(&args->idle.timer,
+			      tcp_worker_idle_cb,
+			      tcp_idle_tick(args),
+			      tcp_idle_tick(args));
+
+		socket_listener->event_loops[i] = ev_loop_new(0);
+		if (socket_listener->event_loops[i] == NULL) {
+			rdlog(LOG_ERR, "Can't create even't loop %zu", i);
+			free(args);
+			continue;
+		}
+
+		ev_set_userdata(socket_listener->event_loops[i], args);
+
+		rd_fifoq_init(&socket_listener->watchers_queue[i]);
+		ev_async_init(&socket_listener->event_asyncs[i], async_cb);
+		socket_listener->event_asyncs[i].data = socket_listener;
+		ev_async_start(socket_listener->event_loops[i],
+			       &socket_listener->event_asyncs[i]);
+		if (args->idle.timeout > 0) {
+			ev_timer_start(socket_listener->event_loops[i],
+				       &args->idle.timer);
+		}
+
+		if (socket_listener->config.reuseport) {
+			struct ev_io *w_worker_accept =
+					&socket_listener->accept_watchers[i];
+			ev_io_init(w_worker_accept,
+				   accept_cb,
+				   socket_listener->listenfds[i],
+				   EV_READ);
+			w_worker_accept->data = socket_listener;
+			ev_io_start(socket_listener->event_loops[i],
+				    w_worker_accept);
+		} else if (socket_listener->config.accept_exclusive) {
+			struct ev_io *w_worker_accept =
+					&socket_listener->accept_watchers[i];
+			ev_io_init(w_worker_accept,
+				   exclusive_accept_cb,
+				   socket_listener->accept_epfds[i],
+				   EV_READ);
+			w_worker_accept->data = socket_listener;
+			ev_io_start(socket_listener->event_loops[i],
+				    w_worker_accept);
+		}
+
+		pthread_create(&socket_listener->threads[i],
+			       NULL,
+			       worker,
+			       args);
+	}
+
+	ev_run(socket_listener->event_loop, 0);
+
+	for (i = 0; i < socket_listener->config.threads; ++i) {
+		if (NULL == socket_listener->event_loops[i]) {
+			rdlog(LOG_ERR,
+			      "Something happened: event loop %zu not found.",
+			      i);
+			continue;
+		}
+
+		ev_async_send(socket_listener->event_loops[i],
+			      &socket_listener->event_asyncs[i]);
+		pthread_join(socket_listener->threads[i], NULL);
+
+		ev_async_stop(socket_listener->event_loops[i],
+			      &socket_listener->event_asyncs[i]);
+		if (workers_accept) {
+			ev_io_stop(socket_listener->event_loops[i],
+				   &socket_listener->accept_watchers[i]);
+		}
+		ev_loop_destroy(socket_listener->event_loops[i]);
+	}
+
+	ev_async_stop(socket_listener->event_loop, &socket_listener->w_async);
+	ev_timer_stop(socket_listener->event_loop,
+		      &socket_listener->worker_load_timer);
+	if (!workers_accept) {
+		ev_io_stop(socket_listener->event_loop, &w_accept);
+	}
+
+	if (socket_listener->config.accept_exclusive) {
+		close_accept_epolls(socket_listener,
+				    socket_listener->config.threads);
+	}
+
+	kafka_stats_provider_remove(&socket_listener->stats_provider);
+	print_tcp_stats(socket_listener);
+
+connections_err:
+	if (socket_listener->ip_connections) {
+		addr_count_done(socket_listener->ip_connections);
+	}
+	if (socket_listener->connections_slab) {
+		slab_destroy(socket_listener->connections_slab);
+	}
+	ev_loop_destroy(socket_listener->event_loop);
+}
+
+/// Sum of read datagrams sizes
+static size_t udp_recv_batch_bytes(const struct udp_recv_batch *batch,
+				   size_t recv_count) {
+	size_t i, ret = 0;
+	for (i = 0; i < recv_count; ++i) {
+		ret += batch->msgs[i].msg_len;
+	}
+	return ret;
+}
+
+/**
+ * @brief      Stop reading until kafka queue goes down to low watermark, so
+ *             datagrams wait in socket buffer.
+ *
+ * @param      socket_listener  The socket listener
+ */
+static void udp_backpressure_wait(struct socket_listener *socket_listener) {
+	struct kafka_backpressure *backpressure =
+			&socket_listener->backpressure;
+	const struct timespec interval = {
+			.tv_sec = 0,
+			.tv_nsec = (long)(BACKPRESSURE_CHECK_INTERVAL * 1e9),
+	};
+
+	rdlog(LOG_INFO,
+	      "Kafka queue over high watermark, pausing %s listener on %s "
+	      "reads",
+	      socket_listener->config.proto,
+	      socket_listener->config.addr_str);
+	ATOMIC_OP(add, fetch, &backpressure->stats.pauses, 1);
+
+	while (!do_shutdown && !kafka_backpressure_low(backpressure)) {
+		nanosleep(&interval, NULL);
+	}
+
+	rdlog(LOG_INFO,
+	      "Kafka queue under low watermark, resuming %s listener on %s "
+	      "reads",
+	      socket_listener->config.proto,
+	      socket_listener->config.addr_str);
+}
+
+/**
+ * @brief      Prepare UDP socket drops and receive buffer tracking.
+ *
+ * @param      state  The socket state
+ * @param[in]  fd     The socket
+ */
+static void udp_socket_state_init(struct udp_socket_state *state, int fd) {
+	memset(state, 0, sizeof(*state));
+	state->fd = fd;
+
+#ifdef SO_RXQ_OVFL
+	const int enable = 1;
+	const int sso_rc = setsockopt(
+			fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+	if (sso_rc != 0) {
+		rdlog(LOG_WARNING,
+		      "Can't enable SO_RXQ_OVFL, kernel drops will not be "
+		      "accounted: %s",
+		      gnu_strerror_r(errno));
+	}
+#endif
+
+	const int rcvbuf = get_rcvbuf_opt(fd);
+	state->rcvbuf = rcvbuf > 0 ? rcvbuf / 2 : 0;
+}
+
+/**
+ * @brief      Enable UDP GRO in all listener sockets, so kernel can deliver
+ *             many datagrams of the same flow in one read. GRO is disabled
+ *             in listener config if no socket supports it.
+ *
+ * @param      socket_listener  The socket listener
+ */
+static void udp_sockets_enable_gro(struct socket_listener *socket_listener) {
+	size_t i, enabled = 0;
+
+	for (i = 0; i < socket_listener->udp_sockets_count; ++i) {
+#ifdef UDP_GRO
+		const int enable = 1;
+		const int fd = socket_listener->udp_sockets[i].fd;
+		const int sso_rc = setsockopt(fd,
+					      SOL_UDP,
+					      UDP_GRO,
+					      &enable,
+					      sizeof(enable));
+		if (sso_rc == 0) {
+			enabled++;
+			continue;
+		}
+#else
+		errno = ENOTSUP;
+#endif
+		rdlog(LOG_WARNING,
+		      "Can't enable UDP_GRO in listener on %s: %s",
+		      socket_listener->config.addr_str,
+		      gnu_strerror_r(errno));
+	}
+
+	socket_listener->config.udp_gro = enabled > 0;
+}
+
+/**
+ * @brief      Search SO_RXQ_OVFL counter in datagram control messages. Kernel
+ *             only adds it if some datagram has been dropped.
+ *
+ * @param      hdr       The datagram header
+ * @param      rxq_ovfl  The dropped datagrams counter
+ *
+ * @return     True if found
+ */
+static bool udp_msg_rxq_ovfl(struct msghdr *hdr, uint32_t *rxq_ovfl) {
+#ifdef SO_RXQ_OVFL
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(rxq_ovfl, CMSG_DATA(cmsg), sizeof(*rxq_ovfl));
+			return true;
+		}
+	}
+#else
+	(void)hdr;
+	(void)rxq_ovfl;
+#endif
+	return false;
+}
+
+/**
+ * @brief      Double UDP socket receive buffer, up to configured max, at most
+ *             once every RCVBUF_AUTOTUNE_INTERVAL
+ *
+ * @param[in]  socket_listener  The socket listener
+ * @param      state            The socket state
+ * @param[in]  drops            The last observed drops
+ */
+static void udp_socket_autotune(const struct socket_listener *socket_listener,
+				struct udp_socket_state *state,
+				uint32_t drops) {
+	const int max = socket_listener->config.rcvbuf_autotune_max;
+	const time_t now = time(NULL);
+
+	if (max <= 0 || state->rcvbuf <= 0 || state->rcvbuf >= max ||
+	    now - state->last_autotune < RCVBUF_AUTOTUNE_INTERVAL) {
+		return;
+	}
+
+	state->last_autotune = now;
+	state->rcvbuf = state->rcvbuf > max / 2 ? max : state->rcvbuf * 2;
+	const int effective_rcvbuf = set_rcvbuf_opt(state->fd, state->rcvbuf);
+
+	rdlog(LOG_INFO,
+	      "%s listener on %s dropped %" PRIu32
+	      " datagrams, growing receive buffer to %d bytes (kernel reports "
+	      "%d)",
+	      socket_listener->config.proto,
+	      socket_listener->config.addr_str,
+	      drops,
+	      state->rcvbuf,
+	      effective_rcvbuf);
+}
+
+/**
+ * @brief      Account kernel drops reported with the last read datagram.
+ *             Needs to be called with socket mutex held, if any.
+ *
+ * @param      socket_listener  The socket listener
+ * @param      state            The socket state
+ * @param      batch            The read batch
+ * @param[in]  recv_count       The number of read datagrams
+ */
+static void udp_socket_update(struct socket_listener *socket_listener,
+			      struct udp_socket_state *state,
+			      struct udp_recv_batch *batch,
+			      size_t recv_count) {
+	uint32_t rxq_ovfl;
+	struct msghdr *hdr = &batch->msgs[recv_count - 1].msg_hdr;
+
+	if (!udp_msg_rxq_ovfl(hdr, &rxq_ovfl) || rxq_ovfl == state->rxq_ovfl) {
+		return;
+	}
+
+	// Unsigned arithmetic handles counter wrap
+	const uint32_t drops = rxq_ovfl - state->rxq_ovfl;
+	state->rxq_ovfl = rxq_ovfl;
+	ATOMIC_OP(add, fetch, &socket_listener->udp_stats.drops, drops);
+	udp_socket_autotune(socket_listener, state, drops);
+}
+
+/**
+ * @brief      Append UDP listener statistics to kafka stats message
+ *
+ * @param      provider  The socket listener stats provider
+ * @param      str       The stats members
+ */
+static void udp_stats_provider_append(struct kafka_stats_provider *provider,
+				      struct string *str) {
+	struct socket_listener *socket_listener =
+			(void *)((char *)provider -
+				 offsetof(struct socket_listener,
+					  stats_provider));
+	int64_t queue_depth = 0;
+	int64_t rcvbuf = 0;
+	uint64_t drops = socket_listener->udp_stats.socket_drops
+				 ? 0
+				 : ATOMIC_OP(add,
+					     fetch,
+					     &socket_listener->udp_stats.drops,
+					     0);
+	size_t i;
+
+	for (i = 0; i < socket_listener->udp_sockets_count; ++i) {
+		const int fd = socket_listener->udp_sockets[i].fd;
+		const int64_t rmem_alloc = get_rmem_alloc(fd);
+		const int socket_rcvbuf = get_rcvbuf_opt(fd);
+		const int64_t socket_drops =
+				socket_listener->udp_stats.socket_drops
+						? get_sk_drops(fd)
+						: -1;
+
+		if (rmem_alloc > 0) {
+			queue_depth += rmem_alloc;
+		}
+		if (socket_rcvbuf > 0) {
+			rcvbuf += socket_rcvbuf;
+		}
+		if (socket_drops > 0) {
+			drops += (uint64_t)socket_drops;
+		}
+	}
+
+	socket_listener_stats_key(socket_listener, N2KAFKA_UDP, str);
+	string_printf(str,
+		      ":{\"received\":%" PRIu64 ",\"dropped\":%" PRIu64
+		      ",\"queue_depth\":%" PRId64 ",\"rcvbuf\":%" PRId64
+		      ",\"latency_p50_us\":%" PRIu64
+		      ",\"latency_p99_us\":%" PRIu64 "}",
+		      ATOMIC_OP(add,
+				fetch,
+				&socket_listener->udp_stats.datagrams,
+				0),
+		      drops,
+		      queue_depth,
+		      rcvbuf,
+		      listener_latency_us(socket_listener, 50),
+		      listener_latency_us(socket_listener, 99));
+}
+
+/// @TODO join with TCP
+static void *main_consumer_loop_udp(void *_thread_info) {
+	struct udp_thread_info *thread_info = _thread_info;
+	struct socket_listener *socket_listener = thread_info->socket_listener;
+	struct udp_recv_batch batch;
+
+	cpu_affinity_apply(&socket_listener->config.affinity,
+			   socket_listener->listener.port,
+			   "UDP",
+			   thread_info->idx);
+
+	const size_t batch_size = socket_listener->config.udp_batch_size;
+	const int batch_init_rc = udp_recv_batch_init(
+			&batch, batch_size, socket_listener->config.udp_gro);
+	if (unlikely(batch_init_rc != 0)) {
+		rdlog(LOG_ERR,
+		      "Can't allocate UDP batch of %zu datagrams (out of "
+		      "memory?)",
+		      batch_size);
+		return NULL;
+	}
+
+	const struct listener *l = &socket_listener->listener;
+	struct kafka_backpressure *backpressure =
+			&socket_listener->backpressure;
+	bool buffer_full = false, held_back = false;
+	struct latency_histogram *latency =
+			&socket_listener->latency[thread_info->idx];
+
+	// Busy poll: read without waiting until deadline, 0 if not spinning.
+	// Threads sharing the socket would spin on its mutex instead.
+	const bool busy_poll = socket_listener->config.latency_mode ==
+					       LATENCY_MODE_BUSY_POLL &&
+			       NULL == thread_info->listenfd_mutex;
+	const uint64_t busy_poll_budget_ns =
+			(uint64_t)socket_listener->config.busy_poll_budget_us *
+			1000;
+	uint64_t spin_deadline = 0;
+
+	while (!do_shutdown) {
+		int recv_result = 0;
+		struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+
+		if (backpressure->high_watermark > 0 &&
+		    (buffer_full || kafka_backpressure_high(backpressure))) {
+			udp_backpressure_wait(socket_listener);
+			buffer_full = false;
+			held_back = true;
+		}
+
+		if (thread_info->listenfd_mutex) {
+			pthread_mutex_lock(thread_info->listenfd_mutex);
+		}
+		if (likely(!do_shutdown) && spin_deadline > 0) {
+			// Sockets had data very recently, don't wait for them
+			recv_result = receive_batch_from_socket(
+					thread_info->listenfd, &batch);
+			if (recv_result > 0) {
+				udp_socket_update(socket_listener,
+						  thread_info->socket_state,
+						  &batch,
+						  (size_t)recv_result);
+			}
+		} else if (likely(!do_shutdown)) {
+			int select_result = select_socket(thread_info->listenfd,
+							  &tv);
+			if (select_result == -1 &&
+			    errno != EINTR) { /* NOT
+						 INTERRUPTED
+					       */
+				rdlog(LOG_ERR,
+				      "listen select error: %s",
+				      gnu_strerror_r(errno));
+			} else if (select_result > 0) {
+				recv_result = receive_batch_from_socket(
+						thread_info->listenfd, &batch);
+			}
+			if (recv_result > 0) {
+				udp_socket_update(socket_listener,
+						  thread_info->socket_state,
+						  &batch,
+						  (size_t)recv_result);
+			}
+		}
+		if (thread_info->listenfd_mutex) {
+			pthread_mutex_unlock(thread_info->listenfd_mutex);
+		}
+
+		if (busy_poll) {
+			const uint64_t now = clock_ns(CLOCK_MONOTONIC);
+			if (recv_result > 0) {
+				spin_deadline = now + busy_poll_budget_ns;
+			} else if (now >= spin_deadline) {
+				// Budget exhausted, wait for data
+				spin_deadline = 0;
+			}
+		}
+
+		if (recv_result < 0) {
+			if (errno == EAGAIN) {
+				rdbg("Socket not ready. re-trying");
+			} else {
+				rdlog(LOG_ERR,
+				      "Recv error: %s",
+				      gnu_strerror_r(errno));
+				break;
+			}
+		} else if (recv_result > 0) {
+			const size_t recv_count = (size_t)recv_result;
+			const size_t msgs_count = udp_recv_batch_messages(
+					&batch, recv_count);
+			ATOMIC_OP(add,
+				  fetch,
+				  &socket_listener->udp_stats.wakeups,
+				  1);
+			ATOMIC_OP(add,
+				  fetch,
+				  &socket_listener->udp_stats.datagrams,
+				  msgs_count);
+			if (recv_count == batch.size) {
+				ATOMIC_OP(add,
+					  fetch,
+					  &socket_listener->udp_stats
+							   .full_batches,
+					  1);
+			}
+
+			if (held_back) {
+				kafka_backpressure_held_back(
+						backpressure,
+						msgs_count,
+						udp_recv_batch_bytes(
+								&batch,
+								recv_count));
+				// Socket buffer drained if batch is not full
+				held_back = recv_count == batch.size;
+			}
+
+			const enum decoder_callback_err decode_rc =
+					listener_decode_batch(l,
+							      batch.batch,
+							      msgs_count);
+			buffer_full = decode_rc == DECODER_CALLBACK_BUFFER_FULL;
+			udp_recv_batch_latency(&batch, recv_count, latency);
+			if (0 != udp_recv_batch_refill(&batch, recv_count)) {
+				break;
+			}
+		}
+	}
+
+	udp_recv_batch_done(&batch);
+	return NULL;
+}
+
+/**
+ * @brief      Log UDP reception statistics
+ *
+ * @param[in]  socket_listener  The socket listener
+ */
+static void
+print_udp_stats(const struct socket_listener *socket_listener) {
+	const uint64_t wakeups = socket_listener->udp_stats.wakeups;
+	const uint64_t datagrams = socket_listener->udp_stats.datagrams;
+
+	rdlog(LOG_INFO,
+	      "%s listener on %s read %" PRIu64
+	      " datagrams in %" PRIu64 " wakeups (%.2f datagrams per wakeup, "
+	      "%" PRIu64 " full batches of %zu), %" PRIu64
+	      " datagrams dropped by kernel",
+	      socket_listener->config.proto,
+	      socket_listener->config.addr_str,
+	      datagrams,
+	      wakeups,
+	      wakeups ? (double)datagrams / (double)wakeups : 0.,
+	      socket_listener->udp_stats.full_batches,
+	      socket_listener->config.udp_batch_size,
+	      socket_listener->udp_stats.drops);
+}
+
+/**
+ * @brief      Log kafka backpressure statistics
+ *
+ * @param[in]  socket_listener  The socket listener
+ */
+static void
+print_backpressure_stats(const struct socket_listener *socket_listener) {
+	const struct kafka_backpressure *backpressure =
+			&socket_listener->backpressure;
+
+	rdlog(LOG_INFO,
+	      "Listener on %s paused reading %" PRIu64
+	      " times because of kafka backpressure, holding back %" PRIu64
+	      " messages (%" PRIu64 " bytes)",
+	      socket_listener->config.addr_str,
+	      backpressure->stats.pauses,
+	      backpressure->stats.held_back_messages,
+	      backpressure->stats.held_back_bytes);
+}
+
+static void main_udp_loop(int listenfd,
+			  struct socket_listener *socket_listener) {
+	/* Lots of threads listening  and processing*/
+	const size_t udp_threads = socket_listener->config.threads;
+	const bool reuseport = socket_listener->config.reuseport;
+	unsigned int i;
+	pthread_mutex_t listenfd_mutex;
+
+	assert(udp_threads > 0);
+	pthread_t *threads = malloc(sizeof(threads[0]) * udp_threads);
+	struct udp_thread_info *udp_thread_info =
+			calloc(udp_threads, sizeof(udp_thread_info[0]));
+	if (unlikely(NULL == threads || NULL == udp_thread_info)) {
+		rdlog(LOG_ERR, "Can't allocate UDP threads (out of memory?)");
+		goto err;
+	}
+
+	if (!reuseport && 0 != createListenSocketMutex(&listenfd_mutex))
+		exit(-1);
+
+	if (!reuseport &&
+	    socket_listener->config.latency_mode == LATENCY_MODE_BUSY_POLL) {
+		rdlog(LOG_WARNING,
+		      "%s listener on %s threads share its socket, so they "
+		      "will not spin on it in " STR_LATENCY_MODE_BUSY_POLL
+		      " latency mode",
+		      socket_listener->config.proto,
+		      socket_listener->config.addr_str);
+	}
+
+	socket_listener->udp_sockets_count = reuseport ? udp_threads : 1;
+	for (i = 0; i < socket_listener->udp_sockets_count; ++i) {
+		udp_socket_state_init(&socket_listener->udp_sockets[i],
+				      reuseport ? socket_listener->listenfds[i]
+						: listenfd);
+	}
+	if (socket_listener->config.udp_gro) {
+		udp_sockets_enable_gro(socket_listener);
+	}
+	socket_listener->stats_provider.append = udp_stats_provider_append;
+	kafka_stats_provider_add(&socket_listener->stats_provider);
+
+	for (i = 0; i < udp_threads; ++i) {
+		udp_thread_info[i].socket_listener = socket_listener;
+		udp_thread_info[i].idx = i;
+		if (reuseport) {
+			// Every thread reads its own socket
+			udp_thread_info[i].listenfd =
+					socket_listener->listenfds[i];
+			udp_thread_info[i].listenfd_mutex = NULL;
+			udp_thread_info[i].socket_state =
+					&socket_listener->udp_sockets[i];
+		} else {
+			udp_thread_info[i].listenfd = listenfd;
+			udp_thread_info[i].listenfd_mutex = &listenfd_mutex;
+			udp_thread_info[i].socket_state =
+					&socket_listener->udp_sockets[0];
+		}
+
+		pthread_create(&threads[i],
+			       NULL,
+			       main_consumer_loop_udp,
+			       &udp_thread_info[i]);
+	}
+
+	for (i = 0; i < udp_threads; ++i)
+		pthread_join(threads[i], NULL);
+
+	kafka_stats_provider_remove(&socket_listener->stats_provider);
+
+	if (!reuseport) {
+		pthread_mutex_destroy(&listenfd_mutex);
+	}
+
+	print_udp_stats(socket_listener);
+
+err:
+	free(udp_thread_info);
+	free(threads);
+}
+
+/**
+ * @brief      Run the listener using io_uring
+ *
+ * @param[in]  listenfd         The listen socket
+ * @param      socket_listener  The socket listener
+ *
+ * @return     0 if the listener has run, -1 if io_uring is not usable and
+ *             caller should fall back to libev.
+ */
+static int main_uring_loop(int listenfd,
+			   struct socket_listener *socket_listener) {
+#ifdef HAVE_LIBURING
+	size_t i;
+
+	const bool tcp =
+			0 == strcmp(N2KAFKA_TCP, socket_listener->config.proto);
+	if (tcp && (socket_listener->config.framing != SOCKET_FRAMING_NONE ||
+		    socket_listener->listener.decoder->new_session)) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " framing and decoder "
+		      "sessions are not supported in " STR_MODE_IO_URING
+		      " mode, falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
+
+	if (tcp && (socket_listener->config.balance != BALANCE_ROUND_ROBIN ||
+		    socket_listener->config.rebalance)) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " connection balance is not "
+		      "supported in " STR_MODE_IO_URING
+		      " mode, where every ring accepts its own connections. "
+		      "Falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
+
+	if (tcp && (socket_listener->config.connection_limit > 0 ||
+		    socket_listener->config.per_ip_connection_limit > 0 ||
+		    socket_listener->config.idle_timeout > 0)) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " connection limits and idle "
+		      "timeout are not supported in " STR_MODE_IO_URING
+		      " mode, falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
+
+	if (!tcp && socket_listener->config.rcvbuf_autotune_max > 0) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " receive buffer autotune is "
+		      "not supported in " STR_MODE_IO_URING
+		      " mode, falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
 
-		socket_listener->event_loops[i] = ev_loop_new(0);
-		if (socket_listener->event_loops[i] == NULL) {
-			rdlog(LOG_ERR, "Can't create even't loop %zu", i);
-			free(args);
-			continue;
-		}
+	if (!tcp && socket_listener->config.udp_gro) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " UDP GRO is not supported "
+		      "in " STR_MODE_IO_URING " mode, falling back to "
+		      STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
 
-		ev_set_userdata(socket_listener->event_loops[i], args);
+	if (socket_listener->backpressure.high_watermark > 0) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " kafka backpressure is not "
+		      "supported in " STR_MODE_IO_URING
+		      " mode, falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
 
-		rd_fifoq_init(&socket_listener->watchers_queue[i]);
-		ev_async_init(&socket_listener->event_asyncs[i], async_cb);
-		socket_listener->event_asyncs[i].data = socket_listener;
-		ev_async_start(socket_listener->event_loops[i],
-			       &socket_listener->event_asyncs[i]);
+	if (socket_listener->config.latency_mode == LATENCY_MODE_BUSY_POLL) {
+		rdlog(LOG_WARNING,
+		      "Listener on port %" PRIu16 " " STR_LATENCY_MODE_BUSY_POLL
+		      " latency mode is not supported in " STR_MODE_IO_URING
+		      " mode, falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+		return -1;
+	}
 
-		pthread_create(&socket_listener->threads[i],
-			       NULL,
-			       worker,
-			       args);
+	if (tcp && socket_listener->config.accept_exclusive) {
+		rdlog(LOG_INFO,
+		      "Listener on port %" PRIu16 " rings always accept from "
+		      "the shared listen socket in " STR_MODE_IO_URING
+		      " mode, accept_exclusive is implied",
+		      socket_listener->listener.port);
 	}
 
-	ev_run(socket_listener->event_loop, 0);
+	if (!socket_listener->config.reuseport) {
+		// All rings share the same socket
+		for (i = 0; i < socket_listener->config.threads; ++i) {
+			socket_listener->listenfds[i] = listenfd;
+		}
+	}
 
-	for (i = 0; i < socket_listener->config.threads; ++i) {
-		if (NULL == socket_listener->event_loops[i]) {
-			rdlog(LOG_ERR,
-			      "Something happened: event loop %zu not found.",
-			      i);
-			continue;
+	const struct socket_uring_params params = {
+			.listener = &socket_listener->listener,
+			.tcp = tcp,
+			.tcp_keepalive = socket_listener->config.tcp_keepalive,
+			.threads = socket_listener->config.threads,
+			.listenfds = socket_listener->listenfds,
+			// TCP reads are batched as UDP datagrams
+			.batch_size = socket_listener->config.udp_batch_size,
+			.received = tcp ? NULL
+					: &socket_listener->udp_stats.datagrams,
+			.shutdown = &do_shutdown,
+			.affinity = &socket_listener->config.affinity,
+	};
+
+	if (!tcp) {
+		// Export UDP statistics as UDP threads do
+		socket_listener->udp_sockets_count =
+				socket_listener->config.reuseport
+						? params.threads
+						: 1;
+		for (i = 0; i < socket_listener->udp_sockets_count; ++i) {
+			socket_listener->udp_sockets[i].fd =
+					socket_listener->listenfds[i];
 		}
+		socket_listener->udp_stats.socket_drops = true;
+		socket_listener->stats_provider.append =
+				udp_stats_provider_append;
+		kafka_stats_provider_add(&socket_listener->stats_provider);
+	}
 
-		ev_async_send(socket_listener->event_loops[i],
-			      &socket_listener->event_asyncs[i]);
-		pthread_join(socket_listener->threads[i], NULL);
+	const int rc = socket_uring_run(&params);
 
-		ev_async_stop(socket_listener->event_loops[i],
-			      &socket_listener->event_asyncs[i]);
-		ev_loop_destroy(socket_listener->event_loops[i]);
+	if (!tcp) {
+		kafka_stats_provider_remove(&socket_listener->stats_provider);
+		socket_listener->udp_stats.socket_drops = false;
 	}
 
-	ev_async_stop(socket_listener->event_loop, &socket_listener->w_async);
-	ev_io_stop(socket_listener->event_loop, &w_accept);
+	if (rc != 0) {
+		rdlog(LOG_WARNING,
+		      "Can't use io_uring in listener on port %" PRIu16
+		      ", falling back to " STR_MODE_EPOLL,
+		      socket_listener->listener.port);
+	}
+	return rc;
+#else
+	(void)listenfd;
+	(void)socket_listener;
+	return -1;
+#endif
+}
 
-	ev_loop_destroy(socket_listener->event_loop);
+/**
+ * @brief      Close the extra per-worker SO_REUSEPORT sockets. First one is
+ *             the listener main socket, so it is not closed.
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  count            The number of opened sockets
+ */
+static void close_reuseport_sockets(struct socket_listener *socket_listener,
+				    size_t count) {
+	size_t i;
+	for (i = 1; i < count; ++i) {
+		close(socket_listener->listenfds[i]);
+	}
 }
 
-/// @TODO join with TCP
-static void *main_consumer_loop_udp(void *_thread_info) {
-	struct udp_thread_info *thread_info = _thread_info;
-	while (!do_shutdown) {
-		struct sockaddr_in6 addr;
-		char addr_buf[BUFSIZ];
-		int recv_result = 0;
-		struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
-		char *buffer = calloc(READ_BUFFER_SIZE, sizeof(char));
-		pthread_mutex_lock(&thread_info->listenfd_mutex);
-		if (likely(!do_shutdown)) {
-			int select_result = select_socket(thread_info->listenfd,
-							  &tv);
-			if (select_result == -1 &&
-			    errno != EINTR) { /* NOT
-						 INTERRUPTED
-					       */
-				rdlog(LOG_ERR,
-				      "listen select error: %s",
-				      gnu_strerror_r(errno));
-			} else if (select_result > 0) {
-				recv_result = receive_from_socket(
-						thread_info->listenfd,
-						&addr,
-						buffer,
-						READ_BUFFER_SIZE);
-			}
+/**
+ * @brief      Open one SO_REUSEPORT socket per worker thread, so the kernel
+ *             can spread flows between them.
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  listenfd         The already opened main socket, that will be
+ *                              used by first worker.
+ *
+ * @return     0 if success, -1 in other case
+ */
+static int open_reuseport_sockets(struct socket_listener *socket_listener,
+				  int listenfd) {
+	const size_t threads = socket_listener->config.threads;
+	size_t i;
+
+	socket_listener->listenfds[0] = listenfd;
+	for (i = 1; i < threads; ++i) {
+		// Kernel assign group index in bind order, so CBPF program
+		// index will match worker index.
+		socket_listener->listenfds[i] = createListenSocket(
+				socket_listener->config.proto,
+				socket_listener->listener.port,
+				true);
+		if (socket_listener->listenfds[i] <= 0) {
+			close_reuseport_sockets(socket_listener, i);
+			return -1;
 		}
-		pthread_mutex_unlock(&thread_info->listenfd_mutex);
+	}
 
-		if (recv_result < 0) {
-			if (errno == EAGAIN) {
-				rdbg("Socket not ready. re-trying");
-				free(buffer);
-			} else {
-				rdlog(LOG_ERR,
-				      "Recv error: %s",
-				      gnu_strerror_r(errno));
-				free(buffer);
-				break;
-			}
-		} else {
-			const char *client_addr =
-					sockaddr2str(addr_buf,
-						     sizeof(addr_buf),
-						     (struct sockaddr *)&addr);
-			process_data_received_from_socket(
-					buffer,
-					(size_t)recv_result,
-					client_addr,
-					thread_info->listener);
+	if (socket_listener->config.reuseport_cpu_affinity) {
+		const int cbpf_rc =
+				attach_reuseport_cpu_cbpf(listenfd, threads);
+		if (cbpf_rc != 0) {
+			rdlog(LOG_WARNING,
+			      "Can't attach SO_REUSEPORT CPU affinity program: "
+			      "%s. Kernel will use flows hash.",
+			      gnu_strerror_r(errno));
 		}
 	}
 
-	return NULL;
+	rdlog(LOG_INFO,
+	      "Created %zu SO_REUSEPORT sockets on port %" PRIu16,
+	      threads,
+	      socket_listener->listener.port);
+	return 0;
 }
 
-static void
-main_udp_loop(int listenfd, size_t udp_threads, const struct listener *l) {
-	/* Lots of threads listening  and processing*/
-	unsigned int i;
-	struct udp_thread_info udp_thread_info;
-	udp_thread_info.listenfd = listenfd;
-	udp_thread_info.listener = l;
+/**
+ * @brief      Set configured receive buffer in all listener sockets. TCP
+ *             connections inherit it from listen socket.
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  listenfd         The listener main socket
+ */
+static void set_listener_rcvbuf(struct socket_listener *socket_listener,
+				int listenfd) {
+	const size_t sockets = socket_listener->config.reuseport
+				       ? socket_listener->config.threads
+				       : 1;
+	size_t i;
 
-	assert(udp_threads > 0);
-	pthread_t *threads = malloc(sizeof(threads[0]) * udp_threads);
+	for (i = 0; i < sockets; ++i) {
+		const int fd = socket_listener->config.reuseport
+				       ? socket_listener->listenfds[i]
+				       : listenfd;
+		const int rcvbuf = set_rcvbuf_opt(
+				fd, socket_listener->config.rcvbuf);
+		rdlog(LOG_INFO,
+		      "Listener on %s receive buffer set to %d bytes (kernel "
+		      "reports %d)",
+		      socket_listener->config.addr_str,
+		      socket_listener->config.rcvbuf,
+		      rcvbuf);
+	}
+}
 
-	if (0 != createListenSocketMutex(&udp_thread_info.listenfd_mutex))
-		exit(-1);
+/**
+ * @brief      Enable kernel reception timestamps in all listener sockets, to
+ *             measure ingest to produce latency. TCP connections inherit
+ *             them from listen socket.
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  listenfd         The listener main socket
+ */
+static void set_listener_timestamps(struct socket_listener *socket_listener,
+				    int listenfd) {
+	const size_t sockets = socket_listener->config.reuseport
+				       ? socket_listener->config.threads
+				       : 1;
+	const int enable = 1;
+	size_t i;
 
-	for (i = 0; i < udp_threads; ++i)
-		pthread_create(&threads[i],
-			       NULL,
-			       main_consumer_loop_udp,
-			       &udp_thread_info);
+	for (i = 0; i < sockets; ++i) {
+		const int fd = socket_listener->config.reuseport
+				       ? socket_listener->listenfds[i]
+				       : listenfd;
+		const int sso_rc = setsockopt(fd,
+					      SOL_SOCKET,
+					      SO_TIMESTAMPNS,
+					      &enable,
+					      sizeof(enable));
+		if (sso_rc != 0) {
+			rdlog(LOG_WARNING,
+			      "Can't enable SO_TIMESTAMPNS in listener on %s, "
+			      "latency will not be measured: %s",
+			      socket_listener->config.addr_str,
+			      gnu_strerror_r(errno));
+		}
+	}
+}
 
-	for (i = 0; i < udp_threads; ++i)
-		pthread_join(threads[i], NULL);
+/**
+ * @brief      Ask the kernel to busy poll NIC queues of listener sockets, so
+ *             non blocking reads can find data before interrupts deliver
+ *             it. TCP connections inherit it from listen socket.
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  listenfd         The listener main socket
+ */
+static void set_listener_busy_poll(struct socket_listener *socket_listener,
+				   int listenfd) {
+	const size_t sockets = socket_listener->config.reuseport
+				       ? socket_listener->config.threads
+				       : 1;
+	const int busy_poll_us = socket_listener->config.busy_poll_budget_us;
+	size_t i;
+
+	for (i = 0; i < sockets; ++i) {
+		const int fd = socket_listener->config.reuseport
+				       ? socket_listener->listenfds[i]
+				       : listenfd;
+		int sso_rc = setsockopt(fd,
+					SOL_SOCKET,
+					SO_BUSY_POLL,
+					&busy_poll_us,
+					sizeof(busy_poll_us));
+#ifdef SO_PREFER_BUSY_POLL
+		if (sso_rc == 0) {
+			const int prefer = 1;
+			sso_rc = setsockopt(fd,
+					    SOL_SOCKET,
+					    SO_PREFER_BUSY_POLL,
+					    &prefer,
+					    sizeof(prefer));
+		}
+#endif
+		if (sso_rc != 0) {
+			// Listener still spins in user space
+			rdlog(LOG_WARNING,
+			      "Can't set busy poll in listener on %s socket "
+			      "(needs CAP_NET_ADMIN?): %s",
+			      socket_listener->config.addr_str,
+			      gnu_strerror_r(errno));
+		}
+	}
+}
 
-	pthread_mutex_destroy(&udp_thread_info.listenfd_mutex);
+/**
+ * @brief      Log ingest to produce latency percentiles
+ *
+ * @param      socket_listener  The socket listener
+ */
+static void print_latency_stats(struct socket_listener *socket_listener) {
+	rdlog(LOG_INFO,
+	      "Listener on %s ingest to produce latency: p50 %" PRIu64
+	      "us, p99 %" PRIu64 "us",
+	      socket_listener->config.addr_str,
+	      listener_latency_us(socket_listener, 50),
+	      listener_latency_us(socket_listener, 99));
+}
 
-	free(threads);
+/// Listener reads datagrams instead of accepting connections
+static bool
+socket_listener_datagrams(const struct socket_listener *socket_listener) {
+	return socket_listener->config.path
+		       ? socket_listener->config.unix_type == SOCK_DGRAM
+		       : 0 == strcmp(N2KAFKA_UDP,
+				     socket_listener->config.proto);
 }
 
 static void *main_socket_loop(void *vsocket_listener) {
@@ -698,40 +3771,200 @@ static void *main_socket_loop(void *vsocket_listener) {
 		return NULL;
 	}
 
-	int listenfd = createListenSocket(socket_listener->config.proto,
-					  socket_listener->listener.port);
+	// Event loop thread, and the threads it creates, run in all the set
+	cpu_affinity_apply(&socket_listener->config.affinity,
+			   socket_listener->listener.port,
+			   "main",
+			   CPU_AFFINITY_ALL);
+
+	const char *unix_path = socket_listener->config.path;
+	int listenfd = unix_path
+			       ? unix_socket_listen(unix_path,
+						    socket_listener->config
+								    .unix_type)
+			       : createListenSocket(
+						 socket_listener->config.proto,
+						 socket_listener->listener.port,
+						 socket_listener->config
+								 .reuseport);
 	if (listenfd == -1)
 		return NULL;
 
+	if (socket_listener->config.reuseport &&
+	    0 != open_reuseport_sockets(socket_listener, listenfd)) {
+		close(listenfd);
+		return NULL;
+	}
+
+	if (socket_listener->config.rcvbuf > 0) {
+		set_listener_rcvbuf(socket_listener, listenfd);
+	}
+
+	set_listener_timestamps(socket_listener, listenfd);
+	if (socket_listener->config.latency_mode == LATENCY_MODE_BUSY_POLL) {
+		set_listener_busy_poll(socket_listener, listenfd);
+	}
+
 	/*
 	@TODO have to look at ev_set_syserr_cb
 	*/
 
-	if (0 == strcmp(N2KAFKA_UDP, socket_listener->config.proto)) {
-		main_udp_loop(listenfd,
-			      socket_listener->config.threads,
-			      &socket_listener->listener);
+	if (socket_listener->config.thread_mode == MODE_IO_URING &&
+	    0 == main_uring_loop(listenfd, socket_listener)) {
+		// io_uring threads have served the listener until shutdown
+	} else if (socket_listener_datagrams(socket_listener)) {
+		main_udp_loop(listenfd, socket_listener);
 	} else {
 		main_tcp_loop(listenfd, socket_listener);
 	}
 
+	if (socket_listener->backpressure.high_watermark > 0) {
+		print_backpressure_stats(socket_listener);
+	}
+	print_latency_stats(socket_listener);
+
 	rdlog(LOG_INFO, "Closing listening socket.");
+	if (socket_listener->config.reuseport) {
+		close_reuseport_sockets(socket_listener,
+					socket_listener->config.threads);
+	}
 	close(listenfd);
+	if (unix_path) {
+		unix_socket_unlink(unix_path);
+	}
 
 	return NULL;
 }
 
+/**
+ * @brief      Save TCP connections decoder sessions properties
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  topic            The listener topic. Global topic will be used
+ *                              if NULL.
+ * @param      options          Extra decoder options object. Can be NULL.
+ *
+ * @return     0 if success, !0 in other case
+ */
+static int
+socket_listener_session_config(struct socket_listener *socket_listener,
+			       const char *topic,
+			       json_t *options) {
+	const char *key;
+	json_t *value;
+
+	if (NULL == topic) {
+		topic = default_topic_name();
+	}
+
+	if (NULL == topic) {
+		rdlog(LOG_ERR,
+		      "Decoder needs a topic in listener or global config");
+		return -1;
+	}
+
+	if (options) {
+		if (!json_is_object(options)) {
+			rdlog(LOG_ERR, "decoder_options must be an object");
+			return -1;
+		}
+
+		json_object_foreach(options, key, value) {
+			if (!json_is_string(value)) {
+				rdlog(LOG_ERR,
+				      "decoder_options %s value must be a "
+				      "string",
+				      key);
+				return -1;
+			}
+		}
+	}
+
+	const size_t uri_size = strlen(SESSION_URI_PREFIX) + strlen(topic) + 1;
+	socket_listener->config.session.uri = malloc(uri_size);
+	if (unlikely(NULL == socket_listener->config.session.uri)) {
+		rdlog(LOG_ERR, "Can't allocate session URI (OOM?)");
+		return -1;
+	}
+
+	snprintf(socket_listener->config.session.uri,
+		 uri_size,
+		 SESSION_URI_PREFIX "%s",
+		 topic);
+	socket_listener->config.session.options =
+			options ? json_incref(options) : NULL;
+	return 0;
+}
+
+static void
+socket_listener_session_config_done(struct socket_listener *socket_listener) {
+	free(socket_listener->config.session.uri);
+	json_decref(socket_listener->config.session.options);
+}
+
 static void join_listener_socket(struct listener *slistener) {
 	struct socket_listener *socket_listener =
 			(struct socket_listener *)slistener;
 
 	do_shutdown = 1;
-	ev_async_send(socket_listener->event_loop, &socket_listener->w_async);
+	if (socket_listener->event_loop) {
+		ev_async_send(socket_listener->event_loop,
+			      &socket_listener->w_async);
+	}
 	pthread_join(socket_listener->main_loop, NULL);
 	listener_join(&socket_listener->listener);
+	socket_listener_session_config_done(socket_listener);
+	free(socket_listener->latency);
+	free(socket_listener->config.proto);
+	free(socket_listener->config.path);
 	free(socket_listener);
 }
 
+/**
+ * @brief      Validate unix socket listener config, and disable the options
+ *             that do not apply to unix sockets
+ *
+ * @param      socket_listener  The socket listener
+ * @param[in]  path             The socket path
+ * @param[in]  unix_type        The socket type name
+ * @param      reuseport        The reuseport option
+ * @param      mode             The mode option
+ *
+ * @return     0 if success, -1 in other case (error is logged)
+ */
+static int socket_listener_unix_config(struct socket_listener *socket_listener,
+				       const char *path,
+				       const char *unix_type,
+				       int *reuseport,
+				       const char **mode) {
+	if (NULL == path ||
+	    strlen(path) >= sizeof(((struct sockaddr_un *)NULL)->sun_path)) {
+		rdlog(LOG_ERR, "Unix socket listener needs a valid path");
+		return -1;
+	}
+
+	socket_listener->config.unix_type = unix_socket_type(unix_type);
+	if (socket_listener->config.unix_type < 0) {
+		rdlog(LOG_ERR, "Invalid unix socket type %s", unix_type);
+		return -1;
+	}
+
+	if (*reuseport) {
+		rdlog(LOG_WARNING,
+		      "reuseport is not supported in unix sockets. Ignoring.");
+		*reuseport = 0;
+	}
+
+	if (*mode && 0 == strcmp(STR_MODE_IO_URING, *mode)) {
+		rdlog(LOG_WARNING,
+		      STR_MODE_IO_URING " mode is not supported in unix "
+					"sockets, using " STR_MODE_EPOLL);
+		*mode = STR_MODE_EPOLL;
+	}
+
+	return 0;
+}
+
 static struct listener *
 create_socket_listener(const struct json_t *const_config,
 		       const struct n2k_decoder *decoder) {
@@ -742,7 +3975,7 @@ create_socket_listener(const struct json_t *const_config,
 	}
 	json_error_t error;
 	char *proto;
-	json_int_t port;
+	int port = 0;
 
 	struct socket_listener *socket_listener =
 			calloc(1, sizeof(*socket_listener));
@@ -755,13 +3988,33 @@ create_socket_listener(const struct json_t *const_config,
 	socket_listener->config.threads = 1;
 	socket_listener->config.tcp_keepalive = 0;
 	socket_listener->config.thread_mode = MODE_EPOLL;
-	const char *mode = NULL;
+	int udp_batch_size = DEFAULT_UDP_BATCH_SIZE;
+	int reuseport = 0, reuseport_cpu_affinity = 0;
+	int max_record_size = DEFAULT_MAX_RECORD_SIZE;
+	const char *mode = NULL, *framing = NULL, *topic = NULL;
+	json_t *decoder_options = NULL;
+	int high_watermark = 0, low_watermark = -1;
+	const char *balance = NULL;
+	int rebalance = 0;
+	int rcvbuf = 0, rcvbuf_autotune_max = 0;
+	int udp_gro = 0;
+	int accept_exclusive = 0;
+	const char *cpu_affinity = NULL;
+	int numa_node = -1;
+	const char *latency_mode = NULL;
+	int busy_poll_budget_us = DEFAULT_BUSY_POLL_BUDGET_US;
+	int connection_limit = 0, per_ip_connection_limit = 0;
+	int idle_timeout = 0;
+	const char *path = NULL, *unix_type = NULL;
 
 	const int unpack_rc =
 			json_unpack_ex(config,
 				       &error,
 				       0,
-				       "{s:s,s:i,s?i,s?b,s?s}",
+				       "{s:s,s?i,s?i,s?b,s?s,s?i,s?b,s?b,s?s,"
+				       "s?i,s?s,s?o,s?i,s?i,s?s,s?b,s?i,s?i,"
+				       "s?b,s?b,s?s,s?i,s?s,s?i,s?i,s?i,s?i,"
+				       "s?s,s?s}",
 				       "proto",
 				       &proto,
 				       "port",
@@ -771,12 +4024,72 @@ create_socket_listener(const struct json_t *const_config,
 				       "tcp_keepalive",
 				       &socket_listener->config.tcp_keepalive,
 				       "mode",
-				       &mode);
+				       &mode,
+				       "udp_batch_size",
+				       &udp_batch_size,
+				       "reuseport",
+				       &reuseport,
+				       "reuseport_cpu_affinity",
+				       &reuseport_cpu_affinity,
+				       "framing",
+				       &framing,
+				       "max_record_size",
+				       &max_record_size,
+				       "topic",
+				       &topic,
+				       "decoder_options",
+				       &decoder_options,
+				       "backpressure_high_watermark",
+				       &high_watermark,
+				       "backpressure_low_watermark",
+				       &low_watermark,
+				       "connection_balance",
+				       &balance,
+				       "connection_rebalance",
+				       &rebalance,
+				       "rcvbuf",
+				       &rcvbuf,
+				       "rcvbuf_autotune_max",
+				       &rcvbuf_autotune_max,
+				       "udp_gro",
+				       &udp_gro,
+				       "accept_exclusive",
+				       &accept_exclusive,
+				       "cpu_affinity",
+				       &cpu_affinity,
+				       "numa_node",
+				       &numa_node,
+				       "latency_mode",
+				       &latency_mode,
+				       "busy_poll_budget_us",
+				       &busy_poll_budget_us,
+				       "connection_limit",
+				       &connection_limit,
+				       "per_ip_connection_limit",
+				       &per_ip_connection_limit,
+				       "idle_timeout",
+				       &idle_timeout,
+				       "path",
+				       &path,
+				       "type",
+				       &unix_type);
 
 	if (unpack_rc != 0 /* Failure */) {
 		rdlog(LOG_ERR, "Can't decode listener: %s", error.text);
-		free(socket_listener);
-		return NULL;
+		goto listener_init_err;
+	}
+
+	if (0 == strcmp(N2KAFKA_UNIX, proto)) {
+		if (0 != socket_listener_unix_config(socket_listener,
+						     path,
+						     unix_type,
+						     &reuseport,
+						     &mode)) {
+			goto listener_init_err;
+		}
+	} else if (port <= 0 || port > UINT16_MAX) {
+		rdlog(LOG_ERR, "Listener needs a valid port");
+		goto listener_init_err;
 	}
 
 	if (socket_listener->config.threads == 0) {
@@ -792,24 +4105,224 @@ create_socket_listener(const struct json_t *const_config,
 		socket_listener->config.threads = MAX_NUM_THREADS;
 	}
 
+	if (udp_batch_size <= 0) {
+		rdlog(LOG_ERR, "UDP batch size has to be > 0. Setting to 1");
+		udp_batch_size = 1;
+	}
+
+	if (udp_batch_size > MAX_UDP_BATCH_SIZE) {
+		rdlog(LOG_ERR,
+		      "UDP batch size has to be <= %d. Setting to %d",
+		      MAX_UDP_BATCH_SIZE,
+		      MAX_UDP_BATCH_SIZE);
+		udp_batch_size = MAX_UDP_BATCH_SIZE;
+	}
+	socket_listener->config.udp_batch_size = (size_t)udp_batch_size;
+	socket_listener->config.reuseport = reuseport;
+	socket_listener->config.reuseport_cpu_affinity = reuseport_cpu_affinity;
+
+	if (reuseport_cpu_affinity && !reuseport) {
+		rdlog(LOG_WARNING,
+		      "reuseport_cpu_affinity needs reuseport enabled. "
+		      "Ignoring.");
+	}
+
+	if (accept_exclusive && reuseport) {
+		rdlog(LOG_WARNING,
+		      "Workers already accept from their own sockets with "
+		      "reuseport. Ignoring accept_exclusive.");
+		accept_exclusive = 0;
+	}
+	socket_listener->config.accept_exclusive = accept_exclusive;
+
+	if (0 != cpu_affinity_init(&socket_listener->config.affinity,
+				   cpu_affinity,
+				   numa_node)) {
+		rdlog(LOG_ERR, "Invalid listener CPU affinity");
+		goto listener_init_err;
+	}
+
+	if (reuseport && reuseport_cpu_affinity) {
+		reuseport_cpu_affinity_config(&socket_listener->config.affinity,
+					      socket_listener->config.threads);
+	}
+
 	if (mode != NULL) {
 		socket_listener->config.thread_mode = thread_mode_str(mode);
 	}
 
+	socket_listener->config.framing = socket_framing_str(framing);
+	if (socket_listener->config.framing == SOCKET_FRAMING_INVALID) {
+		rdlog(LOG_ERR, "Invalid listener framing %s", framing);
+		goto listener_init_err;
+	}
+
+	socket_listener->config.balance = connection_balance_str(balance);
+	if (socket_listener->config.balance == BALANCE_INVALID) {
+		rdlog(LOG_ERR,
+		      "Invalid listener connection balance %s",
+		      balance);
+		goto listener_init_err;
+	}
+	socket_listener->config.rebalance = rebalance;
+
+	socket_listener->config.latency_mode = latency_mode_str(latency_mode);
+	if (socket_listener->config.latency_mode == LATENCY_MODE_INVALID) {
+		rdlog(LOG_ERR,
+		      "Invalid listener latency mode %s",
+		      latency_mode);
+		goto listener_init_err;
+	}
+
+	if (busy_poll_budget_us <= 0) {
+		rdlog(LOG_ERR,
+		      "Busy poll budget has to be > 0. Setting to %d",
+		      DEFAULT_BUSY_POLL_BUDGET_US);
+		busy_poll_budget_us = DEFAULT_BUSY_POLL_BUDGET_US;
+	}
+	socket_listener->config.busy_poll_budget_us = busy_poll_budget_us;
+
+	if (connection_limit < 0) {
+		rdlog(LOG_ERR,
+		      "Connection limit has to be >= 0. Disabling limit");
+		connection_limit = 0;
+	}
+	socket_listener->config.connection_limit = (size_t)connection_limit;
+
+	if (per_ip_connection_limit < 0) {
+		rdlog(LOG_ERR,
+		      "Per IP connection limit has to be >= 0. Disabling "
+		      "limit");
+		per_ip_connection_limit = 0;
+	}
+	socket_listener->config.per_ip_connection_limit =
+			(size_t)per_ip_connection_limit;
+
+	if (idle_timeout < 0) {
+		rdlog(LOG_ERR,
+		      "Idle timeout has to be >= 0. Disabling idle timeout");
+		idle_timeout = 0;
+	}
+	socket_listener->config.idle_timeout = idle_timeout;
+
+	if (max_record_size <= 0) {
+		rdlog(LOG_ERR,
+		      "Max record size has to be > 0. Setting to %d",
+		      DEFAULT_MAX_RECORD_SIZE);
+		max_record_size = DEFAULT_MAX_RECORD_SIZE;
+	}
+	socket_listener->config.max_record_size = (size_t)max_record_size;
+
+	if (high_watermark < 0) {
+		rdlog(LOG_ERR,
+		      "Backpressure high watermark has to be >= 0. "
+		      "Disabling backpressure");
+		high_watermark = 0;
+	}
+
+	if (low_watermark < 0 || low_watermark > high_watermark) {
+		if (low_watermark > high_watermark) {
+			rdlog(LOG_ERR,
+			      "Backpressure low watermark has to be <= high "
+			      "watermark. Setting to %d",
+			      high_watermark / 2);
+		}
+		low_watermark = high_watermark / 2;
+	}
+	socket_listener->backpressure.high_watermark = (size_t)high_watermark;
+	socket_listener->backpressure.low_watermark = (size_t)low_watermark;
+
+	if (rcvbuf < 0) {
+		rdlog(LOG_ERR,
+		      "Receive buffer has to be >= 0. Using system default");
+		rcvbuf = 0;
+	}
+	socket_listener->config.rcvbuf = rcvbuf;
+
+	if (rcvbuf_autotune_max < 0) {
+		rdlog(LOG_ERR,
+		      "Receive buffer autotune max has to be >= 0. Disabling "
+		      "autotune");
+		rcvbuf_autotune_max = 0;
+	}
+	socket_listener->config.rcvbuf_autotune_max = rcvbuf_autotune_max;
+	socket_listener->config.udp_gro = udp_gro;
+
+	if (socket_listener->config.unix_type == SOCK_DGRAM && udp_gro) {
+		rdlog(LOG_WARNING,
+		      "UDP GRO is not supported in unix sockets. Ignoring.");
+		socket_listener->config.udp_gro = false;
+	}
+
+	if (socket_listener->config.unix_type == SOCK_SEQPACKET &&
+	    socket_listener->config.framing != SOCKET_FRAMING_NONE) {
+		rdlog(LOG_WARNING,
+		      "Every seqpacket message is a record. Ignoring "
+		      "framing.");
+		socket_listener->config.framing = SOCKET_FRAMING_NONE;
+	}
+
+#ifndef HAVE_LIBURING
+	if (socket_listener->config.thread_mode == MODE_IO_URING) {
+		rdlog(LOG_WARNING,
+		      "n2kafka built without liburing, using " STR_MODE_EPOLL
+		      " mode");
+		socket_listener->config.thread_mode = MODE_EPOLL;
+	}
+#endif
+
+	if (decoder->new_session) {
+		const int session_rc = socket_listener_session_config(
+				socket_listener, topic, decoder_options);
+		if (session_rc != 0) {
+			goto listener_init_err;
+		}
+	}
+
 	socket_listener->config.proto = strdup(proto);
 	if (NULL == socket_listener->config.proto) {
 		rdlog(LOG_ERR, "Error: Can't strdup protocol (out of memory?)");
-		free(socket_listener);
-		return NULL;
+		goto listener_init_err;
+	}
+
+	if (path && 0 == strcmp(N2KAFKA_UNIX, proto)) {
+		socket_listener->config.path = strdup(path);
+		if (NULL == socket_listener->config.path) {
+			rdlog(LOG_ERR, "Can't strdup unix socket path (OOM?)");
+			goto listener_init_err;
+		}
+	}
+
+	// Threads touch their own histogram first, so it is in their node
+	socket_listener->latency = calloc(socket_listener->config.threads,
+					  sizeof(socket_listener->latency[0]));
+	if (NULL == socket_listener->latency) {
+		rdlog(LOG_ERR, "Can't allocate latency histograms (OOM?)");
+		goto listener_init_err;
+	}
+
+	if (socket_listener->config.path) {
+		snprintf(socket_listener->config.addr_str,
+			 sizeof(socket_listener->config.addr_str),
+			 "path %s",
+			 socket_listener->config.path);
+	} else {
+		snprintf(socket_listener->config.addr_str,
+			 sizeof(socket_listener->config.addr_str),
+			 "port %d",
+			 port);
 	}
 
 	rdlog(LOG_INFO,
-	      "Creating new %s listener on port %d",
+	      "Creating new %s listener on %s",
 	      proto,
-	      (int)port);
+	      socket_listener->config.addr_str);
 
 	const int listener_init_rc = listener_init(
-			&socket_listener->listener, port, decoder, config);
+			&socket_listener->listener,
+			(uint16_t)port,
+			decoder,
+			config);
 
 	if (listener_init_rc) {
 		goto listener_init_err;
@@ -833,6 +4346,11 @@ pthread_create_err:
 	socket_listener->listener.join(&socket_listener->listener);
 
 listener_init_err:
+	// Config errors come here too: fields not set yet are still zeroed
+	socket_listener_session_config_done(socket_listener);
+	free(socket_listener->latency);
+	free(socket_listener->config.path);
+	free(socket_listener->config.proto);
 	free(socket_listener);
 
 calloc_err:
@@ -845,7 +4363,11 @@ static const char *tcp_listener_name() {
 }
 
 static const char *udp_listener_name() {
-	return "ucp";
+	return "udp";
+}
+
+static const char *unix_listener_name() {
+	return N2KAFKA_UNIX;
 }
 
 // clang-format off
@@ -855,4 +4377,7 @@ const n2k_listener_factory tcp_listener_factory = {
 }, udp_listener_factory = {
 	.name = udp_listener_name,
 	.create = create_socket_listener,
+}, unix_listener_factory = {
+	.name = unix_listener_name,
+	.create = create_socket_listener,
 };
@@ -24,5 +24,9 @@
 
 #include "listener/listener_api.h"
 
+/// Socket listeners "latency_mode" that busy polls sockets. Kafka producer
+/// linger needs to be disabled for it.
+#define SOCKET_LATENCY_MODE_BUSY_POLL "busy_poll"
+
 extern const struct n2k_listener_factory tcp_listener_factory,
-		udp_listener_factory;
+		udp_listener_factory, unix_listener_factory;
@@ -0,0 +1,297 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "socket_framing.h"
+
+#include "util/util.h"
+
+#include <librd/rdlog.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+/// Initial size of pending record buffer
+#define PENDING_INITIAL_SIZE 4096
+/// Max number of digits of octet counted framing length
+#define OCTET_COUNTED_MAX_DIGITS 10
+/// Length prefixed framing header size
+#define LENGTH_PREFIX_SIZE 4
+
+enum socket_framing socket_framing_str(const char *framing_str) {
+	if (NULL == framing_str ||
+	    0 == strcmp(STR_SOCKET_FRAMING_NONE, framing_str))
+		return SOCKET_FRAMING_NONE;
+	if (0 == strcmp(STR_SOCKET_FRAMING_NEWLINE, framing_str))
+		return SOCKET_FRAMING_NEWLINE;
+	if (0 == strcmp(STR_SOCKET_FRAMING_OCTET_COUNTED, framing_str))
+		return SOCKET_FRAMING_OCTET_COUNTED;
+	if (0 == strcmp(STR_SOCKET_FRAMING_LENGTH_PREFIXED, framing_str))
+		return SOCKET_FRAMING_LENGTH_PREFIXED;
+	return SOCKET_FRAMING_INVALID;
+}
+
+void socket_framer_init(struct socket_framer *framer,
+			enum socket_framing framing,
+			size_t max_record_size) {
+	memset(framer, 0, sizeof(*framer));
+	framer->framing = framing;
+	framer->max_record_size = max_record_size;
+}
+
+void socket_framer_done(struct socket_framer *framer) {
+	free(framer->pending.buf);
+	framer->pending.buf = NULL;
+}
+
+/// Prepare framer for the next record
+static void socket_framer_reset_record(struct socket_framer *framer) {
+	framer->pending.len = 0;
+	framer->header.len = 0;
+	framer->record_len = 0;
+	framer->record_len_known = false;
+	framer->discarding = false;
+}
+
+/// Log that current record is too big
+static void socket_framer_log_too_big(const struct socket_framer *framer) {
+	rdlog(LOG_WARNING,
+	      "Discarding record bigger than %zu bytes",
+	      framer->max_record_size);
+}
+
+static void socket_framer_discard_record(struct socket_framer *framer) {
+	framer->pending.len = 0;
+	framer->discarding = true;
+}
+
+/**
+ * @brief      Append data to pending record
+ *
+ * @param      framer  The framer
+ * @param[in]  data    The data
+ * @param[in]  size    The data size
+ *
+ * @return     0 if success, -1 if record would be bigger than max record
+ *             size or no memory. The reason is logged.
+ */
+static int socket_framer_append_pending(struct socket_framer *framer,
+					const char *data,
+					size_t size) {
+	const size_t needed = framer->pending.len + size;
+	if (needed > framer->max_record_size) {
+		socket_framer_log_too_big(framer);
+		return -1;
+	}
+
+	if (needed > framer->pending.size) {
+		size_t new_size = framer->pending.size ? framer->pending.size
+						       : PENDING_INITIAL_SIZE;
+		while (new_size < needed) {
+			new_size *= 2;
+		}
+		if (new_size > framer->max_record_size) {
+			new_size = framer->max_record_size;
+		}
+
+		char *new_buf = realloc(framer->pending.buf, new_size);
+		if (unlikely(NULL == new_buf)) {
+			rdlog(LOG_ERR,
+			      "Can't allocate record buffer (OOM?). Discarding "
+			      "record");
+			return -1;
+		}
+		framer->pending.buf = new_buf;
+		framer->pending.size = new_size;
+	}
+
+	memcpy(&framer->pending.buf[framer->pending.len], data, size);
+	framer->pending.len = needed;
+	return 0;
+}
+
+/**
+ * @brief      Consume newline framing data
+ *
+ * @return     Consumed bytes
+ */
+static size_t socket_framer_feed_newline(struct socket_framer *framer,
+					 struct pool_buffer *buffer,
+					 const char *data,
+					 size_t size,
+					 socket_framer_record_cb cb,
+					 void *opaque) {
+	const char *newline = memchr(data, '\n', size);
+	const size_t chunk_size = newline ? (size_t)(newline - data) : size;
+	const size_t consumed = newline ? chunk_size + 1 : chunk_size;
+
+	if (framer->discarding) {
+		if (newline) {
+			socket_framer_reset_record(framer);
+		}
+		return consumed;
+	}
+
+	if (NULL == newline) {
+		if (0 != socket_framer_append_pending(framer, data, size)) {
+			socket_framer_discard_record(framer);
+		}
+		return consumed;
+	}
+
+	if (0 == framer->pending.len) {
+		// Whole record in this read
+		if (chunk_size > 0) {
+			cb(opaque, data, chunk_size, buffer);
+		}
+	} else if (0 == socket_framer_append_pending(
+				framer, data, chunk_size)) {
+		cb(opaque, framer->pending.buf, framer->pending.len, NULL);
+	} else {
+		socket_framer_discard_record(framer);
+	}
+
+	socket_framer_reset_record(framer);
+	return consumed;
+}
+
+/**
+ * @brief      Consume counted framing header data
+ *
+ * @return     Consumed bytes, or 0 if invalid header
+ */
+static size_t socket_framer_feed_header(struct socket_framer *framer,
+					const char *data,
+					size_t size) {
+	size_t i;
+
+	for (i = 0; i < size && !framer->record_len_known; ++i) {
+		const uint8_t c = (uint8_t)data[i];
+
+		if (framer->framing == SOCKET_FRAMING_LENGTH_PREFIXED) {
+			framer->record_len = framer->record_len << 8 | c;
+			if (++framer->header.len == LENGTH_PREFIX_SIZE) {
+				framer->record_len_known = true;
+			}
+		} else if (c == ' ' && framer->header.len > 0) {
+			framer->record_len_known = true;
+		} else if (c >= '0' && c <= '9' &&
+			   framer->header.len < OCTET_COUNTED_MAX_DIGITS &&
+			   (c != '0' || framer->header.len > 0)) {
+			framer->record_len = framer->record_len * 10 +
+					     (size_t)(c - '0');
+			framer->header.buf[framer->header.len++] = c;
+		} else {
+			rdlog(LOG_ERR,
+			      "Invalid octet counted framing length (got "
+			      "'%.*s' and byte 0x%02x)",
+			      (int)framer->header.len,
+			      (const char *)framer->header.buf,
+			      c);
+			return 0;
+		}
+	}
+
+	if (framer->record_len_known &&
+	    framer->record_len > framer->max_record_size) {
+		socket_framer_log_too_big(framer);
+		socket_framer_discard_record(framer);
+	}
+
+	return i;
+}
+
+/**
+ * @brief      Consume counted framing record data
+ *
+ * @return     Consumed bytes
+ */
+static size_t socket_framer_feed_counted(struct socket_framer *framer,
+					 struct pool_buffer *buffer,
+					 const char *data,
+					 size_t size,
+					 socket_framer_record_cb cb,
+					 void *opaque) {
+	const size_t needed = framer->record_len - framer->pending.len;
+	const size_t consumed = size < needed ? size : needed;
+
+	if (framer->discarding) {
+		framer->pending.len += consumed;
+	} else if (0 == framer->pending.len && consumed == framer->record_len) {
+		// Whole record in this read
+		if (consumed > 0) {
+			cb(opaque, data, consumed, buffer);
+		}
+		framer->pending.len = consumed;
+	} else if (0 != socket_framer_append_pending(framer, data, consumed)) {
+		// No memory: skip the rest of the record, but keep counting
+		// its bytes so next record header is found
+		framer->discarding = true;
+		framer->pending.len += consumed;
+	} else if (framer->pending.len == framer->record_len) {
+		cb(opaque, framer->pending.buf, framer->pending.len, NULL);
+	}
+
+	if (framer->pending.len == framer->record_len) {
+		socket_framer_reset_record(framer);
+	}
+
+	return consumed;
+}
+
+int socket_framer_feed(struct socket_framer *framer,
+		       struct pool_buffer *buffer,
+		       const char *data,
+		       size_t size,
+		       socket_framer_record_cb cb,
+		       void *opaque) {
+	if (framer->framing == SOCKET_FRAMING_NONE) {
+		cb(opaque, data, size, buffer);
+		return 0;
+	}
+
+	while (size > 0) {
+		size_t consumed;
+
+		if (framer->framing == SOCKET_FRAMING_NEWLINE) {
+			consumed = socket_framer_feed_newline(
+					framer, buffer, data, size, cb, opaque);
+		} else if (!framer->record_len_known) {
+			consumed = socket_framer_feed_header(
+					framer, data, size);
+			if (0 == consumed) {
+				return -1;
+			}
+		} else {
+			consumed = socket_framer_feed_counted(
+					framer, buffer, data, size, cb, opaque);
+		}
+
+		data += consumed;
+		size -= consumed;
+	}
+
+	// A zero length record may be complete just after its header
+	if (framer->record_len_known && 0 == framer->record_len) {
+		socket_framer_reset_record(framer);
+	}
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct pool_buffer;
+
+/// Stream socket records framing
+enum socket_framing {
+#define STR_SOCKET_FRAMING_NONE "none"
+	/// Every read is a record
+	SOCKET_FRAMING_NONE,
+#define STR_SOCKET_FRAMING_NEWLINE "newline"
+	/// Records are delimited by '\n'
+	SOCKET_FRAMING_NEWLINE,
+#define STR_SOCKET_FRAMING_OCTET_COUNTED "octet_counted"
+	/// Records are preceded by decimal length and a space (RFC 6587)
+	SOCKET_FRAMING_OCTET_COUNTED,
+#define STR_SOCKET_FRAMING_LENGTH_PREFIXED "length_prefixed"
+	/// Records are preceded by 4 bytes big endian length
+	SOCKET_FRAMING_LENGTH_PREFIXED,
+	SOCKET_FRAMING_INVALID,
+};
+
+/**
+ * @brief      Get framing from its string representation
+ *
+ * @param[in]  framing_str  The framing string
+ *
+ * @return     The framing, or SOCKET_FRAMING_INVALID if not known
+ */
+enum socket_framing socket_framing_str(const char *framing_str);
+
+/**
+ * Record found callback.
+ *
+ * @param      opaque  The callback opaque
+ * @param[in]  record  The record
+ * @param[in]  size    The record size
+ * @param      buffer  Pool buffer that contains the record. If NULL, record
+ *                     has been assembled in framer memory, and it is only
+ *                     valid until callback returns.
+ */
+typedef void (*socket_framer_record_cb)(void *opaque,
+					const char *record,
+					size_t size,
+					struct pool_buffer *buffer);
+
+/// Per connection framing state
+struct socket_framer {
+	enum socket_framing framing; ///< Framing mode
+	size_t max_record_size;	     ///< Max record size
+
+	/// Pending record bytes that came in a previous read
+	struct {
+		char *buf;   ///< Buffer
+		size_t len;  ///< Used bytes
+		size_t size; ///< Allocated bytes
+	} pending;
+
+	/// Counted framing record header
+	struct {
+		uint8_t buf[16]; ///< Header bytes
+		size_t len;	 ///< Header bytes read
+	} header;
+
+	/// Length of current record, if known by its header
+	size_t record_len;
+	bool record_len_known;
+
+	/// Skipping current record because it is too big
+	bool discarding;
+};
+
+/**
+ * @brief      Init a connection framer
+ *
+ * @param      framer           The framer
+ * @param[in]  framing          The framing
+ * @param[in]  max_record_size  The max record size. Bigger records will be
+ *                              discarded
+ */
+void socket_framer_init(struct socket_framer *framer,
+			enum socket_framing framing,
+			size_t max_record_size);
+
+/// Release framer resources
+void socket_framer_done(struct socket_framer *framer);
+
+/**
+ * @brief      Feed framer with read data, calling cb for every complete
+ *             record. Records completely contained in data are not copied.
+ *
+ * @param      framer  The framer
+ * @param      buffer  The pool buffer that contains data
+ * @param[in]  data    The data
+ * @param[in]  size    The data size
+ * @param[in]  cb      Record callback
+ * @param      opaque  Record callback opaque
+ *
+ * @return     0 if success, -1 if the stream has invalid framing and needs to
+ *             be closed.
+ */
+int socket_framer_feed(struct socket_framer *framer,
+		       struct pool_buffer *buffer,
+		       const char *data,
+		       size_t size,
+		       socket_framer_record_cb cb,
+		       void *opaque);
@@ -0,0 +1,803 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "socket_packet.h"
+
+#include "config.h"
+
+#include "engine/global_config.h"
+#include "engine/rb_addr.h"
+#include "util/cpu_affinity.h"
+#include "util/pair.h"
+#include "util/util.h"
+
+#include <jansson.h>
+#include <librd/rdlog.h>
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define N2KAFKA_PACKET "udp_packet"
+
+#define MAX_NUM_THREADS 256
+
+#define PACKET_LISTENER_MAGIC 0x50AC3E7115E7E4L
+
+/// Default ring block size. Needs to be a multiple of page size
+#define DEFAULT_BLOCK_SIZE (1024 * 1024)
+/// Default number of blocks in ring
+#define DEFAULT_BLOCK_COUNT 64
+/// Ring frame size. TPACKET_V3 packs variable size frames in blocks, so it is
+/// only used to check ring geometry.
+#define RING_FRAME_SIZE 2048
+/// Kernel hands a non full block to user space after this time
+#define BLOCK_RETIRE_TIMEOUT_MS 10
+/// Max number of datagrams sent to decoder in the same batch
+#define DECODER_BATCH_SIZE 256
+/// Check shutdown flag at least this often
+#define POLL_TIMEOUT_MS 1000
+/// BPF accepted packets snap length
+#define FILTER_SNAPLEN 262144
+
+struct packet_listener;
+
+/// Per thread capture ring
+struct packet_ring {
+	int fd;
+	uint8_t *map;	     ///< Mapped ring memory
+	size_t map_size;     ///< Mapped ring memory size
+	size_t current;	     ///< Next block to read
+	pthread_t thread;    ///< Ring reader thread
+	bool thread_started; ///< thread has been created
+	struct packet_listener *packet_listener;
+
+	/// Statistics, only updated by reader thread
+	struct {
+		uint64_t blocks;    ///< Read blocks
+		uint64_t datagrams; ///< Datagrams sent to decoder
+		uint64_t invalid;   ///< Invalid or truncated packets
+		uint64_t rejected;  ///< Packets from not allowed clients
+	} stats;
+};
+
+struct packet_listener {
+	struct listener listener;
+#ifdef PACKET_LISTENER_MAGIC
+	uint64_t magic;
+#endif
+
+	struct {
+		char *interface;    ///< Capture interface. NULL means all
+		size_t threads;	    ///< Number of rings and reader threads
+		size_t block_size;  ///< Ring block size
+		size_t block_count; ///< Number of blocks of each ring
+		/// Reader threads CPUs and memory NUMA node
+		struct cpu_affinity affinity;
+	} config;
+
+	int shutdown; ///< Reader threads need to stop
+
+	size_t rings_count; ///< Number of opened rings
+	struct packet_ring rings[MAX_NUM_THREADS];
+};
+
+/// Decoder batch of captured datagrams
+struct packet_batch {
+	size_t count;
+	struct n2k_decoder_batch_msg msgs[DECODER_BATCH_SIZE];
+	/// Datagrams sources. Only printed if decoder asks for them
+	struct sockaddr_storage srcs[DECODER_BATCH_SIZE];
+	struct sockaddr_pair attrs_mem[DECODER_BATCH_SIZE];
+	keyval_list_t attrs[DECODER_BATCH_SIZE];
+	struct sockaddr_str_cache addr_cache;
+};
+
+static void packet_batch_init(struct packet_batch *batch) {
+	size_t i;
+	for (i = 0; i < DECODER_BATCH_SIZE; ++i) {
+		sockaddr_pair_init(&batch->attrs_mem[i],
+				   "client_ip",
+				   &batch->addr_cache);
+	}
+}
+
+/**
+ * @brief      Attach a BPF program that only accepts incoming, not
+ *             fragmented UDP over IPv4 or IPv6 (without extension headers)
+ *             packets with given destination port. Packet socket needs to be
+ *             SOCK_DGRAM, so offsets are relative to network header.
+ *
+ * @param[in]  fd    The packet socket
+ * @param[in]  port  The destination port
+ *
+ * @return     0 if success, -1 in other case (errno set)
+ */
+static int packet_attach_port_filter(int fd, uint16_t port) {
+	struct sock_filter code[] = {
+			// Skip our own packets, like loopback ones when sent
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+				 (uint32_t)(SKF_AD_OFF + SKF_AD_PKTTYPE)),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				 PACKET_OUTGOING,
+				 15,
+				 0),
+
+			// Link layer protocol
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+				 (uint32_t)(SKF_AD_OFF + SKF_AD_PROTOCOL)),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 7),
+
+			// IPv4: UDP, not fragmented, destination port
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 11),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 9, 0),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 5, 6),
+
+			// IPv6: UDP next header, destination port
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, 5),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 3),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 40 + 2),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+
+			BPF_STMT(BPF_RET | BPF_K, FILTER_SNAPLEN),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	const struct sock_fprog prog = {
+			.len = RD_ARRAYSIZE(code),
+			.filter = code,
+	};
+
+	return setsockopt(fd,
+			  SOL_SOCKET,
+			  SO_ATTACH_FILTER,
+			  &prog,
+			  sizeof(prog));
+}
+
+static void packet_ring_close(struct packet_ring *ring) {
+	if (ring->map) {
+		munmap(ring->map, ring->map_size);
+		ring->map = NULL;
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+		ring->fd = -1;
+	}
+}
+
+/**
+ * @brief      Open a packet socket with its TPACKET_V3 ring. The port filter
+ *             is attached before binding, so no other packet is queued.
+ *
+ * @param      ring             The ring
+ * @param      packet_listener  The packet listener
+ * @param[in]  ifindex          The interface index, or 0 for all
+ *
+ * @return     0 if success, -1 in other case
+ */
+static int packet_ring_open(struct packet_ring *ring,
+			    struct packet_listener *packet_listener,
+			    int ifindex) {
+	const int version = TPACKET_V3;
+	const size_t block_size = packet_listener->config.block_size;
+	const size_t block_count = packet_listener->config.block_count;
+	const size_t frame_count = block_size / RING_FRAME_SIZE * block_count;
+	const struct tpacket_req3 req = {
+			.tp_block_size = (unsigned int)block_size,
+			.tp_block_nr = (unsigned int)block_count,
+			.tp_frame_size = RING_FRAME_SIZE,
+			.tp_frame_nr = (unsigned int)frame_count,
+			.tp_retire_blk_tov = BLOCK_RETIRE_TIMEOUT_MS,
+	};
+	const struct sockaddr_ll addr = {
+			.sll_family = AF_PACKET,
+			.sll_protocol = htons(ETH_P_ALL),
+			.sll_ifindex = ifindex,
+	};
+	const char *step;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->packet_listener = packet_listener;
+	ring->map_size = block_size * block_count;
+
+	// No protocol until bind, so nothing is queued before filter
+	ring->fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+	if (ring->fd < 0) {
+		step = "create packet socket";
+		goto err;
+	}
+
+	if (0 != packet_attach_port_filter(ring->fd,
+					   packet_listener->listener.port)) {
+		step = "attach port filter";
+		goto err;
+	}
+
+	if (0 != setsockopt(ring->fd,
+			    SOL_PACKET,
+			    PACKET_VERSION,
+			    &version,
+			    sizeof(version))) {
+		step = "set TPACKET_V3";
+		goto err;
+	}
+
+	if (0 != setsockopt(ring->fd,
+			    SOL_PACKET,
+			    PACKET_RX_RING,
+			    &req,
+			    sizeof(req))) {
+		step = "create ring";
+		goto err;
+	}
+
+	ring->map = mmap(NULL,
+			 ring->map_size,
+			 PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE,
+			 ring->fd,
+			 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		step = "map ring";
+		goto err;
+	}
+
+	if (0 != bind(ring->fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+		step = "bind packet socket";
+		goto err;
+	}
+
+	if (packet_listener->config.threads > 1) {
+		// Spread flows between rings. Group id is the listener port.
+		const int fanout = packet_listener->listener.port |
+				   PACKET_FANOUT_HASH << 16;
+		if (0 != setsockopt(ring->fd,
+				    SOL_PACKET,
+				    PACKET_FANOUT,
+				    &fanout,
+				    sizeof(fanout))) {
+			step = "join fanout group";
+			goto err;
+		}
+	}
+
+	return 0;
+
+err:
+	rdlog(LOG_ERR,
+	      "Can't %s for packet listener on port %" PRIu16 ": %s",
+	      step,
+	      packet_listener->listener.port,
+	      gnu_strerror_r(errno));
+	packet_ring_close(ring);
+	return -1;
+}
+
+/**
+ * @brief      Locate UDP payload and source of a captured network packet
+ *
+ * @param[in]  data         The packet, from network header
+ * @param[in]  len          The captured length
+ * @param      src          The source address
+ * @param      payload      The UDP payload
+ * @param      payload_len  The UDP payload length
+ *
+ * @return     0 if success, -1 if packet is not valid or it is truncated
+ */
+static int packet_udp_payload(const uint8_t *data,
+			      size_t len,
+			      struct sockaddr_storage *src,
+			      const uint8_t **payload,
+			      size_t *payload_len) {
+	struct udphdr udp;
+	size_t udp_offset;
+
+	if (len < 1) {
+		return -1;
+	}
+
+	memset(src, 0, sizeof(*src));
+	if (data[0] >> 4 == 4) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)src;
+		struct iphdr ip;
+		if (len < sizeof(ip)) {
+			return -1;
+		}
+		memcpy(&ip, data, sizeof(ip));
+		udp_offset = ip.ihl * 4u;
+		if (ip.protocol != IPPROTO_UDP || udp_offset < sizeof(ip)) {
+			return -1;
+		}
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = ip.saddr;
+	} else if (data[0] >> 4 == 6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)src;
+		struct ip6_hdr ip6;
+		if (len < sizeof(ip6)) {
+			return -1;
+		}
+		memcpy(&ip6, data, sizeof(ip6));
+		udp_offset = sizeof(ip6);
+		if (ip6.ip6_nxt != IPPROTO_UDP) {
+			return -1;
+		}
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = ip6.ip6_src;
+	} else {
+		return -1;
+	}
+
+	if (len < udp_offset + sizeof(udp)) {
+		return -1;
+	}
+	memcpy(&udp, &data[udp_offset], sizeof(udp));
+
+	const size_t udp_len = ntohs(udp.len);
+	if (udp_len < sizeof(udp) || udp_offset + udp_len > len) {
+		return -1;
+	}
+
+	*payload = &data[udp_offset + sizeof(udp)];
+	*payload_len = udp_len - sizeof(udp);
+	return 0;
+}
+
+/// Send pending batch datagrams to decoder
+static void packet_batch_flush(struct packet_ring *ring,
+			       struct packet_batch *batch) {
+	if (0 == batch->count) {
+		return;
+	}
+
+	// Decoder copies datagrams before returning, since they are not in
+	// a pool buffer
+	listener_decode_batch(&ring->packet_listener->listener,
+			      batch->msgs,
+			      batch->count);
+	ring->stats.datagrams += batch->count;
+	batch->count = 0;
+}
+
+/**
+ * @brief      Add a captured packet payload to the decoder batch
+ *
+ * @param      ring   The ring
+ * @param      batch  The batch
+ * @param[in]  pkt    The captured packet
+ */
+static void packet_batch_add(struct packet_ring *ring,
+			     struct packet_batch *batch,
+			     const struct tpacket3_hdr *pkt) {
+	const uint8_t *data = (const uint8_t *)pkt + pkt->tp_net;
+	const uint8_t *payload;
+	size_t payload_len;
+	const size_t i = batch->count;
+	struct sockaddr_storage *src = &batch->srcs[i];
+
+	if (0 != packet_udp_payload(
+			 data, pkt->tp_snaplen, src, &payload, &payload_len)) {
+		ring->stats.invalid++;
+		return;
+	}
+
+	if (!client_addr_allowed((const struct sockaddr *)src)) {
+		ring->stats.rejected++;
+		return;
+	}
+
+	batch->count++;
+	batch->msgs[i].buffer = (const char *)payload;
+	batch->msgs[i].buf_size = payload_len;
+	batch->msgs[i].props = &batch->attrs[i];
+	batch->msgs[i].pool_buffer = NULL;
+	sockaddr_pair_set(&batch->attrs_mem[i], (const struct sockaddr *)src);
+	keyval_list_init(&batch->attrs[i]);
+	add_key_value_pair(&batch->attrs[i], &batch->attrs_mem[i].pair);
+
+	if (unlikely(global_config.log_severity >= LOG_DEBUG)) {
+		rdlog(LOG_DEBUG,
+		      "received %zu data from %s: %.*s",
+		      payload_len,
+		      valueof(&batch->attrs[i], "client_ip", strcmp),
+		      (int)payload_len,
+		      (const char *)payload);
+	}
+
+	if (batch->count == DECODER_BATCH_SIZE) {
+		packet_batch_flush(ring, batch);
+	}
+}
+
+/**
+ * @brief      Send all block datagrams to decoder. Datagrams are read in
+ *             place, so block can only be returned to kernel after that.
+ *
+ * @param      ring   The ring
+ * @param      batch  The decoder batch
+ * @param      block  The block
+ */
+static void packet_ring_process_block(struct packet_ring *ring,
+				      struct packet_batch *batch,
+				      struct tpacket_block_desc *block) {
+	const struct tpacket_hdr_v1 *bh = &block->hdr.bh1;
+	const uint8_t *pkt_ptr =
+			(const uint8_t *)block + bh->offset_to_first_pkt;
+	uint32_t i;
+
+	for (i = 0; i < bh->num_pkts; ++i) {
+		const struct tpacket3_hdr *pkt = (const void *)pkt_ptr;
+		packet_batch_add(ring, batch, pkt);
+		pkt_ptr += pkt->tp_next_offset;
+	}
+
+	packet_batch_flush(ring, batch);
+	ring->stats.blocks++;
+}
+
+static void *packet_ring_loop(void *vring) {
+	struct packet_ring *ring = vring;
+	struct packet_listener *packet_listener = ring->packet_listener;
+	const size_t block_size = packet_listener->config.block_size;
+	const size_t block_count = packet_listener->config.block_count;
+
+	cpu_affinity_apply(&packet_listener->config.affinity,
+			   packet_listener->listener.port,
+			   "ring",
+			   (size_t)(ring - packet_listener->rings));
+
+	struct packet_batch *batch = calloc(1, sizeof(*batch));
+	if (unlikely(NULL == batch)) {
+		rdlog(LOG_ERR, "Can't allocate packet batch (OOM?)");
+		return NULL;
+	}
+	packet_batch_init(batch);
+
+	while (!ATOMIC_OP(add, fetch, &packet_listener->shutdown, 0)) {
+		struct tpacket_block_desc *block =
+				(void *)&ring->map[ring->current * block_size];
+		const uint32_t status = ATOMIC_OP(
+				add, fetch, &block->hdr.bh1.block_status, 0);
+
+		if (0 == (status & TP_STATUS_USER)) {
+			struct pollfd pfd = {
+					.fd = ring->fd,
+					.events = POLLIN | POLLERR,
+			};
+			poll(&pfd, 1, POLL_TIMEOUT_MS);
+			continue;
+		}
+
+		packet_ring_process_block(ring, batch, block);
+
+		// Give block back to kernel
+		__sync_synchronize();
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		ring->current = (ring->current + 1) % block_count;
+	}
+
+	free(batch);
+	return NULL;
+}
+
+/**
+ * @brief      Log packet listener statistics, with kernel drops
+ *
+ * @param      packet_listener  The packet listener
+ */
+static void print_packet_stats(struct packet_listener *packet_listener) {
+	uint64_t blocks = 0, datagrams = 0, invalid = 0, rejected = 0,
+		 drops = 0;
+	size_t i;
+
+	for (i = 0; i < packet_listener->rings_count; ++i) {
+		const struct packet_ring *ring = &packet_listener->rings[i];
+		struct tpacket_stats_v3 kstats;
+		socklen_t len = sizeof(kstats);
+
+		blocks += ring->stats.blocks;
+		datagrams += ring->stats.datagrams;
+		invalid += ring->stats.invalid;
+		rejected += ring->stats.rejected;
+		if (0 == getsockopt(ring->fd,
+				    SOL_PACKET,
+				    PACKET_STATISTICS,
+				    &kstats,
+				    &len)) {
+			drops += kstats.tp_drops;
+		}
+	}
+
+	rdlog(LOG_INFO,
+	      "Packet listener on port %" PRIu16 " read %" PRIu64
+	      " datagrams in %" PRIu64 " blocks, %" PRIu64
+	      " invalid packets, %" PRIu64 " packets from not allowed "
+	      "clients, %" PRIu64 " packets dropped by kernel",
+	      packet_listener->listener.port,
+	      datagrams,
+	      blocks,
+	      invalid,
+	      rejected,
+	      drops);
+}
+
+/// Stop reader threads and close rings
+static void packet_listener_stop(struct packet_listener *packet_listener) {
+	size_t i;
+
+	ATOMIC_OP(add, fetch, &packet_listener->shutdown, 1);
+	for (i = 0; i < packet_listener->rings_count; ++i) {
+		if (packet_listener->rings[i].thread_started) {
+			pthread_join(packet_listener->rings[i].thread, NULL);
+		}
+	}
+
+	print_packet_stats(packet_listener);
+	for (i = 0; i < packet_listener->rings_count; ++i) {
+		packet_ring_close(&packet_listener->rings[i]);
+	}
+}
+
+static void join_packet_listener(struct listener *plistener) {
+	struct packet_listener *packet_listener =
+			(struct packet_listener *)plistener;
+#ifdef PACKET_LISTENER_MAGIC
+	assert(PACKET_LISTENER_MAGIC == packet_listener->magic);
+#endif
+
+	packet_listener_stop(packet_listener);
+	listener_join(&packet_listener->listener);
+	free(packet_listener->config.interface);
+	free(packet_listener);
+}
+
+/**
+ * @brief      Open all rings and start reading them
+ *
+ * @param      packet_listener  The packet listener
+ *
+ * @return     0 if success, -1 in other case
+ */
+static int packet_listener_start(struct packet_listener *packet_listener) {
+	const char *interface = packet_listener->config.interface;
+	int ifindex = 0;
+	size_t i;
+
+	if (interface) {
+		ifindex = (int)if_nametoindex(interface);
+		if (0 == ifindex) {
+			rdlog(LOG_ERR,
+			      "Can't find packet listener interface %s: %s",
+			      interface,
+			      gnu_strerror_r(errno));
+			return -1;
+		}
+	}
+
+	// Kernel allocates ring memory in the calling thread node, so move to
+	// every ring reader CPU while opening it.
+	const struct cpu_affinity *affinity = &packet_listener->config.affinity;
+	struct cpu_affinity_saved saved_affinity;
+	const bool pin = cpu_affinity_enabled(affinity);
+	if (pin && 0 != cpu_affinity_save(&saved_affinity)) {
+		return -1;
+	}
+
+	int rc = 0;
+	for (i = 0; rc == 0 && i < packet_listener->config.threads; ++i) {
+		struct packet_ring *ring = &packet_listener->rings[i];
+		const uint16_t port = packet_listener->listener.port;
+		cpu_affinity_apply(affinity, port, NULL, i);
+		rc = packet_ring_open(ring, packet_listener, ifindex);
+		if (rc == 0) {
+			packet_listener->rings_count++;
+		}
+	}
+
+	if (pin) {
+		cpu_affinity_restore(&saved_affinity);
+	}
+
+	if (rc != 0) {
+		return -1;
+	}
+
+	for (i = 0; i < packet_listener->rings_count; ++i) {
+		struct packet_ring *ring = &packet_listener->rings[i];
+		const int pcreate_rc = pthread_create(
+				&ring->thread, NULL, packet_ring_loop, ring);
+		if (pcreate_rc != 0) {
+			rdlog(LOG_ERR,
+			      "Couldn't create pthread: %s",
+			      gnu_strerror_r(pcreate_rc));
+			return -1;
+		}
+		ring->thread_started = true;
+	}
+
+	rdlog(LOG_INFO,
+	      "Capturing UDP port %" PRIu16 " on %s with %zu rings of %zu "
+	      "blocks of %zu bytes",
+	      packet_listener->listener.port,
+	      interface ? interface : "all interfaces",
+	      packet_listener->rings_count,
+	      packet_listener->config.block_count,
+	      packet_listener->config.block_size);
+	return 0;
+}
+
+static struct listener *
+create_packet_listener(const struct json_t *const_config,
+		       const struct n2k_decoder *decoder) {
+	json_error_t error;
+	json_int_t port;
+	const char *interface = NULL;
+	int threads = 1, block_size = DEFAULT_BLOCK_SIZE,
+	    block_count = DEFAULT_BLOCK_COUNT;
+	const char *cpu_affinity = NULL;
+	int numa_node = -1;
+	const long page_size = sysconf(_SC_PAGESIZE);
+
+	json_t *config = json_deep_copy(const_config);
+	if (NULL == config) {
+		rdlog(LOG_ERR, "Couldn't clone JSON (OOM?)");
+		return NULL;
+	}
+
+	const int unpack_rc = json_unpack_ex(config,
+					     &error,
+					     0,
+					     "{s:i,s?s,s?i,s?i,s?i,s?s,s?i}",
+					     "port",
+					     &port,
+					     "interface",
+					     &interface,
+					     "num_threads",
+					     &threads,
+					     "block_size",
+					     &block_size,
+					     "block_count",
+					     &block_count,
+					     "cpu_affinity",
+					     &cpu_affinity,
+					     "numa_node",
+					     &numa_node);
+	if (unpack_rc != 0) {
+		rdlog(LOG_ERR, "Can't decode listener: %s", error.text);
+		goto err;
+	}
+
+	if (port <= 0 || port > UINT16_MAX) {
+		rdlog(LOG_ERR,
+		      "Invalid packet listener port %lld",
+		      (long long)port);
+		goto err;
+	}
+
+	if (threads <= 0 || threads > MAX_NUM_THREADS) {
+		rdlog(LOG_ERR,
+		      "Packet listener threads has to be > 0 and <= %d",
+		      MAX_NUM_THREADS);
+		goto err;
+	}
+
+	if (block_size <= 0 || page_size <= 0 || block_size % page_size != 0 ||
+	    block_size % RING_FRAME_SIZE != 0) {
+		rdlog(LOG_ERR,
+		      "Packet listener block_size has to be a multiple of page "
+		      "size (%ld)",
+		      page_size);
+		goto err;
+	}
+
+	if (block_count <= 0) {
+		rdlog(LOG_ERR, "Packet listener block_count has to be > 0");
+		goto err;
+	}
+
+	struct packet_listener *packet_listener =
+			calloc(1, sizeof(*packet_listener));
+	if (NULL == packet_listener) {
+		rdlog(LOG_ERR, "Can't allocate private data (out of memory?)");
+		goto err;
+	}
+
+#ifdef PACKET_LISTENER_MAGIC
+	packet_listener->magic = PACKET_LISTENER_MAGIC;
+#endif
+	packet_listener->config.threads = (size_t)threads;
+	packet_listener->config.block_size = (size_t)block_size;
+	packet_listener->config.block_count = (size_t)block_count;
+	if (0 != cpu_affinity_init(&packet_listener->config.affinity,
+				   cpu_affinity,
+				   numa_node)) {
+		rdlog(LOG_ERR, "Invalid packet listener CPU affinity");
+		free(packet_listener);
+		goto err;
+	}
+	if (interface) {
+		packet_listener->config.interface = strdup(interface);
+		if (NULL == packet_listener->config.interface) {
+			rdlog(LOG_ERR, "Can't strdup interface (OOM?)");
+			free(packet_listener);
+			goto err;
+		}
+	}
+
+	rdlog(LOG_INFO,
+	      "Creating new %s listener on port %d",
+	      N2KAFKA_PACKET,
+	      (int)port);
+
+	const int listener_init_rc = listener_init(&packet_listener->listener,
+						   (uint16_t)port,
+						   decoder,
+						   config);
+	if (listener_init_rc != 0) {
+		free(packet_listener->config.interface);
+		free(packet_listener);
+		goto err;
+	}
+
+	if (0 != packet_listener_start(packet_listener)) {
+		join_packet_listener(&packet_listener->listener);
+		goto err;
+	}
+
+	packet_listener->listener.join = join_packet_listener;
+	return &packet_listener->listener;
+
+err:
+	json_decref(config);
+	return NULL;
+}
+
+static const char *packet_listener_name() {
+	return N2KAFKA_PACKET;
+}
+
+const n2k_listener_factory packet_listener_factory = {
+		.name = packet_listener_name,
+		.create = create_packet_listener,
+};
@@ -1,6 +1,4 @@
 /*
-** Copyright (C) 2014-2016, Eneo Tecnologia S.L.
-** Copyright (C) 2017, Eugenio Perez <eupm90@gmail.com>
 ** Copyright (C) 2018-2019, Wizzie S.L.
 ** Author: Eugenio Perez <eupm90@gmail.com>
 **
@@ -22,19 +20,7 @@
 
 #pragma once
 
-struct in_addr;
+#include "listener/listener_api.h"
 
-typedef struct in_addr_list_s in_addr_list_t; /* FW DECLARATION */
-
-/// Init a sockaddr_in list.
-in_addr_list_t *in_addr_list_new();
-
-/// Add an address to list.
-void in_addr_list_add(in_addr_list_t *list, const struct in_addr *addr);
-
-/// Check if an addr is in list.
-int in_addr_list_contains(const in_addr_list_t *list,
-			  const struct in_addr *addr);
-
-/// Deallocate a list.
-void in_addr_list_done(in_addr_list_t *list);
+/// UDP listener that captures datagrams with an AF_PACKET TPACKET_V3 ring
+extern const struct n2k_listener_factory packet_listener_factory;
@@ -0,0 +1,821 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "socket_uring.h"
+
+#ifdef HAVE_LIBURING
+
+#include "engine/global_config.h"
+#include "engine/rb_addr.h"
+#include "listener/listener_api.h"
+#include "util/cpu_affinity.h"
+#include "util/pair.h"
+#include "util/util.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+/// Submission queue entries per ring
+#define URING_SQ_ENTRIES 256
+/// Completion queue entries per ring. Multishot operations can post a lot of
+/// completions for a single submission.
+#define URING_CQ_ENTRIES 4096
+/// Provided buffers per ring. Must be a power of 2.
+#define URING_BUF_RING_ENTRIES 1024
+/// Provided buffers group id
+#define URING_BUF_GROUP 0
+/// Max message size
+#define URING_READ_SIZE 4096
+/// Provided buffer size. Recvmsg multishot place source address before
+/// datagram payload.
+#define URING_BUF_SIZE                                                         \
+	(URING_READ_SIZE + sizeof(struct io_uring_recvmsg_out) +               \
+	 sizeof(struct sockaddr_in6))
+/// Registered files per ring, including listen socket
+#define URING_MAX_FILES 4096
+/// Registered file slot of the listen socket
+#define URING_LISTEN_SLOT 0
+/// Accepts in flight per ring. Every one needs its own client address, so
+/// they can't be a single multishot accept.
+#define URING_ACCEPTS 32
+/// Completions reaped at once
+#define URING_CQE_BATCH 256
+
+/// Kind of operation of a submission, stored in user_data high bits
+enum uring_op {
+	URING_OP_ACCEPT = 1,
+	URING_OP_RECV,
+	URING_OP_RECVMSG,
+	URING_OP_SEND,
+	URING_OP_SHUTDOWN,
+	URING_OP_CLOSE,
+};
+
+#define URING_OP_SHIFT 32
+
+static uint64_t uring_user_data(enum uring_op op, unsigned slot) {
+	return (uint64_t)op << URING_OP_SHIFT | slot;
+}
+
+static enum uring_op uring_user_data_op(uint64_t user_data) {
+	return (enum uring_op)(user_data >> URING_OP_SHIFT);
+}
+
+static unsigned uring_user_data_slot(uint64_t user_data) {
+	return (unsigned)(user_data & UINT32_MAX);
+}
+
+/// Provided buffer id of a completion
+static uint16_t uring_cqe_bid(const struct io_uring_cqe *cqe) {
+	return (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+/// TCP connection, indexed by its registered file slot
+struct uring_conn {
+	bool active;		       ///< Slot has a connection
+	bool first_response_sent;      ///< First response has been sent
+	char client[INET6_ADDRSTRLEN]; ///< Client address
+};
+
+/// Accept in flight, with the address of the client it will accept
+struct uring_accept {
+	struct sockaddr_in6 addr;
+	socklen_t addrlen;
+};
+
+/// Per thread io_uring state
+struct uring_worker {
+	const struct socket_uring_params *params;
+	size_t idx;
+	pthread_t thread;
+	struct io_uring ring;
+
+	/// Provided buffers
+	struct io_uring_buf_ring *buf_ring;
+	char *buffers;
+
+	/// Connections, indexed by registered file slot. Kernel allocates
+	/// slots when it accepts them.
+	struct uring_conn *conns;
+	struct uring_accept accepts[URING_ACCEPTS];
+
+	/// Recvmsg multishot template (only source address length is used)
+	struct msghdr recvmsg_hdr;
+
+	/// Decoder batch and the provided buffers it is using
+	struct {
+		size_t count;
+		struct n2k_decoder_batch_msg *msgs;
+		/// Clients, only printed if decoder asks for them
+		struct sockaddr_pair *attrs_mem;
+		keyval_list_t *attrs;
+		struct sockaddr_str_cache *addr_cache;
+		uint16_t *bids;
+	} batch;
+
+	struct {
+		uint64_t wakeups;  ///< Number of completions reaps with data
+		uint64_t messages; ///< Number of messages received
+	} stats;
+};
+
+static void uring_worker_batch_done(struct uring_worker *worker) {
+	free(worker->batch.msgs);
+	free(worker->batch.attrs_mem);
+	free(worker->batch.attrs);
+	free(worker->batch.addr_cache);
+	free(worker->batch.bids);
+}
+
+static int uring_worker_batch_init(struct uring_worker *worker) {
+	const size_t size = worker->params->batch_size;
+	size_t i;
+
+	worker->batch.msgs = calloc(size, sizeof(worker->batch.msgs[0]));
+	worker->batch.attrs_mem =
+			calloc(size, sizeof(worker->batch.attrs_mem[0]));
+	worker->batch.attrs = calloc(size, sizeof(worker->batch.attrs[0]));
+	worker->batch.addr_cache =
+			calloc(1, sizeof(*worker->batch.addr_cache));
+	worker->batch.bids = calloc(size, sizeof(worker->batch.bids[0]));
+	if (unlikely(!worker->batch.msgs || !worker->batch.attrs_mem ||
+		     !worker->batch.attrs || !worker->batch.addr_cache ||
+		     !worker->batch.bids)) {
+		uring_worker_batch_done(worker);
+		return -1;
+	}
+
+	for (i = 0; i < size; ++i) {
+		sockaddr_pair_init(&worker->batch.attrs_mem[i],
+				   "client_ip",
+				   worker->batch.addr_cache);
+		worker->batch.msgs[i].props = &worker->batch.attrs[i];
+	}
+
+	return 0;
+}
+
+static char *uring_buffer(struct uring_worker *worker, uint16_t bid) {
+	return &worker->buffers[(size_t)bid * URING_BUF_SIZE];
+}
+
+static void uring_buffer_recycle(struct uring_worker *worker, uint16_t bid) {
+	io_uring_buf_ring_add(worker->buf_ring,
+			      uring_buffer(worker, bid),
+			      URING_BUF_SIZE,
+			      bid,
+			      io_uring_buf_ring_mask(URING_BUF_RING_ENTRIES),
+			      0);
+}
+
+/**
+ * @brief      Get a submission queue entry, submitting pending ones if the
+ *             queue is full
+ *
+ * @param      worker  The worker
+ *
+ * @return     The sqe, or NULL if the ring is not working
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring_worker *worker) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&worker->ring);
+	if (unlikely(NULL == sqe)) {
+		io_uring_submit(&worker->ring);
+		sqe = io_uring_get_sqe(&worker->ring);
+	}
+
+	if (unlikely(NULL == sqe)) {
+		rdlog(LOG_ERR, "Can't get io_uring submission entry");
+	}
+	return sqe;
+}
+
+/**
+ * @brief      Accept a connection directly in a free registered file slot,
+ *             saving its address in the accept buffer.
+ *
+ * @param      worker  The worker
+ * @param[in]  idx     The accept index
+ */
+static void uring_arm_accept(struct uring_worker *worker, unsigned idx) {
+	struct uring_accept *accept = &worker->accepts[idx];
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+	if (unlikely(NULL == sqe)) {
+		return;
+	}
+
+	accept->addrlen = sizeof(accept->addr);
+	io_uring_prep_accept_direct(sqe,
+				    URING_LISTEN_SLOT,
+				    (struct sockaddr *)&accept->addr,
+				    &accept->addrlen,
+				    0,
+				    IORING_FILE_INDEX_ALLOC);
+	io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+	io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_ACCEPT, idx));
+}
+
+static void uring_arm_recv(struct uring_worker *worker, unsigned slot) {
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+	if (unlikely(NULL == sqe)) {
+		return;
+	}
+
+	io_uring_prep_recv_multishot(sqe, (int)slot, NULL, 0, 0);
+	io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT);
+	sqe->buf_group = URING_BUF_GROUP;
+	io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_RECV, slot));
+}
+
+static void uring_arm_recvmsg(struct uring_worker *worker) {
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+	if (unlikely(NULL == sqe)) {
+		return;
+	}
+
+	io_uring_prep_recvmsg_multishot(
+			sqe, URING_LISTEN_SLOT, &worker->recvmsg_hdr, 0);
+	io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT);
+	sqe->buf_group = URING_BUF_GROUP;
+	io_uring_sqe_set_data64(sqe,
+				uring_user_data(URING_OP_RECVMSG,
+						URING_LISTEN_SLOT));
+}
+
+static void uring_close_conn(struct uring_worker *worker, unsigned slot) {
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+	worker->conns[slot].active = false;
+	if (unlikely(NULL == sqe)) {
+		return;
+	}
+
+	// Slot will be reused when close completes
+	io_uring_prep_close_direct(sqe, slot);
+	io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_CLOSE, slot));
+}
+
+/// Shutdown connection, so its multishot recv finish and close it
+static void uring_shutdown_conn(struct uring_worker *worker, unsigned slot) {
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+	if (unlikely(NULL == sqe)) {
+		return;
+	}
+
+	io_uring_prep_shutdown(sqe, (int)slot, SHUT_RDWR);
+	io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+	io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_SHUTDOWN, slot));
+}
+
+/**
+ * @brief      Send a batch of received messages to decoder, and give their
+ *             buffers back to the kernel
+ *
+ * @param      worker  The worker
+ */
+static void uring_flush_batch(struct uring_worker *worker) {
+	size_t i;
+	if (0 == worker->batch.count) {
+		return;
+	}
+
+	listener_decode_batch(worker->params->listener,
+			      worker->batch.msgs,
+			      worker->batch.count);
+
+	for (i = 0; i < worker->batch.count; ++i) {
+		uring_buffer_recycle(worker, worker->batch.bids[i]);
+	}
+	io_uring_buf_ring_advance(worker->buf_ring, (int)worker->batch.count);
+
+	worker->stats.messages += worker->batch.count;
+	if (worker->params->received) {
+		ATOMIC_OP(add,
+			  fetch,
+			  worker->params->received,
+			  worker->batch.count);
+	}
+	worker->batch.count = 0;
+}
+
+/**
+ * @brief      Add a received message to the decoder batch. The buffer will be
+ *             given back to the kernel when the batch is flushed.
+ *
+ * @param      worker  The worker
+ * @param[in]  bid     The provided buffer id
+ * @param[in]  buf     The message
+ * @param[in]  size    The message size
+ * @param[in]  client  The printed client, or NULL if it has to be printed
+ *                     from client_sockaddr when decoder asks for it
+ * @param[in]  client_sockaddr  The client address, if client is NULL. It
+ *                              needs to be valid until batch is flushed.
+ */
+static void uring_batch_add(struct uring_worker *worker,
+			    uint16_t bid,
+			    const char *buf,
+			    size_t size,
+			    const char *client,
+			    const struct sockaddr *client_sockaddr) {
+	const size_t i = worker->batch.count++;
+	struct sockaddr_pair *attr = &worker->batch.attrs_mem[i];
+
+	sockaddr_pair_set(attr, client_sockaddr);
+	attr->pair.value = client;
+	worker->batch.bids[i] = bid;
+	worker->batch.msgs[i].buffer = buf;
+	worker->batch.msgs[i].buf_size = size;
+	keyval_list_init(&worker->batch.attrs[i]);
+	add_key_value_pair(&worker->batch.attrs[i], &attr->pair);
+
+	if (unlikely(global_config.log_severity >= LOG_DEBUG)) {
+		rdlog(LOG_DEBUG,
+		      "received %zu data from %s: %.*s",
+		      size,
+		      valueof(&worker->batch.attrs[i], "client_ip", strcmp),
+		      (int)size,
+		      buf);
+	}
+
+	if (worker->batch.count == worker->params->batch_size) {
+		uring_flush_batch(worker);
+	}
+}
+
+static void uring_handle_accept(struct uring_worker *worker,
+				const struct io_uring_cqe *cqe) {
+	const unsigned idx = uring_user_data_slot(cqe->user_data);
+	struct sockaddr *client_saddr =
+			(struct sockaddr *)&worker->accepts[idx].addr;
+	const int slot = cqe->res;
+
+	if (slot == -ENFILE) {
+		rdlog(LOG_ERR,
+		      "Can't accept more connections in thread %zu: %d "
+		      "connections limit reached",
+		      worker->idx,
+		      URING_MAX_FILES - 1);
+		uring_arm_accept(worker, idx);
+		return;
+	} else if (slot < 0) {
+		rdlog(LOG_ERR, "accept error: %s", gnu_strerror_r(-slot));
+		uring_arm_accept(worker, idx);
+		return;
+	}
+
+	struct uring_conn *conn = &worker->conns[slot];
+	const char *client_addr = sockaddr2str(
+			conn->client, sizeof(conn->client), client_saddr);
+	const bool allowed = NULL != client_addr &&
+			     client_addr_allowed(client_saddr);
+	if (NULL == client_addr) {
+		rdlog(LOG_ERR, "couldn't get client address");
+	} else if (!allowed) {
+		rdlog(LOG_INFO,
+		      "Connection rejected: %s not allowed",
+		      client_addr);
+	} else {
+		rdlog(LOG_INFO, "Accepted connection from %s", client_addr);
+	}
+
+	// Address buffer is not needed anymore
+	uring_arm_accept(worker, idx);
+
+	if (!allowed) {
+		uring_close_conn(worker, (unsigned)slot);
+		return;
+	}
+
+	conn->active = true;
+	conn->first_response_sent = false;
+	uring_arm_recv(worker, (unsigned)slot);
+}
+
+static void uring_send_first_response(struct uring_worker *worker,
+				      unsigned slot) {
+	struct uring_conn *conn = &worker->conns[slot];
+	conn->first_response_sent = true;
+
+	if (global_config.response_len == 0) {
+		rdlog(LOG_ERR,
+		      "Can't send first response to %s: size of response == 0",
+		      conn->client);
+		return;
+	}
+
+	struct io_uring_sqe *sqe = uring_get_sqe(worker);
+	if (unlikely(NULL == sqe)) {
+		return;
+	}
+
+	rdlog(LOG_DEBUG, "Sending first response...");
+	io_uring_prep_send(sqe,
+			   (int)slot,
+			   global_config.response,
+			   (size_t)global_config.response_len - 1,
+			   MSG_NOSIGNAL);
+	io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+	io_uring_sqe_set_data64(sqe, uring_user_data(URING_OP_SEND, slot));
+}
+
+static void uring_handle_recv(struct uring_worker *worker,
+			      const struct io_uring_cqe *cqe) {
+	const unsigned slot = uring_user_data_slot(cqe->user_data);
+	struct uring_conn *conn = &worker->conns[slot];
+	const bool more = cqe->flags & IORING_CQE_F_MORE;
+
+	if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		const uint16_t bid = uring_cqe_bid(cqe);
+		uring_batch_add(worker,
+				bid,
+				uring_buffer(worker, bid),
+				(size_t)cqe->res,
+				conn->client,
+				NULL);
+
+		if (NULL != global_config.response &&
+		    !conn->first_response_sent) {
+			uring_send_first_response(worker, slot);
+		}
+	}
+
+	if (more || !conn->active) {
+		return;
+	}
+
+	if (cqe->res > 0 || cqe->res == -ENOBUFS) {
+		// Multishot stopped, but connection is still alive. It will be
+		// submitted after the batch gives its buffers back.
+		uring_arm_recv(worker, slot);
+	} else {
+		if (cqe->res < 0) {
+			rdlog(LOG_ERR,
+			      "Recv error: %s",
+			      gnu_strerror_r(-cqe->res));
+		}
+		uring_close_conn(worker, slot);
+	}
+}
+
+static void uring_handle_recvmsg(struct uring_worker *worker,
+				 const struct io_uring_cqe *cqe) {
+	if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		const uint16_t bid = uring_cqe_bid(cqe);
+		struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(
+				uring_buffer(worker, bid),
+				cqe->res,
+				&worker->recvmsg_hdr);
+		if (unlikely(NULL == out)) {
+			rdlog(LOG_ERR, "Invalid datagram received");
+			uring_buffer_recycle(worker, bid);
+			io_uring_buf_ring_advance(worker->buf_ring, 1);
+		} else if (!client_addr_allowed(io_uring_recvmsg_name(out))) {
+			// Not allowed client
+			uring_buffer_recycle(worker, bid);
+			io_uring_buf_ring_advance(worker->buf_ring, 1);
+		} else {
+			const struct sockaddr *client_sockaddr =
+					io_uring_recvmsg_name(out);
+			if (out->flags & MSG_TRUNC) {
+				rdlog(LOG_WARNING,
+				      "Datagram from %s truncated to %d bytes",
+				      sockaddr2str_cached(
+						      worker->batch.addr_cache,
+						      client_sockaddr),
+				      URING_READ_SIZE);
+			}
+
+			uring_batch_add(worker,
+					bid,
+					io_uring_recvmsg_payload(
+							out,
+							&worker->recvmsg_hdr),
+					io_uring_recvmsg_payload_length(
+							out,
+							cqe->res,
+							&worker->recvmsg_hdr),
+					NULL,
+					client_sockaddr);
+		}
+	} else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+		rdlog(LOG_ERR, "Recvmsg error: %s", gnu_strerror_r(-cqe->res));
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		uring_arm_recvmsg(worker);
+	}
+}
+
+static void uring_handle_cqe(struct uring_worker *worker,
+			     const struct io_uring_cqe *cqe) {
+	const unsigned slot = uring_user_data_slot(cqe->user_data);
+
+	switch (uring_user_data_op(cqe->user_data)) {
+	case URING_OP_ACCEPT:
+		uring_handle_accept(worker, cqe);
+		break;
+	case URING_OP_RECV:
+		uring_handle_recv(worker, cqe);
+		break;
+	case URING_OP_RECVMSG:
+		uring_handle_recvmsg(worker, cqe);
+		break;
+	case URING_OP_SEND:
+		if (cqe->res < 0) {
+			rdlog(LOG_ERR,
+			      "Cannot send first response to %s socket: %s",
+			      worker->conns[slot].client,
+			      gnu_strerror_r(-cqe->res));
+			if (worker->conns[slot].active) {
+				uring_shutdown_conn(worker, slot);
+			}
+		} else {
+			rdlog(LOG_DEBUG, "first response ok");
+		}
+		break;
+	case URING_OP_SHUTDOWN:
+	case URING_OP_CLOSE:
+		break;
+	default:
+		rdlog(LOG_ERR,
+		      "Unknown io_uring completion %" PRIu64,
+		      (uint64_t)cqe->user_data);
+		break;
+	}
+}
+
+/**
+ * @brief      Process all available completions
+ *
+ * @param      worker  The worker
+ */
+static void uring_process_cqes(struct uring_worker *worker) {
+	struct io_uring_cqe *cqes[URING_CQE_BATCH];
+	unsigned cqes_count, i;
+
+	while ((cqes_count = io_uring_peek_batch_cqe(
+				&worker->ring, cqes, RD_ARRAYSIZE(cqes))) > 0) {
+		for (i = 0; i < cqes_count; ++i) {
+			uring_handle_cqe(worker, cqes[i]);
+		}
+
+		// Messages buffers are in the provided buffers ring, not in
+		// completion queue, so we can release completions now.
+		io_uring_cq_advance(&worker->ring, cqes_count);
+		uring_flush_batch(worker);
+		worker->stats.wakeups++;
+	}
+}
+
+static void uring_worker_done(struct uring_worker *worker) {
+	if (worker->buf_ring) {
+		io_uring_free_buf_ring(&worker->ring,
+				       worker->buf_ring,
+				       URING_BUF_RING_ENTRIES,
+				       URING_BUF_GROUP);
+	}
+	io_uring_queue_exit(&worker->ring);
+	uring_worker_batch_done(worker);
+	free(worker->buffers);
+	free(worker->conns);
+}
+
+/**
+ * @brief      Create worker ring, register its listen socket and provide
+ *             buffers to the kernel.
+ *
+ * @param      worker  The worker
+ *
+ * @return     0 if success, -1 in other case
+ */
+static int uring_worker_init(struct uring_worker *worker) {
+	struct io_uring_params ring_params;
+	unsigned i;
+	int rc;
+
+	memset(&ring_params, 0, sizeof(ring_params));
+	ring_params.flags = IORING_SETUP_CQSIZE;
+	ring_params.cq_entries = URING_CQ_ENTRIES;
+	rc = io_uring_queue_init_params(
+			URING_SQ_ENTRIES, &worker->ring, &ring_params);
+	if (rc < 0) {
+		rdlog(LOG_ERR,
+		      "Can't create io_uring: %s",
+		      gnu_strerror_r(-rc));
+		return -1;
+	}
+
+	worker->buffers = malloc((size_t)URING_BUF_RING_ENTRIES *
+				 URING_BUF_SIZE);
+	worker->conns = calloc(URING_MAX_FILES, sizeof(worker->conns[0]));
+	if (unlikely(!worker->buffers || !worker->conns ||
+		     0 != uring_worker_batch_init(worker))) {
+		rdlog(LOG_ERR, "Can't allocate io_uring buffers (OOM?)");
+		goto err;
+	}
+
+	const int listenfd = worker->params->listenfds[worker->idx];
+	rc = io_uring_register_files_sparse(&worker->ring, URING_MAX_FILES);
+	if (rc == 0) {
+		rc = io_uring_register_files_update(
+				&worker->ring, URING_LISTEN_SLOT, &listenfd, 1);
+	}
+	if (rc >= 0) {
+		// Accepted connections slots
+		rc = io_uring_register_file_alloc_range(
+				&worker->ring,
+				URING_LISTEN_SLOT + 1,
+				URING_MAX_FILES - URING_LISTEN_SLOT - 1);
+	}
+	if (rc < 0) {
+		rdlog(LOG_ERR,
+		      "Can't register io_uring files: %s",
+		      gnu_strerror_r(-rc));
+		goto err;
+	}
+
+	if (worker->params->tcp && worker->params->tcp_keepalive) {
+		// Connections accepted as direct descriptors have no file
+		// descriptor to set it, but they inherit it from listen socket
+		const int keepalive = 1;
+		const int sso_rc = setsockopt(listenfd,
+					      SOL_SOCKET,
+					      SO_KEEPALIVE,
+					      &keepalive,
+					      sizeof(keepalive));
+		if (sso_rc == -1)
+			rdbg("Can't set SO_KEEPALIVE option");
+	}
+
+	worker->buf_ring = io_uring_setup_buf_ring(&worker->ring,
+						   URING_BUF_RING_ENTRIES,
+						   URING_BUF_GROUP,
+						   0,
+						   &rc);
+	if (NULL == worker->buf_ring) {
+		rdlog(LOG_ERR,
+		      "Can't setup io_uring provided buffers ring: %s",
+		      gnu_strerror_r(-rc));
+		goto err;
+	}
+
+	for (i = 0; i < URING_BUF_RING_ENTRIES; ++i) {
+		uring_buffer_recycle(worker, (uint16_t)i);
+	}
+	io_uring_buf_ring_advance(worker->buf_ring, URING_BUF_RING_ENTRIES);
+
+	worker->recvmsg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+
+	return 0;
+
+err:
+	uring_worker_done(worker);
+	return -1;
+}
+
+static void *uring_worker_loop(void *vworker) {
+	struct uring_worker *worker = vworker;
+
+	cpu_affinity_apply(worker->params->affinity,
+			   worker->params->listener->port,
+			   "io_uring",
+			   worker->idx);
+
+	if (worker->params->tcp) {
+		unsigned i;
+		for (i = 0; i < URING_ACCEPTS; ++i) {
+			uring_arm_accept(worker, i);
+		}
+	} else {
+		uring_arm_recvmsg(worker);
+	}
+
+	while (!*worker->params->shutdown) {
+		struct __kernel_timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+		struct io_uring_cqe *cqe = NULL;
+
+		// Submit pending work and wait, in only one syscall
+		const int rc = io_uring_submit_and_wait_timeout(
+				&worker->ring, &cqe, 1, &ts, NULL);
+		if (unlikely(rc < 0 && rc != -ETIME && rc != -EINTR)) {
+			rdlog(LOG_ERR,
+			      "Error waiting for io_uring completions: %s",
+			      gnu_strerror_r(-rc));
+			break;
+		}
+
+		uring_process_cqes(worker);
+	}
+
+	return NULL;
+}
+
+int socket_uring_run(const struct socket_uring_params *params) {
+	size_t i, running_threads = 0;
+	uint64_t wakeups = 0, messages = 0;
+	int rc = -1;
+
+	struct uring_worker *workers = calloc(params->threads,
+					      sizeof(workers[0]));
+	if (unlikely(NULL == workers)) {
+		rdlog(LOG_ERR, "Can't allocate io_uring workers (OOM?)");
+		return -1;
+	}
+
+	for (i = 0; i < params->threads; ++i) {
+		workers[i].params = params;
+		workers[i].idx = i;
+		// Allocate ring memory in the node of the thread that uses it
+		cpu_affinity_apply(params->affinity,
+				   params->listener->port,
+				   NULL,
+				   i);
+		if (0 != uring_worker_init(&workers[i])) {
+			goto init_err;
+		}
+	}
+
+	if (params->tcp) {
+		rdlog(LOG_WARNING,
+		      "TCP io_uring listener on port %" PRIu16 " reads in "
+		      "fixed %d bytes buffers, without adaptive read size. "
+		      "Every buffer is sent as a message",
+		      params->listener->port,
+		      URING_READ_SIZE);
+	}
+
+	for (running_threads = 0; running_threads < params->threads;
+	     ++running_threads) {
+		const int pcreate_rc = pthread_create(
+				&workers[running_threads].thread,
+				NULL,
+				uring_worker_loop,
+				&workers[running_threads]);
+		if (pcreate_rc != 0) {
+			rdlog(LOG_ERR,
+			      "Couldn't create io_uring thread: %s",
+			      gnu_strerror_r(pcreate_rc));
+			break;
+		}
+	}
+
+	// From this point we have run, even if not all threads could start
+	rc = 0;
+	for (i = 0; i < running_threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		wakeups += workers[i].stats.wakeups;
+		messages += workers[i].stats.messages;
+	}
+
+	rdlog(LOG_INFO,
+	      "%s io_uring listener on port %" PRIu16 " read %" PRIu64
+	      " messages in %" PRIu64 " wakeups (%.2f messages per wakeup)",
+	      params->tcp ? "TCP" : "UDP",
+	      params->listener->port,
+	      messages,
+	      wakeups,
+	      wakeups ? (double)messages / (double)wakeups : 0.);
+	i = params->threads;
+
+init_err:
+	while (i-- > 0) {
+		uring_worker_done(&workers[i]);
+	}
+	free(workers);
+	// Caller may keep running, with libev threads in case of failure
+	cpu_affinity_apply(params->affinity,
+			   params->listener->port,
+			   NULL,
+			   CPU_AFFINITY_ALL);
+	return rc;
+}
+
+#endif // HAVE_LIBURING
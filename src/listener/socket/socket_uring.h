@@ -0,0 +1,64 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "config.h"
+
+#ifdef HAVE_LIBURING
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct cpu_affinity;
+struct listener;
+
+/// io_uring socket listener parameters
+struct socket_uring_params {
+	const struct listener *listener; ///< Listener to send messages
+	bool tcp;			 ///< Stream socket (accept clients)
+	bool tcp_keepalive;		 ///< Send TCP keepalives to clients
+	size_t threads;			 ///< Number of threads (rings)
+	const int *listenfds;		 ///< Per thread listen socket
+	size_t batch_size;		 ///< Max messages per decoder batch
+	/// Received messages counter, updated atomically. Can be NULL.
+	uint64_t *received;
+	const volatile int *shutdown;	 ///< Stop threads when it is != 0
+	/// Threads placement. Caller thread must be pinned to all the set.
+	const struct cpu_affinity *affinity;
+};
+
+/**
+ * @brief      Run socket listener threads using io_uring, until shutdown
+ *             flag is set. Each thread uses its own ring with the listen
+ *             socket registered, direct accepts into registered file slots
+ *             and multishot recv over a provided buffers ring, so it only
+ *             need one system call to submit and reap a full batch of
+ *             messages.
+ *
+ * @param[in]  params  The parameters
+ *
+ * @return     0 if listener has run, -1 if io_uring is not usable (and no
+ *             message has been read)
+ */
+int socket_uring_run(const struct socket_uring_params *params);
+
+#endif // HAVE_LIBURING
@@ -1,11 +1,18 @@
 THIS_SRCS := \
+	addr_acl.c \
+	addr_count.c \
+	buffer_pool.c \
+	cpu_affinity.c \
 	file.c \
-	in_addr_list.c \
 	kafka.c \
 	kafka_message_array.c \
+	latency_histogram.c \
 	pair.c \
+	slab.c \
 	string.c \
+	timer_wheel.c \
 	topic_database.c \
+	unix_socket.c \
 
 SRCS += $(addprefix $(CURRENT_N2KAFKA_DIR), $(THIS_SRCS))
 
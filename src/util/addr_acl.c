@@ -0,0 +1,301 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "addr_acl.h"
+
+#include "config.h"
+
+#include "util/util.h"
+
+#include <librd/rdlog.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+
+/// Bits consumed by every trie level
+#define ADDR_ACL_STRIDE 4
+/// Children of every trie node
+#define ADDR_ACL_FANOUT (1 << ADDR_ACL_STRIDE)
+
+/// Address families, also index of their trie root node
+enum addr_acl_family {
+	ADDR_ACL_IPV4,
+	ADDR_ACL_IPV6,
+	ADDR_ACL_FAMILIES,
+};
+
+/** Trie node. Prefixes that end in the middle of a node are expanded to all
+  the entries they cover, so lookup only needs to check one entry per
+  level. */
+struct addr_acl_node {
+	uint32_t child[ADDR_ACL_FANOUT]; ///< Child node index, 0 if none
+	uint8_t action[ADDR_ACL_FANOUT]; ///< Longest prefix action, 0 if none
+	uint8_t plen[ADDR_ACL_FANOUT];	 ///< Longest prefix length
+};
+
+struct addr_acl {
+	/// Trie nodes. First ADDR_ACL_FAMILIES are roots.
+	struct {
+		struct addr_acl_node *nodes; ///< Nodes memory
+		size_t count;		     ///< Used nodes
+		size_t size;		     ///< Allocated nodes
+	} trie;
+
+	/// Action of zero length prefixes
+	uint8_t default_action[ADDR_ACL_FAMILIES];
+
+	size_t rules;	///< Number of rules
+	bool has_allow; ///< Unmatched clients are denied
+	size_t refcnt;	///< References count
+};
+
+struct addr_acl *addr_acl_new() {
+	struct addr_acl *acl = calloc(1, sizeof(*acl));
+	if (unlikely(NULL == acl)) {
+		return NULL;
+	}
+
+	acl->refcnt = 1;
+	acl->trie.size = ADDR_ACL_FAMILIES;
+	acl->trie.count = ADDR_ACL_FAMILIES;
+	acl->trie.nodes = calloc(acl->trie.size, sizeof(acl->trie.nodes[0]));
+	if (unlikely(NULL == acl->trie.nodes)) {
+		free(acl);
+		return NULL;
+	}
+
+	return acl;
+}
+
+/// Get address nibble at a given trie level
+static uint8_t addr_nibble(const uint8_t *addr, size_t level) {
+	const uint8_t byte = addr[level / 2];
+	return level % 2 ? byte & 0x0f : byte >> 4;
+}
+
+/**
+ * @brief      Get child node of a trie node, creating it if needed
+ *
+ * @param      acl    The access list
+ * @param[in]  node   The parent node index
+ * @param[in]  entry  The parent node entry
+ *
+ * @return     Child node index, or 0 if no memory
+ */
+static uint32_t
+addr_acl_child(struct addr_acl *acl, uint32_t node, uint8_t entry) {
+	if (acl->trie.nodes[node].child[entry]) {
+		return acl->trie.nodes[node].child[entry];
+	}
+
+	if (acl->trie.count == UINT32_MAX) {
+		return 0;
+	}
+
+	if (acl->trie.count == acl->trie.size) {
+		const size_t new_size = 2 * acl->trie.size;
+		struct addr_acl_node *new_nodes = realloc(
+				acl->trie.nodes,
+				new_size * sizeof(acl->trie.nodes[0]));
+		if (unlikely(NULL == new_nodes)) {
+			return 0;
+		}
+
+		acl->trie.nodes = new_nodes;
+		acl->trie.size = new_size;
+	}
+
+	const uint32_t child = (uint32_t)acl->trie.count++;
+	memset(&acl->trie.nodes[child], 0, sizeof(acl->trie.nodes[child]));
+	acl->trie.nodes[node].child[entry] = child;
+	return child;
+}
+
+/// Insert a prefix in access list. Prefix length must be greater than 0.
+static int addr_acl_insert(struct addr_acl *acl,
+			   enum addr_acl_family family,
+			   const uint8_t *addr,
+			   uint8_t plen,
+			   enum addr_acl_action action) {
+	const size_t level = (size_t)(plen - 1) / ADDR_ACL_STRIDE;
+	uint32_t node = family;
+	size_t i;
+
+	for (i = 0; i < level; ++i) {
+		node = addr_acl_child(acl, node, addr_nibble(addr, i));
+		if (unlikely(0 == node)) {
+			return -1;
+		}
+	}
+
+	// Expand the prefix to all the entries it covers in the last node
+	const size_t node_bits = plen - level * ADDR_ACL_STRIDE;
+	const uint8_t span = (uint8_t)(1 << (ADDR_ACL_STRIDE - node_bits));
+	const uint8_t first = addr_nibble(addr, level) & (uint8_t)~(span - 1);
+	struct addr_acl_node *n = &acl->trie.nodes[node];
+	for (i = first; i < (size_t)(first + span); ++i) {
+		if (n->plen[i] <= plen) {
+			n->action[i] = action;
+			n->plen[i] = plen;
+		}
+	}
+
+	return 0;
+}
+
+int addr_acl_add(struct addr_acl *acl,
+		 const char *cidr,
+		 enum addr_acl_action action) {
+	char addr_str[INET6_ADDRSTRLEN];
+	uint8_t addr[sizeof(struct in6_addr)];
+	enum addr_acl_family family;
+	unsigned long plen, max_plen;
+	const char *slash = strchr(cidr, '/');
+	const size_t addr_len = slash ? (size_t)(slash - cidr) : strlen(cidr);
+
+	if (addr_len >= sizeof(addr_str)) {
+		goto invalid;
+	}
+
+	memcpy(addr_str, cidr, addr_len);
+	addr_str[addr_len] = '\0';
+
+	if (1 == inet_pton(AF_INET, addr_str, addr)) {
+		family = ADDR_ACL_IPV4;
+		max_plen = 32;
+	} else if (1 == inet_pton(AF_INET6, addr_str, addr)) {
+		family = ADDR_ACL_IPV6;
+		max_plen = 128;
+	} else {
+		goto invalid;
+	}
+
+	plen = max_plen;
+	if (slash) {
+		char *endptr = NULL;
+		if (slash[1] < '0' || slash[1] > '9') {
+			goto invalid;
+		}
+
+		plen = strtoul(&slash[1], &endptr, 10);
+		if (*endptr != '\0' || plen > max_plen) {
+			goto invalid;
+		}
+	}
+
+	if (0 == plen) {
+		acl->default_action[family] = (uint8_t)action;
+	} else if (0 != addr_acl_insert(acl,
+					family,
+					addr,
+					(uint8_t)plen,
+					action)) {
+		rdlog(LOG_ERR, "Can't add %s to access list (OOM?)", cidr);
+		return -1;
+	}
+
+	acl->rules++;
+	if (action == ADDR_ACL_ALLOW) {
+		acl->has_allow = true;
+	}
+
+	return 0;
+
+invalid:
+	rdlog(LOG_ERR, "Invalid address or prefix %s", cidr);
+	return -1;
+}
+
+size_t addr_acl_size(const struct addr_acl *acl) {
+	return acl->rules;
+}
+
+/// Longest prefix match of an address in family trie
+static bool addr_acl_lookup(const struct addr_acl *acl,
+			    enum addr_acl_family family,
+			    const uint8_t *addr,
+			    size_t addr_size) {
+	uint8_t action = acl->default_action[family];
+	uint32_t node = family;
+	size_t i;
+
+	for (i = 0; i < 2 * addr_size; ++i) {
+		const struct addr_acl_node *n = &acl->trie.nodes[node];
+		const uint8_t nibble = addr_nibble(addr, i);
+
+		if (n->action[nibble]) {
+			action = n->action[nibble];
+		}
+
+		node = n->child[nibble];
+		if (0 == node) {
+			break;
+		}
+	}
+
+	return action ? action == ADDR_ACL_ALLOW : !acl->has_allow;
+}
+
+bool addr_acl_allowed(const struct addr_acl *acl, const struct sockaddr *addr) {
+	if (addr->sa_family == AF_INET) {
+		const struct sockaddr_in *sin =
+				(const struct sockaddr_in *)addr;
+		return addr_acl_lookup(acl,
+				       ADDR_ACL_IPV4,
+				       (const uint8_t *)&sin->sin_addr,
+				       sizeof(sin->sin_addr));
+	} else if (addr->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 =
+				(const struct sockaddr_in6 *)addr;
+		const uint8_t *addr6 = sin6->sin6_addr.s6_addr;
+		if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+			static const size_t v4_offset =
+					sizeof(struct in6_addr) -
+					sizeof(struct in_addr);
+			return addr_acl_lookup(acl,
+					       ADDR_ACL_IPV4,
+					       &addr6[v4_offset],
+					       sizeof(struct in_addr));
+		}
+
+		return addr_acl_lookup(acl,
+				       ADDR_ACL_IPV6,
+				       addr6,
+				       sizeof(sin6->sin6_addr));
+	}
+
+	return true;
+}
+
+void addr_acl_incref(struct addr_acl *acl) {
+	ATOMIC_OP(add, fetch, &acl->refcnt, 1);
+}
+
+void addr_acl_decref(struct addr_acl *acl) {
+	if (0 == ATOMIC_OP(sub, fetch, &acl->refcnt, 1)) {
+		free(acl->trie.nodes);
+		free(acl);
+	}
+}
@@ -0,0 +1,84 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sockaddr;
+
+/// Client address access rule action
+enum addr_acl_action {
+	ADDR_ACL_ALLOW = 1, ///< Allow clients in prefix
+	ADDR_ACL_DENY,	    ///< Deny clients in prefix
+};
+
+/** Client address access list.
+
+  It holds IPv4 and IPv6 CIDR allow and deny rules in a multibit trie, so
+  lookups cost at most one step per address nibble, no matter how many rules
+  it has. The longest matching prefix decides. If no prefix matches, client
+  is allowed unless there is some allow rule.
+
+  @note Access list can't be modified once it is shared with other threads,
+  but it can be consulted concurrently. Threads that share it hold a
+  reference each.
+  */
+struct addr_acl;
+
+/// Creates a new empty access list, with one reference
+struct addr_acl *addr_acl_new();
+
+/**
+ * @brief      Add a rule to access list
+ *
+ * @param      acl     The access list
+ * @param[in]  cidr    The rule prefix, in "addr" or "addr/len" form. Both
+ *                     IPv4 and IPv6 are accepted.
+ * @param[in]  action  The action
+ *
+ * @return     0 if success, -1 if invalid prefix or no memory (error is
+ *             logged)
+ */
+int addr_acl_add(struct addr_acl *acl,
+		 const char *cidr,
+		 enum addr_acl_action action);
+
+/// Number of rules in access list
+size_t addr_acl_size(const struct addr_acl *acl);
+
+/**
+ * @brief      Check if a client is allowed. IPv4-mapped IPv6 addresses are
+ *             checked against IPv4 rules.
+ *
+ * @param[in]  acl   The access list
+ * @param[in]  addr  The client address
+ *
+ * @return     True if allowed, false otherwise. Non IP addresses are always
+ *             allowed.
+ */
+bool addr_acl_allowed(const struct addr_acl *acl, const struct sockaddr *addr);
+
+/// Take another reference to an access list
+void addr_acl_incref(struct addr_acl *acl);
+
+/// Release an access list reference. Last one deallocates it.
+void addr_acl_decref(struct addr_acl *acl);
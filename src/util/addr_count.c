@@ -0,0 +1,272 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "addr_count.h"
+
+#include "util/util.h"
+
+#include <librd/rdlog.h>
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+
+/// Initial table size. Needs to be a power of 2
+#define ADDR_COUNT_INITIAL_SIZE 64
+
+/// Client address, as hash table key
+struct addr_count_key {
+	sa_family_t family; ///< Address family. 0 if entry is empty
+	uint8_t addr[16];   ///< Binary address, zero padded
+};
+
+struct addr_count_entry {
+	struct addr_count_key key;
+	size_t count;
+};
+
+struct addr_count {
+	pthread_mutex_t lock;
+	struct addr_count_entry *entries;
+	size_t size; ///< Table size, power of 2
+	size_t used; ///< Used entries
+};
+
+/**
+ * @brief      Extract table key from a socket address
+ *
+ * @param      key   The key
+ * @param[in]  addr  The address
+ *
+ * @return     True if address is IP, false in other case
+ */
+static bool addr_count_key(struct addr_count_key *key,
+			   const struct sockaddr *addr) {
+	memset(key, 0, sizeof(*key));
+
+	if (addr->sa_family == AF_INET) {
+		const struct sockaddr_in *sin =
+				(const struct sockaddr_in *)addr;
+		key->family = AF_INET;
+		memcpy(key->addr, &sin->sin_addr, sizeof(sin->sin_addr));
+		return true;
+	} else if (addr->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 =
+				(const struct sockaddr_in6 *)addr;
+		const uint8_t *addr6 = sin6->sin6_addr.s6_addr;
+		if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+			static const size_t v4_offset =
+					sizeof(struct in6_addr) -
+					sizeof(struct in_addr);
+			key->family = AF_INET;
+			memcpy(key->addr,
+			       &addr6[v4_offset],
+			       sizeof(struct in_addr));
+		} else {
+			key->family = AF_INET6;
+			memcpy(key->addr, addr6, sizeof(sin6->sin6_addr));
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/// FNV-1a hash of a key
+static size_t addr_count_hash(const struct addr_count_key *key) {
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	hash = (hash ^ key->family) * 16777619u;
+	for (i = 0; i < sizeof(key->addr); ++i) {
+		hash = (hash ^ key->addr[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief      Find the entry of a key, or the empty entry where it should be
+ *             inserted. Table can't be full.
+ *
+ * @param      entries  The table entries
+ * @param[in]  size     The table size
+ * @param[in]  key      The key
+ *
+ * @return     The entry
+ */
+static struct addr_count_entry *
+addr_count_find(struct addr_count_entry *entries,
+		size_t size,
+		const struct addr_count_key *key) {
+	size_t i = addr_count_hash(key) & (size - 1);
+
+	while (entries[i].key.family != 0 &&
+	       0 != memcmp(&entries[i].key, key, sizeof(*key))) {
+		i = (i + 1) & (size - 1);
+	}
+
+	return &entries[i];
+}
+
+/// Double table size. Needs table lock
+static int addr_count_grow(struct addr_count *count) {
+	const size_t new_size = count->size * 2;
+	struct addr_count_entry *entries =
+			calloc(new_size, sizeof(entries[0]));
+	size_t i;
+
+	if (unlikely(NULL == entries)) {
+		return -1;
+	}
+
+	for (i = 0; i < count->size; ++i) {
+		if (count->entries[i].key.family != 0) {
+			*addr_count_find(entries,
+					 new_size,
+					 &count->entries[i].key) =
+					count->entries[i];
+		}
+	}
+
+	free(count->entries);
+	count->entries = entries;
+	count->size = new_size;
+	return 0;
+}
+
+/**
+ * @brief      Delete an entry, moving back the entries of its probe sequence
+ *             so lookups do not need tombstones. Needs table lock.
+ *
+ * @param      count  The counters table
+ * @param      entry  The entry
+ */
+static void addr_count_delete(struct addr_count *count,
+			      struct addr_count_entry *entry) {
+	const size_t mask = count->size - 1;
+	size_t hole = (size_t)(entry - count->entries);
+	size_t i = hole;
+
+	for (;;) {
+		i = (i + 1) & mask;
+		if (count->entries[i].key.family == 0) {
+			break;
+		}
+
+		// Entry can fill the hole if hole is between its home and it
+		const size_t home = addr_count_hash(&count->entries[i].key) &
+				    mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			count->entries[hole] = count->entries[i];
+			hole = i;
+		}
+	}
+
+	memset(&count->entries[hole], 0, sizeof(count->entries[hole]));
+	count->used--;
+}
+
+struct addr_count *addr_count_new() {
+	struct addr_count *count = calloc(1, sizeof(*count));
+	if (unlikely(NULL == count)) {
+		return NULL;
+	}
+
+	count->size = ADDR_COUNT_INITIAL_SIZE;
+	count->entries = calloc(count->size, sizeof(count->entries[0]));
+	if (unlikely(NULL == count->entries)) {
+		free(count);
+		return NULL;
+	}
+
+	if (unlikely(0 != pthread_mutex_init(&count->lock, NULL))) {
+		free(count->entries);
+		free(count);
+		return NULL;
+	}
+
+	return count;
+}
+
+bool addr_count_inc(struct addr_count *count,
+		    const struct sockaddr *addr,
+		    size_t limit) {
+	struct addr_count_key key;
+	bool ret = true;
+
+	if (!addr_count_key(&key, addr)) {
+		return true;
+	}
+
+	pthread_mutex_lock(&count->lock);
+	if (2 * (count->used + 1) > count->size &&
+	    0 != addr_count_grow(count)) {
+		rdlog(LOG_ERR, "Can't grow client counters table (OOM?)");
+		ret = false;
+		goto unlock;
+	}
+
+	struct addr_count_entry *entry =
+			addr_count_find(count->entries, count->size, &key);
+	if (entry->key.family == 0) {
+		entry->key = key;
+		count->used++;
+	}
+
+	if (entry->count >= limit) {
+		ret = false;
+		if (entry->count == 0) {
+			addr_count_delete(count, entry);
+		}
+	} else {
+		entry->count++;
+	}
+
+unlock:
+	pthread_mutex_unlock(&count->lock);
+	return ret;
+}
+
+void addr_count_dec(struct addr_count *count, const struct sockaddr *addr) {
+	struct addr_count_key key;
+
+	if (!addr_count_key(&key, addr)) {
+		return;
+	}
+
+	pthread_mutex_lock(&count->lock);
+	struct addr_count_entry *entry =
+			addr_count_find(count->entries, count->size, &key);
+	if (entry->key.family != 0 && 0 == --entry->count) {
+		addr_count_delete(count, entry);
+	}
+	pthread_mutex_unlock(&count->lock);
+}
+
+void addr_count_done(struct addr_count *count) {
+	pthread_mutex_destroy(&count->lock);
+	free(count->entries);
+	free(count);
+}
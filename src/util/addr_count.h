@@ -0,0 +1,59 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sockaddr;
+
+/** Per client address counters, like connections per client.
+
+  Counters live in an open addressing hash table, so lookups do not allocate
+  and cost O(1). Entries are deleted when their counter goes back to 0, so
+  table size follows the number of distinct active clients. It is thread
+  safe. IPv4-mapped IPv6 addresses count as their IPv4 address, and non IP
+  addresses are not counted.
+  */
+struct addr_count;
+
+/// Create a new counters table, or NULL if no memory
+struct addr_count *addr_count_new();
+
+/**
+ * @brief      Increment client counter if it is under limit
+ *
+ * @param      count  The counters table
+ * @param[in]  addr   The client address
+ * @param[in]  limit  The counter limit
+ *
+ * @return     True if counter has been incremented, false if it had already
+ *             reached limit or no memory (error is logged).
+ */
+bool addr_count_inc(struct addr_count *count,
+		    const struct sockaddr *addr,
+		    size_t limit);
+
+/// Decrement client counter, previously incremented with addr_count_inc
+void addr_count_dec(struct addr_count *count, const struct sockaddr *addr);
+
+/// Deallocate a counters table
+void addr_count_done(struct addr_count *count);
@@ -0,0 +1,233 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "buffer_pool.h"
+
+#include "config.h"
+
+#include "util/kafka.h"
+#include "util/util.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE 64
+
+struct pool_buffer {
+	/// Delivery report release. Needs to be the first member.
+	struct kafka_msg_private kafka_private;
+	struct buffer_pool *pool; ///< Buffer pool
+	struct pool_buffer *next; ///< Next free buffer
+	size_t refcnt;		  ///< Reference counter
+	/// Data follows, in the next cache line
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct buffer_pool {
+	pthread_t owner;    ///< Owner thread
+	size_t buffer_size; ///< Buffers size
+	size_t max_free;    ///< Max number of free buffers per list
+	/// Owner reference + allocated buffers.
+	size_t refcnt;
+
+	/// Owner thread free buffers
+	struct pool_buffer *free_list;
+	size_t free_count;
+
+	/// Free buffers released from other threads. Kept apart from the
+	/// owner thread data to avoid false sharing.
+	struct {
+		pthread_mutex_t lock;
+		struct pool_buffer *free_list;
+		size_t free_count;
+		bool done; ///< Pool owner has released the pool
+	} remote __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+static void buffer_pool_decref(struct buffer_pool *pool) {
+	if (0 == ATOMIC_OP(sub, fetch, &pool->refcnt, 1)) {
+		pthread_mutex_destroy(&pool->remote.lock);
+		free(pool);
+	}
+}
+
+/// Free a buffer list, releasing pool references
+static void buffer_pool_free_list(struct buffer_pool *pool,
+				  struct pool_buffer *list) {
+	while (list) {
+		struct pool_buffer *next = list->next;
+		free(list);
+		buffer_pool_decref(pool);
+		list = next;
+	}
+}
+
+struct buffer_pool *buffer_pool_new(size_t buffer_size, size_t max_free) {
+	void *ret = NULL;
+	const int rc = posix_memalign(&ret, CACHE_LINE_SIZE,
+				      sizeof(struct buffer_pool));
+	if (unlikely(rc != 0)) {
+		return NULL;
+	}
+
+	struct buffer_pool *pool = ret;
+	*pool = (struct buffer_pool){
+			.owner = pthread_self(),
+			.buffer_size = buffer_size,
+			.max_free = max_free,
+			.refcnt = 1,
+	};
+
+	if (unlikely(0 != pthread_mutex_init(&pool->remote.lock, NULL))) {
+		free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void buffer_pool_done(struct buffer_pool *pool) {
+	pthread_mutex_lock(&pool->remote.lock);
+	struct pool_buffer *remote_list = pool->remote.free_list;
+	pool->remote.free_list = NULL;
+	pool->remote.free_count = 0;
+	pool->remote.done = true;
+	pthread_mutex_unlock(&pool->remote.lock);
+
+	buffer_pool_free_list(pool, remote_list);
+	buffer_pool_free_list(pool, pool->free_list);
+	pool->free_list = NULL;
+	pool->free_count = 0;
+
+	// In flight buffers will release the rest of the references
+	buffer_pool_decref(pool);
+}
+
+static void pool_buffer_release(struct kafka_msg_private *priv) {
+	pool_buffer_unref((struct pool_buffer *)priv);
+}
+
+/// Allocate a new buffer
+static struct pool_buffer *buffer_pool_new_buffer(struct buffer_pool *pool) {
+	void *ret = NULL;
+	const int rc = posix_memalign(&ret,
+				      CACHE_LINE_SIZE,
+				      sizeof(struct pool_buffer) +
+						      pool->buffer_size);
+	if (unlikely(rc != 0)) {
+		return NULL;
+	}
+
+	ATOMIC_OP(add, fetch, &pool->refcnt, 1);
+	struct pool_buffer *buf = ret;
+	buf->kafka_private.release = pool_buffer_release;
+	buf->pool = pool;
+	return buf;
+}
+
+struct pool_buffer *buffer_pool_get(struct buffer_pool *pool) {
+	struct pool_buffer *buf = pool->free_list;
+
+	if (NULL == buf) {
+		// Take all buffers released by other threads
+		pthread_mutex_lock(&pool->remote.lock);
+		buf = pool->remote.free_list;
+		pool->free_count = pool->remote.free_count;
+		pool->remote.free_list = NULL;
+		pool->remote.free_count = 0;
+		pthread_mutex_unlock(&pool->remote.lock);
+	}
+
+	if (buf) {
+		pool->free_list = buf->next;
+		pool->free_count--;
+	} else {
+		buf = buffer_pool_new_buffer(pool);
+		if (unlikely(NULL == buf)) {
+			return NULL;
+		}
+	}
+
+	buf->next = NULL;
+	buf->refcnt = 1;
+	return buf;
+}
+
+struct pool_buffer *buffer_pool_recycle(struct buffer_pool *pool,
+					struct pool_buffer *buf) {
+	if (1 == ATOMIC_OP(add, fetch, &buf->refcnt, 0)) {
+		// Nobody else can take a reference, we are the only owner
+		return buf;
+	}
+
+	pool_buffer_unref(buf);
+	return buffer_pool_get(pool);
+}
+
+char *pool_buffer_data(struct pool_buffer *buf) {
+	return (char *)&buf[1];
+}
+
+size_t pool_buffer_size(const struct pool_buffer *buf) {
+	return buf->pool->buffer_size;
+}
+
+void pool_buffer_ref(struct pool_buffer *buf) {
+	ATOMIC_OP(add, fetch, &buf->refcnt, 1);
+}
+
+void pool_buffer_unref(struct pool_buffer *buf) {
+	if (0 != ATOMIC_OP(sub, fetch, &buf->refcnt, 1)) {
+		return;
+	}
+
+	struct buffer_pool *pool = buf->pool;
+	if (pthread_equal(pthread_self(), pool->owner) && !pool->remote.done) {
+		// Owner thread, no need to lock
+		if (pool->free_count < pool->max_free) {
+			buf->next = pool->free_list;
+			pool->free_list = buf;
+			pool->free_count++;
+			return;
+		}
+	} else {
+		pthread_mutex_lock(&pool->remote.lock);
+		const bool keep = !pool->remote.done &&
+				  pool->remote.free_count < pool->max_free;
+		if (keep) {
+			buf->next = pool->remote.free_list;
+			pool->remote.free_list = buf;
+			pool->remote.free_count++;
+		}
+		pthread_mutex_unlock(&pool->remote.lock);
+
+		if (keep) {
+			return;
+		}
+	}
+
+	free(buf);
+	buffer_pool_decref(pool);
+}
+
+struct kafka_msg_private *pool_buffer_kafka_private(struct pool_buffer *buf) {
+	return &buf->kafka_private;
+}
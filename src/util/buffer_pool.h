@@ -0,0 +1,103 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Per thread pool of receive buffers.
+ *
+ * Buffers are cache aligned and not zeroed. They are reference counted, so a
+ * decoder can keep a buffer the listener passed to it (for example, until
+ * librdkafka delivery report fires) taking a reference. The pool owner thread
+ * get and recycle buffers without locks, other threads give buffers back
+ * through a small locked list that the owner drains when its own list is
+ * empty.
+ */
+
+struct buffer_pool;
+struct pool_buffer;
+struct kafka_msg_private;
+
+/**
+ * @brief      Create a new buffer pool, owned by calling thread
+ *
+ * @param[in]  buffer_size  The buffers size
+ * @param[in]  max_free     Max number of free buffers to keep in pool
+ *
+ * @return     New buffer pool, or NULL if no memory
+ */
+struct buffer_pool *buffer_pool_new(size_t buffer_size, size_t max_free);
+
+/**
+ * @brief      Release the pool owner reference. Pool memory will be freed
+ *             when all buffers have been released.
+ *
+ * @param      pool  The pool
+ */
+void buffer_pool_done(struct buffer_pool *pool);
+
+/**
+ * @brief      Get a buffer from pool, with one reference. Only pool owner
+ *             thread can call it.
+ *
+ * @param      pool  The pool
+ *
+ * @return     The buffer, or NULL if no memory
+ */
+struct pool_buffer *buffer_pool_get(struct buffer_pool *pool);
+
+/**
+ * @brief      Get a buffer to reuse in the next read of the owner thread:
+ *             the same one if nobody else has taken a reference to it, or a
+ *             new one in other case.
+ *
+ * @param      pool  The pool
+ * @param      buf   The buffer with owner thread reference, already used
+ *
+ * @return     The buffer to use, or NULL if no memory
+ */
+struct pool_buffer *buffer_pool_recycle(struct buffer_pool *pool,
+					struct pool_buffer *buf);
+
+/// Buffer data
+char *pool_buffer_data(struct pool_buffer *buf);
+
+/// Buffer size
+size_t pool_buffer_size(const struct pool_buffer *buf);
+
+/// Take a new buffer reference. Thread safe.
+void pool_buffer_ref(struct pool_buffer *buf);
+
+/// Release a buffer reference, returning it to its pool if it was the last
+/// one. Thread safe.
+void pool_buffer_unref(struct pool_buffer *buf);
+
+/**
+ * @brief      Buffer kafka message private data. A librdkafka message that
+ *             uses it as `_private` will release one buffer reference in the
+ *             delivery report.
+ *
+ * @param      buf   The buffer
+ *
+ * @return     Kafka message private data
+ */
+struct kafka_msg_private *pool_buffer_kafka_private(struct pool_buffer *buf);
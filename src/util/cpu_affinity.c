@@ -0,0 +1,400 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cpu_affinity.h"
+
+#include "util/util.h"
+
+#include <librd/rdlog.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define SYSFS_NODE_CPULIST_FMT "/sys/devices/system/node/node%d/cpulist"
+#define SYSFS_CPU_DIR_FMT "/sys/devices/system/cpu/cpu%zu"
+
+/// Bits of a memory policy nodemask
+#define NODEMASK_BITS CPU_AFFINITY_MAX_NUMA_NODES
+
+/**
+ * @brief      Parse a CPU list, in "0-3,8,10-11" form
+ *
+ * @param      cpus      The CPU set
+ * @param[in]  cpu_list  The CPU list
+ *
+ * @return     0 if success, -1 if invalid list
+ */
+static int cpu_list_parse(cpu_set_t *cpus, const char *cpu_list) {
+	const char *cursor = cpu_list;
+
+	CPU_ZERO(cpus);
+	while (*cursor != '\0') {
+		char *endptr = NULL;
+		if (*cursor < '0' || *cursor > '9') {
+			return -1;
+		}
+
+		const unsigned long first = strtoul(cursor, &endptr, 10);
+		unsigned long last = first;
+		if (*endptr == '-') {
+			cursor = endptr + 1;
+			if (*cursor < '0' || *cursor > '9') {
+				return -1;
+			}
+			last = strtoul(cursor, &endptr, 10);
+		}
+
+		if (last < first || last >= CPU_SETSIZE) {
+			return -1;
+		}
+
+		unsigned long cpu;
+		for (cpu = first; cpu <= last; ++cpu) {
+			CPU_SET(cpu, cpus);
+		}
+
+		if (*endptr == ',') {
+			endptr++;
+		} else if (*endptr != '\0') {
+			return -1;
+		}
+		cursor = endptr;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Read the CPU list of a NUMA node
+ *
+ * @param      cpus       The CPU set
+ * @param[in]  numa_node  The NUMA node
+ *
+ * @return     0 if success, -1 in other case (error is logged)
+ */
+static int numa_node_cpus(cpu_set_t *cpus, int numa_node) {
+	char path[sizeof(SYSFS_NODE_CPULIST_FMT) + 16];
+	char cpu_list[4096];
+	int rc = -1;
+
+	snprintf(path, sizeof(path), SYSFS_NODE_CPULIST_FMT, numa_node);
+	FILE *file = fopen(path, "r");
+	if (NULL == file) {
+		rdlog(LOG_ERR,
+		      "Can't read NUMA node %d CPUs from %s: %s",
+		      numa_node,
+		      path,
+		      gnu_strerror_r(errno));
+		return -1;
+	}
+
+	if (NULL != fgets(cpu_list, sizeof(cpu_list), file)) {
+		cpu_list[strcspn(cpu_list, "\n")] = '\0';
+		rc = cpu_list_parse(cpus, cpu_list);
+	}
+	fclose(file);
+
+	if (rc != 0) {
+		rdlog(LOG_ERR, "Can't parse NUMA node %d CPU list", numa_node);
+	}
+	return rc;
+}
+
+/// NUMA node of a CPU, or -1 if unknown
+static int cpu_numa_node(size_t cpu) {
+	char path[sizeof(SYSFS_CPU_DIR_FMT) + 16];
+	int node = -1;
+
+	snprintf(path, sizeof(path), SYSFS_CPU_DIR_FMT, cpu);
+	DIR *dir = opendir(path);
+	if (NULL == dir) {
+		return -1;
+	}
+
+	struct dirent *entry;
+	while (node < 0 && NULL != (entry = readdir(dir))) {
+		char *endptr = NULL;
+		if (0 != strncmp(entry->d_name, "node", strlen("node")) ||
+		    entry->d_name[strlen("node")] < '0' ||
+		    entry->d_name[strlen("node")] > '9') {
+			continue;
+		}
+
+		const char *node_str = &entry->d_name[strlen("node")];
+		const long l_node = strtol(node_str, &endptr, 10);
+		if (*endptr == '\0' && l_node < CPU_AFFINITY_MAX_NUMA_NODES) {
+			node = (int)l_node;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/**
+ * @brief      Print a CPU set in "0-3,8,10-11" form
+ *
+ * @param      buf      The buffer
+ * @param[in]  bufsize  The buffer size
+ * @param[in]  set      The set
+ *
+ * @return     buf
+ */
+static const char *
+cpu_set_str(char *buf, size_t bufsize, const cpu_set_t *set) {
+	size_t pos = 0, i = 0;
+
+	buf[0] = '\0';
+	while (i < CPU_SETSIZE && pos < bufsize) {
+		if (!CPU_ISSET(i, set)) {
+			i++;
+			continue;
+		}
+
+		const size_t first = i;
+		while (i + 1 < CPU_SETSIZE && CPU_ISSET(i + 1, set)) {
+			i++;
+		}
+
+		const int rc = first == i ? snprintf(&buf[pos],
+						     bufsize - pos,
+						     "%s%zu",
+						     pos ? "," : "",
+						     first)
+					  : snprintf(&buf[pos],
+						     bufsize - pos,
+						     "%s%zu-%zu",
+						     pos ? "," : "",
+						     first,
+						     i);
+		if (rc < 0) {
+			break;
+		}
+		pos += (size_t)rc;
+		i++;
+	}
+
+	return buf;
+}
+
+int cpu_affinity_init(struct cpu_affinity *aff,
+		      const char *cpu_list,
+		      int numa_node) {
+	memset(aff, 0, sizeof(*aff));
+	aff->numa_node = numa_node;
+
+	if (numa_node >= CPU_AFFINITY_MAX_NUMA_NODES) {
+		rdlog(LOG_ERR, "Invalid NUMA node %d", numa_node);
+		return -1;
+	}
+
+	if (cpu_list) {
+		if (0 != cpu_list_parse(&aff->cpus, cpu_list)) {
+			rdlog(LOG_ERR, "Invalid CPU list \"%s\"", cpu_list);
+			return -1;
+		}
+	} else if (numa_node >= 0) {
+		if (0 != numa_node_cpus(&aff->cpus, numa_node)) {
+			return -1;
+		}
+	}
+
+	aff->cpus_count = (size_t)CPU_COUNT(&aff->cpus);
+	if (0 == aff->cpus_count && (cpu_list || numa_node >= 0)) {
+		rdlog(LOG_ERR, "Empty CPU list");
+		return -1;
+	}
+
+	return 0;
+}
+
+/// Set calling thread memory policy
+static int set_mempolicy_nodes(int mode, const unsigned long *nodemask) {
+	// Kernel reads maxnode - 1 bits
+	const long rc = syscall(SYS_set_mempolicy,
+				mode,
+				nodemask,
+				nodemask ? NODEMASK_BITS + 1 : 0);
+	return rc == 0 ? 0 : -1;
+}
+
+/**
+ * @brief      Report thread placement
+ *
+ * @param[in]  aff     The affinity
+ * @param[in]  port    The listener port
+ * @param[in]  thread  The thread name
+ * @param[in]  idx     The thread index, or CPU_AFFINITY_ALL
+ * @param[in]  cpus    The thread CPUs
+ */
+static void cpu_affinity_report(const struct cpu_affinity *aff,
+				uint16_t port,
+				const char *thread,
+				size_t idx,
+				const cpu_set_t *cpus) {
+	char cpus_buf[256], nodes_buf[64], idx_buf[32] = "";
+	cpu_set_t nodes;
+	size_t cpu;
+
+	CPU_ZERO(&nodes);
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, cpus)) {
+			const int node = cpu_numa_node(cpu);
+			if (node >= 0) {
+				CPU_SET((size_t)node, &nodes);
+			}
+		}
+	}
+
+	if (idx != CPU_AFFINITY_ALL) {
+		snprintf(idx_buf, sizeof(idx_buf), " %zu", idx);
+	}
+
+	rdlog(LOG_INFO,
+	      "Listener on port %" PRIu16 " %s thread%s runs on CPU%s %s "
+	      "(NUMA node %s), allocates memory from %s",
+	      port,
+	      thread,
+	      idx_buf,
+	      CPU_COUNT(cpus) > 1 ? "s" : "",
+	      cpu_set_str(cpus_buf, sizeof(cpus_buf), cpus),
+	      CPU_COUNT(&nodes) ? cpu_set_str(nodes_buf,
+					      sizeof(nodes_buf),
+					      &nodes)
+				: "unknown",
+	      aff->numa_node >= 0 ? "its preferred NUMA node"
+				  : "the local NUMA node");
+}
+
+int cpu_affinity_apply(const struct cpu_affinity *aff,
+		       uint16_t port,
+		       const char *thread,
+		       size_t idx) {
+	cpu_set_t thread_cpus;
+
+	if (!cpu_affinity_enabled(aff)) {
+		return 0;
+	}
+
+	if (idx == CPU_AFFINITY_ALL) {
+		thread_cpus = aff->cpus;
+	} else {
+		// Look for the (idx % count)-th CPU of the set
+		size_t skip = idx % aff->cpus_count;
+		size_t cpu;
+
+		CPU_ZERO(&thread_cpus);
+		for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &aff->cpus) && 0 == skip--) {
+				CPU_SET(cpu, &thread_cpus);
+				break;
+			}
+		}
+	}
+
+	const int setaffinity_rc = pthread_setaffinity_np(
+			pthread_self(), sizeof(thread_cpus), &thread_cpus);
+	if (setaffinity_rc != 0) {
+		rdlog(LOG_ERR,
+		      "Can't pin listener on port %" PRIu16 " thread: %s",
+		      port,
+		      gnu_strerror_r(setaffinity_rc));
+		return -1;
+	}
+
+	if (aff->numa_node >= 0) {
+		unsigned long nodemask[CPU_AFFINITY_MAX_NUMA_NODES /
+				       (8 * sizeof(unsigned long))] = {0};
+		const size_t node = (size_t)aff->numa_node;
+		nodemask[node / (8 * sizeof(nodemask[0]))] |=
+				1UL << (node % (8 * sizeof(nodemask[0])));
+		if (0 != set_mempolicy_nodes(MPOL_PREFERRED, nodemask)) {
+			rdlog(LOG_ERR,
+			      "Can't set listener on port %" PRIu16
+			      " thread memory NUMA node %d: %s",
+			      port,
+			      aff->numa_node,
+			      gnu_strerror_r(errno));
+			return -1;
+		}
+	}
+
+	if (thread) {
+		cpu_affinity_report(aff, port, thread, idx, &thread_cpus);
+	}
+
+	return 0;
+}
+
+int cpu_affinity_save(struct cpu_affinity_saved *saved) {
+	memset(saved, 0, sizeof(*saved));
+	const int getaffinity_rc = pthread_getaffinity_np(
+			pthread_self(), sizeof(saved->cpus), &saved->cpus);
+	if (getaffinity_rc != 0) {
+		rdlog(LOG_ERR,
+		      "Can't get thread CPU affinity: %s",
+		      gnu_strerror_r(getaffinity_rc));
+		return -1;
+	}
+
+	const long getmempolicy_rc = syscall(SYS_get_mempolicy,
+					     &saved->mempolicy,
+					     saved->nodemask,
+					     NODEMASK_BITS + 1,
+					     NULL,
+					     0UL);
+	if (getmempolicy_rc != 0) {
+		// No NUMA support. Nothing to restore.
+		saved->mempolicy = MPOL_DEFAULT;
+	}
+
+	return 0;
+}
+
+void cpu_affinity_restore(const struct cpu_affinity_saved *saved) {
+	const int setaffinity_rc = pthread_setaffinity_np(
+			pthread_self(), sizeof(saved->cpus), &saved->cpus);
+	if (setaffinity_rc != 0) {
+		rdlog(LOG_ERR,
+		      "Can't restore thread CPU affinity: %s",
+		      gnu_strerror_r(setaffinity_rc));
+	}
+
+	// Main thread could have been started with a different policy
+	const int mode = saved->mempolicy & ~(MPOL_F_STATIC_NODES |
+					       MPOL_F_RELATIVE_NODES);
+	if (0 != set_mempolicy_nodes(saved->mempolicy,
+				     mode == MPOL_DEFAULT ? NULL
+							  : saved->nodemask) &&
+	    errno != ENOSYS) {
+		rdlog(LOG_ERR,
+		      "Can't restore thread memory policy: %s",
+		      gnu_strerror_r(errno));
+	}
+}
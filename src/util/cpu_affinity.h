@@ -0,0 +1,105 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Max NUMA node number + 1
+#define CPU_AFFINITY_MAX_NUMA_NODES 1024
+
+/// Pin thread to all the CPUs of the set, not to one of them
+#define CPU_AFFINITY_ALL SIZE_MAX
+
+/** Listener threads placement.
+
+  Threads are pinned to the configured CPUs and, if a NUMA node is
+  configured, they prefer to allocate memory from it. Without NUMA node,
+  kernel default policy already allocates memory in the node of the CPU the
+  thread runs on, so memory allocated by a pinned thread is local to it too.
+  */
+struct cpu_affinity {
+	cpu_set_t cpus;	   ///< CPUs to run threads
+	size_t cpus_count; ///< Number of CPUs in set. 0 means disabled
+	int numa_node;	   ///< Memory NUMA node. -1 means not set
+};
+
+/// Calling thread placement, to restore it later
+struct cpu_affinity_saved {
+	cpu_set_t cpus; ///< Thread CPUs
+	int mempolicy;	///< Thread memory policy
+	/// Memory policy nodes
+	unsigned long nodemask[CPU_AFFINITY_MAX_NUMA_NODES /
+			       (8 * sizeof(unsigned long))];
+};
+
+/**
+ * @brief      Initialize listener threads placement
+ *
+ * @param      aff        The affinity
+ * @param[in]  cpu_list   The CPU list, in "0-3,8,10-11" form. If NULL and
+ *                        NUMA node is set, all the CPUs of the NUMA node
+ *                        are used.
+ * @param[in]  numa_node  The NUMA node, or -1
+ *
+ * @return     0 if success, -1 in other case (error is logged)
+ */
+int cpu_affinity_init(struct cpu_affinity *aff,
+		      const char *cpu_list,
+		      int numa_node);
+
+/// Threads placement is configured
+static inline bool cpu_affinity_enabled(const struct cpu_affinity *aff) {
+	return aff->cpus_count > 0;
+}
+
+/**
+ * @brief      Pin calling thread and set its memory policy. Call it before
+ *             the thread allocates its own buffers.
+ *
+ * @param[in]  aff     The affinity
+ * @param[in]  port    The listener port, only to report placement
+ * @param[in]  thread  The thread name to report placement, or NULL to not
+ *                     report it
+ * @param[in]  idx     The thread index. Thread runs in the (idx % count)-th
+ *                     CPU of the set, or in all of them if CPU_AFFINITY_ALL
+ *
+ * @return     0 if success, -1 in other case (error is logged)
+ */
+int cpu_affinity_apply(const struct cpu_affinity *aff,
+		       uint16_t port,
+		       const char *thread,
+		       size_t idx);
+
+/**
+ * @brief      Save calling thread placement. Useful to pin a thread only
+ *             while it creates other threads, that inherit its placement.
+ *
+ * @param      saved  The saved placement
+ *
+ * @return     0 if success, -1 in other case (error is logged)
+ */
+int cpu_affinity_save(struct cpu_affinity_saved *saved);
+
+/// Restore calling thread placement saved with cpu_affinity_save
+void cpu_affinity_restore(const struct cpu_affinity_saved *saved);
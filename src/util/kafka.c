@@ -26,13 +26,14 @@
 
 #include "util.h"
 #include "util/kafka.h"
-#include "util/kafka_message_array.h"
+#include "util/string.h"
 
 #include <librd/rdlog.h>
 #include <librdkafka/rdkafka.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <syslog.h>
 
@@ -59,7 +60,15 @@ struct {
 		/// Buffer size
 		size_t size;
 	} append_buf;
-} stats;
+
+	/// Extra stats providers
+	struct {
+		pthread_mutex_t lock;
+		LIST_HEAD(, kafka_stats_provider) list;
+	} providers;
+} stats = {
+		.providers = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
 
 /// librdkafka stats_cb return code indicating that librdkafka should free stats
 static const int PLEASE_FREE_LIBRDKAFKA = 0;
@@ -109,10 +118,8 @@ static void msg_delivered(rd_kafka_t *rk RD_UNUSED,
 	}
 
 	if (rkmessage->_private) {
-		struct kafka_message_array_internal *karray =
-				kafka_message_array_internal_cast(
-						rkmessage->_private);
-		kafka_message_array_internal_decref(karray);
+		struct kafka_msg_private *priv = rkmessage->_private;
+		priv->release(priv);
 	}
 }
 
@@ -214,14 +221,61 @@ static int rdkafka_stats_rdlog_cb(rd_kafka_t *rk,
 	return PLEASE_FREE_LIBRDKAFKA;
 }
 
+void kafka_stats_provider_add(struct kafka_stats_provider *provider) {
+	pthread_mutex_lock(&stats.providers.lock);
+	LIST_INSERT_HEAD(&stats.providers.list, provider, entry);
+	pthread_mutex_unlock(&stats.providers.lock);
+}
+
+void kafka_stats_provider_remove(struct kafka_stats_provider *provider) {
+	pthread_mutex_lock(&stats.providers.lock);
+	LIST_REMOVE(provider, entry);
+	pthread_mutex_unlock(&stats.providers.lock);
+}
+
+/**
+ * @brief      Collect stats extra members: Configured append buffer and
+ *             providers ones.
+ *
+ * @param      extra  The extra members, separated by commas
+ */
+static void rdkafka_stats_extra(string *extra) {
+	struct kafka_stats_provider *provider;
+
+	if (stats.append_buf.size) {
+		string_append(extra,
+			      stats.append_buf.buf,
+			      stats.append_buf.size - 1);
+	}
+
+	pthread_mutex_lock(&stats.providers.lock);
+	LIST_FOREACH(provider, &stats.providers.list, entry) {
+		const size_t prev_size = string_size(extra);
+		if (prev_size > 0) {
+			string_append(extra, ",", 1);
+		}
+
+		provider->append(provider, extra);
+		if (string_size(extra) == prev_size + 1) {
+			// Provider did not add anything
+			string_pop_back(extra);
+		}
+	}
+	pthread_mutex_unlock(&stats.providers.lock);
+}
+
 static int rdkafka_stats_enrich_decorator_cb(rd_kafka_t *rk,
 					     char *json,
 					     size_t json_len,
 					     void *opaque) {
-	assert(stats.append_buf.size);
-	assert(stats.append_buf.buf);
+	string extra = N2K_STRING_INITIALIZER;
+	rdkafka_stats_extra(&extra);
 
-	const size_t new_json_len = json_len + stats.append_buf.size;
+	if (0 == string_size(&extra)) {
+		return stats.n2k_stats_cb(rk, json, json_len, opaque);
+	}
+
+	const size_t new_json_len = json_len + string_size(&extra) + 1;
 	char *new_json = realloc(json, new_json_len);
 	if (unlikely(NULL == new_json)) {
 		rdlog(LOG_ERR, "Can't reallocate stats buffer (OOM?)");
@@ -230,13 +284,13 @@ static int rdkafka_stats_enrich_decorator_cb(rd_kafka_t *rk,
 		assert(json[json_len - 1] == '}');
 		char *json_last_brace = &json[json_len - 1];
 		*json_last_brace = ',';
-		memcpy(json_last_brace + 1,
-		       stats.append_buf.buf,
-		       stats.append_buf.size);
+		memcpy(json_last_brace + 1, extra.buf, string_size(&extra));
 		json[new_json_len - 1] = '}';
 	}
+	string_done(&extra);
 
-	const int child_rc = stats.n2k_stats_cb(rk, json, new_json_len, opaque);
+	const int child_rc = stats.n2k_stats_cb(
+			rk, json, new_json ? new_json_len : json_len, opaque);
 
 	if (new_json && child_rc == PLEASE_FREE_LIBRDKAFKA) {
 		// Librdkafka can have a dangling pointer because of realloc
@@ -271,12 +325,9 @@ void init_rdkafka(n2kafka_rdkafka_conf *conf) {
 
 	stats.append_buf.buf = conf->statistics.message_extra.buf;
 	stats.append_buf.size = conf->statistics.message_extra.size;
-	if (stats.append_buf.size) {
-		rd_kafka_conf_set_stats_cb(conf->rk_conf,
-					   rdkafka_stats_enrich_decorator_cb);
-	} else {
-		rd_kafka_conf_set_stats_cb(conf->rk_conf, stats.n2k_stats_cb);
-	}
+	// Providers can be added at any moment
+	rd_kafka_conf_set_stats_cb(conf->rk_conf,
+				   rdkafka_stats_enrich_decorator_cb);
 
 	print_rdkafka_conf(conf->rk_conf);
 	rd_kafka_conf_set_dr_msg_cb(conf->rk_conf, msg_delivered);
@@ -311,6 +362,10 @@ void kafka_poll(int timeout_ms) {
 	rd_kafka_poll(global_config.rk, timeout_ms);
 }
 
+size_t kafka_outq_len() {
+	return (size_t)rd_kafka_outq_len(global_config.rk);
+}
+
 void flush_kafka() {
 	kafka_poll(1000);
 }
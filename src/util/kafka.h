@@ -24,17 +24,55 @@
 
 #include <librdkafka/rdkafka.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/queue.h>
 
 /* Private data */
 struct rd_kafka_message_s;
 
+/// Message private data, released in librdkafka delivery report. Actual
+/// private data must start with it, and it is the message `_private` pointer.
+struct kafka_msg_private {
+	/// Release one message reference to private data
+	void (*release)(struct kafka_msg_private *priv);
+};
+
+struct string;
+
+/// Extra stats provider, that adds members to every rdkafka stats message
+struct kafka_stats_provider {
+	/** Append provider stats to rdkafka stats JSON object. It is called
+	    from the thread that polls rdkafka.
+	    @param provider The provider
+	    @param str String to append JSON object members, without braces
+	    (i.e., `"key":value`)
+	    */
+	void (*append)(struct kafka_stats_provider *provider,
+		       struct string *str);
+	LIST_ENTRY(kafka_stats_provider) entry; ///< Providers list entry
+};
+
+/** Add an extra stats provider
+    @param provider The provider
+    */
+void kafka_stats_provider_add(struct kafka_stats_provider *provider);
+
+/** Remove an extra stats provider. When it returns, provider is not being
+    called and it will not be called anymore.
+    @param provider The provider
+    */
+void kafka_stats_provider_remove(struct kafka_stats_provider *provider);
+
 /// rdkafka options
 typedef struct n2kafka_rdkafka_conf {
 	/// Options that can be mapped directly to a rdkafka conf
 	rd_kafka_conf_t *rk_conf;
 
+	/// User configured producer linger (queue.buffering.max.ms)
+	bool linger_set;
+
 	/// Stats related options
 	struct {
 		/// Stats destination topic
@@ -62,6 +100,12 @@ void init_rdkafka(n2kafka_rdkafka_conf *conf);
 
 void kafka_poll();
 
+/** Number of messages waiting in producer queue, or waiting for broker
+    acknowledge
+    @return Producer queue length
+    */
+size_t kafka_outq_len();
+
 /** Creates a new topic handler using global configuration
     @param topic_name Topic name
     @param partitioner Partitioner function
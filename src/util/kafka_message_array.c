@@ -61,10 +61,17 @@ void kafka_message_array_set_payload_buffer0(kafka_message_array *array,
 	}
 }
 
+/// Delivery report release of kafka message array
+static void karray_release(struct kafka_msg_private *priv) {
+	kafka_message_array_internal_decref(
+			kafka_message_array_internal_cast(priv));
+}
+
 int kafka_msg_array_add(kafka_message_array *array,
 			const rd_kafka_message_t *msg) {
 	if (0 == kafka_message_array_size(array)) {
 		static const struct kafka_message_array_internal karray_init = {
+				.kafka_private.release = karray_release,
 #ifdef KAFKA_MESSAGE_ARRAY_INTERNAL_MAGIC
 				.magic = KAFKA_MESSAGE_ARRAY_INTERNAL_MAGIC,
 #endif
@@ -108,7 +115,7 @@ size_t kafka_message_array_produce(rd_kafka_topic_t *rkt,
 		// send that information to librdkafka delivery report callback.
 		size_t i;
 		for (i = 0; i < karray->count; ++i) {
-			karray->msgs[i]._private = karray;
+			karray->msgs[i]._private = &karray->kafka_private;
 		}
 		// stealing karray
 		*array = KAFKA_MESSAGE_ARRAY_INITIALIZER;
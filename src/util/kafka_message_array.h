@@ -26,6 +26,7 @@
 
 #include "config.h"
 
+#include "util/kafka.h"
 #include "util/string.h"
 #include "util/util.h"
 
@@ -38,6 +39,8 @@
 
 /// Internal kafka message array definition
 struct kafka_message_array_internal {
+	/// Delivery report release. Needs to be the first member.
+	struct kafka_msg_private kafka_private;
 #ifndef NDEBUG
 #define KAFKA_MESSAGE_ARRAY_INTERNAL_MAGIC 0xaa343aa13aaa343aL
 	uint64_t magic;
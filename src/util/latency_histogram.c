@@ -0,0 +1,94 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "latency_histogram.h"
+
+#include "config.h"
+
+#define SUB_BITS LATENCY_HISTOGRAM_SUB_BITS
+#define SUB_BUCKETS (1u << SUB_BITS)
+
+/// Bucket of a value
+static size_t latency_bucket(uint64_t value) {
+	if (value < SUB_BUCKETS) {
+		return (size_t)value;
+	}
+
+	const unsigned msb = 63u - (unsigned)__builtin_clzll(value);
+	const unsigned shift = msb - SUB_BITS;
+	return ((size_t)(shift + 1) << SUB_BITS) +
+	       (size_t)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/// Middle value of a bucket
+static uint64_t latency_bucket_value(size_t bucket) {
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+
+	const unsigned shift = (unsigned)(bucket >> SUB_BITS) - 1;
+	const uint64_t sub = bucket & (SUB_BUCKETS - 1);
+	const uint64_t lower = (SUB_BUCKETS + sub) << shift;
+	return lower + ((UINT64_C(1) << shift) >> 1);
+}
+
+void latency_histogram_add(struct latency_histogram *histogram,
+			   uint64_t latency_ns) {
+	ATOMIC_OP(add,
+		  fetch,
+		  &histogram->buckets[latency_bucket(latency_ns)],
+		  1);
+}
+
+uint64_t latency_histogram_percentile(struct latency_histogram *histograms,
+				      size_t count,
+				      double percentile) {
+	uint64_t merged[LATENCY_HISTOGRAM_BUCKETS];
+	uint64_t total = 0, accumulated = 0;
+	size_t i, bucket;
+
+	for (bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; ++bucket) {
+		merged[bucket] = 0;
+		for (i = 0; i < count; ++i) {
+			uint64_t *samples = &histograms[i].buckets[bucket];
+			merged[bucket] += ATOMIC_OP(add, fetch, samples, 0);
+		}
+		total += merged[bucket];
+	}
+
+	if (0 == total) {
+		return 0;
+	}
+
+	// Rank of the percentile sample, from 1 to total
+	uint64_t rank = (uint64_t)((double)total * percentile / 100.);
+	if (rank < 1) {
+		rank = 1;
+	}
+
+	for (bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; ++bucket) {
+		accumulated += merged[bucket];
+		if (accumulated >= rank) {
+			break;
+		}
+	}
+
+	return latency_bucket_value(bucket);
+}
@@ -0,0 +1,62 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Sub buckets of every power of two, as bits. Precision is 1/8 (12.5%).
+#define LATENCY_HISTOGRAM_SUB_BITS 3
+/// Number of buckets needed to cover all uint64_t values
+#define LATENCY_HISTOGRAM_BUCKETS                                              \
+	((64 - LATENCY_HISTOGRAM_SUB_BITS + 1) << LATENCY_HISTOGRAM_SUB_BITS)
+
+/** Log-linear histogram of latencies, in nanoseconds.
+
+  Every power of two range is split in 8 buckets, so percentiles are
+  reported with 12.5% precision in constant memory. Only one thread can add
+  samples to a histogram, but any thread can read it concurrently.
+  */
+struct latency_histogram {
+	uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @brief      Add a sample to histogram
+ *
+ * @param      histogram   The histogram
+ * @param[in]  latency_ns  The latency, in nanoseconds
+ */
+void latency_histogram_add(struct latency_histogram *histogram,
+			   uint64_t latency_ns);
+
+/**
+ * @brief      Get a percentile of many histograms merged
+ *
+ * @param[in]  histograms  The histograms
+ * @param[in]  count       The number of histograms
+ * @param[in]  percentile  The percentile, in (0, 100]
+ *
+ * @return     Percentile latency, in nanoseconds. 0 if there are no samples.
+ */
+uint64_t latency_histogram_percentile(struct latency_histogram *histograms,
+				      size_t count,
+				      double percentile);
@@ -34,6 +34,9 @@ const char *valueof(const keyval_list_t *list,
 	struct pair *pair = NULL;
 	TAILQ_FOREACH(pair, list, entry) {
 		if (0 == key_compare_callback(key, pair->key)) {
+			if (NULL == pair->value && pair->lazy_value) {
+				pair->value = pair->lazy_value(pair);
+			}
 			return pair->value;
 		}
 	}
@@ -27,6 +27,9 @@
 struct pair {
 	const char *key;
 	const char *value;
+	/// Compute value the first time it is asked for, if value is NULL. Can
+	/// be NULL.
+	const char *(*lazy_value)(struct pair *pair);
 	TAILQ_ENTRY(pair) entry;
 };
 
@@ -37,7 +40,8 @@ typedef TAILQ_HEAD(, pair) keyval_list_t;
 void add_key_value_pair(keyval_list_t *list, struct pair *pair);
 
 /**
- * @brief      Obtains a value for a given key in the key-value list
+ * @brief      Obtains a value for a given key in the key-value list. Lazy
+ *             values are computed at this moment.
  *
  * @param[in]  list                     The list
  * @param[in]  key                      The key
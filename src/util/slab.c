@@ -0,0 +1,134 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "slab.h"
+
+#include "util/util.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+/// Free object. Next free object pointer is stored in object memory
+struct slab_free_object {
+	struct slab_free_object *next;
+};
+
+/// Chunk of objects. Objects follow, in the next cache line
+struct slab_chunk {
+	struct slab_chunk *next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct slab {
+	pthread_mutex_t lock;
+	size_t object_size;	  ///< Objects size, cache aligned
+	size_t objects_per_chunk; ///< Objects allocated at once
+	struct slab_chunk *chunks;
+	struct slab_free_object *free_list;
+};
+
+struct slab *slab_new(size_t object_size, size_t objects_per_chunk) {
+	struct slab *slab = calloc(1, sizeof(*slab));
+	if (unlikely(NULL == slab)) {
+		return NULL;
+	}
+
+	if (object_size < sizeof(struct slab_free_object)) {
+		object_size = sizeof(struct slab_free_object);
+	}
+
+	slab->object_size = (object_size + CACHE_LINE_SIZE - 1) &
+			    ~(size_t)(CACHE_LINE_SIZE - 1);
+	slab->objects_per_chunk = objects_per_chunk ? objects_per_chunk : 1;
+
+	if (unlikely(0 != pthread_mutex_init(&slab->lock, NULL))) {
+		free(slab);
+		return NULL;
+	}
+
+	return slab;
+}
+
+/// Allocate a new chunk, and add its objects to free list. Needs slab lock
+static int slab_grow(struct slab *slab) {
+	void *mem = NULL;
+	const size_t chunk_size = sizeof(struct slab_chunk) +
+				  slab->object_size * slab->objects_per_chunk;
+	const int rc = posix_memalign(&mem, CACHE_LINE_SIZE, chunk_size);
+	if (unlikely(rc != 0)) {
+		return -1;
+	}
+
+	struct slab_chunk *chunk = mem;
+	char *objects = (char *)&chunk[1];
+	size_t i;
+
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+
+	// Reverse order, so first objects are used first
+	for (i = slab->objects_per_chunk; i > 0; --i) {
+		struct slab_free_object *object =
+				(void *)&objects[(i - 1) * slab->object_size];
+		object->next = slab->free_list;
+		slab->free_list = object;
+	}
+
+	return 0;
+}
+
+void *slab_alloc(struct slab *slab) {
+	struct slab_free_object *object = NULL;
+
+	pthread_mutex_lock(&slab->lock);
+	if (NULL != slab->free_list || 0 == slab_grow(slab)) {
+		object = slab->free_list;
+		slab->free_list = object->next;
+	}
+	pthread_mutex_unlock(&slab->lock);
+
+	if (likely(object)) {
+		memset(object, 0, slab->object_size);
+	}
+
+	return object;
+}
+
+void slab_free(struct slab *slab, void *object) {
+	struct slab_free_object *free_object = object;
+
+	pthread_mutex_lock(&slab->lock);
+	free_object->next = slab->free_list;
+	slab->free_list = free_object;
+	pthread_mutex_unlock(&slab->lock);
+}
+
+void slab_destroy(struct slab *slab) {
+	while (slab->chunks) {
+		struct slab_chunk *next = slab->chunks->next;
+		free(slab->chunks);
+		slab->chunks = next;
+	}
+
+	pthread_mutex_destroy(&slab->lock);
+	free(slab);
+}
@@ -0,0 +1,59 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/** Fixed size objects allocator.
+
+  Objects are carved from big cache aligned chunks and recycled through a
+  free list, so allocating and releasing them is just a couple of pointer
+  operations, and objects of the same slab are kept close in memory. It is
+  thread safe: objects can be allocated in one thread and released in
+  another one. Chunks are only returned to the system when the slab is
+  destroyed.
+  */
+struct slab;
+
+/**
+ * @brief      Create a new slab
+ *
+ * @param[in]  object_size        The objects size
+ * @param[in]  objects_per_chunk  Number of objects allocated at once
+ *
+ * @return     New slab, or NULL if no memory
+ */
+struct slab *slab_new(size_t object_size, size_t objects_per_chunk);
+
+/**
+ * @brief      Get a zeroed object from slab
+ *
+ * @param      slab  The slab
+ *
+ * @return     The object, cache aligned, or NULL if no memory
+ */
+void *slab_alloc(struct slab *slab);
+
+/// Return an object to its slab
+void slab_free(struct slab *slab, void *object);
+
+/// Destroy a slab and all its objects, even if they have not been freed
+void slab_destroy(struct slab *slab);
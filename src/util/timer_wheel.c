@@ -0,0 +1,75 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "timer_wheel.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+void timer_wheel_init(struct timer_wheel *wheel) {
+	size_t i;
+
+	for (i = 0; i < TIMER_WHEEL_SLOTS; ++i) {
+		TAILQ_INIT(&wheel->slots[i]);
+	}
+	wheel->current_tick = 0;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel,
+		     struct timer_wheel_entry *entry,
+		     uint64_t ticks) {
+	assert(ticks > 0 && ticks < TIMER_WHEEL_SLOTS);
+
+	timer_wheel_remove(wheel, entry);
+	entry->expire_tick = wheel->current_tick + ticks;
+	entry->linked = true;
+	TAILQ_INSERT_TAIL(&wheel->slots[entry->expire_tick % TIMER_WHEEL_SLOTS],
+			  entry,
+			  slot_entry);
+}
+
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_entry *entry) {
+	if (!entry->linked) {
+		return;
+	}
+
+	TAILQ_REMOVE(&wheel->slots[entry->expire_tick % TIMER_WHEEL_SLOTS],
+		     entry,
+		     slot_entry);
+	entry->linked = false;
+}
+
+void timer_wheel_tick(struct timer_wheel *wheel,
+		      void (*expire)(struct timer_wheel_entry *entry,
+				     void *opaque),
+		      void *opaque) {
+	struct timer_wheel_entry *entry;
+
+	wheel->current_tick++;
+	const size_t slot = wheel->current_tick % TIMER_WHEEL_SLOTS;
+
+	// Entries added by callback go to other slots, since ticks > 0
+	while ((entry = TAILQ_FIRST(&wheel->slots[slot]))) {
+		TAILQ_REMOVE(&wheel->slots[slot], entry, slot_entry);
+		entry->linked = false;
+		expire(entry, opaque);
+	}
+}
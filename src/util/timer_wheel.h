@@ -0,0 +1,80 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+/// Number of wheel slots. Timers can't be longer than this number of ticks.
+#define TIMER_WHEEL_SLOTS 64
+
+/// Timer wheel entry. Embed it in the object to time out.
+struct timer_wheel_entry {
+	TAILQ_ENTRY(timer_wheel_entry) slot_entry; ///< Slot list entry
+	uint64_t expire_tick; ///< Tick the entry expires at
+	bool linked;	      ///< Entry is in the wheel
+};
+
+/** Hashed timer wheel.
+
+  Entries are kept in the slot of the tick they expire at, so adding,
+  removing and expiring an entry cost O(1), no matter the number of entries.
+  It is not thread safe: it is intended to be owned by an event loop thread,
+  that calls timer_wheel_tick() every tick interval.
+  */
+struct timer_wheel {
+	TAILQ_HEAD(, timer_wheel_entry) slots[TIMER_WHEEL_SLOTS];
+	uint64_t current_tick; ///< Number of ticks since creation
+};
+
+/// Init an empty timer wheel
+void timer_wheel_init(struct timer_wheel *wheel);
+
+/**
+ * @brief      Add an entry to wheel. If it was already in the wheel, it is
+ *             moved.
+ *
+ * @param      wheel  The wheel
+ * @param      entry  The entry
+ * @param[in]  ticks  Ticks until expiration, in [1, TIMER_WHEEL_SLOTS)
+ */
+void timer_wheel_add(struct timer_wheel *wheel,
+		     struct timer_wheel_entry *entry,
+		     uint64_t ticks);
+
+/// Remove an entry from wheel, if it is in it
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_entry *entry);
+
+/**
+ * @brief      Advance wheel one tick, calling expire callback for every
+ *             expired entry. Entries are removed from wheel before the call,
+ *             so callback can add them again or free them.
+ *
+ * @param      wheel   The wheel
+ * @param[in]  expire  The expire callback
+ * @param      opaque  The expire callback opaque
+ */
+void timer_wheel_tick(struct timer_wheel *wheel,
+		      void (*expire)(struct timer_wheel_entry *entry,
+				     void *opaque),
+		      void *opaque);
@@ -0,0 +1,154 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "unix_socket.h"
+
+#include "util/util.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+int unix_socket_type(const char *type_str) {
+	static const struct {
+		const char *name;
+		int type;
+	} types[] = {
+			{UNIX_SOCKET_TYPE_STREAM, SOCK_STREAM},
+			{UNIX_SOCKET_TYPE_DGRAM, SOCK_DGRAM},
+			{UNIX_SOCKET_TYPE_SEQPACKET, SOCK_SEQPACKET},
+	};
+	size_t i;
+
+	if (NULL == type_str) {
+		return SOCK_STREAM;
+	}
+
+	for (i = 0; i < RD_ARRAYSIZE(types); ++i) {
+		if (0 == strcmp(types[i].name, type_str)) {
+			return types[i].type;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief      Remove a socket file left by a previous run in path
+ *
+ * @param[in]  path  The path
+ *
+ * @return     0 if path is free to bind, -1 in other case (error is logged)
+ */
+static int unix_socket_remove_stale(const char *path) {
+	struct stat path_stat;
+
+	if (0 != lstat(path, &path_stat)) {
+		if (errno == ENOENT) {
+			return 0;
+		}
+
+		rdlog(LOG_ERR,
+		      "Can't stat unix socket path %s: %s",
+		      path,
+		      gnu_strerror_r(errno));
+		return -1;
+	}
+
+	if (!S_ISSOCK(path_stat.st_mode)) {
+		rdlog(LOG_ERR,
+		      "Can't create unix socket %s: File exists and it is "
+		      "not a socket",
+		      path);
+		return -1;
+	}
+
+	if (0 != unlink(path)) {
+		rdlog(LOG_ERR,
+		      "Can't remove old unix socket %s: %s",
+		      path,
+		      gnu_strerror_r(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int unix_socket_listen(const char *path, int type) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		rdlog(LOG_ERR, "Unix socket path %s is too long", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (0 != unix_socket_remove_stale(path)) {
+		return -1;
+	}
+
+	const int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		rdlog(LOG_ERR,
+		      "Error creating unix socket: %s",
+		      gnu_strerror_r(errno));
+		return -1;
+	}
+
+	if (0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		rdlog(LOG_ERR,
+		      "Error binding unix socket %s: %s",
+		      path,
+		      gnu_strerror_r(errno));
+		goto err;
+	}
+
+	if (type != SOCK_DGRAM && 0 != listen(fd, SOMAXCONN)) {
+		rdlog(LOG_ERR,
+		      "Error in unix socket %s listen: %s",
+		      path,
+		      gnu_strerror_r(errno));
+		unlink(path);
+		goto err;
+	}
+
+	rdlog(LOG_INFO, "Listening in unix socket %s", path);
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+}
+
+void unix_socket_unlink(const char *path) {
+	if (0 != unlink(path) && errno != ENOENT) {
+		rdlog(LOG_WARNING,
+		      "Can't remove unix socket %s: %s",
+		      path,
+		      gnu_strerror_r(errno));
+	}
+}
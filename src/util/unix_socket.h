@@ -0,0 +1,50 @@
+/*
+** Copyright (C) 2018-2019, Wizzie S.L.
+** Author: Eugenio Perez <eupm90@gmail.com>
+**
+** This file is part of n2kafka.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU Affero General Public License as
+** published by the Free Software Foundation, either version 3 of the
+** License, or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Affero General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/// Unix domain socket types names
+#define UNIX_SOCKET_TYPE_STREAM "stream"
+#define UNIX_SOCKET_TYPE_DGRAM "dgram"
+#define UNIX_SOCKET_TYPE_SEQPACKET "seqpacket"
+
+/**
+ * @brief      Get unix domain socket type from its name
+ *
+ * @param[in]  type_str  The type name. NULL means stream.
+ *
+ * @return     SOCK_STREAM, SOCK_DGRAM or SOCK_SEQPACKET, or -1 if unknown
+ */
+int unix_socket_type(const char *type_str);
+
+/**
+ * @brief      Create a unix domain socket bound to a path, listening if it
+ *             is connection oriented. A socket file left in path by a
+ *             previous run is replaced, but any other kind of file is kept.
+ *
+ * @param[in]  path  The socket path
+ * @param[in]  type  The socket type
+ *
+ * @return     The non-blocking socket, or -1 if error (error is logged)
+ */
+int unix_socket_listen(const char *path, int type);
+
+/// Remove a unix domain socket file created with unix_socket_listen
+void unix_socket_unlink(const char *path);
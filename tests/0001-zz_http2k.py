@@ -41,7 +41,7 @@ from n2k_test import \
                      main, \
                      TestN2kafka
 
-from n2k_test import valgrind_handler  # noqa: F401
+from n2k_test import http_engine, valgrind_handler  # noqa: F401
 
 
 def strip_apart(base, min_pieces=10, max_pieces=30):
@@ -66,6 +66,7 @@ class TestHTTP2K(TestN2kafka):
                           messages,
                           kafka_handler,
                           valgrind_handler,
+                          http_engine,
                           base_config_add={}):
         ''' Base n2kafka test
 
@@ -74,12 +75,14 @@ class TestHTTP2K(TestN2kafka):
           - messages: Messages to test
           - kafka_handler: Kafka handler to use
           - valgrind_handler: Valgrind handler if any
+          - http_engine: HTTP listener engine
           - base_config_add: Config to add (override).
         '''
         base_config = {
             **{
               "listeners": [{
                   'proto': 'http',
+                  'engine': http_engine,
                   'decode_as': 'zz_http2k'
               }]
             },
@@ -97,6 +100,7 @@ class TestHTTP2K(TestN2kafka):
     def test_http2k_url(self,  # noqa: F811
                         kafka_handler,
                         valgrind_handler,
+                        http_engine,
                         child):
         ''' Test URL behavior '''
         TEST_MESSAGE = '{"test":1}'
@@ -133,11 +137,13 @@ class TestHTTP2K(TestN2kafka):
         self._base_http2k_test(child=child,
                                messages=test_messages,
                                kafka_handler=kafka_handler,
-                               valgrind_handler=valgrind_handler)
+                               valgrind_handler=valgrind_handler,
+                               http_engine=http_engine)
 
     def test_http2k_client(self,  # noqa: F811
                            kafka_handler,
                            valgrind_handler,
+                           http_engine,
                            child):
         ''' Test ZZ client behavior. http2k expect client as X-CONSUMER-ID http
         header, and it needs to forward messages to that client '''
@@ -170,11 +176,13 @@ class TestHTTP2K(TestN2kafka):
         self._base_http2k_test(child=child,
                                messages=test_messages,
                                kafka_handler=kafka_handler,
-                               valgrind_handler=valgrind_handler)
+                               valgrind_handler=valgrind_handler,
+                               http_engine=http_engine)
 
     def test_http2k_invalid_request(self,  # noqa: F811
                                     kafka_handler,
                                     valgrind_handler,
+                                    http_engine,
                                     child):
         ''' Test ZZ client behavior. http2k expect client as X-CONSUMER-ID http
         header, and it needs to forward messages to that client '''
@@ -191,11 +199,13 @@ class TestHTTP2K(TestN2kafka):
         self._base_http2k_test(child=child,
                                messages=test_messages,
                                kafka_handler=kafka_handler,
-                               valgrind_handler=valgrind_handler)
+                               valgrind_handler=valgrind_handler,
+                               http_engine=http_engine)
 
     def test_http2k_unexpected_close(self,  # noqa: F811
                                      kafka_handler,
                                      valgrind_handler,
+                                     http_engine,
                                      child):
         used_topic = TestN2kafka.random_topic()
         test_message = HTTPPostMessage(
@@ -211,7 +221,8 @@ class TestHTTP2K(TestN2kafka):
         self._base_http2k_test(child=child,
                                messages=[test_message],
                                kafka_handler=kafka_handler,
-                               valgrind_handler=valgrind_handler)
+                               valgrind_handler=valgrind_handler,
+                               http_engine=http_engine)
 
     @staticmethod
     def __http2k_decoder_response(
@@ -244,6 +255,7 @@ class TestHTTP2K(TestN2kafka):
                              kafka_handler,
                              child,
                              valgrind_handler,
+                             http_engine,
                              content_encoding):
         ''' Test http2k different messages behavior '''
         used_topic = TestN2kafka.random_topic()
@@ -600,11 +612,13 @@ class TestHTTP2K(TestN2kafka):
         self._base_http2k_test(child=child,
                                messages=test_messages,
                                kafka_handler=kafka_handler,
-                               valgrind_handler=valgrind_handler)
+                               valgrind_handler=valgrind_handler,
+                               http_engine=http_engine)
 
     def test_http2k_full_queue(self,  # noqa: F811
                                kafka_handler,
                                valgrind_handler,
+                               http_engine,
                                child):
         used_topic = TestN2kafka.random_topic()
         test_message = HTTPPostMessage(
@@ -621,12 +635,14 @@ class TestHTTP2K(TestN2kafka):
                                messages=[test_message],
                                kafka_handler=kafka_handler,
                                valgrind_handler=valgrind_handler,
+                               http_engine=http_engine,
                                base_config_add={
                                 'rdkafka.queue.buffering.max.messages': '3'})
 
     def test_http2k_noautocreate_topic(self,  # noqa: F811
                                        kafka_handler,
                                        valgrind_handler,
+                                       http_engine,
                                        child):
         used_topic = TestN2kafka.random_topic()
         test_message = HTTPPostMessage(
@@ -640,6 +656,7 @@ class TestHTTP2K(TestN2kafka):
                                messages=[test_message],
                                kafka_handler=kafka_handler,
                                valgrind_handler=valgrind_handler,
+                               http_engine=http_engine,
                                base_config_add={
                                 'brokers': 'kafka_noautocreatetopic',
                                 'rdkafka.queue.buffering.max.messages': '3'})
@@ -33,7 +33,7 @@ from n2k_test import \
     TestN2kafka
 
 # flake8 does not handle pytest fixtures
-from n2k_test import valgrind_handler  # noqa: F401
+from n2k_test import http_engine, valgrind_handler  # noqa: F401
 
 
 class TestDumb(TestN2kafka):
@@ -61,6 +61,18 @@ class TestDumb(TestN2kafka):
                                 {'topic': kafka_topic_name,
                                  'messages': ['{"test":1}{"test":2}']}
                             ])
+        ] + [
+            # Bodies bigger than a quarter of connection memory, and
+            # bigger than the whole connection memory
+            HTTPPostMessage(uri='/v1/meraki/mytestvalidator',
+                            data=big_message,
+                            expected_response_code=200,
+                            expected_kafka_messages=[
+                                {'topic': kafka_topic_name,
+                                 'messages': [big_message]}
+                            ])
+            for big_message in ('{"test":"' + 'x' * pad_size + '"}'
+                                for pad_size in (64 * 1024, 200 * 1024))
         ]
 
         t_locals = locals()
@@ -73,10 +85,12 @@ class TestDumb(TestN2kafka):
     def test_dumb_topic_general(self,  # noqa: F811
                                 kafka_handler,
                                 valgrind_handler,
+                                http_engine,
                                 child):
         ''' Test dumb decoder with topic in general config'''
         used_topic = TestN2kafka.random_topic()
-        base_config = {'listeners': [{}], 'topic': used_topic}
+        base_config = {'listeners': [{'engine': http_engine}],
+                       'topic': used_topic}
         self.base_test_dumb(kafka_topic_name=used_topic,
                             child=child,
                             base_config=base_config,
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+'''Test TCP socket listener records framing
+'''
+
+import json
+import pytest
+import struct
+from n2k_test import \
+    main, \
+    SocketMessage, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+
+def _frame_newline(record):
+    return record + b'\n'
+
+
+def _frame_octet_counted(record):
+    return str(len(record)).encode() + b' ' + record
+
+
+def _frame_length_prefixed(record):
+    return struct.pack('>I', len(record)) + record
+
+
+_FRAMERS = {
+    'newline': _frame_newline,
+    'octet_counted': _frame_octet_counted,
+    'length_prefixed': _frame_length_prefixed,
+}
+
+
+def _split(data, size):
+    ''' Split data in pieces of size bytes '''
+    return [data[i:i + size] for i in range(0, len(data), size)]
+
+
+class TestSocketFraming(TestN2kafka):
+    def _base_framing_test(self,  # noqa: F811
+                           child,
+                           framing,
+                           used_topic,
+                           messages,
+                           kafka_handler,
+                           valgrind_handler,
+                           listener_add={}):
+        ''' Base framing test
+
+        Arguments:
+          - child: Child string to execute
+          - framing: Listener framing
+          - used_topic: Topic to send records
+          - messages: Messages to test
+          - kafka_handler: Kafka handler to use
+          - valgrind_handler: Valgrind handler if any
+          - listener_add: Listener config to add (override)
+        '''
+        base_config = {
+            'listeners': [{'proto': 'tcp',
+                           'framing': framing,
+                           **listener_add}],
+            'topic': used_topic,
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=messages,
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+    @pytest.mark.parametrize('framing', sorted(_FRAMERS))  # noqa: F811
+    def test_framing_split_records(self,
+                                   kafka_handler,
+                                   valgrind_handler,
+                                   child,
+                                   framing):
+        ''' Records split in many writes, even in the middle of their
+        header, and many records in the same write, have to be sent to
+        kafka one by one '''
+        used_topic = TestN2kafka.random_topic()
+        frame = _FRAMERS[framing]
+
+        small_records = [json.dumps({'test': i}).encode() for i in range(3)]
+        big_record = json.dumps({'test': 'big',
+                                 'pad': 'x' * 10000}).encode()
+        last_records = [json.dumps({'test': i}).encode() for i in range(3, 6)]
+
+        small_stream = b''.join(frame(r) for r in small_records)
+        big_stream = frame(big_record)
+        last_stream = b''.join(frame(r) for r in last_records)
+
+        writes = _split(small_stream, 3) + [
+            big_stream[:5000],
+            # Rest of the record and the start of the next one
+            big_stream[5000:] + last_stream[:2],
+            last_stream[2:],
+        ]
+
+        test_message = SocketMessage(
+            writes=writes,
+            expected_kafka_messages=[
+                {'topic': used_topic,
+                 'messages': small_records + [big_record] + last_records}
+            ])
+
+        self._base_framing_test(child=child,
+                                framing=framing,
+                                used_topic=used_topic,
+                                messages=[test_message],
+                                kafka_handler=kafka_handler,
+                                valgrind_handler=valgrind_handler)
+
+    @pytest.mark.parametrize('framing', sorted(_FRAMERS))  # noqa: F811
+    def test_framing_max_record_size(self,
+                                     kafka_handler,
+                                     valgrind_handler,
+                                     child,
+                                     framing):
+        ''' Records bigger than max_record_size are discarded, and the next
+        ones are still found '''
+        used_topic = TestN2kafka.random_topic()
+        frame = _FRAMERS[framing]
+        max_record_size = 64
+
+        big_record = b'x' * (4 * max_record_size)
+        record = b'{"test":1}'
+        stream = frame(big_record) + frame(record)
+
+        test_message = SocketMessage(
+            writes=_split(stream, max_record_size // 2),
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': [record]}
+            ])
+
+        self._base_framing_test(
+                    child=child,
+                    framing=framing,
+                    used_topic=used_topic,
+                    messages=[test_message],
+                    kafka_handler=kafka_handler,
+                    valgrind_handler=valgrind_handler,
+                    listener_add={'max_record_size': max_record_size})
+
+
+if __name__ == '__main__':
+    main()
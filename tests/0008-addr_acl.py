@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+'''Test clients blacklist and allowlist
+'''
+
+import pytest
+import requests
+from n2k_test import \
+    HTTPPostMessage, \
+    main, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+# localhost can be reached through IPv4 or IPv6
+_LOCALHOST_NETWORKS = ['127.0.0.0/8', '::1/128']
+_LOCALHOST_HOSTS = ['127.0.0.1', '::1']
+_OTHER_NETWORKS = ['10.0.0.0/8', '2001:db8::/32']
+
+
+class TestAddrACL(TestN2kafka):
+    @pytest.mark.parametrize('acl,allowed', [  # noqa: F811
+        # Client denied by its network
+        ({'blacklist': _LOCALHOST_NETWORKS}, False),
+        # Other networks denied
+        ({'blacklist': _OTHER_NETWORKS}, True),
+        # Client network allowed
+        ({'allowlist': _LOCALHOST_NETWORKS}, True),
+        # Client is not in any allowed network
+        ({'allowlist': _OTHER_NETWORKS}, False),
+        # Longest prefix wins: host allowed inside a denied network
+        ({'blacklist': _LOCALHOST_NETWORKS,
+          'allowlist': _LOCALHOST_HOSTS}, True),
+        # Longest prefix wins: host denied inside an allowed network
+        ({'allowlist': _LOCALHOST_NETWORKS,
+          'blacklist': _LOCALHOST_HOSTS}, False),
+    ])
+    def test_addr_acl(self,
+                      kafka_handler,
+                      valgrind_handler,
+                      child,
+                      acl,
+                      allowed):
+        ''' Test that clients are accepted or rejected by their CIDR '''
+        TEST_MESSAGE = '{"test":1}'
+        used_topic = TestN2kafka.random_topic()
+        base_config = {'listeners': [{}], 'topic': used_topic, **acl}
+
+        if allowed:
+            test_message = HTTPPostMessage(
+                uri='/v1/data/' + used_topic,
+                data=TEST_MESSAGE,
+                expected_response_code=200,
+                expected_kafka_messages=[
+                    {'topic': used_topic, 'messages': [TEST_MESSAGE]}
+                ])
+        else:
+            # Connection is closed as soon as it is accepted
+            test_message = HTTPPostMessage(
+                uri='/v1/data/' + used_topic,
+                data=TEST_MESSAGE,
+                expected_exception_type=requests.exceptions.ConnectionError)
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=[test_message],
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+
+if __name__ == '__main__':
+    main()
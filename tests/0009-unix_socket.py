@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+'''Test unix domain socket listener
+'''
+
+from socket import AF_UNIX, SOCK_DGRAM, SOCK_SEQPACKET, SOCK_STREAM
+from n2k_test import \
+    main, \
+    SocketMessage, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+
+class TestUnixSocket(TestN2kafka):
+    def _base_unix_test(self,  # noqa: F811
+                        child,
+                        unix_type,
+                        used_topic,
+                        messages,
+                        kafka_handler,
+                        valgrind_handler,
+                        listener_add={}):
+        ''' Base unix socket listener test
+
+        Arguments:
+          - child: Child string to execute
+          - unix_type: Unix socket type
+          - used_topic: Topic to send messages
+          - messages: Messages to test
+          - kafka_handler: Kafka handler to use
+          - valgrind_handler: Valgrind handler if any
+          - listener_add: Listener config to add (override)
+        '''
+        base_config = {
+            'listeners': [{'proto': 'unix',
+                           'path': TestN2kafka.random_unix_path(),
+                           'type': unix_type,
+                           **listener_add}],
+            'topic': used_topic,
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=messages,
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+    def test_unix_stream(self,  # noqa: F811
+                         kafka_handler,
+                         valgrind_handler,
+                         child):
+        ''' Stream sockets work as TCP connections '''
+        used_topic = TestN2kafka.random_topic()
+        test_message = SocketMessage(
+            family=AF_UNIX,
+            type=SOCK_STREAM,
+            writes=['{"test":1}\n{"te', 'st":2}\n{"test":3}\n'],
+            expected_kafka_messages=[
+                {'topic': used_topic,
+                 'messages': ['{"test":1}', '{"test":2}', '{"test":3}']}
+            ])
+
+        self._base_unix_test(child=child,
+                             unix_type='stream',
+                             used_topic=used_topic,
+                             messages=[test_message],
+                             kafka_handler=kafka_handler,
+                             valgrind_handler=valgrind_handler,
+                             listener_add={'framing': 'newline'})
+
+    def test_unix_dgram(self,  # noqa: F811
+                        kafka_handler,
+                        valgrind_handler,
+                        child):
+        ''' Every datagram is a message, as in UDP '''
+        used_topic = TestN2kafka.random_topic()
+        datagrams = ['{"test":%d}' % i for i in range(3)]
+        test_message = SocketMessage(
+            family=AF_UNIX,
+            type=SOCK_DGRAM,
+            writes=datagrams,
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': datagrams}
+            ])
+
+        self._base_unix_test(child=child,
+                             unix_type='dgram',
+                             used_topic=used_topic,
+                             messages=[test_message],
+                             kafka_handler=kafka_handler,
+                             valgrind_handler=valgrind_handler)
+
+    def test_unix_seqpacket(self,  # noqa: F811
+                            kafka_handler,
+                            valgrind_handler,
+                            child):
+        ''' Every seqpacket message is a record, and the ones bigger than
+        max_record_size are discarded '''
+        used_topic = TestN2kafka.random_topic()
+        max_record_size = 64
+        test_message = SocketMessage(
+            family=AF_UNIX,
+            type=SOCK_SEQPACKET,
+            writes=['{"test":1}', 'x' * (2 * max_record_size), '{"test":2}'],
+            expected_kafka_messages=[
+                {'topic': used_topic,
+                 'messages': ['{"test":1}', '{"test":2}']}
+            ])
+
+        self._base_unix_test(
+                        child=child,
+                        unix_type='seqpacket',
+                        used_topic=used_topic,
+                        messages=[test_message],
+                        kafka_handler=kafka_handler,
+                        valgrind_handler=valgrind_handler,
+                        listener_add={'max_record_size': max_record_size})
+
+
+if __name__ == '__main__':
+    main()
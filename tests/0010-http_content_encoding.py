@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+'''Test zstd, lz4 and br HTTP Content-Encodings
+'''
+
+import json
+import pytest
+import zlib
+from n2k_test import \
+    HTTPPostMessage, \
+    main, \
+    n2kafka_has_feature, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import http_engine, valgrind_handler  # noqa: F401
+
+# Content-Encoding: (config.h feature, python module, compress function)
+_ENCODINGS = {
+    'zstd': ('HAVE_ZSTD', 'zstandard',
+             lambda module: module.ZstdCompressor().compress),
+    'lz4': ('HAVE_LZ4', 'lz4.frame', lambda module: module.compress),
+    'br': ('HAVE_BROTLI', 'brotli', lambda module: module.compress),
+}
+
+# Listener decompresses bodies in blocks of this size
+_DECOMPRESS_BUFFER_SIZE = 512 * 1024
+
+
+def _compress_function(content_encoding):
+    ''' Compress function of content encoding, or skip test if n2kafka or
+    python does not support it '''
+    feature, module_name, compress_function = _ENCODINGS[content_encoding]
+    if not n2kafka_has_feature(feature):
+        pytest.skip('n2kafka built without ' + content_encoding)
+
+    return compress_function(pytest.importorskip(module_name))
+
+
+class OneShotCompressor(object):
+    ''' zlib compressobj interface over a one shot compress function, so
+    HTTPMessage can use it. Chunked data is not supported. '''
+
+    def __init__(self, compress_function):
+        self.__compress_function = compress_function
+        self.__data = b''
+
+    def copy(self):
+        return OneShotCompressor(self.__compress_function)
+
+    def compress(self, data):
+        self.__data += data
+        return b''
+
+    def flush(self, mode=zlib.Z_FINISH):
+        assert(mode == zlib.Z_FINISH)
+        return self.__compress_function(self.__data)
+
+
+class TestHTTPContentEncoding(TestN2kafka):
+    def _base_content_encoding_test(self,  # noqa: F811
+                                    child,
+                                    messages,
+                                    kafka_handler,
+                                    valgrind_handler,
+                                    http_engine):
+        ''' Base Content-Encoding test, using zz_http2k decoder that stream
+        decompressed data.
+
+        Arguments:
+          - child: Child string to execute
+          - messages: Messages to test
+          - kafka_handler: Kafka handler to use
+          - valgrind_handler: Valgrind handler if any
+          - http_engine: HTTP listener engine
+        '''
+        base_config = {
+            'listeners': [{'proto': 'http',
+                           'engine': http_engine,
+                           'decode_as': 'zz_http2k'}]
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=messages,
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+    @pytest.mark.parametrize('content_encoding',  # noqa: F811
+                             sorted(_ENCODINGS))
+    def test_content_encoding(self,
+                              kafka_handler,
+                              valgrind_handler,
+                              http_engine,
+                              child,
+                              content_encoding):
+        ''' Short bodies, and bodies longer than many decompression buffers,
+        are decompressed and decoded. Bodies that end in the middle of
+        compressed data are rejected. '''
+        compress_function = _compress_function(content_encoding)
+        used_topic = TestN2kafka.random_topic()
+
+        small_messages = [json.dumps({'test': i}) for i in range(2)]
+        big_messages = []
+        big_messages_size = 0
+        while big_messages_size <= 2 * _DECOMPRESS_BUFFER_SIZE:
+            message = json.dumps({'test': len(big_messages),
+                                  'pad': 'x' * 100})
+            big_messages.append(message)
+            big_messages_size += len(message)
+
+        truncated_data = compress_function(''.join(small_messages).encode())
+        truncated_data = truncated_data[:len(truncated_data) // 2]
+
+        base_args = {
+            'uri': '/v1/data/' + used_topic,
+            'headers': {'Content-Encoding': content_encoding},
+            'compressor': OneShotCompressor(compress_function),
+            'expected_response_code': 200,
+        }
+
+        test_messages = [
+            # Compressed empty body
+            HTTPPostMessage(**{**base_args,
+                               'data': '',
+                               'expected_kafka_messages': [
+                                   {'topic': used_topic, 'messages': []}
+                               ]}),
+
+            HTTPPostMessage(**{**base_args,
+                               'data': ''.join(small_messages),
+                               'expected_kafka_messages': [
+                                   {'topic': used_topic,
+                                    'messages': small_messages}
+                               ]}),
+
+            # Body decompressed in many buffers
+            HTTPPostMessage(**{**base_args,
+                               'data': ''.join(big_messages),
+                               'expected_kafka_messages': [
+                                   {'topic': used_topic,
+                                    'messages': big_messages}
+                               ]}),
+
+            # Body ends in the middle of compressed data
+            HTTPPostMessage(**{**base_args,
+                               'compressor': None,  # Already compressed
+                               'data': truncated_data,
+                               'expected_response_code': 400}),
+        ]
+
+        self._base_content_encoding_test(child=child,
+                                         messages=test_messages,
+                                         kafka_handler=kafka_handler,
+                                         valgrind_handler=valgrind_handler,
+                                         http_engine=http_engine)
+
+
+if __name__ == '__main__':
+    main()
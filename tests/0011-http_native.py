@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+'''Test native HTTP engine requests framing, using raw sockets
+'''
+
+from n2k_test import \
+    main, \
+    SocketMessage, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+
+def _http_request(uri, headers={}, body=b'', version='1.1'):
+    ''' Raw HTTP POST request '''
+    head = 'POST {} HTTP/{}\r\nHost: localhost\r\n'.format(uri, version) + \
+        ''.join('{}: {}\r\n'.format(k, v) for k, v in headers.items()) + \
+        '\r\n'
+    return head.encode() + body
+
+
+def _chunked_body(chunks):
+    ''' Chunked transfer encoding of chunks '''
+    return b''.join(b'%x\r\n' % len(chunk) + chunk + b'\r\n'
+                    for chunk in chunks) + b'0\r\n\r\n'
+
+
+def _split(data, size):
+    ''' Split data in pieces of size bytes '''
+    return [data[i:i + size] for i in range(0, len(data), size)]
+
+
+def _responses_regex(*codes, minor_version=1):
+    ''' Regex of HTTP responses with codes, in order '''
+    return b'.*'.join(b'HTTP/1\\.%d %d ' % (minor_version, code)
+                      for code in codes)
+
+
+class TestHTTPNative(TestN2kafka):
+    def _base_native_test(self,  # noqa: F811
+                          child,
+                          used_topic,
+                          messages,
+                          kafka_handler,
+                          valgrind_handler,
+                          listener_add={}):
+        ''' Base native engine test
+
+        Arguments:
+          - child: Child string to execute
+          - used_topic: Topic of dumb decoder
+          - messages: Messages to test
+          - kafka_handler: Kafka handler to use
+          - valgrind_handler: Valgrind handler if any
+          - listener_add: Listener config to add (override)
+        '''
+        base_config = {
+            'listeners': [{'proto': 'http',
+                           'engine': 'native',
+                           **listener_add}],
+            'topic': used_topic,
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=messages,
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+    def test_native_pipelining(self,  # noqa: F811
+                               kafka_handler,
+                               valgrind_handler,
+                               child):
+        ''' Many requests in the same write are answered in order, and the
+        ones split between writes are joined '''
+        used_topic = TestN2kafka.random_topic()
+        bodies = [b'{"test":%d}' % i for i in range(3)]
+        requests = [_http_request('/v1/data/' + used_topic,
+                                  headers={'Content-Length': len(body)},
+                                  body=body)
+                    for body in bodies]
+        stream = b''.join(requests)
+        split_at = len(requests[0]) + len(requests[1]) + 10
+
+        test_message = SocketMessage(
+            writes=[stream[:split_at], stream[split_at:]],
+            expected_response_regex=_responses_regex(200, 200, 200),
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': bodies}
+            ])
+
+        self._base_native_test(child=child,
+                               used_topic=used_topic,
+                               messages=[test_message],
+                               kafka_handler=kafka_handler,
+                               valgrind_handler=valgrind_handler)
+
+    def test_native_http10(self,  # noqa: F811
+                           kafka_handler,
+                           valgrind_handler,
+                           child):
+        ''' HTTP/1.0 requests are answered with their own version '''
+        used_topic = TestN2kafka.random_topic()
+        body = b'{"test":1}'
+
+        test_message = SocketMessage(
+            writes=[_http_request('/v1/data/' + used_topic,
+                                  headers={'Content-Length': len(body)},
+                                  body=body,
+                                  version='1.0')],
+            expected_response_regex=_responses_regex(200, minor_version=0),
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': [body]}
+            ])
+
+        self._base_native_test(child=child,
+                               used_topic=used_topic,
+                               messages=[test_message],
+                               kafka_handler=kafka_handler,
+                               valgrind_handler=valgrind_handler)
+
+    def test_native_chunked(self,  # noqa: F811
+                            kafka_handler,
+                            valgrind_handler,
+                            child):
+        ''' Chunked bodies split at any point, even in the chunk size line,
+        are decoded as they arrive. Requests need to wait for 100 Continue
+        response if they ask for it. '''
+        used_topic = TestN2kafka.random_topic()
+        uri = '/v1/data/' + used_topic
+        chunked_request = _http_request(
+            uri,
+            headers={'Transfer-Encoding': 'chunked'},
+            body=_chunked_body([b'{"test":1}{"te', b'st":2}', b'{"test":3}']))
+        continue_body = b'{"test":4}'
+        continue_head = _http_request(
+            uri,
+            headers={'Content-Length': len(continue_body),
+                     'Expect': '100-continue'})
+
+        test_message = SocketMessage(
+            writes=_split(chunked_request, 7) + [continue_head,
+                                                 continue_body],
+            expected_response_regex=_responses_regex(200, 100, 200),
+            expected_kafka_messages=[
+                {'topic': used_topic,
+                 'messages': ['{"test":1}', '{"test":2}', '{"test":3}',
+                              '{"test":4}']}
+            ])
+
+        self._base_native_test(child=child,
+                               used_topic=used_topic,
+                               messages=[test_message],
+                               kafka_handler=kafka_handler,
+                               valgrind_handler=valgrind_handler,
+                               listener_add={'decode_as': 'zz_http2k'})
+
+    def test_native_max_body_size(self,  # noqa: F811
+                                  kafka_handler,
+                                  valgrind_handler,
+                                  child):
+        ''' Buffered bodies bigger than max_body_size are answered with 413,
+        both if they are announced by Content-Length and if they are
+        chunked '''
+        used_topic = TestN2kafka.random_topic()
+        uri = '/v1/data/' + used_topic
+        max_body_size = 1024
+        big_body = b'x' * (2 * max_body_size)
+        body = b'{"test":1}'
+
+        test_messages = [
+            # Don't even need to send the body
+            SocketMessage(
+                writes=[_http_request(
+                    uri, headers={'Content-Length': len(big_body)})],
+                expected_response_regex=_responses_regex(413)),
+
+            SocketMessage(
+                writes=[_http_request(
+                    uri,
+                    headers={'Transfer-Encoding': 'chunked'},
+                    body=_chunked_body(_split(big_body, 256)))],
+                expected_response_regex=_responses_regex(413)),
+
+            # Bodies under the limit still work
+            SocketMessage(
+                writes=[_http_request(
+                    uri,
+                    headers={'Transfer-Encoding': 'chunked'},
+                    body=_chunked_body([body]))],
+                expected_response_regex=_responses_regex(200),
+                expected_kafka_messages=[
+                    {'topic': used_topic, 'messages': [body]}
+                ]),
+        ]
+
+        self._base_native_test(child=child,
+                               used_topic=used_topic,
+                               messages=test_messages,
+                               kafka_handler=kafka_handler,
+                               valgrind_handler=valgrind_handler,
+                               listener_add={'max_body_size': max_body_size})
+
+
+if __name__ == '__main__':
+    main()
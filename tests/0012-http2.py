@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+'''Test native HTTP engine HTTP/2 connections, with prior knowledge
+'''
+
+import itertools
+import pytest
+import time
+from socket import socket
+from n2k_test import \
+    main, \
+    n2kafka_has_feature, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+h2_config = pytest.importorskip('h2.config')
+h2_connection = pytest.importorskip('h2.connection')
+h2_events = pytest.importorskip('h2.events')
+
+
+class HTTP2Message(object):
+    ''' Many POST requests sent as concurrent streams of the same HTTP/2
+    connection '''
+
+    # Time to let the listener read every write on its own
+    WRITE_INTERVAL_S = 0.1
+
+    def __init__(self, **kwargs):
+        ''' Honored params: 'streams' (list of dicts with 'uri', 'headers',
+        'chunks' and 'expected_response_code'), 'expected_kafka_messages'.
+        Streams chunks are interleaved.
+        '''
+        self.params = kwargs
+
+    @staticmethod
+    def __receive_events(s, conn):
+        ''' Receive connection events, giving window back for any data '''
+        data = s.recv(65535)
+        assert(data)  # Peer closed before expected events
+
+        events = conn.receive_data(data)
+        for event in events:
+            if isinstance(event, h2_events.DataReceived):
+                conn.acknowledge_received_data(
+                                              event.flow_controlled_length,
+                                              event.stream_id)
+
+        s.sendall(conn.data_to_send())
+        return events
+
+    def test(self, listener_port, kafka_handler, t_child):
+        ''' Do the HTTP/2 message test.
+
+        Arguments:
+          - listener_port: HTTP listener port
+          - kafka handler: Kafka handler to check messages
+          - t_child: Tested child
+        '''
+        streams = self.params['streams']
+        receive_events = HTTP2Message._HTTP2Message__receive_events
+
+        with socket() as s:
+            response_timeout_s = 30
+            s.settimeout(response_timeout_s)
+            s.connect(('localhost', listener_port))
+
+            conn = h2_connection.H2Connection(
+                config=h2_config.H2Configuration(client_side=True))
+            conn.initiate_connection()
+            s.sendall(conn.data_to_send())
+
+            # Wait for server windows
+            while not any(isinstance(event, h2_events.RemoteSettingsChanged)
+                          for event in receive_events(s, conn)):
+                pass
+
+            stream_ids = []
+            for stream in streams:
+                stream_id = conn.get_next_available_stream_id()
+                conn.send_headers(stream_id, [
+                    (':method', 'POST'),
+                    (':path', stream['uri']),
+                    (':scheme', 'http'),
+                    (':authority', 'localhost'),
+                ] + list(stream.get('headers', {}).items()))
+                stream_ids.append(stream_id)
+
+            for chunks in itertools.zip_longest(
+                    *(stream.get('chunks', []) for stream in streams)):
+                for stream_id, chunk in zip(stream_ids, chunks):
+                    if chunk is not None:
+                        conn.send_data(stream_id, chunk)
+                s.sendall(conn.data_to_send())
+                time.sleep(HTTP2Message.WRITE_INTERVAL_S)
+
+            for stream_id in stream_ids:
+                conn.end_stream(stream_id)
+            s.sendall(conn.data_to_send())
+
+            response_codes = {}
+            ended_streams = set()
+            while ended_streams != set(stream_ids):
+                for event in receive_events(s, conn):
+                    if isinstance(event, h2_events.ResponseReceived):
+                        response_codes[event.stream_id] = \
+                            int(dict(event.headers)[b':status'])
+                    elif isinstance(event, (h2_events.StreamEnded,
+                                            h2_events.StreamReset)):
+                        ended_streams.add(event.stream_id)
+
+        for stream, stream_id in zip(streams, stream_ids):
+            expected_response_code = stream.get('expected_response_code')
+            if expected_response_code:
+                assert(response_codes.get(stream_id) ==
+                       expected_response_code)
+
+        for messages in self.params.get('expected_kafka_messages', []):
+            topic_name = messages['topic']
+            kafka_messages = messages['messages']
+            kafka_handler.check_kafka_messages(topic_name, kafka_messages)
+
+
+class TestHTTP2(TestN2kafka):
+    def _base_http2_test(self,  # noqa: F811
+                         child,
+                         messages,
+                         kafka_handler,
+                         valgrind_handler,
+                         base_config_add={},
+                         listener_add={}):
+        ''' Base HTTP/2 test
+
+        Arguments:
+          - child: Child string to execute
+          - messages: Messages to test
+          - kafka_handler: Kafka handler to use
+          - valgrind_handler: Valgrind handler if any
+          - base_config_add: Config to add (override)
+          - listener_add: Listener config to add (override)
+        '''
+        if not n2kafka_has_feature('HAVE_NGHTTP2'):
+            pytest.skip('n2kafka built without HTTP/2 support')
+
+        base_config = {
+            'listeners': [{'proto': 'http',
+                           'engine': 'native',
+                           **listener_add}],
+            **base_config_add,
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=messages,
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+    def test_http2_streams(self,  # noqa: F811
+                           kafka_handler,
+                           valgrind_handler,
+                           child):
+        ''' Concurrent streams are decoded independently, even with their
+        data interleaved and split in the middle of JSON messages '''
+        topics = [TestN2kafka.random_topic() for _ in range(3)]
+        test_message = HTTP2Message(
+            streams=[{
+                'uri': '/v1/data/' + topic,
+                'chunks': [b'{"test":1}{"te', b'st":2}', b'{"test":3}'],
+                'expected_response_code': 200,
+            } for topic in topics],
+            expected_kafka_messages=[{
+                'topic': topic,
+                'messages': ['{"test":1}', '{"test":2}', '{"test":3}'],
+            } for topic in topics])
+
+        self._base_http2_test(child=child,
+                              messages=[test_message],
+                              kafka_handler=kafka_handler,
+                              valgrind_handler=valgrind_handler,
+                              listener_add={'decode_as': 'zz_http2k'})
+
+    def test_http2_dumb(self,  # noqa: F811
+                        kafka_handler,
+                        valgrind_handler,
+                        child):
+        ''' Streams bodies are buffered for decoders that don't stream, up
+        to max_body_size '''
+        used_topic = TestN2kafka.random_topic()
+        max_body_size = 1024
+        body = b'{"test":1}'
+        big_body_chunks = [b'x' * 256] * (2 * max_body_size // 256)
+
+        test_message = HTTP2Message(
+            streams=[{
+                'uri': '/v1/data/' + used_topic,
+                'chunks': [body[:4], body[4:]],
+                'expected_response_code': 200,
+            }, {
+                'uri': '/v1/data/' + used_topic,
+                'chunks': big_body_chunks,
+                'expected_response_code': 413,
+            }],
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': [body]}
+            ])
+
+        self._base_http2_test(child=child,
+                              messages=[test_message],
+                              kafka_handler=kafka_handler,
+                              valgrind_handler=valgrind_handler,
+                              base_config_add={'topic': used_topic},
+                              listener_add={'max_body_size': max_body_size})
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+
+'''Test UDP listener batched reads
+'''
+
+import pytest
+import time
+from socket import socket, AF_INET, SOCK_DGRAM
+from n2k_test import \
+    main, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+
+class DatagramsMessage(object):
+    ''' Many UDP datagrams, sent in a burst so the listener reads many of them
+    in the same system call '''
+
+    # Time to let the listener open its socket after announcing it
+    LISTENER_OPEN_S = 1
+
+    def __init__(self, **kwargs):
+        ''' Honored params: 'datagrams', 'expected_kafka_messages' '''
+        self.params = kwargs
+
+    def test(self, listener_port, kafka_handler, t_child):
+        ''' Do the datagrams test.
+
+        Arguments:
+          - listener_port: UDP listener port
+          - kafka handler: Kafka handler to check messages
+          - t_child: Tested child
+        '''
+        time.sleep(DatagramsMessage.LISTENER_OPEN_S)
+
+        with socket(AF_INET, SOCK_DGRAM) as s:
+            s.connect(('localhost', listener_port))
+            for datagram in self.params.get('datagrams', []):
+                s.send(datagram.encode())
+
+        for messages in self.params.get('expected_kafka_messages', []):
+            topic_name = messages['topic']
+            kafka_messages = messages['messages']
+            kafka_handler.check_kafka_messages(topic_name, kafka_messages)
+
+
+class TestUDPBatch(TestN2kafka):
+    @pytest.mark.parametrize('udp_batch_size', [1, 8])  # noqa: F811
+    def test_udp_batch(self,
+                       kafka_handler,
+                       valgrind_handler,
+                       child,
+                       udp_batch_size):
+        ''' Every datagram is a message, even if many of them are read in the
+        same batch, or if there are more datagrams than batch size '''
+        used_topic = TestN2kafka.random_topic()
+        datagrams = ['{"test":%d}' % i for i in range(4 * udp_batch_size + 1)]
+        test_message = DatagramsMessage(
+            datagrams=datagrams,
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': datagrams}
+            ])
+
+        # Only one thread, so datagrams are produced in order
+        base_config = {
+            'listeners': [{'proto': 'udp',
+                           'num_threads': 1,
+                           'udp_batch_size': udp_batch_size}],
+            'topic': used_topic,
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=[test_message],
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+
+if __name__ == '__main__':
+    main()
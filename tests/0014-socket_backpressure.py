@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+
+'''Test socket listeners kafka backpressure
+'''
+
+import pytest
+import re
+from socket import SOCK_DGRAM, SOCK_STREAM
+from n2k_test import \
+    main, \
+    SocketMessage, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+
+class BackpressureMessage(SocketMessage):
+    ''' Socket message that also checks listener messages '''
+
+    def test(self, listener_port, kafka_handler, t_child):
+        ''' Do the socket message test, and wait for every
+        'expected_stdout_regex' pattern in listener messages, in order '''
+        super().test(listener_port, kafka_handler, t_child)
+
+        stdout_timeout_s = 30
+        for pattern in self.params.get('expected_stdout_regex', []):
+            while not re.search(pattern,
+                                t_child.readline(
+                                    t_timeout_seconds=stdout_timeout_s)):
+                pass
+
+
+class TestSocketBackpressure(TestN2kafka):
+    @pytest.mark.parametrize('proto,socket_type,listener_add', [  # noqa: F811
+        ('tcp', SOCK_STREAM, {'framing': 'newline'}),
+        ('udp', SOCK_DGRAM, {}),
+    ])
+    def test_backpressure(self,
+                          kafka_handler,
+                          valgrind_handler,
+                          child,
+                          proto,
+                          socket_type,
+                          listener_add):
+        ''' Listener pauses reading while the producer lingers over high
+        watermark messages, and resumes when they are sent, without losing
+        or reordering any of them '''
+        used_topic = TestN2kafka.random_topic()
+        records = ['{"test":%d}' % i for i in range(8)]
+        record_suffix = '\n' if socket_type == SOCK_STREAM else ''
+
+        test_message = BackpressureMessage(
+            type=socket_type,
+            writes=[record + record_suffix for record in records],
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': records}
+            ],
+            expected_stdout_regex=[
+                r'over high watermark, pausing',
+                r'under low watermark, resuming',
+            ])
+
+        # Only one thread, so records are produced in order
+        base_config = {
+            'listeners': [{'proto': proto,
+                           'num_threads': 1,
+                           'backpressure_high_watermark': 2,
+                           **listener_add}],
+            'topic': used_topic,
+            # Hold messages in producer queue
+            'rdkafka.queue.buffering.max.ms': '500',
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=[test_message],
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+
+if __name__ == '__main__':
+    main()
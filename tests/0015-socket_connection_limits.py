@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2018-2019, Wizzie S.L.
+# Author: Eugenio Perez <eupm90@gmail.com>
+#
+# This file is part of n2kafka.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+__author__ = "Eugenio Perez"
+__copyright__ = "Copyright (C) 2018-2019, Wizzie S.L."
+__license__ = "AGPL"
+__maintainer__ = "Eugenio Perez"
+__email__ = "eperez@wizzie.io"
+__status__ = "Production"
+
+
+'''Test TCP socket listener connection limits and idle timeout
+'''
+
+import contextlib
+import pytest
+import time
+from socket import socket, IPPROTO_TCP, TCP_NODELAY
+from n2k_test import \
+    main, \
+    TestN2kafka
+
+# flake8 does not handle pytest fixtures
+from n2k_test import valgrind_handler  # noqa: F401
+
+
+class ConnectionsMessage(object):
+    ''' Many TCP connections open at the same time '''
+
+    # Time to let the listener handle every connection on its own
+    CONNECT_INTERVAL_S = 0.1
+
+    def __init__(self, **kwargs):
+        ''' Honored params: 'connections' (list of dicts with 'writes' and
+        'expected_closed'), 'wait_s' (time to wait before checking if
+        connections have been closed), 'expected_kafka_messages'.
+        Connections are opened in order, and kept open until the end.
+        '''
+        self.params = kwargs
+
+    @staticmethod
+    def __closed(s):
+        ''' Check if peer has closed the connection, without waiting '''
+        s.setblocking(False)
+        try:
+            return s.recv(1) == b''
+        except BlockingIOError:
+            return False  # Nothing to read, but still open
+        except ConnectionResetError:
+            return True
+
+    def test(self, listener_port, kafka_handler, t_child):
+        ''' Do the connections test.
+
+        Arguments:
+          - listener_port: TCP listener port
+          - kafka handler: Kafka handler to check messages
+          - t_child: Tested child
+        '''
+        connections = self.params['connections']
+        closed = ConnectionsMessage._ConnectionsMessage__closed
+
+        with contextlib.ExitStack() as exit_stack:
+            sockets = []
+            for connection in connections:
+                s = exit_stack.enter_context(socket())
+                s.connect(('localhost', listener_port))
+                s.setsockopt(IPPROTO_TCP, TCP_NODELAY, 1)
+                for data in connection.get('writes', []):
+                    s.sendall(data.encode())
+                sockets.append(s)
+                time.sleep(ConnectionsMessage.CONNECT_INTERVAL_S)
+
+            time.sleep(self.params.get('wait_s', 0))
+
+            for connection, s in zip(connections, sockets):
+                assert(closed(s) == connection.get('expected_closed', False))
+
+        for messages in self.params.get('expected_kafka_messages', []):
+            topic_name = messages['topic']
+            kafka_messages = messages['messages']
+            kafka_handler.check_kafka_messages(topic_name, kafka_messages)
+
+
+class TestSocketConnectionLimits(TestN2kafka):
+    def _base_limits_test(self,  # noqa: F811
+                          child,
+                          used_topic,
+                          messages,
+                          kafka_handler,
+                          valgrind_handler,
+                          listener_add={}):
+        ''' Base connection limits test
+
+        Arguments:
+          - child: Child string to execute
+          - used_topic: Topic to send messages
+          - messages: Messages to test
+          - kafka_handler: Kafka handler to use
+          - valgrind_handler: Valgrind handler if any
+          - listener_add: Listener config to add (override)
+        '''
+        base_config = {
+            'listeners': [{'proto': 'tcp',
+                           'framing': 'newline',
+                           **listener_add}],
+            'topic': used_topic,
+        }
+
+        self.base_test(base_config=base_config,
+                       child_argv_str=child,
+                       messages=messages,
+                       kafka_handler=kafka_handler,
+                       valgrind_handler=valgrind_handler)
+
+    @pytest.mark.parametrize('limit_option', [  # noqa: F811
+        'connection_limit',
+        'per_ip_connection_limit',
+    ])
+    def test_connection_limit(self,
+                              kafka_handler,
+                              valgrind_handler,
+                              child,
+                              limit_option):
+        ''' Connections over the limit are closed just after accepting them,
+        and the ones under it keep working '''
+        used_topic = TestN2kafka.random_topic()
+        limit = 2
+        records = ['{"test":%d}' % i for i in range(limit)]
+
+        test_message = ConnectionsMessage(
+            connections=[
+                {'writes': [record + '\n']} for record in records
+            ] + [{'expected_closed': True}],
+            wait_s=1,
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': records}
+            ])
+
+        self._base_limits_test(child=child,
+                               used_topic=used_topic,
+                               messages=[test_message],
+                               kafka_handler=kafka_handler,
+                               valgrind_handler=valgrind_handler,
+                               listener_add={limit_option: limit})
+
+    def test_idle_timeout(self,  # noqa: F811
+                          kafka_handler,
+                          valgrind_handler,
+                          child):
+        ''' Connections without data for idle_timeout are closed, after
+        sending their records '''
+        used_topic = TestN2kafka.random_topic()
+        idle_timeout_s = 1
+        record = '{"test":1}'
+
+        test_message = ConnectionsMessage(
+            connections=[{'writes': [record + '\n'],
+                          'expected_closed': True}],
+            wait_s=3 * idle_timeout_s,
+            expected_kafka_messages=[
+                {'topic': used_topic, 'messages': [record]}
+            ])
+
+        self._base_limits_test(child=child,
+                               used_topic=used_topic,
+                               messages=[test_message],
+                               kafka_handler=kafka_handler,
+                               valgrind_handler=valgrind_handler,
+                               listener_add={'idle_timeout': idle_timeout_s})
+
+
+if __name__ == '__main__':
+    main()
@@ -29,7 +29,8 @@ __status__ = "Production"
 
 from tempfile import NamedTemporaryFile
 import zlib
-from socket import socket, AF_INET, SOCK_STREAM
+from socket import socket, AF_INET, AF_UNIX, SOCK_STREAM, IPPROTO_TCP, \
+    TCP_NODELAY
 from subprocess import Popen, PIPE
 from concurrent.futures import ThreadPoolExecutor
 from itertools import repeat
@@ -43,6 +44,7 @@ import pytest
 import requests
 import json
 import re
+import time
 
 
 class TestChild(Popen):
@@ -172,6 +174,12 @@ def valgrind_handler(child):
     h.write_xml()
 
 
+@pytest.fixture(params=['libmicrohttpd', 'native'])
+def http_engine(request):
+    ''' HTTP listener engine. Tests using it run with every engine. '''
+    return request.param
+
+
 class HTTPMessage(object):
     ''' Base HTTP message for testing '''
 
@@ -344,6 +352,65 @@ class HTTPMessage(object):
             kafka_handler.check_kafka_messages(topic_name, kafka_messages)
 
 
+class SocketMessage(object):
+    ''' Message sent through a raw socket, in many writes '''
+
+    # Time to let the listener read every write on its own
+    WRITE_INTERVAL_S = 0.1
+
+    def __init__(self, family=AF_INET, type=SOCK_STREAM, **kwargs):
+        ''' Honored params: 'writes' (data of every write, or every datagram),
+        'expected_response_regex' (bytes the peer should answer before
+        closing), 'expected_kafka_messages'
+        '''
+        self.family = family
+        self.type = type
+        self.params = kwargs
+
+    def test(self, listener_port, kafka_handler, t_child):
+        ''' Do the socket message test.
+
+        Arguments:
+          - listener_port: Listener port, or path if unix socket
+          - kafka handler: Kafka handler to check messages
+          - t_child: Tested child
+        '''
+        address = listener_port if self.family == AF_UNIX \
+            else ('localhost', listener_port)
+
+        with socket(self.family, self.type) as s:
+            s.connect(address)
+            if self.family == AF_INET and self.type == SOCK_STREAM:
+                # Don't let kernel join our writes
+                s.setsockopt(IPPROTO_TCP, TCP_NODELAY, 1)
+
+            for data in self.params.get('writes', []):
+                try:
+                    data = data.encode()
+                except AttributeError:
+                    pass  # Already in bytes format
+
+                s.sendall(data)
+                time.sleep(SocketMessage.WRITE_INTERVAL_S)
+
+            expected_response_regex = self.params.get(
+                                                    'expected_response_regex')
+            if expected_response_regex:
+                response_timeout_s = 30
+                s.settimeout(response_timeout_s)
+                response = b''
+                while not re.search(expected_response_regex, response,
+                                    re.DOTALL):
+                    chunk = s.recv(4096)
+                    assert(chunk)  # Peer closed before expected response
+                    response += chunk
+
+        for messages in self.params.get('expected_kafka_messages', []):
+            topic_name = messages['topic']
+            kafka_messages = messages['messages']
+            kafka_handler.check_kafka_messages(topic_name, kafka_messages)
+
+
 class HTTPGetMessage(HTTPMessage):
     def __init__(self, **kwargs):
         super().__init__(requests.get, **kwargs)
@@ -354,6 +421,14 @@ class HTTPPostMessage(HTTPMessage):
         super().__init__(requests.post, **kwargs)
 
 
+def n2kafka_has_feature(define, config_h='config.h'):
+    ''' Check if n2kafka has been built with a feature, looking for its
+    define (like HAVE_ZSTD) in configure generated config.h '''
+    define_regex = r'#define\s+' + define + r'\s+1\b'
+    with open(config_h) as f:
+        return any(re.match(define_regex, line) for line in f)
+
+
 def test_module_argv(argv):
     ''' Search test module in argv'''
     return next(i for i, arg in enumerate(argv) if os.path.basename(
@@ -387,6 +462,12 @@ class TestN2kafka(object):
             name = s.getsockname()
             return name[1]
 
+    def random_unix_path():
+        ''' Random unix socket path, that does not exist yet '''
+        path = TestN2kafka.random_resource_file('unix')
+        os.remove(path)
+        return path
+
     def random_topic():
         # kafka broker complains if topic ends with __
         topic = '_'
@@ -432,7 +513,8 @@ class TestN2kafka(object):
         Arguments:
           - base_config: Base config file to use. Listener port(random) &
             proto(http), number of threads (2), brokers (kafka) and some
-            rdkafka options will be added if not present.
+            rdkafka options will be added if not present. Messages are sent
+            to the first listener, through its path if it has one.
           - child_argv_str: Child string to execute
           - messages: Messages to test
           - kafka_handler: Kafka handler to use
@@ -440,12 +522,16 @@ class TestN2kafka(object):
         '''
         config_file, config = self._create_config_file(base_config)
 
-        listener_port = config['listeners'][0]['port']
+        listener = config['listeners'][0]
+        listener_port = listener.get('path', listener['port'])
+        listener_proto = listener['proto']
+        if listener_proto == 'http':
+            listener_proto = 'HTTP'
 
         with contextlib.ExitStack() as exit_stack:
             child_cls = N2KafkaChild
             child_kwargs = {
-                'proto': 'HTTP',
+                'proto': listener_proto,
                 'port': listener_port,
                 'config_file': config_file
             }